@@ -0,0 +1,183 @@
+/*
+Fuzzing driver for fuzz.h. Built three ways:
+- with I8080_LIBFUZZER and -fsanitize=fuzzer, as a libFuzzer target. The
+  edge map is registered as extra counters
+- with afl-clang-fast, as an AFL persistent mode target. The edges are
+  counted straight into AFL's map
+- otherwise as a plain program running the files given on the command
+  line, or stdin, to reproduce crashes
+It is set up from the environment:
+  I8080_FUZZ_ROM     ROM image, required
+  I8080_FUZZ_ORIGIN  where the ROM is loaded and run from, default 0
+  I8080_FUZZ_CYCLES  cycle budget per input, default 1000000
+  I8080_FUZZ_INPUT   "port" (default) or a memory address for the input
+  I8080_FUZZ_SIZE    bytes of input copied to memory, default 256
+*/
+
+#include "fuzz.h"
+#include <stdlib.h>
+#include <string.h>
+
+static fuzz target;
+static bool ready;
+
+static unsigned long env_number(const char *name, unsigned long fallback)
+{
+  const char *value = getenv(name);
+
+  return value != NULL ? strtoul(value, NULL, 0) : fallback;
+}
+
+static uint8_t *read_file(FILE *in, size_t *size)
+{
+  size_t capacity = 0x1000;
+  uint8_t *data = malloc(capacity);
+
+  *size = 0;
+  while (data != NULL)
+  {
+    *size += fread(data + *size, 1, capacity - *size, in);
+    if (*size < capacity)
+    {
+      return data;
+    }
+
+    uint8_t *grown = realloc(data, capacity * 2);
+
+    if (grown == NULL)
+    {
+      free(data);
+      return NULL;
+    }
+    data = grown;
+    capacity *= 2;
+  }
+  return NULL;
+}
+
+static void setup(void)
+{
+  const char *path = getenv("I8080_FUZZ_ROM");
+  FILE *in = path != NULL ? fopen(path, "rb") : NULL;
+
+  if (in == NULL)
+  {
+    fprintf(stderr, "i8080_fuzz: set I8080_FUZZ_ROM to a ROM image\n");
+    exit(1);
+  }
+
+  size_t size;
+  uint8_t *rom = read_file(in, &size);
+  fclose(in);
+
+  if (rom == NULL ||
+      fuzz_init(&target, rom, size, env_number("I8080_FUZZ_ORIGIN", 0), env_number("I8080_FUZZ_CYCLES", 1000000)) != 0)
+  {
+    fprintf(stderr, "i8080_fuzz: can't load %s\n", path);
+    exit(1);
+  }
+  free(rom);
+
+  const char *input = getenv("I8080_FUZZ_INPUT");
+
+  if (input != NULL && strcmp(input, "port") != 0)
+  {
+    target.mode = FUZZ_INPUT_MEMORY;
+    target.input_addr = strtoul(input, NULL, 0);
+    target.input_max = env_number("I8080_FUZZ_SIZE", 256);
+  }
+  ready = true;
+}
+
+#ifdef I8080_LIBFUZZER
+
+void __sanitizer_cov_8bit_counters_init(uint8_t *start, uint8_t *stop);
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+  (void)argc;
+  (void)argv;
+  setup();
+  __sanitizer_cov_8bit_counters_init(target.edges, target.edges + FUZZ_MAP_SIZE);
+  return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  fuzz_run_one(&target, data, size);
+  return 0;
+}
+
+#elif defined(__AFL_LOOP)
+
+extern uint8_t *__afl_area_ptr;
+extern uint32_t __afl_map_size;
+
+__AFL_FUZZ_INIT();
+
+int main(void)
+{
+  setup();
+
+  __AFL_INIT();
+  uint8_t *data = __AFL_FUZZ_TESTCASE_BUF;
+
+  while (__AFL_LOOP(100000))
+  {
+    if (__afl_map_size >= FUZZ_MAP_SIZE)
+    {
+      target.edges = __afl_area_ptr;
+    }
+    fuzz_run_one(&target, data, __AFL_FUZZ_TESTCASE_LEN);
+  }
+  return 0;
+}
+
+#else
+
+static int run_file(FILE *in, const char *name)
+{
+  size_t size;
+  uint8_t *data = read_file(in, &size);
+
+  if (data == NULL)
+  {
+    fprintf(stderr, "i8080_fuzz: can't read %s\n", name);
+    return 1;
+  }
+
+  enum i8080_exit reason = fuzz_run_one(&target, data, size);
+
+  printf("%s: %s at pc %04x after %llu cycles\n", name, i8080_exit_name(reason), target.cpu.pc,
+         (unsigned long long)target.cpu.cycles);
+  free(data);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  int failed = 0;
+
+  setup();
+  if (argc < 2)
+  {
+    return run_file(stdin, "stdin");
+  }
+  for (int i = 1; i < argc; i++)
+  {
+    FILE *in = fopen(argv[i], "rb");
+
+    if (in == NULL)
+    {
+      fprintf(stderr, "i8080_fuzz: can't open %s\n", argv[i]);
+      failed = 1;
+      continue;
+    }
+    failed |= run_file(in, argv[i]);
+    fclose(in);
+  }
+  fuzz_free(&target);
+  return failed;
+}
+
+#endif
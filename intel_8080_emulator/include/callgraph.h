@@ -0,0 +1,81 @@
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+#include "i8080.h"
+#include "symbols.h"
+
+#define CALLGRAPH_MAX_DEPTH 256
+
+// One subroutine activation on the shadow stack
+typedef struct callgraph_frame
+{
+  uint16_t function;
+  // Stack pointer right after the return address was pushed. RET only
+  // pops the frame when it finds the stack pointer at this value
+  uint16_t sp;
+  uint32_t node;
+  uint64_t entry_cycles;
+} callgraph_frame;
+
+// Calling context tree node: one per distinct call path
+typedef struct callgraph_node
+{
+  uint16_t function;
+  uint32_t parent, first_child, next_sibling;
+  uint64_t calls;
+  uint64_t self_cycles;
+} callgraph_node;
+
+/*
+Call-graph profiler. Attach it by pointing the processor's callgraph
+field to an initialized instance. CALL, conditional calls and RST push
+a frame on a shadow stack and RET pops it, so cycles are attributed to
+subroutines, both exclusive (spent in the subroutine itself) and
+inclusive (including its callees).
+Frames are matched by stack pointer rather than return address, which
+keeps the shadow stack consistent when code rewrites the return address
+(XTHL), switches stacks (SPHL), jumps through a pushed address
+(PUSH + RET) or leaves a subroutine with PCHL
+*/
+typedef struct callgraph
+{
+  callgraph_frame stack[CALLGRAPH_MAX_DEPTH];
+  int depth;
+  // Calls that did not fit in the shadow stack
+  uint64_t overflows;
+
+  callgraph_node *nodes;
+  uint32_t nodes_count, nodes_capacity;
+
+  // Per subroutine totals, indexed by entry address
+  uint64_t calls[0x10000];
+  uint64_t inclusive_cycles[0x10000];
+  uint64_t exclusive_cycles[0x10000];
+
+  // Cycles already attributed to a node
+  uint64_t last_cycles;
+
+  symbol_map symbols;
+} callgraph;
+
+// The processor's current pc is used as the root routine. Returns -1 on allocation failure
+int callgraph_init(callgraph *cg, i8080 *p);
+
+void callgraph_free(callgraph *cg);
+
+// Loads a symbol map (see symbols_load) to name subroutines. Returns -1 if the file can not be read
+int callgraph_load_symbols(callgraph *cg, const char *path);
+
+// Hooks called by call() and ret()
+void callgraph_call(callgraph *cg, i8080 *p, uint16_t addr);
+void callgraph_ret(callgraph *cg, i8080 *p);
+
+// Writes one name for addr into out
+void callgraph_symbolize(callgraph *cg, uint16_t addr, char *out, size_t out_size);
+
+// Writes "calls,inclusive,exclusive" per subroutine as CSV, hottest first
+void callgraph_write_report(callgraph *cg, i8080 *p, FILE *out);
+
+// Writes exclusive cycles per call path as folded stacks for flamegraph.pl
+void callgraph_write_folded(callgraph *cg, i8080 *p, FILE *out);
+
+#endif // CALLGRAPH_H
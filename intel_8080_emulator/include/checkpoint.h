@@ -0,0 +1,66 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include "i8080.h"
+#include <stdatomic.h>
+#include <threads.h>
+
+// Who has a page while a checkpoint is written
+enum checkpoint_page
+{
+  CHECKPOINT_PENDING,  // nobody yet, memory still holds it as it was
+  CHECKPOINT_READING,  // the writer thread is reading it from memory
+  CHECKPOINT_DONE,     // the writer thread has it
+  CHECKPOINT_COPYING,  // the processor is copying it before a write
+  CHECKPOINT_COPIED    // the copy in pages is the one to write
+};
+
+/*
+Save states written by a background thread while emulation goes on.
+checkpoint_start saves the registers and arms PAGE_CHECKPOINT on all
+pages, which takes microseconds, and the thread writes the state with
+savestate_write. Each page goes to whoever claims it first: the thread
+reads it straight from memory, or the first write from the processor,
+or restore of a snapshot, rewind or save state, copies it aside. A write only waits if it hits the page the thread is
+reading at that moment.
+The thread reads memory through the read_byte callback, so the callback
+must be safe to call for RAM from another thread. The file is written
+under path.tmp and renamed when complete
+*/
+typedef struct checkpoint
+{
+  i8080_state state;
+  uint8_t (*read_byte)(uint16_t);
+
+  atomic_uchar page_state[256];
+  uint8_t pages[256][256];
+
+  void *device;
+  size_t device_size;
+  char *path;
+
+  atomic_bool busy;
+  bool started;
+  int result;
+  thrd_t thread;
+} checkpoint;
+
+// Clears the checkpoint. Call once before the first checkpoint_start
+void checkpoint_init(checkpoint *c);
+
+/*
+Starts writing a checkpoint of the processor and a copy of the device
+state. Call it between runs, e.g. every N frames. Returns -1 if the
+previous checkpoint is still being written or the thread can not start
+*/
+int checkpoint_start(checkpoint *c, i8080 *p, const char *path, const void *device, size_t device_size);
+
+// Whether the thread has finished writing
+bool checkpoint_done(checkpoint *c);
+
+// Waits for the thread and detaches the checkpoint. Returns -1 if the checkpoint could not be written
+int checkpoint_finish(checkpoint *c, i8080 *p);
+
+// Hook used by write_byte for pages flagged with PAGE_CHECKPOINT
+void checkpoint_save_page(checkpoint *c, i8080 *p, uint8_t page);
+
+#endif // CHECKPOINT_H
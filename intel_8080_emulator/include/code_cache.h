@@ -0,0 +1,65 @@
+#ifndef CODE_CACHE_H
+#define CODE_CACHE_H
+#include "i8080.h"
+#include "fusion.h"
+#include <stdatomic.h>
+
+// The fusion classifications of a ROM page, for the page holding those bytes
+typedef struct code_cache_page
+{
+  uint64_t hash;
+  uint8_t page;
+  uint8_t bytes[256];
+  uint8_t kinds[256];
+} code_cache_page;
+
+/*
+Classified ROM pages shared by processors running the same ROM, such as
+many instances of one machine on a pool of threads. Each page is
+classified for fusion once, by the first processor to share it. The
+others find it by the hash of its contents and use its classifications
+in place of their own, so the ROM is classified once however many
+processors run it. What each processor still has of its own: a 256 byte
+fusion table for every page it classifies itself, RAM and the ends of
+shared pages, the per-block flags of an attached recompiled image,
+whose block table is shared, and the counters of a tiering manager.
+Lookups take no lock: pages are added to an open addressing table with
+a compare and swap, and never changed or removed until code_cache_free,
+which must wait until no processor uses the cache. Groups starting in the
+last FUSION_MAX_GROUP_BYTES - 1 bytes of a page depend on the next one,
+so each processor classifies those itself.
+The pages shared must be ROM. A write to one, through write_byte or
+restore_byte, makes that processor classify it on its own from then on
+*/
+typedef struct code_cache
+{
+  _Atomic(code_cache_page *) *slots;
+  size_t capacity;
+  atomic_size_t pages;
+
+  // Lookups that found the page, pages classified and added, and pages classified for nothing, as another thread added them first
+  atomic_uint_least64_t hits, misses, wasted;
+} code_cache;
+
+// Sets up the cache for up to max_pages pages. Returns -1 on failure
+int code_cache_init(code_cache *c, size_t max_pages);
+void code_cache_free(code_cache *c);
+
+/*
+Finds the page, read through the processor's read_byte callback,
+classifying and adding it if it isn't there. Returns NULL if the cache
+is full or out of memory
+*/
+const code_cache_page *code_cache_lookup(code_cache *c, i8080 *p, uint8_t page);
+
+/*
+Makes an attached fusion use the cached classifications of pages
+first_page to first_page + pages - 1, which must hold ROM. Returns the
+number of pages shared. The others are classified by fusion as usual
+*/
+int code_cache_share(code_cache *c, fusion *f, i8080 *p, uint8_t first_page, int pages);
+
+// Prints the pages cached and how often they were found
+void code_cache_report(const code_cache *c, FILE *out);
+
+#endif // CODE_CACHE_H
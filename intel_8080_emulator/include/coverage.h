@@ -0,0 +1,83 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+#include "i8080.h"
+#include "symbols.h"
+
+#define COVERAGE_BITMAP_SIZE (0x10000 / 8)
+
+/*
+Code coverage. Attach it by pointing the processor's coverage field to
+an initialized instance; i8080_step then sets one bit per executed
+instruction address and, for conditional jumps, calls and returns, one
+bit per outcome seen (taken, not taken).
+The maps are plain bitmaps, so runs on other threads or processes are
+combined by OR-ing them (coverage_merge, coverage_load)
+*/
+typedef struct coverage
+{
+  uint8_t executed[COVERAGE_BITMAP_SIZE];
+  uint8_t taken[COVERAGE_BITMAP_SIZE];
+  uint8_t not_taken[COVERAGE_BITMAP_SIZE];
+} coverage;
+
+void coverage_init(coverage *cov);
+
+static inline bool coverage_bit(const uint8_t *bitmap, uint16_t addr)
+{
+  return (bitmap[addr >> 3] >> (addr & 7)) & 1;
+}
+
+static inline void coverage_set_bit(uint8_t *bitmap, uint16_t addr)
+{
+  bitmap[addr >> 3] |= 1 << (addr & 7);
+}
+
+// True for Jcc, Ccc and Rcc
+static inline bool is_conditional_branch(uint8_t opcode)
+{
+  uint8_t kind = opcode & 0xc7;
+  return kind == 0xc0 || kind == 0xc2 || kind == 0xc4;
+}
+
+/*
+Records the instruction that was at pc. Conditional branches count as
+taken when they did not continue to the next instruction
+*/
+static inline void coverage_record(coverage *cov, uint16_t pc, uint8_t opcode, uint16_t next_pc)
+{
+  coverage_set_bit(cov->executed, pc);
+
+  if (is_conditional_branch(opcode))
+  {
+    uint16_t fall_through = pc + ((opcode & 0xc7) == 0xc0 ? 1 : 3);
+    coverage_set_bit(next_pc == fall_through ? cov->not_taken : cov->taken, pc);
+  }
+}
+
+// ORs src into dst
+void coverage_merge(coverage *dst, const coverage *src);
+
+// Number of executed addresses
+uint32_t coverage_count(const coverage *cov);
+
+// Both functions return -1 on I/O errors. coverage_load merges the file into cov
+int coverage_save(const coverage *cov, const char *path);
+int coverage_load(coverage *cov, const char *path);
+
+/*
+Writes a disassembly listing of [start, end) with one instruction per
+line, prefixed with its address and its hit marker. Line numbers match
+the ones used by coverage_write_lcov for the same range
+*/
+void coverage_write_listing(coverage *cov, i8080 *p, uint16_t start, uint32_t end, FILE *out);
+
+/*
+Writes an lcov tracefile for [start, end) against the listing at
+listing_path: one DA record per instruction and two BRDA records per
+conditional branch. When symbols is not NULL, each symbol in the range
+becomes a function (FN/FNDA), hit when its first instruction ran
+*/
+void coverage_write_lcov(coverage *cov, i8080 *p, uint16_t start, uint32_t end,
+                         symbol_map *symbols, const char *listing_path, FILE *out);
+
+#endif // COVERAGE_H
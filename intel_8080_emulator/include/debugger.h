@@ -0,0 +1,55 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+#include "i8080.h"
+
+#define DEBUGGER_BITMAP_SIZE (0x10000 / 8)
+
+enum debugger_hit
+{
+  DEBUGGER_NONE,
+  DEBUGGER_BREAKPOINT,
+  DEBUGGER_WATCH_READ,
+  DEBUGGER_WATCH_WRITE
+};
+
+/*
+Breakpoints and watchpoints. Each is one bit in a 64K bitmap, and the
+processor's page_flags tell which pages have any, so i8080_run and the
+memory helpers only look at the bitmaps for flagged pages. With nothing
+armed they cost one flag test per instruction and memory access.
+A watchpoint lets the access complete and stops before the next
+instruction
+*/
+typedef struct debugger
+{
+  uint8_t breakpoints[DEBUGGER_BITMAP_SIZE];
+  uint8_t watch_reads[DEBUGGER_BITMAP_SIZE];
+  uint8_t watch_writes[DEBUGGER_BITMAP_SIZE];
+
+  // What stopped the processor last
+  enum debugger_hit hit;
+  uint16_t hit_addr;
+  uint8_t hit_value;
+} debugger;
+
+// Clears the debugger and attaches it to the processor
+void debugger_attach(debugger *d, i8080 *p);
+
+// Disarms everything and detaches the debugger from the processor
+void debugger_detach(debugger *d, i8080 *p);
+
+void debugger_set_breakpoint(debugger *d, i8080 *p, uint16_t addr);
+void debugger_clear_breakpoint(debugger *d, i8080 *p, uint16_t addr);
+
+// Watches length bytes from addr (wrapping around at 0xffff) for reads, writes or both
+void debugger_set_watchpoint(debugger *d, i8080 *p, uint16_t addr, uint32_t length, bool reads, bool writes);
+void debugger_clear_watchpoint(debugger *d, i8080 *p, uint16_t addr, uint32_t length);
+
+// Called by i8080_run for pages flagged with PAGE_BREAKPOINT
+bool debugger_check_breakpoint(debugger *d, i8080 *p);
+
+// Called by the memory helpers for pages flagged with PAGE_WATCH_READ or PAGE_WATCH_WRITE
+void debugger_check_read(debugger *d, i8080 *p, uint16_t addr, uint8_t value);
+void debugger_check_write(debugger *d, i8080 *p, uint16_t addr, uint8_t value);
+
+#endif // DEBUGGER_H
@@ -0,0 +1,18 @@
+#ifndef DISASSEMBLER_H
+#define DISASSEMBLER_H
+#include "i8080.h"
+
+// Size in bytes (1 to 3) of the instruction starting with opcode
+uint8_t instruction_length(uint8_t opcode);
+
+// Mnemonic of opcode without its operands (e.g. "MVI B")
+const char *opcode_name(uint8_t opcode);
+
+/*
+Writes the instruction at addr as text into out (e.g. "MVI B,01h").
+Memory is read through the processor's read_byte callback.
+Returns the instruction length
+*/
+uint8_t disassemble(i8080 *p, uint16_t addr, char *out, size_t out_size);
+
+#endif // DISASSEMBLER_H
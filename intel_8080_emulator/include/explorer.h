@@ -0,0 +1,121 @@
+#ifndef EXPLORER_H
+#define EXPLORER_H
+#include "i8080.h"
+#include "snapshot.h"
+#include "state_hash.h"
+#include <stdatomic.h>
+#include <threads.h>
+
+// A machine state reached by the explorer
+typedef struct explorer_node
+{
+  i8080_state state;
+  uint64_t memory_hash;
+
+  // Pages are shared with the parent unless the branch wrote them
+  const uint8_t *pages[256];
+
+  // The node this one was reached from, and the IN that was answered on the way
+  struct explorer_node *parent;
+  uint8_t port, input;
+  uint32_t depth;
+
+  // Why the run stopped. Only nodes stopped at an IN are branched from
+  enum i8080_exit reason;
+} explorer_node;
+
+typedef struct explorer_block
+{
+  struct explorer_block *next;
+  size_t used;
+  uint8_t data[];
+} explorer_block;
+
+// A thread with its own processor and memory
+typedef struct explorer_worker
+{
+  struct explorer *e;
+  thrd_t thread;
+  bool running;
+  uint64_t generation;
+
+  i8080 cpu;
+  uint8_t *memory;
+  const uint8_t *loaded[256];
+  snapshot *snap;
+  state_hash hash;
+
+  explorer_block *blocks;
+  explorer_node **children;
+  size_t children_count, children_capacity;
+  bool failed;
+} explorer_worker;
+
+/*
+Breadth-first search over port input. Every IN is a decision point: the
+explorer runs each branch until the next IN, which traps without a
+port_in callback, and branches again with each of the candidate inputs.
+States are told apart with state_hash, and a state seen before, from any
+thread, is not explored again. Each level of the search is shared out
+to a pool of threads with their own processor and 64K of RAM, through
+_Thread_local memory callbacks, so the machines explored have plain RAM
+and no devices: OUT is ignored.
+goal is called from the worker threads for every new state, with the
+processor in that state. Returning true ends the search
+*/
+typedef struct explorer
+{
+  const uint8_t *inputs;
+  int inputs_count;
+  uint64_t budget;
+  uint32_t max_depth;
+
+  bool (*goal)(const i8080 *p, void *context);
+  void *context;
+
+  // Visited state hashes, shared by all threads. Zero marks an empty slot
+  _Atomic uint64_t *visited;
+  size_t visited_capacity;
+  atomic_size_t states;
+  atomic_bool full;
+
+  explorer_worker *workers;
+  int threads;
+  bool started;
+
+  // The level being explored
+  explorer_node **frontier;
+  size_t frontier_count;
+  atomic_size_t next;
+  atomic_bool stop;
+  _Atomic(explorer_node *) found;
+
+  mtx_t lock;
+  cnd_t start, done;
+  uint64_t generation;
+  int active;
+  bool quit;
+} explorer;
+
+// Sets up the explorer for up to max_states states. Returns -1 on failure
+int explorer_init(explorer *e, const uint8_t *inputs, int inputs_count, size_t max_states, int threads);
+
+/*
+Explores from the processor's state and memory, read through its
+read_byte callback, running at most budget cycles between inputs and
+going max_depth inputs deep. Returns 1 if goal was met, then
+explorer_path gives the inputs to get there, 0 if not, 2 if not but the
+visited set filled up, so states were left unexplored, and -1 on failure
+*/
+int explorer_run(explorer *e, i8080 *p, uint64_t budget, uint32_t max_depth);
+
+// The node goal was met at, or NULL
+explorer_node *explorer_found(explorer *e);
+
+// Writes the inputs leading to a node, first one first. Returns their number
+int explorer_path(const explorer_node *node, uint8_t *inputs, int max);
+
+// Stops the threads and frees all the nodes
+void explorer_free(explorer *e);
+
+#endif // EXPLORER_H
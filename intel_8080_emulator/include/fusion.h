@@ -0,0 +1,111 @@
+#ifndef FUSION_H
+#define FUSION_H
+#include "i8080.h"
+
+// What starts at an address. Addresses are classified the first time they are run
+enum fusion_kind
+{
+  FUSION_UNCLASSIFIED,
+  FUSION_NONE,
+  FUSION_DCR_JNZ,     // DCR r; JNZ adr
+  FUSION_LOAD_INX,    // MOV A,M; INX H
+  FUSION_LXI_CALL,    // LXI rp,d16; CALL adr
+  FUSION_CPI_JZ,      // CPI d8; JZ adr
+  FUSION_CPI_JNZ,     // CPI d8; JNZ adr
+  FUSION_TEST_JNZ,    // MOV A,r; ORA r; JNZ adr, the 16-bit counter test
+  FUSION_COPY_BC,     // loop: MOV A,M; STAX D; INX H; INX D; DCX B; MOV A,B; ORA C; JNZ loop
+  FUSION_COPY_R,      // loop: MOV A,M; STAX D; INX H; INX D; DCR r; JNZ loop
+  FUSION_FILL_BC,     // loop: MOV M,r or MVI M,d8; INX H; DCX B; MOV A,B; ORA C; JNZ loop
+  FUSION_FILL_R,      // loop: MOV M,r or MVI M,d8; INX H; DCR r; JNZ loop
+  FUSION_KINDS
+};
+
+// The most bytes a group takes, the block copy with a 16-bit count
+#define FUSION_MAX_GROUP_BYTES 10
+
+/*
+Superinstructions. Attach it by pointing the processor's fusion field to
+an initialized instance; i8080_run then runs the instruction pairs and
+triples above as one handler each, skipping the dispatch, the per-step
+hooks and the run loop checks between them. The result, down to the
+cycles and the memory accesses, is the same as running them one by one.
+Every address is classified once and the kind kept in a table of its
+page, allocated the first time code on the page is classified. Pages
+holding a fused group get PAGE_CODE, and a write to one of them, through
+write_byte or restore_byte, forgets what was classified there, so code
+that rewrites itself is seen again. Memory changed behind the
+processor's back needs fusion_flush. The ROM pages of processors running
+the same ROM can be classified once for all of them, see code_cache.h.
+Groups are run one instruction at a time, through i8080_step, while
+anything watches every instruction: the profiler, coverage, fuzzing,
+the heatmap, rewind, lockstep, replays and per-step run_until
+conditions. They are also split at pages with breakpoints or run_until
+pc conditions, before pending interrupts, after EI and when a watchpoint stops
+the run in the middle of a group. i8080_step alone never fuses.
+The copy and fill loops are block idioms: as many of their iterations
+as the cycle budget allows are done at once, with memmove and memset on
+the host's RAM given to fusion_map_ram, leaving the registers, flags
+and cycles as the loop would. The block stops short of pages that are
+not mapped and of pages whose writes, or reads, something watches or
+that hold fused code, and the loop then goes on one instruction at a
+time. Without mapped RAM the idioms are never run as blocks
+*/
+typedef struct fusion
+{
+  // The instance's own classifications, per page, NULL for pages it never classified
+  uint8_t *kinds[256];
+
+  // Classifications of ROM pages shared through a code cache, used where they aren't FUSION_UNCLASSIFIED
+  const uint8_t *shared[256];
+
+  // The host's memory, for the pages the block idioms may access directly
+  uint8_t *ram;
+  bool ram_pages[256];
+
+  // Groups run fused, or block idiom iterations, per kind, and pages forgotten because they were written
+  uint64_t executed[FUSION_KINDS];
+  uint64_t invalidations;
+} fusion;
+
+// Detaching frees the tables of the pages classified
+void fusion_attach(fusion *f, i8080 *p);
+void fusion_detach(fusion *f, i8080 *p);
+
+/*
+Lets the block idioms access pages first_page to first_page + pages - 1
+directly in memory, the 64K the read_byte and write_byte callbacks use.
+The pages must be plain RAM, read and written with no side effects
+*/
+void fusion_map_ram(fusion *f, uint8_t *memory, uint8_t first_page, int pages);
+
+// Forgets every classification, for memory changed without write_byte
+void fusion_flush(fusion *f, i8080 *p);
+
+/*
+Runs the group at pc fused, block idioms for up to about cycles_left
+cycles. Returns false, having done nothing, if there is none or it can't
+be fused now, as when cycles_left ends before its last instruction
+*/
+bool fusion_step(fusion *f, i8080 *p, uint64_t cycles_left);
+
+// Called by the memory helpers for writes to PAGE_CODE pages
+void fusion_invalidate_page(fusion *f, i8080 *p, uint8_t page);
+
+// Classifies the code at pc, read through the read_byte callback
+enum fusion_kind fusion_classify(i8080 *p, uint16_t pc);
+
+// Number of instructions in a group of the kind, or in one iteration of a block idiom
+int fusion_instructions(enum fusion_kind kind);
+
+// Number of bytes the code of a group of the kind takes. 0 for FUSION_NONE and FUSION_UNCLASSIFIED
+int fusion_bytes(enum fusion_kind kind);
+
+// What was classified at pc, from a shared page or the instance's own table
+enum fusion_kind fusion_kind_at(const fusion *f, uint16_t pc);
+
+const char *fusion_kind_name(enum fusion_kind kind);
+
+// Prints the groups run per kind and the dispatches they saved
+void fusion_report(const fusion *f, FILE *out);
+
+#endif // FUSION_H
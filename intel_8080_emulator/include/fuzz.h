@@ -0,0 +1,74 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+#include "i8080.h"
+#include "coverage.h"
+#include "snapshot.h"
+
+#define FUZZ_MAP_SIZE 0x10000
+
+enum fuzz_input
+{
+  FUZZ_INPUT_MEMORY, // the input is copied to memory before the run
+  FUZZ_INPUT_PORT    // IN reads the input one byte at a time
+};
+
+/*
+In-process fuzzing target. It owns a processor and 64K of RAM holding a
+ROM image, and runs one input at a time from the state the ROM was
+loaded in, for at most budget cycles. The machine is reset between runs
+by restoring the pages the last run wrote from a snapshot and reloading
+the registers, so a run costs what it executes, not a 64K clear.
+Attached to its processor, it counts the edges taken by branches, calls
+and returns in edges, AFL style. The map is not cleared between runs:
+fuzzers clear their own. Memory callbacks reach the target through a
+_Thread_local pointer, so each thread can run its own target
+*/
+typedef struct fuzz
+{
+  i8080 cpu;
+  uint8_t *memory;
+  snapshot *start;
+  uint64_t budget;
+
+  enum fuzz_input mode;
+  // Where FUZZ_INPUT_MEMORY puts the input and how much of it fits
+  uint16_t input_addr;
+  uint32_t input_max;
+
+  const uint8_t *input;
+  size_t input_size, input_pos;
+
+  // FUZZ_MAP_SIZE edge counters. Can be pointed at a fuzzer's own map
+  uint8_t *edges;
+  uint8_t *own_edges;
+  uint16_t prev;
+} fuzz;
+
+// Loads the ROM at origin in zeroed memory. Returns -1 on failure
+int fuzz_init(fuzz *f, const uint8_t *rom, size_t rom_size, uint16_t origin, uint64_t budget);
+
+// Runs one input from the starting state. Running out of port input stops the run
+enum i8080_exit fuzz_run_one(fuzz *f, const uint8_t *data, size_t size);
+
+void fuzz_free(fuzz *f);
+
+// True for the instructions that can leave the straight line
+static inline bool is_branch(uint8_t opcode)
+{
+  return is_conditional_branch(opcode) || (opcode & 0xc7) == 0xc7 || opcode == 0xc3 || opcode == 0xc9 ||
+         opcode == 0xcd || opcode == 0xe9;
+}
+
+// Counts the edge to next_pc when the instruction just run was a branch, taken or not
+static inline void fuzz_record_edge(fuzz *f, uint8_t opcode, uint16_t next_pc)
+{
+  if (is_branch(opcode))
+  {
+    uint16_t current = next_pc * 0x9e37u;
+
+    f->edges[current ^ f->prev]++;
+    f->prev = current >> 1;
+  }
+}
+
+#endif // FUZZ_H
@@ -0,0 +1,103 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+#include "i8080.h"
+
+enum heatmap_kind
+{
+  HEATMAP_READS,
+  HEATMAP_WRITES,
+  HEATMAP_FETCHES,
+  HEATMAP_ALL
+};
+
+enum heatmap_format
+{
+  HEATMAP_CSV,
+  HEATMAP_JSON
+};
+
+/*
+Memory access heatmap. Attach it by pointing the processor's heatmap
+field to an initialized instance; every read, write and opcode fetch
+going through the memory helpers is then counted per 256-byte page,
+and per byte when asked for. Operand bytes count as reads
+*/
+typedef struct heatmap
+{
+  uint64_t reads[256];
+  uint64_t writes[256];
+  uint64_t fetches[256];
+
+  // Per byte counters, NULL unless requested in heatmap_init
+  uint64_t *byte_reads;
+  uint64_t *byte_writes;
+  uint64_t *byte_fetches;
+
+  // Periodic dump, disabled while dump_interval is 0
+  uint64_t dump_interval;
+  uint64_t next_dump;
+  FILE *dump_out;
+  enum heatmap_format dump_format;
+} heatmap;
+
+// Returns -1 if the per byte counters can not be allocated
+int heatmap_init(heatmap *h, bool per_byte);
+
+void heatmap_free(heatmap *h);
+
+// Clears the counters, keeping the dump settings
+void heatmap_reset(heatmap *h);
+
+static inline void heatmap_read(heatmap *h, uint16_t addr)
+{
+  h->reads[addr >> 8]++;
+  if (h->byte_reads != NULL)
+  {
+    h->byte_reads[addr]++;
+  }
+}
+
+static inline void heatmap_write(heatmap *h, uint16_t addr)
+{
+  h->writes[addr >> 8]++;
+  if (h->byte_writes != NULL)
+  {
+    h->byte_writes[addr]++;
+  }
+}
+
+static inline void heatmap_fetch(heatmap *h, uint16_t addr)
+{
+  h->fetches[addr >> 8]++;
+  if (h->byte_fetches != NULL)
+  {
+    h->byte_fetches[addr]++;
+  }
+}
+
+/*
+Appends the page counters to out every interval cycles, checked by
+i8080_step: CSV rows ("cycles,page,reads,writes,fetches", pages
+without accesses skipped) or one JSON object per line
+*/
+void heatmap_set_dump(heatmap *h, uint64_t interval, FILE *out, enum heatmap_format format);
+
+void heatmap_dump(heatmap *h, uint64_t cycles);
+
+// Called by i8080_step
+static inline void heatmap_tick(heatmap *h, i8080 *p)
+{
+  if (h->dump_interval != 0 && p->cycles >= h->next_dump)
+  {
+    heatmap_dump(h, p->cycles);
+  }
+}
+
+void heatmap_write_csv(heatmap *h, uint64_t cycles, FILE *out);
+void heatmap_write_json(heatmap *h, uint64_t cycles, FILE *out);
+
+// Writes a 16x16 grid of pages (rows are the high nibble of the page)
+// shaded by access count on a logarithmic scale
+void heatmap_write_ascii(heatmap *h, enum heatmap_kind kind, FILE *out);
+
+#endif // HEATMAP_H
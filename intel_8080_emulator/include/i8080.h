@@ -9,6 +9,35 @@ Intel 8080 emulator
 #include <stdint.h>
 #include <stdbool.h>
 
+// Flags of page_flags, one word per 256-byte page
+#define PAGE_BREAKPOINT 0x01
+#define PAGE_WATCH_READ 0x02
+#define PAGE_WATCH_WRITE 0x04
+#define PAGE_UNTIL_PC 0x08
+#define PAGE_UNTIL_WRITE 0x10
+#define PAGE_REWIND 0x20
+#define PAGE_SNAPSHOT 0x40
+#define PAGE_CHECKPOINT 0x80
+#define PAGE_CODE 0x100
+
+// Why i8080_run returned. Reasons from I8080_EXIT_INVALID_OPCODE on are
+// traps: the faulting instruction is undone so the run can be resumed
+enum i8080_exit
+{
+  I8080_EXIT_NONE,
+  I8080_EXIT_BUDGET,       // the cycles given to i8080_run were executed
+  I8080_EXIT_HALT,         // HLT executed
+  I8080_EXIT_BREAKPOINT,   // debugger breakpoint reached
+  I8080_EXIT_WATCHPOINT,   // debugger watchpoint hit
+  I8080_EXIT_UNTIL,        // run_until condition met
+  I8080_EXIT_STOPPED,      // i8080_stop called by the host
+  I8080_EXIT_DIVERGENCE,   // the core and the lockstep reference disagree
+  I8080_EXIT_INVALID_OPCODE,
+  I8080_EXIT_UNIMPLEMENTED,
+  I8080_EXIT_IO_TRAP,      // IN or OUT without a port callback
+  I8080_EXIT_REPLAY        // IN not matching the replay being played
+};
+
 typedef struct i8080
 {
   /* 
@@ -39,13 +68,111 @@ typedef struct i8080
   // Some other necessary state
   bool halted;
 
-  // Interrupts
-  uint8_t cycles;
+  // Makes i8080_run return before the next instruction
+  bool stop_requested;
+
+  // Why the last run stopped, and the instruction that trapped
+  enum i8080_exit exit_reason;
+  uint16_t exit_pc;
+  uint8_t exit_opcode;
+
+  // Pages that need extra work in the run loop or the memory helpers
+  uint16_t page_flags[256];
+
+  // Interrupts. A pending interrupt is taken before the next instruction
+  // once interrupts are enabled. EI enables them only after the
+  // instruction following it, which interrupt_delay marks
+  uint64_t cycles;
   bool interrupt_pending;
+  bool interrupts_enabled;
+  bool interrupt_delay;
+  uint8_t interrupt_opcode;
+
+  // Optional instrumentation. NULL when not in use
+  struct profiler *profiler;
+  struct callgraph *callgraph;
+  struct sampler *sampler;
+  struct coverage *coverage;
+  struct heatmap *heatmap;
+
+  // Optional debugger and run_until conditions. NULL when not in use
+  struct debugger *debugger;
+  struct run_until *until;
+
+  // Optional I/O and interrupt recording or playback. NULL when not in use
+  struct replay *replay;
+
+  // Optional rewind history. NULL when not in use
+  struct rewind_buffer *rewind;
+
+  // Optional copy-on-write snapshot. NULL when not in use
+  struct snapshot *snapshot;
+
+  // Optional checkpoint being written in the background. NULL when not in use
+  struct checkpoint *checkpoint;
+
+  // Optional incremental hash of the machine state. NULL when not in use
+  struct state_hash *state_hash;
+
+  // Optional fuzzer edge counters. NULL when not in use
+  struct fuzz *fuzz;
+
+  // Optional reference interpreter checking every step. NULL when not in use
+  struct lockstep *lockstep;
+
+  // Optional superinstructions run by i8080_run. NULL when not in use
+  struct fusion *fusion;
+
+  // Optional ahead-of-time recompiled ROM code run by i8080_run. NULL when not in use
+  struct recompiled *recompiled;
+
+  // Optional manager moving hot code from the interpreter to fusion and recompiled code. NULL when not in use
+  struct tiering *tiering;
 } i8080;
 
+// Processor state without the memory callbacks and attachments, for snapshots
+typedef struct i8080_state
+{
+  uint8_t a, b, c, d, e, h, l;
+  uint16_t bp, sp, pc;
+  bool zf, sf, pf, cf, acf;
+  bool halted;
+  uint64_t cycles;
+  bool interrupt_pending;
+  bool interrupts_enabled;
+  bool interrupt_delay;
+  uint8_t interrupt_opcode;
+} i8080_state;
+
 void i8080_init(i8080 *p);
 void i8080_step(i8080 *p);
-void i8080_interrupt(i8080 *p, uint8_t opcode);
+
+void i8080_save_state(const i8080 *p, i8080_state *s);
+void i8080_load_state(i8080 *p, const i8080_state *s);
+
+/*
+Runs for at least the given cycles, stopping early at breakpoints,
+watchpoints, run_until conditions, HLT, traps or any other stop request.
+A breakpoint at the pc the run starts from is ignored, so a run can
+resume from where it stopped. Returns why the run stopped, which is also
+kept in exit_reason
+*/
+enum i8080_exit i8080_run(i8080 *p, uint64_t cycles);
+
+// Runs to the end of the current frame. Frames are frame_cycles long and
+// counted from cycle 0, so overshooting one frame shortens the next
+enum i8080_exit i8080_run_frame(i8080 *p, uint64_t frame_cycles);
+
+// Makes i8080_run return before the next instruction. The first reason
+// given during a run is the one reported
+void i8080_stop(i8080 *p, enum i8080_exit reason);
+
+// Name of an exit reason, for logs and reports
+const char *i8080_exit_name(enum i8080_exit reason);
+
+// Raises an interrupt that executes the given RST instruction. It is
+// ignored while a replay is played, which delivers its own. Returns -1,
+// raising nothing, if the opcode isn't a RST
+int i8080_interrupt(i8080 *p, uint8_t opcode);
 
 #endif // i8080_H
\ No newline at end of file
@@ -2,6 +2,13 @@
 #define INSTRUCTIONS_H
 #include "i8080.h"
 
-void process_instruction(i8080 *p);
+// Extra cycles of conditional calls and returns when the condition holds
+#define CONDITIONAL_EXTRA_CYCLES 6
+
+// Executes the instruction at pc and returns its opcode
+uint8_t process_instruction(i8080 *p);
+
+// Base cycle count of opcode, what it takes when no condition holds
+uint8_t instruction_cycles(uint8_t opcode);
 
 #endif // INSTRUCTIONS_H
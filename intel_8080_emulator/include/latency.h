@@ -0,0 +1,83 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+#include "i8080.h"
+
+/*
+Host time spent per opcode handler and per helper, only measured in
+instrumentation builds (configure with -DI8080_LATENCY=ON). Otherwise
+the LATENCY_* macros expand to nothing.
+Each measurement goes into a log-linear histogram (16 sub-buckets per
+power of two, so values are kept within ~6%) from which tail
+percentiles are reported. Helper time is also included in the time of
+the handler that called it. The histograms are process wide; only
+measure one processor at a time
+*/
+
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+typedef struct latency_histogram
+{
+  uint64_t count, total, min, max;
+  uint64_t buckets[LATENCY_BUCKETS];
+} latency_histogram;
+
+enum latency_helper
+{
+  LATENCY_READ_BYTE,
+  LATENCY_READ_WORD,
+  LATENCY_WRITE_BYTE,
+  LATENCY_WRITE_WORD,
+  LATENCY_PARITY,
+  LATENCY_UPDATE_ACF,
+  LATENCY_UPDATE_Z_S_P,
+  LATENCY_UPDATE_CF,
+  LATENCY_ADD_BYTE,
+  LATENCY_SUB_BYTE,
+  LATENCY_AND_BYTE,
+  LATENCY_XOR_BYTE,
+  LATENCY_OR_BYTE,
+  LATENCY_CMP_BYTE,
+  LATENCY_STACK_PUSH,
+  LATENCY_STACK_POP,
+  LATENCY_CALL,
+  LATENCY_RET,
+  LATENCY_HELPERS
+};
+
+#ifdef I8080_LATENCY
+
+extern latency_histogram latency_opcodes[256];
+extern latency_histogram latency_helpers[LATENCY_HELPERS];
+
+// Host timestamp in ticks (TSC on x86, nanoseconds elsewhere)
+uint64_t latency_now(void);
+
+#define LATENCY_BEGIN() uint64_t latency_start = latency_now()
+#define LATENCY_END(histogram) latency_record(&(histogram), latency_now() - latency_start)
+#define LATENCY_HELPER_END(helper) LATENCY_END(latency_helpers[helper])
+
+#else
+
+#define LATENCY_BEGIN()
+#define LATENCY_END(histogram)
+#define LATENCY_HELPER_END(helper)
+
+#endif // I8080_LATENCY
+
+void latency_reset(void);
+
+void latency_record(latency_histogram *h, uint64_t ticks);
+
+// Value below which the given fraction (0 to 1) of the measurements fall, in ticks
+uint64_t latency_percentile(latency_histogram *h, double fraction);
+
+/*
+Writes count, mean and p50/p90/p99/p99.9/max in nanoseconds for every
+handler and helper that ran, as CSV. Writes nothing in builds without
+I8080_LATENCY
+*/
+void latency_write_report(FILE *out);
+
+#endif // LATENCY_H
@@ -0,0 +1,71 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+#include "i8080.h"
+
+// More than any instruction plus an interrupt does
+#define LOCKSTEP_MAX_ACCESSES 8
+
+typedef struct lockstep_access
+{
+  uint16_t addr; // address, or port for I/O
+  uint8_t value;
+  uint8_t old;   // memory before a write
+} lockstep_access;
+
+// What a processor did in one step
+typedef struct lockstep_trace
+{
+  lockstep_access reads[LOCKSTEP_MAX_ACCESSES];
+  lockstep_access writes[LOCKSTEP_MAX_ACCESSES];
+  lockstep_access ins[LOCKSTEP_MAX_ACCESSES];
+  lockstep_access outs[LOCKSTEP_MAX_ACCESSES];
+  int reads_count, writes_count, ins_count, outs_count;
+} lockstep_trace;
+
+/*
+Checked mode: runs the reference interpreter (reference.h) alongside the
+core, one instruction at a time, and stops the run with
+I8080_EXIT_DIVERGENCE at the first instruction where the two disagree on
+registers, flags, cycles, memory writes or port output.
+Attaching it wraps the processor's memory and port callbacks to trace
+what the core does in each step. The reference then runs the same step
+from the state before it. It sees the values the core read, the memory
+from before the core's writes and the input the core got, so devices
+are only accessed once. Memory writes are compared by their final value
+per address, not by their order. Replays being played are not supported
+*/
+typedef struct lockstep
+{
+  // The host's callbacks
+  uint8_t (*read_byte)(uint16_t);
+  void (*write_byte)(uint16_t, uint8_t);
+  uint8_t (*port_in)(uint8_t);
+  uint8_t (*port_out)(uint8_t, uint8_t);
+
+  bool tracing;
+  i8080_state before;
+  lockstep_trace core;
+  lockstep_trace reference;
+  int ins_used;
+
+  uint64_t steps;
+
+  // The first divergence
+  bool diverged;
+  uint8_t opcode;
+  i8080_state expected, actual;
+  lockstep_trace expected_trace, actual_trace;
+} lockstep;
+
+// The callbacks have no context, so one lockstep is attached per thread
+void lockstep_attach(lockstep *l, i8080 *p);
+void lockstep_detach(lockstep *l, i8080 *p);
+
+// Called by i8080_step around each instruction
+void lockstep_begin(lockstep *l, i8080 *p);
+void lockstep_check(lockstep *l, i8080 *p, uint8_t opcode);
+
+// Writes the first divergence, field by field
+void lockstep_report(const lockstep *l, FILE *out);
+
+#endif // LOCKSTEP_H
@@ -0,0 +1,43 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include "i8080.h"
+
+/*
+Execution profiler. Attach it by pointing the processor's profiler
+field to an initialized instance; i8080_step then counts every executed
+instruction by address and by opcode, along with the cycles it took.
+It is around 1 MB, so allocate it on the heap
+*/
+typedef struct profiler
+{
+  uint64_t pc_count[0x10000];
+  uint64_t pc_cycles[0x10000];
+  uint64_t opcode_count[256];
+  uint64_t opcode_cycles[256];
+} profiler;
+
+void profiler_init(profiler *prof);
+
+static inline void profiler_record(profiler *prof, uint16_t pc, uint8_t opcode, uint64_t cycles)
+{
+  prof->pc_count[pc]++;
+  prof->pc_cycles[pc] += cycles;
+  prof->opcode_count[opcode]++;
+  prof->opcode_cycles[opcode] += cycles;
+}
+
+/*
+Writes the cycles spent per address as folded stacks ("page;instruction
+cycles" per line), ready for flamegraph.pl or speedscope.
+Instructions are disassembled from the processor's memory
+*/
+void profiler_write_folded(profiler *prof, i8080 *p, FILE *out);
+
+// Writes a callgrind file with one function per executed instruction,
+// named after its disassembly, with "Ir" and "Cycles" events
+void profiler_write_callgrind(profiler *prof, i8080 *p, FILE *out);
+
+// Writes a per-opcode table sorted by cycles, most expensive first
+void profiler_write_opcodes(profiler *prof, FILE *out);
+
+#endif // PROFILER_H
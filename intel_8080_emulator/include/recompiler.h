@@ -0,0 +1,145 @@
+#ifndef RECOMPILER_H
+#define RECOMPILER_H
+#include "i8080.h"
+#include <stdio.h>
+
+/*
+Ahead-of-time recompiler for ROM images. recompiler_discover follows the
+code from the entry point and the interrupt vectors by recursive
+descent: both ways of every conditional branch, call targets and the
+instructions after calls, since something will return there.
+recompiler_emit then writes C source with one function per basic block,
+each instruction turned into the statements the interpreter would run,
+with its operands as constants. The source is compiled into the program
+with the host compiler, and the image it defines attached with
+recompiled_attach.
+Anything the discovery can't see through is left to the interpreter:
+computed jumps (PCHL), returns to addresses that were never the
+instruction after a call, code that isn't reached from the entry points,
+IN and OUT, and blocks with bytes that a STA or SHLD in the image writes
+to. Blocks whose bytes don't match memory when they are entered, because
+the code was changed at run time, are skipped as well
+*/
+
+// What the discovery found at each address of the image
+#define MARK_INSTRUCTION 0x01 // the first byte of an instruction that can be reached
+#define MARK_LEADER 0x02      // the first instruction of a basic block
+#define MARK_WRITTEN 0x04     // written by a STA or SHLD of the image
+
+typedef struct recompiler
+{
+  const uint8_t *rom;
+  uint16_t origin;
+  uint32_t size;
+
+  // Marks, indexed by address, and how many instructions and blocks have them
+  uint8_t marks[0x10000];
+  uint32_t instructions, leaders;
+} recompiler;
+
+// A basic block of a recompiled image, and the most cycles it can take
+typedef struct recompiled_block
+{
+  uint16_t addr;
+  uint16_t length;
+  uint32_t cycles;
+  void (*run)(i8080 *p);
+} recompiled_block;
+
+/*
+What the generated source defines, blocks sorted by address, and for
+each address of the image 1 + the index of the block starting there, 0
+for none. It is static data, shared by every processor it is attached to
+*/
+typedef struct recompiled_image
+{
+  const uint8_t *bytes;
+  uint16_t origin;
+  uint32_t size;
+  const recompiled_block *blocks;
+  uint32_t count;
+  const uint32_t *block_at;
+} recompiled_image;
+
+/*
+An image attached to a processor. i8080_run then runs the block at pc,
+when there is one, as a call to its function. Like fusion, blocks are
+run one instruction at a time, through the interpreter, while anything
+watches every instruction, on pages with breakpoints, run_until pc
+conditions or read watchpoints, before pending interrupts, after EI, and when the
+cycle budget left is less than the block can take. The generated code
+returns to the run loop after any instruction that accessed memory and
+stopped the run, raised an interrupt or wrote to code.
+Pages holding blocks get PAGE_CODE. A write to one makes the blocks on
+it be checked against memory again before the next of them is run.
+Memory changed behind the processor's back needs the image attached again
+*/
+typedef struct recompiled
+{
+  const recompiled_image *image;
+
+  // Per block, whether it no longer matches memory
+  bool *mismatched;
+  uint16_t longest;
+
+  // Pages written since their blocks were checked, and whether code was written during the block being run
+  bool stale[256];
+  bool code_written;
+
+  // Blocks run, and blocks found not to match memory
+  uint64_t executed, mismatches;
+} recompiled;
+
+// Reads the image, which must lie within the 64K, from origin. Returns -1 if it doesn't fit
+int recompiler_init(recompiler *r, const uint8_t *rom, uint32_t size, uint16_t origin);
+
+/*
+Finds the code reached from entry and from the addresses of the RST
+instructions, the interrupt vectors, whose bits are set in vectors: bit
+n for RST n at 8 * n. May be called again for more entry points. Returns
+the number of instructions found so far, or -1 if out of memory
+*/
+int recompiler_discover(recompiler *r, uint16_t entry, uint8_t vectors);
+
+/*
+Writes the C source of the blocks found. It defines the recompiled_image
+name, and static functions and tables prefixed with name, so several
+images can share a file. Returns the number of blocks, or -1 on failure
+*/
+int recompiler_emit(const recompiler *r, FILE *out, const char *name);
+
+/*
+Attaches the image to the processor. Returns the number of its blocks
+matching memory, or -1 if out of memory. Detaching frees what was allocated
+*/
+int recompiled_attach(recompiled *r, const recompiled_image *image, i8080 *p);
+void recompiled_detach(recompiled *r, i8080 *p);
+
+/*
+Runs the block at pc if there is one, it matches memory and nothing
+above keeps it from being run as a whole. Returns false, having done
+nothing, otherwise
+*/
+bool recompiled_step(recompiled *r, i8080 *p, uint64_t cycles_left);
+
+// Called by the memory helpers for writes to PAGE_CODE pages
+void recompiled_invalidate_page(recompiled *r, i8080 *p, uint8_t page);
+
+// Prints the blocks in use and run
+void recompiled_report(const recompiled *r, FILE *out);
+
+// 1 + the index of the block of the image starting at addr, 0 for none
+static inline uint32_t recompiled_block_at(const recompiled_image *image, uint16_t addr)
+{
+  uint16_t offset = addr - image->origin;
+
+  return offset < image->size ? image->block_at[offset] : 0;
+}
+
+// Whether generated code has to return to the run loop after an instruction that accessed memory
+static inline bool recompiled_leave(const i8080 *p)
+{
+  return p->stop_requested || (p->interrupt_pending && p->interrupts_enabled) || p->recompiled->code_written;
+}
+
+#endif // RECOMPILER_H
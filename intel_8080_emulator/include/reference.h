@@ -0,0 +1,26 @@
+#ifndef REFERENCE_H
+#define REFERENCE_H
+#include "i8080.h"
+
+// Memory and ports as the reference interpreter sees them
+typedef struct reference_bus
+{
+  uint8_t (*read)(void *context, uint16_t addr);
+  void (*write)(void *context, uint16_t addr, uint8_t value);
+  uint8_t (*in)(void *context, uint8_t port);
+  void (*out)(void *context, uint8_t port, uint8_t value);
+  void *context;
+} reference_bus;
+
+/*
+A plain 8080 interpreter written from the data sheet, to check the core
+against. It decodes instructions from their bit fields rather than from
+a table of 256 cases, computes every flag from scratch and shares no
+code with instructions.c or utils.c, so the two are unlikely to be
+wrong the same way. Speed is not a goal.
+Executes one instruction of the state, taking the pending interrupt
+first when interrupts are enabled, as i8080_step does
+*/
+void reference_step(i8080_state *s, const reference_bus *bus);
+
+#endif // REFERENCE_H
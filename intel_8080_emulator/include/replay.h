@@ -0,0 +1,89 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+#include "i8080.h"
+
+#define REPLAY_MAGIC "I8RP"
+#define REPLAY_VERSION 1
+
+enum replay_mode
+{
+  REPLAY_RECORD,
+  REPLAY_PLAY
+};
+
+/*
+Recording of everything that comes into the processor from outside: the
+values read by IN and the interrupts delivered, each stamped with the
+cycle count it happened at. Events are kept as a byte stream, each one
+a varint of (cycles since the previous event << 1 | is_interrupt)
+followed by port and value for IN, or the opcode for an interrupt, so a
+busy input loop costs three or four bytes per read.
+Playing a recording back feeds the same values at the same cycles, with
+no port_in callback or host interrupts needed, so starting from the same
+state the run is reproduced exactly and at full interpreter speed. An
+IN that does not match the recording, or that comes after its end,
+traps with I8080_EXIT_REPLAY
+*/
+typedef struct replay
+{
+  enum replay_mode mode;
+
+  uint8_t *data;
+  size_t size, capacity;
+  bool failed;
+
+  // Cycle count at the start and at the previous event
+  uint64_t start_cycles;
+  uint64_t last_cycles;
+  uint64_t events;
+
+  // When playing, the read position and the next event decoded ahead,
+  // which starts at next_pos
+  size_t pos, next_pos;
+  bool has_next;
+  bool next_interrupt;
+  uint64_t next_cycles;
+  uint8_t next_port, next_value;
+} replay;
+
+// Starts recording from the processor's current state and attaches the replay. Returns -1 on failure
+int replay_record(replay *r, i8080 *p);
+
+// Starts playing a recording back on a processor in the state it was recorded from
+void replay_play(replay *r, i8080 *p);
+
+// Plays from a position of the recording, where the previous event happened at the given cycles
+void replay_seek(replay *r, i8080 *p, size_t pos, uint64_t last_cycles);
+
+// Drops the recording after the current play position and records from there
+void replay_truncate(replay *r, i8080 *p);
+
+// Drops the first bytes of the recording, up to a position later events are relative to
+void replay_discard(replay *r, size_t pos);
+
+// Detaches the replay, keeping its data
+void replay_detach(replay *r, i8080 *p);
+
+void replay_free(replay *r);
+
+/*
+Saves a recording to a file, or loads one for replay_play. Return -1 on
+failure. Loading needs a seekable file, and fails without allocating
+anything if the size in the header is more than the file holds
+*/
+int replay_save(const replay *r, FILE *out);
+int replay_load(replay *r, FILE *in);
+
+// Hooks used by the port helpers and i8080_step while a replay is attached
+void replay_record_in(replay *r, i8080 *p, uint8_t port, uint8_t value);
+void replay_record_interrupt(replay *r, i8080 *p, uint8_t opcode);
+uint8_t replay_play_in(replay *r, i8080 *p, uint8_t port);
+uint8_t replay_take_interrupt(replay *r);
+
+// Whether the recording has an interrupt to deliver before the next instruction
+static inline bool replay_interrupt_due(const replay *r, const i8080 *p)
+{
+  return r->has_next && r->next_interrupt && !p->interrupt_delay && (p->cycles >= r->next_cycles || p->halted);
+}
+
+#endif // REPLAY_H
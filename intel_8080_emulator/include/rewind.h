@@ -0,0 +1,79 @@
+#ifndef REWIND_H
+#define REWIND_H
+#include "i8080.h"
+#include "replay.h"
+
+// Contents of a 256-byte page
+typedef struct rewind_page
+{
+  uint8_t page;
+  uint8_t data[256];
+} rewind_page;
+
+typedef struct rewind_keyframe
+{
+  i8080_state state;
+  uint64_t instructions;
+
+  // Where the input recording was at the keyframe
+  size_t replay_pos;
+  uint64_t replay_cycles;
+
+  // Contents at the keyframe of the pages written before the next one
+  rewind_page *pages;
+  int pages_count, pages_capacity;
+} rewind_keyframe;
+
+/*
+Reverse execution. Every interval cycles a keyframe saves the registers
+and arms PAGE_REWIND on all pages; the first write to a page after that
+saves the page as it was at the keyframe and clears the flag, so further
+writes cost nothing. Going back restores memory by undoing those pages
+from the newest keyframe down to the one before the target, then
+executes forward to the target. IN values and interrupts are recorded
+and played back on the way, so the forward run is the same as the
+original, and its OUT instructions are not sent to the devices again.
+When the keyframes and their pages take more than budget bytes the
+oldest keyframes are dropped. The newest one is always kept
+*/
+typedef struct rewind_buffer
+{
+  uint64_t interval;
+  size_t budget;
+  size_t used;
+
+  rewind_keyframe *keyframes;
+  int count, capacity;
+
+  uint64_t next_keyframe;
+  uint64_t instructions;
+
+  replay input;
+} rewind_buffer;
+
+// Attaches a rewind buffer and takes the first keyframe. Returns -1 on failure or if a replay is attached
+int rewind_init(rewind_buffer *rw, i8080 *p, uint64_t interval, size_t budget);
+
+// Detaches the rewind buffer and frees its history
+void rewind_free(rewind_buffer *rw, i8080 *p);
+
+// Number of instructions that can be stepped back
+uint64_t rewind_available(const rewind_buffer *rw);
+
+// Goes back the given instructions. Returns -1 if they are not all in the history
+int rewind_step_back(rewind_buffer *rw, i8080 *p, uint64_t instructions);
+
+// Hooks used by i8080_step and write_byte while a rewind buffer is attached
+void rewind_take_keyframe(rewind_buffer *rw, i8080 *p);
+void rewind_save_page(rewind_buffer *rw, i8080 *p, uint8_t page);
+
+static inline void rewind_tick(rewind_buffer *rw, i8080 *p)
+{
+  rw->instructions++;
+  if (p->cycles >= rw->next_keyframe)
+  {
+    rewind_take_keyframe(rw, p);
+  }
+}
+
+#endif // REWIND_H
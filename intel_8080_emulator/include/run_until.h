@@ -0,0 +1,97 @@
+#ifndef RUN_UNTIL_H
+#define RUN_UNTIL_H
+#include "i8080.h"
+
+#define RUN_UNTIL_MAX_CONDITIONS 32
+
+enum until_kind
+{
+  UNTIL_PC,           // pc reaches addr
+  UNTIL_MEMORY,       // a write stores value at addr
+  UNTIL_REGISTER,     // reg holds value after an instruction
+  UNTIL_INSTRUCTIONS, // count instructions were executed
+  UNTIL_CYCLES,       // count cycles elapsed
+  UNTIL_PORT_IN,      // IN reads from port
+  UNTIL_PORT_OUT      // OUT writes to port
+};
+
+enum until_register
+{
+  REG_A,
+  REG_B,
+  REG_C,
+  REG_D,
+  REG_E,
+  REG_H,
+  REG_L,
+  REG_BC,
+  REG_DE,
+  REG_HL,
+  REG_SP
+};
+
+typedef struct until_condition
+{
+  enum until_kind kind;
+  uint16_t addr;
+  uint8_t port;
+  enum until_register reg;
+  uint16_t value;
+  uint64_t count;
+} until_condition;
+
+/*
+A set of conditions compiled for i8080_run_until. Each kind is checked
+only where it can become true: pc conditions through a pc bitmap and
+page_flags before each instruction, memory conditions on writes to
+flagged pages, port conditions on IN/OUT, and counts as the cycle budget
+of the run. Only register and instruction count conditions are checked
+after every instruction, and only if there are any
+*/
+typedef struct run_until
+{
+  until_condition conditions[RUN_UNTIL_MAX_CONDITIONS];
+  int count;
+
+  uint8_t pcs[0x10000 / 8];
+  uint8_t ports_in[256 / 8];
+  uint8_t ports_out[256 / 8];
+  bool has_ports;
+
+  // Indexes of the memory and register conditions
+  int memory[RUN_UNTIL_MAX_CONDITIONS];
+  int memory_count;
+  int registers[RUN_UNTIL_MAX_CONDITIONS];
+  int registers_count;
+
+  uint64_t max_instructions;
+  int instructions_condition;
+  uint64_t max_cycles;
+  int cycles_condition;
+
+  // Register or instruction count conditions need a check after every instruction
+  bool per_step;
+
+  // Filled while running
+  uint64_t instructions;
+  int met;
+} run_until;
+
+// Returns -1 if there are more than RUN_UNTIL_MAX_CONDITIONS conditions
+int run_until_compile(run_until *u, const until_condition *conditions, int count);
+
+/*
+Runs until one of the compiled conditions holds and returns its index,
+or -1 when execution stopped for another reason (breakpoint, watchpoint,
+stop request). Counts are relative to the start of the run, and a pc
+condition at the starting pc is ignored, like breakpoints
+*/
+int i8080_run_until(i8080 *p, run_until *u);
+
+// Hooks used by i8080_run and the helpers while a run_until is attached
+bool run_until_check_pc(run_until *u, i8080 *p);
+bool run_until_check_step(run_until *u, i8080 *p);
+void run_until_check_write(run_until *u, i8080 *p, uint16_t addr, uint8_t value);
+void run_until_check_port(run_until *u, i8080 *p, uint8_t port, bool out);
+
+#endif // RUN_UNTIL_H
@@ -0,0 +1,45 @@
+#ifndef RUNAHEAD_H
+#define RUNAHEAD_H
+#include "i8080.h"
+#include "snapshot.h"
+
+/*
+Run-ahead for interactive machines. Each host frame runs one real frame,
+then snapshots the machine, runs frames more with the current input,
+presents the output of the last one and restores the snapshot. What is
+shown is frames ahead of the real machine, which hides that many frames
+of the program's own input lag.
+The frames ahead are not seen by the profiler, the call graph, coverage,
+the heatmap or rewind, which are detached while they run, and what an
+attached replay records during them is dropped, a replay being played
+going back to where it was. speculative is set while they run; port
+callbacks get no context, so only frame_begin and present can check it,
+through a context that holds the runahead, and hold back sound and other
+output that must not happen twice
+*/
+typedef struct runahead
+{
+  uint64_t frame_cycles;
+  int frames;
+  bool speculative;
+
+  // Called at the start of every frame, e.g. to raise the frame interrupt
+  void (*frame_begin)(i8080 *p, void *context);
+
+  // Called once per host frame with the machine in the state to show
+  void (*present)(i8080 *p, void *context);
+
+  void *context;
+  snapshot snap;
+} runahead;
+
+// Sets up run-ahead of the given frames. With 0 frames every frame is presented as it runs
+void runahead_init(runahead *ra, uint64_t frame_cycles, int frames);
+
+/*
+Runs one host frame. Returns why the real frame stopped; if it was not
+the end of the frame nothing runs ahead and nothing is presented
+*/
+enum i8080_exit runahead_frame(runahead *ra, i8080 *p);
+
+#endif // RUNAHEAD_H
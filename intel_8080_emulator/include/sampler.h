@@ -0,0 +1,46 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+#include "i8080.h"
+#include <stdatomic.h>
+#include <threads.h>
+
+/*
+Statistical sampling profiler. While attached, i8080_step, before each
+instruction, and i8080_run, after each fused group or recompiled block,
+publish the current pc and cycle count with a single relaxed atomic
+store, and a
+helper thread reads it every interval and builds a pc histogram. The
+emulated processor is never paused or slowed down by the sampling.
+Samples taken while the cycle count did not move (the emulation is
+paused or waiting) are counted as idle
+*/
+typedef struct sampler
+{
+  // pc in the low 16 bits, cycles in the upper 48 bits
+  _Atomic uint64_t snapshot;
+
+  // Written by the sampling thread only. Read them after sampler_stop
+  uint64_t histogram[0x10000];
+  uint64_t samples;
+  uint64_t idle_samples;
+
+  uint32_t interval_us;
+  atomic_bool running;
+  thrd_t thread;
+} sampler;
+
+static inline void sampler_publish(sampler *s, i8080 *p)
+{
+  atomic_store_explicit(&s->snapshot, (p->cycles << 16) | p->pc, memory_order_relaxed);
+}
+
+// Clears the histogram and starts the sampling thread. Returns -1 if the thread can not be created
+int sampler_start(sampler *s, uint32_t interval_us);
+
+// Stops and joins the sampling thread
+void sampler_stop(sampler *s);
+
+// Writes "address,instruction,samples,percent" per sampled pc, most sampled first
+void sampler_write_report(sampler *s, i8080 *p, FILE *out);
+
+#endif // SAMPLER_H
@@ -0,0 +1,46 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+#include "i8080.h"
+
+#define SAVESTATE_MAGIC "I8SS"
+#define SAVESTATE_VERSION 2
+
+// Kinds of page in the page table
+#define SAVESTATE_PAGE_FILL 0
+#define SAVESTATE_PAGE_RAW 1
+
+/*
+Save states. All numbers are little endian:
+  magic "I8SS", version
+  a b c d e h l, bp sp pc, a byte of flags, interrupt opcode, cycles
+  device state size (4 bytes), a second byte of flags, and the device
+  state, owned by the host
+  page table: kind and fill byte for each of the 256 pages
+  the 256 bytes of each raw page, in page order
+Pages holding a single value, zero pages above all, only take their two
+table bytes. The table lets a loader find any page without reading the
+pages before it, so a mapped file is copied from once, page by page
+*/
+
+// Reads a 256-byte page of the state being saved
+typedef void (*savestate_page_reader)(void *context, uint8_t page, uint8_t *data);
+
+// Saves the processor, its memory and the device state. Returns -1 on failure
+int savestate_save(i8080 *p, const void *device, size_t device_size, FILE *out);
+
+// Same as savestate_save for a state given apart from the processor
+int savestate_write(const i8080_state *s, savestate_page_reader read_page, void *context,
+                    const void *device, size_t device_size, FILE *out);
+
+/*
+Restores a save state from memory. device_size must match the saved
+device state. With fresh set the memory is known to be all zeros and
+zero pages are not written. Returns -1 on a bad or mismatched state,
+leaving the processor untouched
+*/
+int savestate_restore(i8080 *p, const uint8_t *data, size_t size, void *device, size_t device_size, bool fresh);
+
+// Restores a save state file, mapping it when the platform can. Returns -1 on failure
+int savestate_load(i8080 *p, const char *path, void *device, size_t device_size, bool fresh);
+
+#endif // SAVESTATE_H
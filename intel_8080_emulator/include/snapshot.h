@@ -0,0 +1,34 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include "i8080.h"
+
+/*
+Copy-on-write snapshot of the processor and its memory. Taking one saves
+the registers and arms PAGE_SNAPSHOT on all pages; the first write to a
+page saves it and clears the flag. Restoring writes back only the saved
+pages, so both cost the registers plus the pages written in between,
+with no allocation. After a restore the snapshot is still taken and can
+be restored again
+*/
+typedef struct snapshot
+{
+  i8080_state state;
+
+  uint8_t pages[256][256];
+  uint8_t saved[256];
+  int saved_count;
+} snapshot;
+
+// Takes a snapshot of the processor's current state and attaches it
+void snapshot_take(snapshot *s, i8080 *p);
+
+// Returns the processor and memory to the snapshot
+void snapshot_restore(snapshot *s, i8080 *p);
+
+// Detaches the snapshot. The processor keeps its current state
+void snapshot_release(snapshot *s, i8080 *p);
+
+// Hook used by write_byte for pages flagged with PAGE_SNAPSHOT
+void snapshot_save_page(snapshot *s, i8080 *p, uint8_t page);
+
+#endif // SNAPSHOT_H
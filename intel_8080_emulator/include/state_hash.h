@@ -0,0 +1,56 @@
+#ifndef STATE_HASH_H
+#define STATE_HASH_H
+#include "i8080.h"
+
+/*
+Hash of the whole machine state: registers, flags, interrupt state and
+the 64K of memory, without the cycle count. The memory part is the XOR
+of a mix of every address and its value, so write_byte keeps it up to
+date with the old and new value of each write, and the hash is
+available at any time for the price of hashing the registers.
+Visited states are kept in an open addressing set of hashes. Two states
+are taken as the same when their 64-bit hashes are
+*/
+typedef struct state_hash
+{
+  uint64_t memory;
+
+  uint64_t *visited;
+  size_t visited_count, visited_capacity;
+  bool visited_zero;
+} state_hash;
+
+// Hashes the memory and attaches the hash. Returns -1 on failure
+int state_hash_attach(state_hash *h, i8080 *p);
+
+// Detaches the hash and frees the visited set
+void state_hash_detach(state_hash *h, i8080 *p);
+
+// Hash of the processor's current state
+uint64_t state_hash_value(const state_hash *h, const i8080 *p);
+
+// Adds the current state to the visited set. Returns 1 if it was already there, 0 if not and -1 on failure
+int state_hash_visit(state_hash *h, i8080 *p);
+
+void state_hash_clear_visited(state_hash *h);
+
+static inline uint64_t state_hash_mix(uint64_t x)
+{
+  // splitmix64 finalizer
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// Hook used by write_byte and restore_byte while a hash is attached
+static inline void state_hash_write(state_hash *h, i8080 *p, uint16_t addr, uint8_t value)
+{
+  uint8_t old = p->read_byte(addr);
+
+  h->memory ^= state_hash_mix((uint32_t)addr << 8 | old) ^ state_hash_mix((uint32_t)addr << 8 | value);
+}
+
+#endif // STATE_HASH_H
@@ -0,0 +1,34 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+#include "i8080.h"
+
+typedef struct symbol
+{
+  uint16_t addr;
+  char name[32];
+} symbol;
+
+// Symbols sorted by address. Zero initialize before loading
+typedef struct symbol_map
+{
+  symbol *symbols;
+  uint32_t count;
+} symbol_map;
+
+/*
+Loads a symbol map. Each line holds a hexadecimal address followed by
+a name ("0100 main"); lines starting with ';' or '#' are ignored.
+Returns -1 if the file can not be read
+*/
+int symbols_load(symbol_map *map, const char *path);
+
+void symbols_free(symbol_map *map);
+
+// Name of the symbol at exactly addr, or NULL
+const char *symbols_find(symbol_map *map, uint16_t addr);
+
+// Writes the name of addr into out: its symbol, the nearest preceding
+// symbol plus an offset ("main+0x12") or "sub_<addr>"
+void symbols_name(symbol_map *map, uint16_t addr, char *out, size_t out_size);
+
+#endif // SYMBOLS_H
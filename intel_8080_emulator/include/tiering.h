@@ -0,0 +1,77 @@
+#ifndef TIERING_H
+#define TIERING_H
+#include "i8080.h"
+#include "fusion.h"
+#include "recompiler.h"
+
+// How code at an address is run, from the cheapest to start to the fastest
+enum tier
+{
+  TIER_INTERPRETED, // one instruction at a time by i8080_step
+  TIER_PREDECODED,  // classified once and run as fused groups
+  TIER_COMPILED,    // the block of a recompiled image starting there
+  TIERS
+};
+
+// Dispatches of an address before it is moved up to the next tier
+#define TIERING_PREDECODE_AFTER 16
+#define TIERING_COMPILE_AFTER 256
+
+/*
+Tiered execution. Attach it by pointing the processor's tiering field to
+an initialized instance; i8080_run then asks it how to run each address
+it dispatches, instead of trying recompiled code and fusion everywhere.
+Every address starts in the interpreter and counts how often it is
+dispatched. Past predecode_after dispatches it is classified by fusion
+and its groups run fused, and past compile_after the block of the
+recompiled image starting there, if there is one, is run. Cold code
+costs only its counter, and the fusion tables and image blocks of code
+that never gets hot are never looked at.
+A write into the bytes of a group or block of the upper tiers demotes
+the address it starts at back to the interpreter, with its count reset.
+Writes elsewhere on the page, to variables kept next to the code, leave
+it where it is. Fusion and the recompiled code still forget or recheck
+what they had on any written page. The fusion and recompiled instances
+are attached along with the manager; fusion_map_ram can be called on
+the fusion one
+*/
+typedef struct tiering
+{
+  fusion f;
+  recompiled r;
+  bool compiled;
+
+  uint8_t tiers[0x10000];
+  uint32_t hotness[0x10000];
+  uint32_t predecode_after, compile_after;
+
+  // Dispatches handled per tier, addresses moved up to each tier, and addresses moved back down
+  uint64_t dispatched[TIERS];
+  uint64_t promotions[TIERS];
+  uint64_t demotions;
+} tiering;
+
+/*
+Attaches the manager, with fusion and, unless image is NULL, the
+recompiled image. The thresholds start at TIERING_PREDECODE_AFTER and
+TIERING_COMPILE_AFTER
+*/
+void tiering_attach(tiering *t, i8080 *p, const recompiled_image *image);
+void tiering_detach(tiering *t, i8080 *p);
+
+/*
+Runs the address at pc in its tier, counting the dispatch and promoting
+it when hot. Returns false, having done nothing, when the interpreter
+has to run it
+*/
+bool tiering_step(tiering *t, i8080 *p, uint64_t cycles_left);
+
+// Called by the memory helpers for writes to PAGE_CODE pages, before fusion and the recompiled code forget them
+void tiering_code_written(tiering *t, uint16_t addr);
+
+const char *tiering_tier_name(enum tier tier);
+
+// Prints the addresses in each tier and the dispatches, promotions and demotions
+void tiering_report(const tiering *t, FILE *out);
+
+#endif // TIERING_H
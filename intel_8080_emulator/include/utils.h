@@ -2,8 +2,6 @@
 #define UTILS_H
 #include "i8080.h"
 
-void non_implem_error(uint8_t opcode);
-
 // Joins registers h and l to form a 16 bit address
 uint16_t join_hl(i8080 *p);
 
@@ -12,8 +10,16 @@ uint16_t join_for_16_bit(uint8_t high, uint8_t low);
 
 uint8_t read_byte(i8080 *p, uint16_t addr);
 
+// Same as read_byte, for opcode fetches
+uint8_t read_opcode(i8080 *p, uint16_t addr);
+
 uint16_t read_word(i8080 *p, uint16_t addr);
 
+// I/O through the port callbacks, or the replay being played. Without either the instruction traps
+uint8_t port_in(i8080 *p, uint8_t port);
+
+void port_out(i8080 *p, uint8_t port, uint8_t value);
+
 bool parity(uint8_t value);
 
 void update_acf(i8080 *p, uint8_t a, uint8_t b, char *mode);
@@ -26,6 +32,15 @@ void write_byte(i8080 *p, uint16_t addr, uint8_t data);
 
 void write_word(i8080 *p, uint16_t addr, uint16_t data);
 
+/*
+Writes memory back to a saved state. Nothing but the state hash, the
+code caches and a checkpoint being written see it
+*/
+void restore_byte(i8080 *p, uint16_t addr, uint8_t data);
+
+// Whether something attached has to see every instruction, so none can be run in groups
+bool observed_per_step(const i8080 *p);
+
 void update_zf_sf(i8080 *p);
 
 void add_byte(i8080 *p, uint8_t to_add, uint8_t carry);
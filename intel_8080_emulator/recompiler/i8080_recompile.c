@@ -0,0 +1,123 @@
+/*
+Recompiles a ROM image to C source, see recompiler.h:
+  i8080_recompile [options] rom.bin output.c
+    -n name    name of the recompiled_image defined, default rom
+    -b origin  where the ROM is loaded, default 0
+    -e entry   an entry point, default the origin. May be repeated
+    -v vectors the interrupt vectors to start from, bit n for RST n at
+               8 * n, default 0xff. Those holding no code are best left
+               out, code decoded from the middle of instructions is only
+               wasted
+Numbers are read as C constants, so 0x100 is hex. The output compiles
+with the emulator's headers and is attached with recompiled_attach.
+From CMake, the ROM is best recompiled with an add_custom_command whose
+OUTPUT is listed with the program's sources
+*/
+
+#include "recompiler.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ENTRIES 64
+
+static recompiler r;
+static uint8_t rom[0x10000];
+
+static int usage(void)
+{
+  fprintf(stderr, "usage: i8080_recompile [-n name] [-b origin] [-e entry]... [-v vectors] rom.bin output.c\n");
+  return 2;
+}
+
+int main(int argc, char **argv)
+{
+  const char *name = "rom", *rom_path = NULL, *out_path = NULL;
+  unsigned long origin = 0, entries[MAX_ENTRIES];
+  int entries_count = 0;
+  unsigned long vectors = 0xff;
+
+  for (int i = 1; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+
+    if (strcmp(argv[i], "-n") == 0 && has_value)
+    {
+      name = argv[++i];
+    }
+    else if (strcmp(argv[i], "-b") == 0 && has_value)
+    {
+      origin = strtoul(argv[++i], NULL, 0);
+    }
+    else if (strcmp(argv[i], "-e") == 0 && has_value && entries_count < MAX_ENTRIES)
+    {
+      entries[entries_count++] = strtoul(argv[++i], NULL, 0);
+    }
+    else if (strcmp(argv[i], "-v") == 0 && has_value)
+    {
+      vectors = strtoul(argv[++i], NULL, 0);
+    }
+    else if (argv[i][0] == '-')
+    {
+      return usage();
+    }
+    else if (rom_path == NULL)
+    {
+      rom_path = argv[i];
+    }
+    else if (out_path == NULL)
+    {
+      out_path = argv[i];
+    }
+    else
+    {
+      return usage();
+    }
+  }
+  if (rom_path == NULL || out_path == NULL || origin > 0xffff)
+  {
+    return usage();
+  }
+  if (entries_count == 0)
+  {
+    entries[entries_count++] = origin;
+  }
+
+  FILE *in = fopen(rom_path, "rb");
+  if (in == NULL)
+  {
+    perror(rom_path);
+    return 1;
+  }
+  size_t size = fread(rom, 1, sizeof(rom) - origin, in);
+  fclose(in);
+
+  if (recompiler_init(&r, rom, size, origin) != 0)
+  {
+    fprintf(stderr, "%s: empty, or doesn't fit at %04lxh\n", rom_path, origin);
+    return 1;
+  }
+  for (int i = 0; i < entries_count; i++)
+  {
+    if (recompiler_discover(&r, entries[i], i == 0 ? vectors : 0) < 0)
+    {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+    }
+  }
+
+  FILE *out = fopen(out_path, "w");
+  if (out == NULL)
+  {
+    perror(out_path);
+    return 1;
+  }
+  int blocks = recompiler_emit(&r, out, name);
+  if (fclose(out) != 0 || blocks < 0)
+  {
+    fprintf(stderr, "%s: write failed\n", out_path);
+    return 1;
+  }
+
+  fprintf(stderr, "%s: %u instructions found, %d blocks recompiled\n", rom_path, (unsigned)r.instructions, blocks);
+  return 0;
+}
@@ -0,0 +1,276 @@
+#include "callgraph.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_NODE UINT32_MAX
+
+static uint32_t new_node(callgraph *cg, uint16_t function, uint32_t parent)
+{
+  if (cg->nodes_count == cg->nodes_capacity)
+  {
+    uint32_t capacity = cg->nodes_capacity * 2;
+    callgraph_node *nodes = realloc(cg->nodes, capacity * sizeof(callgraph_node));
+
+    if (nodes == NULL)
+    {
+      return NO_NODE;
+    }
+    cg->nodes = nodes;
+    cg->nodes_capacity = capacity;
+  }
+
+  uint32_t index = cg->nodes_count++;
+  callgraph_node *node = &cg->nodes[index];
+  node->function = function;
+  node->parent = parent;
+  node->first_child = NO_NODE;
+  node->next_sibling = NO_NODE;
+  node->calls = 0;
+  node->self_cycles = 0;
+
+  if (parent != NO_NODE)
+  {
+    node->next_sibling = cg->nodes[parent].first_child;
+    cg->nodes[parent].first_child = index;
+  }
+
+  return index;
+}
+
+static uint32_t child_node(callgraph *cg, uint32_t parent, uint16_t function)
+{
+  for (uint32_t i = cg->nodes[parent].first_child; i != NO_NODE; i = cg->nodes[i].next_sibling)
+  {
+    if (cg->nodes[i].function == function)
+    {
+      return i;
+    }
+  }
+
+  return new_node(cg, function, parent);
+}
+
+int callgraph_init(callgraph *cg, i8080 *p)
+{
+  memset(cg, 0, sizeof(callgraph));
+
+  cg->nodes_capacity = 1024;
+  cg->nodes = malloc(cg->nodes_capacity * sizeof(callgraph_node));
+
+  if (cg->nodes == NULL)
+  {
+    return -1;
+  }
+
+  // The routine running when profiling starts is the root and is never popped
+  new_node(cg, p->pc, NO_NODE);
+  cg->nodes[0].calls = 1;
+  cg->calls[p->pc] = 1;
+  cg->stack[0].function = p->pc;
+  cg->stack[0].sp = p->sp;
+  cg->stack[0].node = 0;
+  cg->stack[0].entry_cycles = p->cycles;
+  cg->depth = 1;
+  cg->last_cycles = p->cycles;
+
+  return 0;
+}
+
+void callgraph_free(callgraph *cg)
+{
+  free(cg->nodes);
+  cg->nodes = NULL;
+  symbols_free(&cg->symbols);
+}
+
+int callgraph_load_symbols(callgraph *cg, const char *path)
+{
+  return symbols_load(&cg->symbols, path);
+}
+
+void callgraph_symbolize(callgraph *cg, uint16_t addr, char *out, size_t out_size)
+{
+  symbols_name(&cg->symbols, addr, out, out_size);
+}
+
+// Charges the cycles elapsed since the last event to the running subroutine
+static void attribute_cycles(callgraph *cg, i8080 *p)
+{
+  callgraph_frame *top = &cg->stack[cg->depth - 1];
+  uint64_t elapsed = p->cycles - cg->last_cycles;
+
+  cg->nodes[top->node].self_cycles += elapsed;
+  cg->exclusive_cycles[top->function] += elapsed;
+  cg->last_cycles = p->cycles;
+}
+
+static bool is_active(callgraph *cg, uint16_t function)
+{
+  for (int i = 0; i < cg->depth; i++)
+  {
+    if (cg->stack[i].function == function)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void pop_frame(callgraph *cg, i8080 *p)
+{
+  callgraph_frame *frame = &cg->stack[--cg->depth];
+
+  // Recursive activations are already covered by the outermost one
+  if (!is_active(cg, frame->function))
+  {
+    cg->inclusive_cycles[frame->function] += p->cycles - frame->entry_cycles;
+  }
+}
+
+void callgraph_call(callgraph *cg, i8080 *p, uint16_t addr)
+{
+  attribute_cycles(cg, p);
+
+  uint32_t node = NO_NODE;
+
+  if (cg->depth < CALLGRAPH_MAX_DEPTH)
+  {
+    node = child_node(cg, cg->stack[cg->depth - 1].node, addr);
+  }
+
+  if (node == NO_NODE)
+  {
+    cg->overflows++;
+    return;
+  }
+
+  cg->nodes[node].calls++;
+  cg->calls[addr]++;
+
+  callgraph_frame *frame = &cg->stack[cg->depth++];
+  frame->function = addr;
+  frame->sp = p->sp;
+  frame->node = node;
+  frame->entry_cycles = p->cycles;
+}
+
+void callgraph_ret(callgraph *cg, i8080 *p)
+{
+  attribute_cycles(cg, p);
+
+  for (int i = cg->depth - 1; i > 0; i--)
+  {
+    if (cg->stack[i].sp == p->sp)
+    {
+      while (cg->depth > i)
+      {
+        pop_frame(cg, p);
+      }
+      return;
+    }
+  }
+
+  // No frame owns this return address: RET is being used as a jump. Frames
+  // below the stack pointer were discarded by the code and are dropped too
+  while (cg->depth > 1 && cg->stack[cg->depth - 1].sp < p->sp)
+  {
+    pop_frame(cg, p);
+  }
+}
+
+// Inclusive cycles including the subroutines that have not returned yet
+static uint64_t current_inclusive_cycles(callgraph *cg, i8080 *p, uint16_t function)
+{
+  uint64_t cycles = cg->inclusive_cycles[function];
+
+  for (int i = 0; i < cg->depth; i++)
+  {
+    if (cg->stack[i].function == function)
+    {
+      return cycles + p->cycles - cg->stack[i].entry_cycles;
+    }
+  }
+  return cycles;
+}
+
+typedef struct function_cost
+{
+  uint16_t function;
+  uint64_t inclusive;
+} function_cost;
+
+static int compare_function_cost(const void *a, const void *b)
+{
+  uint64_t inclusive_a = ((const function_cost *)a)->inclusive;
+  uint64_t inclusive_b = ((const function_cost *)b)->inclusive;
+  return (inclusive_a < inclusive_b) - (inclusive_a > inclusive_b);
+}
+
+void callgraph_write_report(callgraph *cg, i8080 *p, FILE *out)
+{
+  function_cost *costs = malloc(0x10000 * sizeof(function_cost));
+  uint32_t count = 0;
+  char name[48];
+
+  if (costs == NULL)
+  {
+    return;
+  }
+
+  attribute_cycles(cg, p);
+
+  for (uint32_t addr = 0; addr < 0x10000; addr++)
+  {
+    if (cg->calls[addr] > 0)
+    {
+      costs[count].function = addr;
+      costs[count].inclusive = current_inclusive_cycles(cg, p, addr);
+      count++;
+    }
+  }
+
+  qsort(costs, count, sizeof(function_cost), compare_function_cost);
+
+  fprintf(out, "address,name,calls,inclusive_cycles,exclusive_cycles\n");
+  for (uint32_t i = 0; i < count; i++)
+  {
+    uint16_t function = costs[i].function;
+
+    callgraph_symbolize(cg, function, name, sizeof(name));
+    fprintf(out, "%04x,%s,%llu,%llu,%llu\n", function, name,
+            (unsigned long long)cg->calls[function],
+            (unsigned long long)costs[i].inclusive,
+            (unsigned long long)cg->exclusive_cycles[function]);
+  }
+
+  free(costs);
+}
+
+void callgraph_write_folded(callgraph *cg, i8080 *p, FILE *out)
+{
+  uint32_t path[CALLGRAPH_MAX_DEPTH];
+  char name[48];
+
+  attribute_cycles(cg, p);
+
+  for (uint32_t i = 0; i < cg->nodes_count; i++)
+  {
+    if (cg->nodes[i].self_cycles == 0)
+    {
+      continue;
+    }
+
+    int length = 0;
+    for (uint32_t node = i; node != NO_NODE; node = cg->nodes[node].parent)
+    {
+      path[length++] = node;
+    }
+
+    while (length-- > 0)
+    {
+      callgraph_symbolize(cg, cg->nodes[path[length]].function, name, sizeof(name));
+      fprintf(out, "%s%c", name, length > 0 ? ';' : ' ');
+    }
+    fprintf(out, "%llu\n", (unsigned long long)cg->nodes[i].self_cycles);
+  }
+}
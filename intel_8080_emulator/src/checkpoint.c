@@ -0,0 +1,184 @@
+#include "checkpoint.h"
+#include "savestate.h"
+#include <stdlib.h>
+#include <string.h>
+
+void checkpoint_init(checkpoint *c)
+{
+  memset(c, 0, sizeof(checkpoint));
+  atomic_init(&c->busy, false);
+  for (int page = 0; page < 256; page++)
+  {
+    atomic_init(&c->page_state[page], CHECKPOINT_PENDING);
+  }
+}
+
+// Page reader for savestate_write, run by the writer thread
+static void read_page(void *context, uint8_t page, uint8_t *data)
+{
+  checkpoint *c = context;
+  unsigned char expected = CHECKPOINT_PENDING;
+
+  if (atomic_compare_exchange_strong(&c->page_state[page], &expected, CHECKPOINT_READING))
+  {
+    for (int offset = 0; offset < 256; offset++)
+    {
+      data[offset] = c->read_byte((page << 8) | offset);
+    }
+    atomic_store_explicit(&c->page_state[page], CHECKPOINT_DONE, memory_order_release);
+    return;
+  }
+
+  // The processor claimed it first
+  while (atomic_load_explicit(&c->page_state[page], memory_order_acquire) != CHECKPOINT_COPIED)
+  {
+    thrd_yield();
+  }
+  memcpy(data, c->pages[page], 256);
+}
+
+static int write_checkpoint(void *arg)
+{
+  checkpoint *c = arg;
+  size_t length = strlen(c->path);
+  char *tmp = malloc(length + 5);
+  FILE *out = NULL;
+
+  c->result = -1;
+  if (tmp != NULL)
+  {
+    memcpy(tmp, c->path, length);
+    memcpy(tmp + length, ".tmp", 5);
+    out = fopen(tmp, "wb");
+  }
+
+  if (out != NULL)
+  {
+    int written = savestate_write(&c->state, &read_page, c, c->device, c->device_size, out);
+
+    if (fclose(out) == 0 && written == 0)
+    {
+      // Some platforms do not rename over an existing file
+      if (rename(tmp, c->path) == 0 || (remove(c->path) == 0 && rename(tmp, c->path) == 0))
+      {
+        c->result = 0;
+      }
+    }
+    if (c->result != 0)
+    {
+      remove(tmp);
+    }
+  }
+
+  free(tmp);
+  atomic_store_explicit(&c->busy, false, memory_order_release);
+  return 0;
+}
+
+static void detach(checkpoint *c, i8080 *p)
+{
+  for (int page = 0; page < 256; page++)
+  {
+    p->page_flags[page] &= ~PAGE_CHECKPOINT;
+  }
+  if (p->checkpoint == c)
+  {
+    p->checkpoint = NULL;
+  }
+
+  free(c->path);
+  free(c->device);
+  c->path = NULL;
+  c->device = NULL;
+}
+
+int checkpoint_start(checkpoint *c, i8080 *p, const char *path, const void *device, size_t device_size)
+{
+  if (c->started)
+  {
+    if (!checkpoint_done(c))
+    {
+      return -1;
+    }
+    checkpoint_finish(c, p);
+  }
+
+  size_t length = strlen(path);
+
+  c->path = malloc(length + 1);
+  c->device = malloc(device_size ? device_size : 1);
+  if (c->path == NULL || c->device == NULL)
+  {
+    free(c->path);
+    free(c->device);
+    c->path = NULL;
+    c->device = NULL;
+    return -1;
+  }
+  memcpy(c->path, path, length + 1);
+  if (device_size > 0)
+  {
+    memcpy(c->device, device, device_size);
+  }
+  c->device_size = device_size;
+
+  i8080_save_state(p, &c->state);
+  c->read_byte = p->read_byte;
+  for (int page = 0; page < 256; page++)
+  {
+    atomic_store_explicit(&c->page_state[page], CHECKPOINT_PENDING, memory_order_relaxed);
+    p->page_flags[page] |= PAGE_CHECKPOINT;
+  }
+  p->checkpoint = c;
+
+  atomic_store_explicit(&c->busy, true, memory_order_release);
+  if (thrd_create(&c->thread, write_checkpoint, c) != thrd_success)
+  {
+    atomic_store(&c->busy, false);
+    detach(c, p);
+    return -1;
+  }
+
+  c->started = true;
+  return 0;
+}
+
+bool checkpoint_done(checkpoint *c)
+{
+  return !atomic_load_explicit(&c->busy, memory_order_acquire);
+}
+
+int checkpoint_finish(checkpoint *c, i8080 *p)
+{
+  if (!c->started)
+  {
+    return 0;
+  }
+
+  thrd_join(c->thread, NULL);
+  detach(c, p);
+  c->started = false;
+  return c->result;
+}
+
+void checkpoint_save_page(checkpoint *c, i8080 *p, uint8_t page)
+{
+  unsigned char expected = CHECKPOINT_PENDING;
+
+  p->page_flags[page] &= ~PAGE_CHECKPOINT;
+
+  if (atomic_compare_exchange_strong(&c->page_state[page], &expected, CHECKPOINT_COPYING))
+  {
+    for (int offset = 0; offset < 256; offset++)
+    {
+      c->pages[page][offset] = p->read_byte((page << 8) | offset);
+    }
+    atomic_store_explicit(&c->page_state[page], CHECKPOINT_COPIED, memory_order_release);
+    return;
+  }
+
+  // The writer thread is reading the page from memory, which must not change under it
+  while (atomic_load_explicit(&c->page_state[page], memory_order_acquire) == CHECKPOINT_READING)
+  {
+  }
+}
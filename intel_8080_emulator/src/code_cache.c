@@ -0,0 +1,142 @@
+#include "code_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+int code_cache_init(code_cache *c, size_t max_pages)
+{
+  memset(c, 0, sizeof(code_cache));
+
+  // At most half full, so probing stays short
+  c->capacity = 64;
+  while (c->capacity < max_pages * 2)
+  {
+    c->capacity *= 2;
+  }
+  c->slots = calloc(c->capacity, sizeof(*c->slots));
+  return c->slots == NULL ? -1 : 0;
+}
+
+void code_cache_free(code_cache *c)
+{
+  for (size_t slot = 0; c->slots != NULL && slot < c->capacity; slot++)
+  {
+    free(atomic_load(&c->slots[slot]));
+  }
+  free(c->slots);
+  c->slots = NULL;
+}
+
+// FNV-1a over the page number and its bytes
+static uint64_t page_hash(uint8_t page, const uint8_t *bytes)
+{
+  uint64_t hash = (0xcbf29ce484222325ULL ^ page) * 0x100000001b3ULL;
+
+  for (int i = 0; i < 256; i++)
+  {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static code_cache_page *classify_page(i8080 *p, uint8_t page, uint64_t hash, const uint8_t *bytes)
+{
+  code_cache_page *entry = malloc(sizeof(code_cache_page));
+
+  if (entry == NULL)
+  {
+    return NULL;
+  }
+  entry->hash = hash;
+  entry->page = page;
+  memcpy(entry->bytes, bytes, sizeof(entry->bytes));
+
+  // Groups that may reach into the next page are left to each processor
+  memset(entry->kinds, FUSION_UNCLASSIFIED, sizeof(entry->kinds));
+  for (int i = 0; i <= 256 - FUSION_MAX_GROUP_BYTES; i++)
+  {
+    entry->kinds[i] = fusion_classify(p, page << 8 | i);
+  }
+  return entry;
+}
+
+const code_cache_page *code_cache_lookup(code_cache *c, i8080 *p, uint8_t page)
+{
+  uint8_t bytes[256];
+  code_cache_page *fresh = NULL;
+  size_t mask = c->capacity - 1;
+
+  for (int i = 0; i < 256; i++)
+  {
+    bytes[i] = p->read_byte(page << 8 | i);
+  }
+  uint64_t hash = page_hash(page, bytes);
+
+  for (size_t probe = 0, slot = hash & mask; probe < c->capacity; probe++, slot = (slot + 1) & mask)
+  {
+    code_cache_page *entry = atomic_load_explicit(&c->slots[slot], memory_order_acquire);
+
+    if (entry == NULL)
+    {
+      if (fresh == NULL)
+      {
+        if (atomic_load_explicit(&c->pages, memory_order_relaxed) * 2 >= c->capacity)
+        {
+          return NULL;
+        }
+        fresh = classify_page(p, page, hash, bytes);
+        if (fresh == NULL)
+        {
+          return NULL;
+        }
+      }
+      if (atomic_compare_exchange_strong_explicit(&c->slots[slot], &entry, fresh, memory_order_acq_rel,
+                                                  memory_order_acquire))
+      {
+        atomic_fetch_add_explicit(&c->pages, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&c->misses, 1, memory_order_relaxed);
+        return fresh;
+      }
+      // Another thread took the slot, maybe with the same page
+    }
+    if (entry->hash == hash && entry->page == page && memcmp(entry->bytes, bytes, sizeof(bytes)) == 0)
+    {
+      if (fresh != NULL)
+      {
+        free(fresh);
+        atomic_fetch_add_explicit(&c->wasted, 1, memory_order_relaxed);
+      }
+      atomic_fetch_add_explicit(&c->hits, 1, memory_order_relaxed);
+      return entry;
+    }
+  }
+
+  free(fresh);
+  return NULL;
+}
+
+int code_cache_share(code_cache *c, fusion *f, i8080 *p, uint8_t first_page, int pages)
+{
+  int shared = 0;
+
+  for (int i = 0; i < pages && first_page + i < 256; i++)
+  {
+    uint8_t page = first_page + i;
+    const code_cache_page *entry = code_cache_lookup(c, p, page);
+
+    if (entry != NULL)
+    {
+      // So that a write to the page stops it being shared
+      f->shared[page] = entry->kinds;
+      p->page_flags[page] |= PAGE_CODE;
+      shared++;
+    }
+  }
+  return shared;
+}
+
+void code_cache_report(const code_cache *c, FILE *out)
+{
+  fprintf(out, "%zu pages cached, %llu found, %llu classified, %llu classified for nothing\n",
+          atomic_load(&c->pages), (unsigned long long)atomic_load(&c->hits),
+          (unsigned long long)atomic_load(&c->misses), (unsigned long long)atomic_load(&c->wasted));
+}
@@ -0,0 +1,155 @@
+#include "coverage.h"
+#include "disassembler.h"
+#include <string.h>
+
+void coverage_init(coverage *cov)
+{
+  memset(cov, 0, sizeof(coverage));
+}
+
+static void merge_bitmap(uint8_t *dst, const uint8_t *src)
+{
+  for (int i = 0; i < COVERAGE_BITMAP_SIZE; i++)
+  {
+    dst[i] |= src[i];
+  }
+}
+
+void coverage_merge(coverage *dst, const coverage *src)
+{
+  merge_bitmap(dst->executed, src->executed);
+  merge_bitmap(dst->taken, src->taken);
+  merge_bitmap(dst->not_taken, src->not_taken);
+}
+
+uint32_t coverage_count(const coverage *cov)
+{
+  uint32_t count = 0;
+
+  for (int i = 0; i < COVERAGE_BITMAP_SIZE; i++)
+  {
+    for (uint8_t bits = cov->executed[i]; bits != 0; bits &= bits - 1)
+    {
+      count++;
+    }
+  }
+  return count;
+}
+
+int coverage_save(const coverage *cov, const char *path)
+{
+  FILE *file = fopen(path, "wb");
+
+  if (file == NULL)
+  {
+    return -1;
+  }
+
+  size_t written = fwrite(cov, sizeof(coverage), 1, file);
+
+  if (fclose(file) != 0 || written != 1)
+  {
+    return -1;
+  }
+  return 0;
+}
+
+int coverage_load(coverage *cov, const char *path)
+{
+  coverage loaded;
+  FILE *file = fopen(path, "rb");
+
+  if (file == NULL)
+  {
+    return -1;
+  }
+
+  size_t read = fread(&loaded, sizeof(coverage), 1, file);
+  fclose(file);
+
+  if (read != 1)
+  {
+    return -1;
+  }
+
+  coverage_merge(cov, &loaded);
+  return 0;
+}
+
+void coverage_write_listing(coverage *cov, i8080 *p, uint16_t start, uint32_t end, FILE *out)
+{
+  char text[32];
+  uint32_t addr = start;
+
+  while (addr < end)
+  {
+    uint8_t length = disassemble(p, addr, text, sizeof(text));
+
+    fprintf(out, "%04x %c %s\n", addr, coverage_bit(cov->executed, addr) ? '*' : ' ', text);
+    addr += length;
+  }
+}
+
+void coverage_write_lcov(coverage *cov, i8080 *p, uint16_t start, uint32_t end,
+                         symbol_map *symbols, const char *listing_path, FILE *out)
+{
+  uint32_t line = 1, lines_found = 0, lines_hit = 0;
+  uint32_t branches_found = 0, branches_hit = 0;
+  uint32_t functions_found = 0, functions_hit = 0;
+
+  fprintf(out, "TN:\nSF:%s\n", listing_path);
+
+  // Functions first, as lcov expects FN records before DA ones
+  for (uint32_t addr = start; symbols != NULL && addr < end;)
+  {
+    uint8_t opcode = p->read_byte(addr);
+    const char *name = symbols_find(symbols, addr);
+
+    if (name != NULL)
+    {
+      bool hit = coverage_bit(cov->executed, addr);
+
+      fprintf(out, "FN:%u,%s\nFNDA:%d,%s\n", line, name, hit, name);
+      functions_found++;
+      functions_hit += hit;
+    }
+    addr += instruction_length(opcode);
+    line++;
+  }
+
+  line = 1;
+  for (uint32_t addr = start; addr < end; line++)
+  {
+    uint8_t opcode = p->read_byte(addr);
+    bool hit = coverage_bit(cov->executed, addr);
+
+    if (is_conditional_branch(opcode))
+    {
+      bool taken = coverage_bit(cov->taken, addr);
+      bool not_taken = coverage_bit(cov->not_taken, addr);
+
+      if (hit)
+      {
+        fprintf(out, "BRDA:%u,0,0,%d\nBRDA:%u,0,1,%d\n", line, taken, line, not_taken);
+      }
+      else
+      {
+        fprintf(out, "BRDA:%u,0,0,-\nBRDA:%u,0,1,-\n", line, line);
+      }
+      branches_found += 2;
+      branches_hit += taken + not_taken;
+    }
+
+    fprintf(out, "DA:%u,%d\n", line, hit);
+    lines_found++;
+    lines_hit += hit;
+    addr += instruction_length(opcode);
+  }
+
+  if (symbols != NULL)
+  {
+    fprintf(out, "FNF:%u\nFNH:%u\n", functions_found, functions_hit);
+  }
+  fprintf(out, "BRF:%u\nBRH:%u\n", branches_found, branches_hit);
+  fprintf(out, "LF:%u\nLH:%u\nend_of_record\n", lines_found, lines_hit);
+}
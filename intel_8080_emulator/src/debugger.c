@@ -0,0 +1,146 @@
+#include "debugger.h"
+#include <string.h>
+
+static bool get_bit(const uint8_t *bitmap, uint16_t addr)
+{
+  return (bitmap[addr >> 3] >> (addr & 7)) & 1;
+}
+
+static void set_bit(uint8_t *bitmap, uint16_t addr, bool value)
+{
+  if (value)
+  {
+    bitmap[addr >> 3] |= 1 << (addr & 7);
+  }
+  else
+  {
+    bitmap[addr >> 3] &= ~(1 << (addr & 7));
+  }
+}
+
+// True if any address of the page is set in the bitmap
+static bool page_has_bits(const uint8_t *bitmap, uint8_t page)
+{
+  const uint8_t *bits = bitmap + page * (256 / 8);
+
+  for (int i = 0; i < 256 / 8; i++)
+  {
+    if (bits[i] != 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void update_page_flag(i8080 *p, const uint8_t *bitmap, uint8_t page, uint8_t flag)
+{
+  if (page_has_bits(bitmap, page))
+  {
+    p->page_flags[page] |= flag;
+  }
+  else
+  {
+    p->page_flags[page] &= ~flag;
+  }
+}
+
+void debugger_attach(debugger *d, i8080 *p)
+{
+  memset(d, 0, sizeof(debugger));
+  p->debugger = d;
+}
+
+void debugger_detach(debugger *d, i8080 *p)
+{
+  for (int page = 0; page < 256; page++)
+  {
+    p->page_flags[page] &= ~(PAGE_BREAKPOINT | PAGE_WATCH_READ | PAGE_WATCH_WRITE);
+  }
+  memset(d, 0, sizeof(debugger));
+  p->debugger = NULL;
+}
+
+void debugger_set_breakpoint(debugger *d, i8080 *p, uint16_t addr)
+{
+  set_bit(d->breakpoints, addr, true);
+  p->page_flags[addr >> 8] |= PAGE_BREAKPOINT;
+}
+
+void debugger_clear_breakpoint(debugger *d, i8080 *p, uint16_t addr)
+{
+  set_bit(d->breakpoints, addr, false);
+  update_page_flag(p, d->breakpoints, addr >> 8, PAGE_BREAKPOINT);
+}
+
+void debugger_set_watchpoint(debugger *d, i8080 *p, uint16_t addr, uint32_t length, bool reads, bool writes)
+{
+  for (uint32_t i = 0; i < length; i++)
+  {
+    uint16_t watched = addr + i;
+
+    if (reads)
+    {
+      set_bit(d->watch_reads, watched, true);
+      p->page_flags[watched >> 8] |= PAGE_WATCH_READ;
+    }
+    if (writes)
+    {
+      set_bit(d->watch_writes, watched, true);
+      p->page_flags[watched >> 8] |= PAGE_WATCH_WRITE;
+    }
+  }
+}
+
+void debugger_clear_watchpoint(debugger *d, i8080 *p, uint16_t addr, uint32_t length)
+{
+  for (uint32_t i = 0; i < length; i++)
+  {
+    set_bit(d->watch_reads, addr + i, false);
+    set_bit(d->watch_writes, addr + i, false);
+  }
+
+  for (uint32_t i = 0; i < length; i++)
+  {
+    uint8_t page = (addr + i) >> 8;
+    update_page_flag(p, d->watch_reads, page, PAGE_WATCH_READ);
+    update_page_flag(p, d->watch_writes, page, PAGE_WATCH_WRITE);
+  }
+}
+
+bool debugger_check_breakpoint(debugger *d, i8080 *p)
+{
+  if (!get_bit(d->breakpoints, p->pc))
+  {
+    return false;
+  }
+
+  d->hit = DEBUGGER_BREAKPOINT;
+  d->hit_addr = p->pc;
+  d->hit_value = 0;
+  return true;
+}
+
+static void watch_hit(debugger *d, i8080 *p, enum debugger_hit hit, uint16_t addr, uint8_t value)
+{
+  d->hit = hit;
+  d->hit_addr = addr;
+  d->hit_value = value;
+  i8080_stop(p, I8080_EXIT_WATCHPOINT);
+}
+
+void debugger_check_read(debugger *d, i8080 *p, uint16_t addr, uint8_t value)
+{
+  if (get_bit(d->watch_reads, addr))
+  {
+    watch_hit(d, p, DEBUGGER_WATCH_READ, addr, value);
+  }
+}
+
+void debugger_check_write(debugger *d, i8080 *p, uint16_t addr, uint8_t value)
+{
+  if (get_bit(d->watch_writes, addr))
+  {
+    watch_hit(d, p, DEBUGGER_WATCH_WRITE, addr, value);
+  }
+}
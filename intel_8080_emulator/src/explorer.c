@@ -0,0 +1,500 @@
+#include "explorer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_SIZE (1 << 20)
+
+// Each thread runs its machine on its own memory
+static _Thread_local uint8_t *worker_memory;
+static _Thread_local uint8_t worker_input;
+
+static uint8_t read_memory(uint16_t addr)
+{
+  return worker_memory[addr];
+}
+
+static void write_memory(uint16_t addr, uint8_t value)
+{
+  worker_memory[addr] = value;
+}
+
+static uint8_t feed_input(uint8_t port)
+{
+  (void)port;
+  return worker_input;
+}
+
+static uint8_t ignore_output(uint8_t port, uint8_t value)
+{
+  (void)port;
+  (void)value;
+  return 0;
+}
+
+static void *allocate(explorer_worker *w, size_t size)
+{
+  size = (size + 15) & ~(size_t)15;
+
+  if (w->blocks == NULL || w->blocks->used + size > BLOCK_SIZE)
+  {
+    explorer_block *block = malloc(sizeof(explorer_block) + BLOCK_SIZE);
+
+    if (block == NULL)
+    {
+      return NULL;
+    }
+    block->next = w->blocks;
+    block->used = 0;
+    w->blocks = block;
+  }
+
+  void *data = w->blocks->data + w->blocks->used;
+  w->blocks->used += size;
+  return data;
+}
+
+// Adds a hash to the visited set. Returns 1 if it was there, 0 if not and -1 if the set is full
+static int visit(explorer *e, uint64_t hash)
+{
+  size_t mask = e->visited_capacity - 1;
+  size_t slot = hash & mask;
+
+  if (hash == 0)
+  {
+    hash = 1;
+  }
+  if (atomic_load_explicit(&e->states, memory_order_relaxed) * 2 >= e->visited_capacity)
+  {
+    atomic_store(&e->full, true);
+    return -1;
+  }
+
+  for (;;)
+  {
+    uint64_t current = atomic_load_explicit(&e->visited[slot], memory_order_relaxed);
+
+    if (current == hash)
+    {
+      return 1;
+    }
+    if (current == 0)
+    {
+      if (atomic_compare_exchange_strong(&e->visited[slot], &current, hash))
+      {
+        atomic_fetch_add_explicit(&e->states, 1, memory_order_relaxed);
+        return 0;
+      }
+      // Another thread took the slot, maybe with the same state
+      if (current == hash)
+      {
+        return 1;
+      }
+    }
+    slot = (slot + 1) & mask;
+  }
+}
+
+static void fail(explorer_worker *w)
+{
+  w->failed = true;
+  atomic_store(&w->e->stop, true);
+}
+
+static void load_node(explorer_worker *w, const explorer_node *node)
+{
+  for (int page = 0; page < 256; page++)
+  {
+    if (w->loaded[page] != node->pages[page])
+    {
+      memcpy(w->memory + (page << 8), node->pages[page], 256);
+      w->loaded[page] = node->pages[page];
+    }
+  }
+  i8080_load_state(&w->cpu, &node->state);
+  w->hash.memory = node->memory_hash;
+}
+
+// Keeps the state the branch ran to if it is new
+static void add_child(explorer_worker *w, explorer_node *node, uint8_t port, uint8_t input, enum i8080_exit reason)
+{
+  explorer *e = w->e;
+  i8080 *p = &w->cpu;
+
+  if (visit(e, state_hash_value(&w->hash, p)) != 0)
+  {
+    return;
+  }
+
+  explorer_node *child = allocate(w, sizeof(explorer_node));
+
+  if (child == NULL)
+  {
+    fail(w);
+    return;
+  }
+
+  i8080_save_state(p, &child->state);
+  child->memory_hash = w->hash.memory;
+  memcpy(child->pages, node->pages, sizeof(child->pages));
+  child->parent = node;
+  child->port = port;
+  child->input = input;
+  child->depth = node->reason == I8080_EXIT_NONE ? 0 : node->depth + 1;
+  child->reason = reason;
+
+  for (int i = 0; i < w->snap->saved_count; i++)
+  {
+    uint8_t page = w->snap->saved[i];
+    uint8_t *copy = allocate(w, 256);
+
+    if (copy == NULL)
+    {
+      fail(w);
+      return;
+    }
+    memcpy(copy, w->memory + (page << 8), 256);
+    child->pages[page] = copy;
+  }
+
+  if (e->goal != NULL && e->goal(p, e->context))
+  {
+    explorer_node *none = NULL;
+
+    atomic_compare_exchange_strong(&e->found, &none, child);
+    atomic_store(&e->stop, true);
+    return;
+  }
+
+  if (reason != I8080_EXIT_IO_TRAP || child->depth >= e->max_depth)
+  {
+    return;
+  }
+
+  if (w->children_count == w->children_capacity)
+  {
+    size_t capacity = w->children_capacity ? w->children_capacity * 2 : 256;
+    explorer_node **children = realloc(w->children, capacity * sizeof(explorer_node *));
+
+    if (children == NULL)
+    {
+      fail(w);
+      return;
+    }
+    w->children = children;
+    w->children_capacity = capacity;
+  }
+  w->children[w->children_count++] = child;
+}
+
+static void expand(explorer_worker *w, explorer_node *node)
+{
+  explorer *e = w->e;
+  i8080 *p = &w->cpu;
+
+  load_node(w, node);
+  snapshot_take(w->snap, p);
+
+  if (node->reason == I8080_EXIT_NONE)
+  {
+    // The starting state runs to its first IN without any input
+    add_child(w, node, 0, 0, i8080_run(p, e->budget));
+  }
+  else
+  {
+    uint8_t port = w->memory[(uint16_t)(node->state.pc + 1)];
+
+    for (int i = 0; i < e->inputs_count && !atomic_load_explicit(&e->stop, memory_order_relaxed); i++)
+    {
+      worker_input = e->inputs[i];
+      p->port_in = &feed_input;
+      i8080_step(p);
+      p->port_in = NULL;
+
+      add_child(w, node, port, e->inputs[i], i8080_run(p, e->budget));
+      snapshot_restore(w->snap, p);
+    }
+  }
+
+  snapshot_restore(w->snap, p);
+  snapshot_release(w->snap, p);
+}
+
+static int worker_loop(void *arg)
+{
+  explorer_worker *w = arg;
+  explorer *e = w->e;
+
+  worker_memory = w->memory;
+
+  for (;;)
+  {
+    mtx_lock(&e->lock);
+    while (e->generation == w->generation && !e->quit)
+    {
+      cnd_wait(&e->start, &e->lock);
+    }
+    if (e->quit)
+    {
+      mtx_unlock(&e->lock);
+      return 0;
+    }
+    w->generation = e->generation;
+    mtx_unlock(&e->lock);
+
+    size_t i;
+    while (!atomic_load_explicit(&e->stop, memory_order_relaxed) &&
+           (i = atomic_fetch_add(&e->next, 1)) < e->frontier_count)
+    {
+      expand(w, e->frontier[i]);
+    }
+
+    mtx_lock(&e->lock);
+    if (--e->active == 0)
+    {
+      cnd_signal(&e->done);
+    }
+    mtx_unlock(&e->lock);
+  }
+}
+
+int explorer_init(explorer *e, const uint8_t *inputs, int inputs_count, size_t max_states, int threads)
+{
+  memset(e, 0, sizeof(explorer));
+  e->inputs = inputs;
+  e->inputs_count = inputs_count;
+  e->threads = threads;
+
+  e->visited_capacity = 16;
+  while (e->visited_capacity < max_states * 2)
+  {
+    e->visited_capacity *= 2;
+  }
+  e->visited = calloc(e->visited_capacity, sizeof(uint64_t));
+  e->workers = calloc(threads, sizeof(explorer_worker));
+  if (e->visited == NULL || e->workers == NULL)
+  {
+    explorer_free(e);
+    return -1;
+  }
+
+  if (mtx_init(&e->lock, mtx_plain) != thrd_success)
+  {
+    explorer_free(e);
+    return -1;
+  }
+  cnd_init(&e->start);
+  cnd_init(&e->done);
+  e->started = true;
+
+  for (int i = 0; i < threads; i++)
+  {
+    explorer_worker *w = &e->workers[i];
+
+    w->e = e;
+    w->memory = calloc(0x10000, 1);
+    w->snap = malloc(sizeof(snapshot));
+    if (w->memory == NULL || w->snap == NULL)
+    {
+      explorer_free(e);
+      return -1;
+    }
+
+    i8080_init(&w->cpu);
+    w->cpu.read_byte = &read_memory;
+    w->cpu.write_byte = &write_memory;
+    w->cpu.port_out = &ignore_output;
+
+    // The memory hash is set from each node loaded
+    w->cpu.state_hash = &w->hash;
+
+    if (thrd_create(&w->thread, worker_loop, w) != thrd_success)
+    {
+      explorer_free(e);
+      return -1;
+    }
+    w->running = true;
+  }
+
+  return 0;
+}
+
+// Runs one level of the search on all the threads
+static void run_level(explorer *e)
+{
+  atomic_store(&e->next, 0);
+
+  mtx_lock(&e->lock);
+  e->active = e->threads;
+  e->generation++;
+  cnd_broadcast(&e->start);
+  while (e->active > 0)
+  {
+    cnd_wait(&e->done, &e->lock);
+  }
+  mtx_unlock(&e->lock);
+}
+
+int explorer_run(explorer *e, i8080 *p, uint64_t budget, uint32_t max_depth)
+{
+  explorer_worker *first = &e->workers[0];
+  explorer_node *root = allocate(first, sizeof(explorer_node));
+
+  e->budget = budget;
+  e->max_depth = max_depth;
+  memset(e->visited, 0, e->visited_capacity * sizeof(uint64_t));
+  atomic_store(&e->states, 0);
+  atomic_store(&e->full, false);
+  atomic_store(&e->stop, false);
+  atomic_store(&e->found, NULL);
+
+  if (root == NULL)
+  {
+    return -1;
+  }
+
+  // The starting memory, and its hash, go to the root node
+  memset(root, 0, sizeof(explorer_node));
+  i8080_save_state(p, &root->state);
+  root->reason = I8080_EXIT_NONE;
+  for (int page = 0; page < 256; page++)
+  {
+    uint8_t *data = allocate(first, 256);
+
+    if (data == NULL)
+    {
+      return -1;
+    }
+    for (int offset = 0; offset < 256; offset++)
+    {
+      data[offset] = p->read_byte((page << 8) | offset);
+      root->memory_hash ^= state_hash_mix((uint32_t)(page << 8 | offset) << 8 | data[offset]);
+    }
+    root->pages[page] = data;
+  }
+
+  free(e->frontier);
+  e->frontier = malloc(sizeof(explorer_node *));
+  if (e->frontier == NULL)
+  {
+    return -1;
+  }
+  e->frontier[0] = root;
+  e->frontier_count = 1;
+
+  while (e->frontier_count > 0 && !atomic_load(&e->stop))
+  {
+    run_level(e);
+
+    size_t count = 0;
+    for (int i = 0; i < e->threads; i++)
+    {
+      count += e->workers[i].children_count;
+    }
+
+    explorer_node **frontier = realloc(e->frontier, (count ? count : 1) * sizeof(explorer_node *));
+    if (frontier == NULL)
+    {
+      return -1;
+    }
+    e->frontier = frontier;
+    e->frontier_count = 0;
+    for (int i = 0; i < e->threads; i++)
+    {
+      explorer_worker *w = &e->workers[i];
+
+      if (w->children_count > 0)
+      {
+        memcpy(e->frontier + e->frontier_count, w->children, w->children_count * sizeof(explorer_node *));
+        e->frontier_count += w->children_count;
+      }
+      w->children_count = 0;
+    }
+  }
+
+  for (int i = 0; i < e->threads; i++)
+  {
+    if (e->workers[i].failed)
+    {
+      return -1;
+    }
+  }
+  if (atomic_load(&e->found) != NULL)
+  {
+    return 1;
+  }
+  // States were dropped, so the goal may still be reachable
+  return atomic_load(&e->full) ? 2 : 0;
+}
+
+explorer_node *explorer_found(explorer *e)
+{
+  return atomic_load(&e->found);
+}
+
+int explorer_path(const explorer_node *node, uint8_t *inputs, int max)
+{
+  int count = 0;
+
+  for (const explorer_node *n = node; n != NULL; n = n->parent)
+  {
+    if (n->depth > 0)
+    {
+      count++;
+    }
+  }
+
+  int i = count;
+  for (const explorer_node *n = node; n != NULL; n = n->parent)
+  {
+    if (n->depth > 0 && --i < max)
+    {
+      inputs[i] = n->input;
+    }
+  }
+  return count;
+}
+
+void explorer_free(explorer *e)
+{
+  if (e->started)
+  {
+    mtx_lock(&e->lock);
+    e->quit = true;
+    cnd_broadcast(&e->start);
+    mtx_unlock(&e->lock);
+  }
+
+  for (int i = 0; e->workers != NULL && i < e->threads; i++)
+  {
+    explorer_worker *w = &e->workers[i];
+
+    if (w->running)
+    {
+      thrd_join(w->thread, NULL);
+    }
+    while (w->blocks != NULL)
+    {
+      explorer_block *next = w->blocks->next;
+      free(w->blocks);
+      w->blocks = next;
+    }
+    free(w->children);
+    free(w->memory);
+    free(w->snap);
+  }
+
+  if (e->started)
+  {
+    cnd_destroy(&e->start);
+    cnd_destroy(&e->done);
+    mtx_destroy(&e->lock);
+  }
+
+  free(e->workers);
+  free(e->visited);
+  free(e->frontier);
+  e->workers = NULL;
+  e->visited = NULL;
+  e->frontier = NULL;
+  e->started = false;
+}
@@ -0,0 +1,716 @@
+#include "fusion.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Pages the block idioms can't write directly: something has to see every write to them
+#define BLOCK_WRITE_STOPS                                                                                             \
+  (PAGE_WATCH_WRITE | PAGE_UNTIL_WRITE | PAGE_REWIND | PAGE_SNAPSHOT | PAGE_CHECKPOINT | PAGE_CODE)
+
+static const uint8_t GROUP_BYTES[FUSION_KINDS] = {
+    [FUSION_DCR_JNZ] = 4,
+    [FUSION_LOAD_INX] = 2,
+    [FUSION_LXI_CALL] = 6,
+    [FUSION_CPI_JZ] = 5,
+    [FUSION_CPI_JNZ] = 5,
+    [FUSION_TEST_JNZ] = 5,
+    [FUSION_COPY_BC] = 10,
+    [FUSION_COPY_R] = 8,
+    [FUSION_FILL_BC] = 9,
+    [FUSION_FILL_R] = 7,
+};
+
+static const uint8_t GROUP_INSTRUCTIONS[FUSION_KINDS] = {
+    [FUSION_DCR_JNZ] = 2,
+    [FUSION_LOAD_INX] = 2,
+    [FUSION_LXI_CALL] = 2,
+    [FUSION_CPI_JZ] = 2,
+    [FUSION_CPI_JNZ] = 2,
+    [FUSION_TEST_JNZ] = 3,
+    [FUSION_COPY_BC] = 8,
+    [FUSION_COPY_R] = 6,
+    [FUSION_FILL_BC] = 6,
+    [FUSION_FILL_R] = 4,
+};
+
+/*
+Cycles of the instructions of a group before its last one. The run
+would stop after them with a budget no larger, so the group isn't run
+then. The block idioms fit the budget themselves
+*/
+static const uint8_t GROUP_LEAD_CYCLES[FUSION_KINDS] = {
+    [FUSION_DCR_JNZ] = 5,
+    [FUSION_LOAD_INX] = 7,
+    [FUSION_LXI_CALL] = 10,
+    [FUSION_CPI_JZ] = 7,
+    [FUSION_CPI_JNZ] = 7,
+    [FUSION_TEST_JNZ] = 5 + 4,
+};
+
+void fusion_attach(fusion *f, i8080 *p)
+{
+  memset(f, 0, sizeof(fusion));
+  p->fusion = f;
+}
+
+void fusion_detach(fusion *f, i8080 *p)
+{
+  // The recompiled code still needs to hear of writes to its pages
+  for (int page = 0; page < 256 && p->recompiled == NULL; page++)
+  {
+    p->page_flags[page] &= ~PAGE_CODE;
+  }
+  for (int page = 0; page < 256; page++)
+  {
+    free(f->kinds[page]);
+    f->kinds[page] = NULL;
+  }
+  if (p->fusion == f)
+  {
+    p->fusion = NULL;
+  }
+}
+
+void fusion_map_ram(fusion *f, uint8_t *memory, uint8_t first_page, int pages)
+{
+  f->ram = memory;
+  for (int i = 0; i < pages && first_page + i < 256; i++)
+  {
+    f->ram_pages[first_page + i] = true;
+  }
+}
+
+// Forgets what was classified at an address, if its page has a table
+static void forget(fusion *f, uint16_t addr)
+{
+  if (f->kinds[addr >> 8] != NULL)
+  {
+    f->kinds[addr >> 8][addr & 0xff] = FUSION_UNCLASSIFIED;
+  }
+}
+
+void fusion_flush(fusion *f, i8080 *p)
+{
+  for (int page = 0; page < 256; page++)
+  {
+    if (f->kinds[page] != NULL)
+    {
+      memset(f->kinds[page], FUSION_UNCLASSIFIED, 256);
+    }
+  }
+  memset(f->shared, 0, sizeof(f->shared));
+  for (int page = 0; page < 256 && p->recompiled == NULL; page++)
+  {
+    p->page_flags[page] &= ~PAGE_CODE;
+  }
+}
+
+void fusion_invalidate_page(fusion *f, i8080 *p, uint8_t page)
+{
+  // Groups starting at the end of the page before reach into this one
+  uint16_t start = (page << 8) - (FUSION_MAX_GROUP_BYTES - 1);
+
+  for (int i = 0; i < 256 + FUSION_MAX_GROUP_BYTES - 1; i++)
+  {
+    forget(f, start + i);
+  }
+  f->shared[page] = NULL;
+  p->page_flags[page] &= ~PAGE_CODE;
+  f->invalidations++;
+}
+
+// MOV A,r and ORA r of the registers B to L
+static bool is_mov_a_r(uint8_t opcode)
+{
+  return opcode >= 0x78 && opcode <= 0x7d;
+}
+
+static bool is_ora_r(uint8_t opcode)
+{
+  return opcode >= 0xb0 && opcode <= 0xb5;
+}
+
+// DCR B or DCR C, the counters of the short block loops
+static bool is_dcr_counter(uint8_t opcode)
+{
+  return opcode == 0x05 || opcode == 0x0d;
+}
+
+// The store of a fill loop, MVI M or MOV M of a register the loop leaves alone. Returns its size or 0
+static int fill_store(const uint8_t *bytes, uint8_t counter)
+{
+  uint8_t source = bytes[0] & 7;
+
+  if (bytes[0] == 0x36)
+  {
+    return 2;
+  }
+  if ((bytes[0] & 0xf8) != 0x70 || source == 4 || source == 5 || source == 6)
+  {
+    return 0;
+  }
+  // B, C and A change in the 16-bit count test, the counter in the short one
+  if (counter == 0x0b ? source != 2 && source != 3 : source == ((counter >> 3) & 7))
+  {
+    return 0;
+  }
+  return 1;
+}
+
+// Whether the JNZ at bytes goes back to pc
+static bool jnz_to(const uint8_t *bytes, uint16_t pc)
+{
+  return bytes[0] == 0xc2 && bytes[1] == (pc & 0xff) && bytes[2] == pc >> 8;
+}
+
+static enum fusion_kind classify_block(const uint8_t *bytes, uint16_t pc)
+{
+  static const uint8_t copy[] = {0x7e, 0x12, 0x23, 0x13};
+  static const uint8_t count_test[] = {0x0b, 0x78, 0xb1};
+
+  if (memcmp(bytes, copy, sizeof(copy)) == 0)
+  {
+    if (memcmp(bytes + 4, count_test, sizeof(count_test)) == 0 && jnz_to(bytes + 7, pc))
+    {
+      return FUSION_COPY_BC;
+    }
+    if (is_dcr_counter(bytes[4]) && jnz_to(bytes + 5, pc))
+    {
+      return FUSION_COPY_R;
+    }
+    return FUSION_NONE;
+  }
+
+  int store = fill_store(bytes, 0x0b);
+  if (store > 0 && bytes[store] == 0x23 && memcmp(bytes + store + 1, count_test, sizeof(count_test)) == 0 &&
+      jnz_to(bytes + store + 4, pc))
+  {
+    return FUSION_FILL_BC;
+  }
+
+  uint8_t counter = bytes[0] == 0x36 ? bytes[3] : bytes[2];
+  store = is_dcr_counter(counter) ? fill_store(bytes, counter) : 0;
+  if (store > 0 && bytes[store] == 0x23 && jnz_to(bytes + store + 2, pc))
+  {
+    return FUSION_FILL_R;
+  }
+  return FUSION_NONE;
+}
+
+enum fusion_kind fusion_classify(i8080 *p, uint16_t pc)
+{
+  uint8_t bytes[FUSION_MAX_GROUP_BYTES];
+
+  // Code is read straight from the callback, as no instruction reads it here
+  for (int i = 0; i < FUSION_MAX_GROUP_BYTES; i++)
+  {
+    bytes[i] = p->read_byte((uint16_t)(pc + i));
+  }
+
+  enum fusion_kind block = classify_block(bytes, pc);
+  if (block != FUSION_NONE)
+  {
+    return block;
+  }
+
+  if ((bytes[0] & 0xc7) == 0x05 && bytes[0] != 0x35 && bytes[1] == 0xc2)
+  {
+    return FUSION_DCR_JNZ;
+  }
+  if (bytes[0] == 0x7e && bytes[1] == 0x23)
+  {
+    return FUSION_LOAD_INX;
+  }
+  if ((bytes[0] & 0xcf) == 0x01 && bytes[3] == 0xcd)
+  {
+    return FUSION_LXI_CALL;
+  }
+  if (bytes[0] == 0xfe && bytes[2] == 0xca)
+  {
+    return FUSION_CPI_JZ;
+  }
+  if (bytes[0] == 0xfe && bytes[2] == 0xc2)
+  {
+    return FUSION_CPI_JNZ;
+  }
+  if (is_mov_a_r(bytes[0]) && is_ora_r(bytes[1]) && bytes[2] == 0xc2)
+  {
+    return FUSION_TEST_JNZ;
+  }
+  return FUSION_NONE;
+}
+
+// Whether the group has to be left after the instruction just run. Handlers then return false
+static bool interrupted(const i8080 *p)
+{
+  return p->stop_requested || (p->interrupt_pending && p->interrupts_enabled);
+}
+
+// Registers B, C, D, E, H, L and A by their number in the opcode. M is not one of them
+static uint8_t *reg(i8080 *p, uint8_t number)
+{
+  uint8_t *registers[8] = {&p->b, &p->c, &p->d, &p->e, &p->h, &p->l, NULL, &p->a};
+
+  return registers[number];
+}
+
+static void jump_if(i8080 *p, bool condition)
+{
+  p->cycles += 10;
+  p->pc++;
+  if (condition)
+  {
+    p->pc = read_word(p, p->pc);
+  }
+  else
+  {
+    p->pc += 2;
+  }
+}
+
+static bool dcr_jnz(i8080 *p, uint8_t opcode)
+{
+  uint8_t *r = reg(p, (opcode >> 3) & 7);
+
+  p->cycles += 5;
+  p->pc++;
+  update_acf(p, *r, 1, "sub");
+  (*r)--;
+  update_z_s_p(p, *r);
+
+  jump_if(p, !p->zf);
+  return true;
+}
+
+static bool load_inx(i8080 *p)
+{
+  p->cycles += 7;
+  p->pc++;
+  p->a = read_byte(p, join_hl(p));
+  if (interrupted(p))
+  {
+    return false;
+  }
+
+  uint16_t hl = join_hl(p) + 1;
+
+  p->cycles += 5;
+  p->pc++;
+  p->h = hl >> 8;
+  p->l = hl & 0xff;
+  return true;
+}
+
+static bool lxi_call(i8080 *p, uint8_t opcode)
+{
+  uint8_t low, high;
+
+  p->cycles += 10;
+  p->pc++;
+  low = read_byte(p, p->pc++);
+  high = read_byte(p, p->pc++);
+  if ((opcode & 0x30) == 0x30)
+  {
+    p->sp = join_for_16_bit(high, low);
+  }
+  else
+  {
+    *reg(p, (opcode >> 3) & 6) = high;
+    *reg(p, ((opcode >> 3) & 6) + 1) = low;
+  }
+  if (interrupted(p))
+  {
+    return false;
+  }
+
+  p->cycles += 17;
+  p->pc++;
+  uint16_t addr = read_word(p, p->pc);
+  p->pc += 2;
+  call(p, addr);
+  return true;
+}
+
+static bool cpi_jump(i8080 *p, bool if_zero)
+{
+  p->cycles += 7;
+  p->pc++;
+  sub_byte(p, read_byte(p, p->pc), 0);
+  p->pc++;
+  if (interrupted(p))
+  {
+    return false;
+  }
+
+  jump_if(p, p->zf == if_zero);
+  return true;
+}
+
+static bool test_jnz(i8080 *p, uint8_t opcode)
+{
+  uint8_t ora = p->read_byte((uint16_t)(p->pc + 1));
+
+  p->cycles += 5 + 4;
+  p->pc += 2;
+  p->a = *reg(p, opcode & 7);
+  or_byte(p, *reg(p, ora & 7));
+
+  jump_if(p, !p->zf);
+  return true;
+}
+
+/*
+How many of count iterations, moving a byte from src, if reads, to dst
+in each, can be done directly on the host's RAM: no address wraps and
+no page reached that is not mapped or has something to see the access
+*/
+static uint32_t block_length(fusion *f, i8080 *p, uint16_t src, bool reads, uint16_t dst, uint32_t count)
+{
+  if (f->ram == NULL || p->state_hash != NULL)
+  {
+    return 0;
+  }
+  if (count > 0x10000u - dst)
+  {
+    count = 0x10000u - dst;
+  }
+  if (reads && count > 0x10000u - src)
+  {
+    count = 0x10000u - src;
+  }
+
+  for (uint32_t page = dst >> 8; count > 0 && page <= (dst + count - 1) >> 8; page++)
+  {
+    if (!f->ram_pages[page] || (p->page_flags[page] & BLOCK_WRITE_STOPS))
+    {
+      count = page > (uint32_t)(dst >> 8) ? (page << 8) - dst : 0;
+    }
+  }
+  for (uint32_t page = src >> 8; reads && count > 0 && page <= (src + count - 1) >> 8; page++)
+  {
+    if (!f->ram_pages[page] || (p->page_flags[page] & PAGE_WATCH_READ))
+    {
+      count = page > (uint32_t)(src >> 8) ? (page << 8) - src : 0;
+    }
+  }
+  return count;
+}
+
+// Iterations of cycles each that fit in the budget, the last one allowed to go over as an instruction would
+static uint32_t within_budget(uint32_t count, uint64_t cycles_left, int cycles)
+{
+  uint64_t fit = cycles_left / cycles + (cycles_left % cycles != 0);
+
+  return fit < count ? fit : count;
+}
+
+static uint16_t hl(const i8080 *p)
+{
+  return p->h << 8 | p->l;
+}
+
+static void set_hl(i8080 *p, uint16_t value)
+{
+  p->h = value >> 8;
+  p->l = value & 0xff;
+}
+
+static void set_bc(i8080 *p, uint16_t value)
+{
+  p->b = value >> 8;
+  p->c = value & 0xff;
+}
+
+// Copies forwards a byte at a time, as the loop does, so a destination just after the source repeats it
+static void copy_forwards(uint8_t *ram, uint16_t src, uint16_t dst, uint32_t count)
+{
+  if ((uint16_t)(dst - src) < count)
+  {
+    for (uint32_t i = 0; i < count; i++)
+    {
+      ram[dst + i] = ram[src + i];
+    }
+  }
+  else
+  {
+    memmove(ram + dst, ram + src, count);
+  }
+}
+
+// The end of a loop iteration counted down in DCR r: the flags of the last DCR
+static void count_down(i8080 *p, uint8_t *counter, uint32_t iterations)
+{
+  uint8_t last = *counter - (iterations - 1);
+
+  update_acf(p, last, 1, "sub");
+  *counter = last - 1;
+  update_z_s_p(p, *counter);
+}
+
+// The end of a loop iteration counted down in BC: MOV A,B; ORA C
+static void test_bc(i8080 *p)
+{
+  p->a = p->b;
+  or_byte(p, p->c);
+}
+
+static uint32_t copy_bc(fusion *f, i8080 *p, uint64_t cycles_left)
+{
+  uint16_t bc = join_for_16_bit(p->b, p->c), de = join_for_16_bit(p->d, p->e);
+  uint32_t count = bc == 0 ? 0x10000 : bc;
+
+  count = block_length(f, p, hl(p), true, de, within_budget(count, cycles_left, 48));
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  copy_forwards(f->ram, hl(p), de, count);
+  set_hl(p, hl(p) + count);
+  p->d = (uint16_t)(de + count) >> 8;
+  p->e = (de + count) & 0xff;
+  set_bc(p, bc - count);
+  test_bc(p);
+  p->cycles += 48 * count;
+  p->pc += p->zf ? 10 : 0;
+  return count;
+}
+
+static uint32_t copy_r(fusion *f, i8080 *p, uint64_t cycles_left)
+{
+  uint8_t *counter = reg(p, (p->read_byte((uint16_t)(p->pc + 4)) >> 3) & 7);
+  uint16_t de = join_for_16_bit(p->d, p->e);
+  uint32_t count = *counter == 0 ? 256 : *counter;
+
+  count = block_length(f, p, hl(p), true, de, within_budget(count, cycles_left, 39));
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  copy_forwards(f->ram, hl(p), de, count);
+  p->a = f->ram[de + count - 1];
+  set_hl(p, hl(p) + count);
+  p->d = (uint16_t)(de + count) >> 8;
+  p->e = (de + count) & 0xff;
+  count_down(p, counter, count);
+  p->cycles += 39 * count;
+  p->pc += p->zf ? 8 : 0;
+  return count;
+}
+
+// The value a fill loop stores, its size and its cycles
+static uint8_t fill_value(i8080 *p, int *size, int *cycles)
+{
+  uint8_t opcode = p->read_byte(p->pc);
+
+  if (opcode == 0x36)
+  {
+    *size = 2;
+    *cycles = 10;
+    return p->read_byte((uint16_t)(p->pc + 1));
+  }
+  *size = 1;
+  *cycles = 7;
+  return *reg(p, opcode & 7);
+}
+
+static uint32_t fill_bc(fusion *f, i8080 *p, uint64_t cycles_left)
+{
+  int size, store_cycles;
+  uint8_t value = fill_value(p, &size, &store_cycles);
+  uint16_t bc = join_for_16_bit(p->b, p->c);
+  uint32_t count = bc == 0 ? 0x10000 : bc;
+  int cycles = store_cycles + 5 + 5 + 5 + 4 + 10;
+
+  count = block_length(f, p, 0, false, hl(p), within_budget(count, cycles_left, cycles));
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  memset(f->ram + hl(p), value, count);
+  set_hl(p, hl(p) + count);
+  set_bc(p, bc - count);
+  test_bc(p);
+  p->cycles += (uint64_t)cycles * count;
+  p->pc += p->zf ? size + 7 : 0;
+  return count;
+}
+
+static uint32_t fill_r(fusion *f, i8080 *p, uint64_t cycles_left)
+{
+  int size, store_cycles;
+  uint8_t value = fill_value(p, &size, &store_cycles);
+  uint8_t *counter = reg(p, (p->read_byte((uint16_t)(p->pc + size + 1)) >> 3) & 7);
+  uint32_t count = *counter == 0 ? 256 : *counter;
+  int cycles = store_cycles + 5 + 5 + 10;
+
+  count = block_length(f, p, 0, false, hl(p), within_budget(count, cycles_left, cycles));
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  memset(f->ram + hl(p), value, count);
+  set_hl(p, hl(p) + count);
+  count_down(p, counter, count);
+  p->cycles += (uint64_t)cycles * count;
+  p->pc += p->zf ? size + 5 : 0;
+  return count;
+}
+
+bool fusion_step(fusion *f, i8080 *p, uint64_t cycles_left)
+{
+  uint16_t pc = p->pc;
+  uint8_t kind = fusion_kind_at(f, pc);
+
+  if (kind == FUSION_NONE)
+  {
+    return false;
+  }
+  if (kind == FUSION_UNCLASSIFIED)
+  {
+    uint8_t *own = f->kinds[pc >> 8];
+
+    // Without memory for the table, the group is classified again the next time
+    if (own == NULL && (own = malloc(256)) != NULL)
+    {
+      memset(own, FUSION_UNCLASSIFIED, 256);
+      f->kinds[pc >> 8] = own;
+    }
+    kind = fusion_classify(p, pc);
+    if (own != NULL)
+    {
+      own[pc & 0xff] = kind;
+    }
+    if (kind != FUSION_NONE)
+    {
+      p->page_flags[pc >> 8] |= PAGE_CODE;
+      p->page_flags[(uint16_t)(pc + GROUP_BYTES[kind] - 1) >> 8] |= PAGE_CODE;
+    }
+  }
+
+  // Breakpoints and run_until pc conditions are checked before every instruction of their pages
+  uint16_t flags = p->page_flags[pc >> 8] | p->page_flags[(uint16_t)(pc + FUSION_MAX_GROUP_BYTES - 1) >> 8];
+
+  if (kind == FUSION_NONE || (flags & (PAGE_BREAKPOINT | PAGE_UNTIL_PC)) || observed_per_step(p) || p->halted ||
+      p->interrupt_delay || (p->interrupt_pending && p->interrupts_enabled) || GROUP_LEAD_CYCLES[kind] >= cycles_left)
+  {
+    return false;
+  }
+
+  uint8_t opcode = p->read_byte(pc);
+  uint32_t done = 0;
+  bool whole = false;
+
+  switch (kind)
+  {
+  case FUSION_DCR_JNZ:
+    whole = dcr_jnz(p, opcode);
+    break;
+  case FUSION_LOAD_INX:
+    whole = load_inx(p);
+    break;
+  case FUSION_LXI_CALL:
+    whole = lxi_call(p, opcode);
+    break;
+  case FUSION_CPI_JZ:
+    whole = cpi_jump(p, true);
+    break;
+  case FUSION_CPI_JNZ:
+    whole = cpi_jump(p, false);
+    break;
+  case FUSION_TEST_JNZ:
+    whole = test_jnz(p, opcode);
+    break;
+  case FUSION_COPY_BC:
+    done = copy_bc(f, p, cycles_left);
+    break;
+  case FUSION_COPY_R:
+    done = copy_r(f, p, cycles_left);
+    break;
+  case FUSION_FILL_BC:
+    done = fill_bc(f, p, cycles_left);
+    break;
+  case FUSION_FILL_R:
+    done = fill_r(f, p, cycles_left);
+    break;
+  }
+
+  if (kind >= FUSION_COPY_BC)
+  {
+    // The block stopped at once, the loop runs an instruction at a time
+    f->executed[kind] += done;
+    return done > 0;
+  }
+
+  // Groups left in the middle are not counted
+  if (whole)
+  {
+    f->executed[kind]++;
+  }
+  return true;
+}
+
+int fusion_instructions(enum fusion_kind kind)
+{
+  return (unsigned)kind < FUSION_KINDS ? GROUP_INSTRUCTIONS[kind] : 0;
+}
+
+int fusion_bytes(enum fusion_kind kind)
+{
+  return (unsigned)kind < FUSION_KINDS ? GROUP_BYTES[kind] : 0;
+}
+
+enum fusion_kind fusion_kind_at(const fusion *f, uint16_t pc)
+{
+  const uint8_t *shared = f->shared[pc >> 8];
+  const uint8_t *own = f->kinds[pc >> 8];
+
+  if (shared != NULL && shared[pc & 0xff] != FUSION_UNCLASSIFIED)
+  {
+    return shared[pc & 0xff];
+  }
+  return own != NULL ? own[pc & 0xff] : FUSION_UNCLASSIFIED;
+}
+
+const char *fusion_kind_name(enum fusion_kind kind)
+{
+  static const char *names[FUSION_KINDS] = {
+      "unclassified",
+      "none",
+      "DCR r; JNZ",
+      "MOV A,M; INX H",
+      "LXI rp; CALL",
+      "CPI; JZ",
+      "CPI; JNZ",
+      "MOV A,r; ORA r; JNZ",
+      "block copy, BC",
+      "block copy, DCR",
+      "block fill, BC",
+      "block fill, DCR",
+  };
+
+  if ((unsigned)kind >= FUSION_KINDS)
+  {
+    return "unknown";
+  }
+  return names[kind];
+}
+
+void fusion_report(const fusion *f, FILE *out)
+{
+  uint64_t saved = 0;
+
+  for (int kind = FUSION_DCR_JNZ; kind < FUSION_KINDS; kind++)
+  {
+    if (f->executed[kind] > 0)
+    {
+      fprintf(out, "%-20s %12llu\n", fusion_kind_name(kind), (unsigned long long)f->executed[kind]);
+      saved += f->executed[kind] * (GROUP_INSTRUCTIONS[kind] - 1);
+    }
+  }
+  fprintf(out, "%llu dispatches saved, %llu pages invalidated\n", (unsigned long long)saved,
+          (unsigned long long)f->invalidations);
+}
@@ -0,0 +1,111 @@
+#include "fuzz.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The target being run by this thread
+static _Thread_local fuzz *current;
+
+static uint8_t read_memory(uint16_t addr)
+{
+  return current->memory[addr];
+}
+
+static void write_memory(uint16_t addr, uint8_t value)
+{
+  current->memory[addr] = value;
+}
+
+static uint8_t read_input(uint8_t port)
+{
+  (void)port;
+
+  if (current->input_pos == current->input_size)
+  {
+    i8080_stop(&current->cpu, I8080_EXIT_STOPPED);
+    return 0;
+  }
+  return current->input[current->input_pos++];
+}
+
+static uint8_t ignore_output(uint8_t port, uint8_t value)
+{
+  (void)port;
+  (void)value;
+  return 0;
+}
+
+int fuzz_init(fuzz *f, const uint8_t *rom, size_t rom_size, uint16_t origin, uint64_t budget)
+{
+  memset(f, 0, sizeof(fuzz));
+  f->budget = budget;
+  f->mode = FUZZ_INPUT_PORT;
+
+  f->memory = calloc(0x10000, 1);
+  f->start = malloc(sizeof(snapshot));
+  f->own_edges = calloc(FUZZ_MAP_SIZE, 1);
+  if (f->memory == NULL || f->start == NULL || f->own_edges == NULL || origin + rom_size > 0x10000)
+  {
+    fuzz_free(f);
+    return -1;
+  }
+  memcpy(f->memory + origin, rom, rom_size);
+  f->edges = f->own_edges;
+
+  i8080_init(&f->cpu);
+  f->cpu.read_byte = &read_memory;
+  f->cpu.write_byte = &write_memory;
+  f->cpu.port_in = &read_input;
+  f->cpu.port_out = &ignore_output;
+  f->cpu.pc = origin;
+  f->cpu.fuzz = f;
+
+  snapshot_take(f->start, &f->cpu);
+  return 0;
+}
+
+enum i8080_exit fuzz_run_one(fuzz *f, const uint8_t *data, size_t size)
+{
+  i8080 *p = &f->cpu;
+
+  current = f;
+  snapshot_restore(f->start, p);
+  f->prev = 0;
+
+  if (f->mode == FUZZ_INPUT_MEMORY)
+  {
+    if (size > f->input_max)
+    {
+      size = f->input_max;
+    }
+    // Through the helper, so the snapshot saves the pages first
+    for (size_t i = 0; i < size; i++)
+    {
+      write_byte(p, f->input_addr + i, data[i]);
+    }
+    f->input_size = 0;
+  }
+  else
+  {
+    f->input = data;
+    f->input_size = size;
+  }
+  f->input_pos = 0;
+
+  return i8080_run(p, f->budget);
+}
+
+void fuzz_free(fuzz *f)
+{
+  if (f->start != NULL && f->cpu.snapshot == f->start)
+  {
+    snapshot_release(f->start, &f->cpu);
+  }
+  free(f->memory);
+  free(f->start);
+  free(f->own_edges);
+  f->memory = NULL;
+  f->start = NULL;
+  f->own_edges = NULL;
+  f->edges = NULL;
+}
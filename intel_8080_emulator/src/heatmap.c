@@ -0,0 +1,167 @@
+#include "heatmap.h"
+#include <stdlib.h>
+#include <string.h>
+
+int heatmap_init(heatmap *h, bool per_byte)
+{
+  memset(h, 0, sizeof(heatmap));
+
+  if (per_byte)
+  {
+    h->byte_reads = calloc(0x10000, sizeof(uint64_t));
+    h->byte_writes = calloc(0x10000, sizeof(uint64_t));
+    h->byte_fetches = calloc(0x10000, sizeof(uint64_t));
+
+    if (h->byte_reads == NULL || h->byte_writes == NULL || h->byte_fetches == NULL)
+    {
+      heatmap_free(h);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+void heatmap_free(heatmap *h)
+{
+  free(h->byte_reads);
+  free(h->byte_writes);
+  free(h->byte_fetches);
+  h->byte_reads = NULL;
+  h->byte_writes = NULL;
+  h->byte_fetches = NULL;
+}
+
+void heatmap_reset(heatmap *h)
+{
+  memset(h->reads, 0, sizeof(h->reads));
+  memset(h->writes, 0, sizeof(h->writes));
+  memset(h->fetches, 0, sizeof(h->fetches));
+
+  if (h->byte_reads != NULL)
+  {
+    memset(h->byte_reads, 0, 0x10000 * sizeof(uint64_t));
+    memset(h->byte_writes, 0, 0x10000 * sizeof(uint64_t));
+    memset(h->byte_fetches, 0, 0x10000 * sizeof(uint64_t));
+  }
+}
+
+void heatmap_set_dump(heatmap *h, uint64_t interval, FILE *out, enum heatmap_format format)
+{
+  h->dump_interval = interval;
+  h->next_dump = interval;
+  h->dump_out = out;
+  h->dump_format = format;
+}
+
+void heatmap_dump(heatmap *h, uint64_t cycles)
+{
+  if (h->dump_format == HEATMAP_JSON)
+  {
+    heatmap_write_json(h, cycles, h->dump_out);
+  }
+  else
+  {
+    heatmap_write_csv(h, cycles, h->dump_out);
+  }
+  fflush(h->dump_out);
+
+  while (h->next_dump <= cycles)
+  {
+    h->next_dump += h->dump_interval;
+  }
+}
+
+void heatmap_write_csv(heatmap *h, uint64_t cycles, FILE *out)
+{
+  for (int page = 0; page < 256; page++)
+  {
+    if (h->reads[page] == 0 && h->writes[page] == 0 && h->fetches[page] == 0)
+    {
+      continue;
+    }
+
+    fprintf(out, "%llu,%02x,%llu,%llu,%llu\n", (unsigned long long)cycles, page,
+            (unsigned long long)h->reads[page],
+            (unsigned long long)h->writes[page],
+            (unsigned long long)h->fetches[page]);
+  }
+}
+
+static void write_json_array(FILE *out, const char *name, uint64_t *counts)
+{
+  fprintf(out, "\"%s\":[", name);
+  for (int page = 0; page < 256; page++)
+  {
+    fprintf(out, "%s%llu", page == 0 ? "" : ",", (unsigned long long)counts[page]);
+  }
+  fprintf(out, "]");
+}
+
+void heatmap_write_json(heatmap *h, uint64_t cycles, FILE *out)
+{
+  fprintf(out, "{\"cycles\":%llu,", (unsigned long long)cycles);
+  write_json_array(out, "reads", h->reads);
+  fprintf(out, ",");
+  write_json_array(out, "writes", h->writes);
+  fprintf(out, ",");
+  write_json_array(out, "fetches", h->fetches);
+  fprintf(out, "}\n");
+}
+
+static uint64_t page_count(heatmap *h, enum heatmap_kind kind, int page)
+{
+  switch (kind)
+  {
+  case HEATMAP_READS:
+    return h->reads[page];
+  case HEATMAP_WRITES:
+    return h->writes[page];
+  case HEATMAP_FETCHES:
+    return h->fetches[page];
+  default:
+    return h->reads[page] + h->writes[page] + h->fetches[page];
+  }
+}
+
+// Number of bits needed to hold value
+static int bit_length(uint64_t value)
+{
+  int bits = 0;
+  while (value != 0)
+  {
+    bits++;
+    value >>= 1;
+  }
+  return bits;
+}
+
+void heatmap_write_ascii(heatmap *h, enum heatmap_kind kind, FILE *out)
+{
+  static const char SHADES[] = " .:-=+*#%@";
+  const int shades_count = sizeof(SHADES) - 2;
+  int max_bits = 2;
+
+  for (int page = 0; page < 256; page++)
+  {
+    int bits = bit_length(page_count(h, kind, page));
+    if (bits > max_bits)
+    {
+      max_bits = bits;
+    }
+  }
+
+  fprintf(out, "    0 1 2 3 4 5 6 7 8 9 a b c d e f\n");
+  for (int row = 0; row < 16; row++)
+  {
+    fprintf(out, "%x0 ", row);
+    for (int column = 0; column < 16; column++)
+    {
+      uint64_t count = page_count(h, kind, row * 16 + column);
+      // Untouched pages stay blank; any access shows at least a dot
+      int shade = count == 0 ? 0 : 1 + (bit_length(count) - 1) * (shades_count - 1) / (max_bits - 1);
+      fprintf(out, " %c", SHADES[shade]);
+    }
+    fprintf(out, "\n");
+  }
+}
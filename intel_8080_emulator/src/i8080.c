@@ -1,9 +1,28 @@
 #include "i8080.h"
 #include "instructions.h"
+#include "profiler.h"
+#include "sampler.h"
+#include "latency.h"
+#include "coverage.h"
+#include "heatmap.h"
+#include "debugger.h"
+#include "run_until.h"
+#include "replay.h"
+#include "rewind.h"
+#include "fuzz.h"
+#include "lockstep.h"
+#include "fusion.h"
+#include "recompiler.h"
+#include "tiering.h"
+#include "utils.h"
 #include <stdio.h>
+#include <string.h>
 
 void i8080_init(i8080 *p)
 {
+  p->port_in = NULL;
+  p->port_out = NULL;
+
   p->a = 0;
   p->b = 0;
   p->c = 0;
@@ -24,8 +43,35 @@ void i8080_init(i8080 *p)
   p->acf = 0;
 
   p->halted = 0;
+  p->stop_requested = false;
+  p->exit_reason = I8080_EXIT_NONE;
+  p->exit_pc = 0;
+  p->exit_opcode = 0;
+  memset(p->page_flags, 0, sizeof(p->page_flags));
   p->cycles = 0;
   p->interrupt_pending = false;
+  p->interrupts_enabled = false;
+  p->interrupt_delay = false;
+  p->interrupt_opcode = 0;
+
+  p->profiler = NULL;
+  p->callgraph = NULL;
+  p->sampler = NULL;
+  p->coverage = NULL;
+  p->heatmap = NULL;
+
+  p->debugger = NULL;
+  p->until = NULL;
+  p->replay = NULL;
+  p->rewind = NULL;
+  p->snapshot = NULL;
+  p->checkpoint = NULL;
+  p->state_hash = NULL;
+  p->fuzz = NULL;
+  p->lockstep = NULL;
+  p->fusion = NULL;
+  p->recompiled = NULL;
+  p->tiering = NULL;
 
   // for (;;)
   // {
@@ -61,7 +107,285 @@ void i8080_init(i8080 *p)
   // }
 }
 
+void i8080_save_state(const i8080 *p, i8080_state *s)
+{
+  s->a = p->a;
+  s->b = p->b;
+  s->c = p->c;
+  s->d = p->d;
+  s->e = p->e;
+  s->h = p->h;
+  s->l = p->l;
+  s->bp = p->bp;
+  s->sp = p->sp;
+  s->pc = p->pc;
+  s->zf = p->zf;
+  s->sf = p->sf;
+  s->pf = p->pf;
+  s->cf = p->cf;
+  s->acf = p->acf;
+  s->halted = p->halted;
+  s->cycles = p->cycles;
+  s->interrupt_pending = p->interrupt_pending;
+  s->interrupts_enabled = p->interrupts_enabled;
+  s->interrupt_delay = p->interrupt_delay;
+  s->interrupt_opcode = p->interrupt_opcode;
+}
+
+void i8080_load_state(i8080 *p, const i8080_state *s)
+{
+  p->a = s->a;
+  p->b = s->b;
+  p->c = s->c;
+  p->d = s->d;
+  p->e = s->e;
+  p->h = s->h;
+  p->l = s->l;
+  p->bp = s->bp;
+  p->sp = s->sp;
+  p->pc = s->pc;
+  p->zf = s->zf;
+  p->sf = s->sf;
+  p->pf = s->pf;
+  p->cf = s->cf;
+  p->acf = s->acf;
+  p->halted = s->halted;
+  p->cycles = s->cycles;
+  p->interrupt_pending = s->interrupt_pending;
+  p->interrupts_enabled = s->interrupts_enabled;
+  p->interrupt_delay = s->interrupt_delay;
+  p->interrupt_opcode = s->interrupt_opcode;
+}
+
+int i8080_interrupt(i8080 *p, uint8_t opcode)
+{
+  // Only RST instructions can be put on the bus
+  if ((opcode & 0xc7) != 0xc7)
+  {
+    return -1;
+  }
+  if (p->replay != NULL && p->replay->mode == REPLAY_PLAY)
+  {
+    return 0;
+  }
+
+  p->interrupt_pending = true;
+  p->interrupt_opcode = opcode;
+  return 0;
+}
+
+// Whether an interrupt will be taken before the next instruction
+static inline bool interrupt_due(const i8080 *p)
+{
+  if (p->replay != NULL && p->replay->mode == REPLAY_PLAY)
+  {
+    return replay_interrupt_due(p->replay, p);
+  }
+  return p->interrupt_pending && p->interrupts_enabled && !p->interrupt_delay;
+}
+
+static void take_interrupt(i8080 *p)
+{
+  uint8_t opcode;
+
+  if (p->replay != NULL && p->replay->mode == REPLAY_PLAY)
+  {
+    opcode = replay_take_interrupt(p->replay);
+    p->interrupt_pending = false;
+  }
+  else
+  {
+    opcode = p->interrupt_opcode;
+    p->interrupt_pending = false;
+    if (p->replay != NULL)
+    {
+      replay_record_interrupt(p->replay, p, opcode);
+    }
+  }
+
+  p->interrupts_enabled = false;
+  p->halted = false;
+  p->cycles += 11;
+  call(p, opcode & 0x38);
+}
+
 void i8080_step(i8080 *p)
 {
-  process_instruction(p);
+  // A run stops on the first reason, so one left here is from an earlier run
+  p->exit_reason = I8080_EXIT_NONE;
+
+  if (p->lockstep != NULL)
+  {
+    lockstep_begin(p->lockstep, p);
+  }
+
+  if ((p->interrupt_pending || p->replay != NULL) && interrupt_due(p))
+  {
+    take_interrupt(p);
+  }
+  // Only the instruction right after EI runs before an interrupt can be taken
+  p->interrupt_delay = false;
+
+  if (p->sampler != NULL)
+  {
+    sampler_publish(p->sampler, p);
+  }
+
+  uint16_t pc = p->pc;
+  uint64_t cycles = p->cycles;
+
+  LATENCY_BEGIN();
+  uint8_t opcode = process_instruction(p);
+  LATENCY_END(latency_opcodes[opcode]);
+
+  if (p->lockstep != NULL)
+  {
+    lockstep_check(p->lockstep, p, opcode);
+  }
+
+  if (p->exit_reason >= I8080_EXIT_INVALID_OPCODE)
+  {
+    // Undo the trapping instruction so the host can fix things up and resume
+    p->exit_pc = pc;
+    p->exit_opcode = opcode;
+    p->pc = pc;
+    p->cycles = cycles;
+    return;
+  }
+
+  if (p->profiler != NULL)
+  {
+    profiler_record(p->profiler, pc, opcode, p->cycles - cycles);
+  }
+
+  if (p->coverage != NULL)
+  {
+    coverage_record(p->coverage, pc, opcode, p->pc);
+  }
+
+  if (p->fuzz != NULL)
+  {
+    fuzz_record_edge(p->fuzz, opcode, p->pc);
+  }
+
+  if (p->heatmap != NULL)
+  {
+    heatmap_tick(p->heatmap, p);
+  }
+
+  if (p->rewind != NULL)
+  {
+    rewind_tick(p->rewind, p);
+  }
+}
+
+// Checks breakpoints and run_until pc conditions of flagged pages
+static bool stops_at_pc(i8080 *p)
+{
+  uint16_t flags = p->page_flags[p->pc >> 8];
+
+  if ((flags & PAGE_BREAKPOINT) && debugger_check_breakpoint(p->debugger, p))
+  {
+    i8080_stop(p, I8080_EXIT_BREAKPOINT);
+    return true;
+  }
+  return (flags & PAGE_UNTIL_PC) && run_until_check_pc(p->until, p);
+}
+
+void i8080_stop(i8080 *p, enum i8080_exit reason)
+{
+  if (p->exit_reason == I8080_EXIT_NONE)
+  {
+    p->exit_reason = reason;
+  }
+  p->stop_requested = true;
+}
+
+const char *i8080_exit_name(enum i8080_exit reason)
+{
+  static const char *names[] = {
+      "none",
+      "budget",
+      "halt",
+      "breakpoint",
+      "watchpoint",
+      "until",
+      "stopped",
+      "divergence",
+      "invalid opcode",
+      "unimplemented",
+      "I/O trap",
+      "replay",
+  };
+
+  if ((unsigned)reason >= sizeof(names) / sizeof(names[0]))
+  {
+    return "unknown";
+  }
+  return names[reason];
+}
+
+enum i8080_exit i8080_run(i8080 *p, uint64_t cycles)
+{
+  uint64_t start = p->cycles;
+  bool resuming = true;
+
+  p->stop_requested = false;
+  p->exit_reason = I8080_EXIT_NONE;
+
+  if (p->halted && !interrupt_due(p))
+  {
+    i8080_stop(p, I8080_EXIT_HALT);
+  }
+
+  while (!p->stop_requested)
+  {
+    if (p->cycles - start >= cycles)
+    {
+      i8080_stop(p, I8080_EXIT_BUDGET);
+      break;
+    }
+    if (!resuming && (p->page_flags[p->pc >> 8] & (PAGE_BREAKPOINT | PAGE_UNTIL_PC)) && stops_at_pc(p))
+    {
+      break;
+    }
+    resuming = false;
+
+    uint64_t cycles_left = cycles - (p->cycles - start);
+    bool ran;
+
+    if (p->tiering != NULL)
+    {
+      ran = tiering_step(p->tiering, p, cycles_left);
+    }
+    else
+    {
+      ran = (p->recompiled != NULL && recompiled_step(p->recompiled, p, cycles_left)) ||
+            (p->fusion != NULL && fusion_step(p->fusion, p, cycles_left));
+    }
+
+    // i8080_step publishes itself, fused groups and recompiled blocks publish where they ended
+    if (!ran)
+    {
+      i8080_step(p);
+    }
+    else if (p->sampler != NULL)
+    {
+      sampler_publish(p->sampler, p);
+    }
+
+    if (p->until != NULL && p->until->per_step)
+    {
+      run_until_check_step(p->until, p);
+    }
+  }
+
+  return p->exit_reason;
+}
+
+enum i8080_exit i8080_run_frame(i8080 *p, uint64_t frame_cycles)
+{
+  uint64_t end = (p->cycles / frame_cycles + 1) * frame_cycles;
+
+  return i8080_run(p, end - p->cycles);
 }
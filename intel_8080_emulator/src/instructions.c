@@ -3,28 +3,57 @@
 #include "utils.h"
 #include <stdlib.h>
 
-void process_instruction(i8080 *p)
+// Base cycle count of every opcode. Conditional calls and returns add
+// CONDITIONAL_EXTRA_CYCLES when the condition holds
+static const uint8_t OPCODES_CYCLES[256] = {
+    // 0   1   2   3   4   5   6   7   8   9   a   b   c   d   e   f
+     4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4, // 0
+     4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4, // 1
+     4, 10, 16,  5,  5,  5,  7,  4,  4, 10, 16,  5,  5,  5,  7,  4, // 2
+     4, 10, 13,  5, 10, 10, 10,  4,  4, 10, 13,  5,  5,  5,  7,  4, // 3
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 4
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 5
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 6
+     7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5, // 7
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 8
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 9
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // a
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // b
+     5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11, // c
+     5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11, // d
+     5, 10, 10, 18, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11, // e
+     5, 10, 10,  4, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11  // f
+};
+
+uint8_t instruction_cycles(uint8_t opcode)
+{
+  return OPCODES_CYCLES[opcode];
+}
+
+uint8_t process_instruction(i8080 *p)
 {
-  uint8_t opcode = p->read_byte(p->pc++);
+  uint8_t opcode = read_opcode(p, p->pc++);
   uint16_t tmp_16;
   uint8_t tmp_8;
 
+  p->cycles += OPCODES_CYCLES[opcode];
+
   switch (opcode)
   {
   case 0x00: // NOP
     break;
   case 0x01: // LXI B,D16
-    p->c = p->read_byte(p->pc);
-    p->b = p->read_byte(++p->pc);
+    p->c = read_byte(p, p->pc++);
+    p->b = read_byte(p, p->pc++);
     break;
   case 0x02: // STAX B
-    p->write_byte(join_for_16_bit(p->b, p->c), p->a);
+    write_byte(p, join_for_16_bit(p->b, p->c), p->a);
     break;
   case 0x03: // INX B
     tmp_16 = join_for_16_bit(p->b, p->c);
     tmp_16++;
-    p->b = (uint8_t)tmp_16 >> 8;
-    p->c = (uint8_t)tmp_16 & 0xff;
+    p->b = (uint8_t)(tmp_16 >> 8);
+    p->c = (uint8_t)(tmp_16 & 0xff);
     break;
   case 0x04: // INR B
     update_acf(p, p->b, 1, "add");
@@ -37,7 +66,7 @@ void process_instruction(i8080 *p)
     update_z_s_p(p, p->b);
     break;
   case 0x06: // MVI B, D8
-    p->b = p->read_byte(p->pc++);
+    p->b = read_byte(p, p->pc++);
     break;
   case 0x07: // RLC
     tmp_8 = p->a;
@@ -46,24 +75,22 @@ void process_instruction(i8080 *p)
     break;
   case 0x08: // Undocumented
     break;
-  case 0x09:
+  case 0x09: // DAD B
   {
-    uint16_t hl = join_for_16_bit(p->h, p->l);
-    uint16_t bc = join_for_16_bit(p->b, p->c);
-    tmp_16 = hl + bc;
-    p->h = (uint8_t)tmp_16 >> 8;
-    p->l = (uint8_t)tmp_16 & 0xff;
-    update_cf(p, hl, bc);
+    uint32_t sum = join_for_16_bit(p->h, p->l) + join_for_16_bit(p->b, p->c);
+    p->h = (uint8_t)(sum >> 8);
+    p->l = (uint8_t)(sum & 0xff);
+    p->cf = sum >> 16;
     break;
   }
   case 0x0a: // LDAX B
-    p->b = p->read_byte(join_for_16_bit(p->b, p->c));
+    p->a = read_byte(p, join_for_16_bit(p->b, p->c));
     break;
-  case 0x0b: // DCR B
+  case 0x0b: // DCX B
     tmp_16 = join_for_16_bit(p->b, p->c);
     tmp_16--;
-    p->b = (uint8_t)tmp_16 >> 8;
-    p->c = (uint8_t)tmp_16 & 0xff;
+    p->b = (uint8_t)(tmp_16 >> 8);
+    p->c = (uint8_t)(tmp_16 & 0xff);
     break;
   case 0x0c: // INR C
     update_acf(p, p->c, 1, "add");
@@ -76,7 +103,7 @@ void process_instruction(i8080 *p)
     update_z_s_p(p, p->c);
     break;
   case 0x0e: // MVI C, D8
-    p->c = p->read_byte(p->pc++);
+    p->c = read_byte(p, p->pc++);
     break;
   case 0x0f: // RRC
     tmp_8 = p->a;
@@ -86,17 +113,17 @@ void process_instruction(i8080 *p)
   case 0x10: // Undocumented
     break;
   case 0x11: // LXI D,D16
-    p->e = p->read_byte(p->pc);
-    p->d = p->read_byte(++p->pc);
+    p->e = read_byte(p, p->pc++);
+    p->d = read_byte(p, p->pc++);
     break;
   case 0x12: // STAX D
-    p->write_byte(join_for_16_bit(p->d, p->e), p->a);
+    write_byte(p, join_for_16_bit(p->d, p->e), p->a);
     break;
   case 0x13: // INX D
     tmp_16 = join_for_16_bit(p->d, p->e);
     tmp_16++;
-    p->d = (uint8_t)tmp_16 >> 8;
-    p->e = (uint8_t)tmp_16 & 0xff;
+    p->d = (uint8_t)(tmp_16 >> 8);
+    p->e = (uint8_t)(tmp_16 & 0xff);
     break;
   case 0x14: // INR D
     update_acf(p, p->d, 1, "add");
@@ -109,7 +136,7 @@ void process_instruction(i8080 *p)
     update_z_s_p(p, p->d);
     break;
   case 0x16: // MVI D, D8
-    p->d = p->read_byte(p->pc++);
+    p->d = read_byte(p, p->pc++);
     break;
   case 0x17: // RAL
     tmp_8 = p->a;
@@ -120,12 +147,10 @@ void process_instruction(i8080 *p)
     break;
   case 0x19: // DAD D
   {
-    tmp_16 = join_for_16_bit(p->h, p->l) + join_for_16_bit(p->d, p->e);
-    p->h = (uint8_t)tmp_16 >> 8;
-    p->l = (uint8_t)tmp_16 & 0xff;
-    // update carry flag
-    uint32_t sum = tmp_16 + p->cf;
-    p->cf = (sum >> 16);
+    uint32_t sum = join_for_16_bit(p->h, p->l) + join_for_16_bit(p->d, p->e);
+    p->h = (uint8_t)(sum >> 8);
+    p->l = (uint8_t)(sum & 0xff);
+    p->cf = sum >> 16;
     break;
   }
   case 0x1a: // LDAX D
@@ -134,8 +159,8 @@ void process_instruction(i8080 *p)
   case 0x1b: // DCX D
     tmp_16 = join_for_16_bit(p->d, p->e);
     tmp_16--;
-    p->d = (uint8_t)tmp_16 >> 8;
-    p->e = (uint8_t)tmp_16 & 0xff;
+    p->d = (uint8_t)(tmp_16 >> 8);
+    p->e = (uint8_t)(tmp_16 & 0xff);
     break;
   case 0x1c: // INR E
     update_acf(p, p->e, 1, "add");
@@ -148,32 +173,32 @@ void process_instruction(i8080 *p)
     update_z_s_p(p, p->e);
     break;
   case 0x1e: // MVI E, D8
-    p->e = p->read_byte(p->pc++);
+    p->e = read_byte(p, p->pc++);
     break;
   case 0x1f: // RAR
     tmp_8 = p->a;
-    p->a = (p->a >> 1) | (tmp_8 & 0b10000000);
+    p->a = (p->a >> 1) | (p->cf << 7);
     p->cf = tmp_8 & 1;
     break;
   case 0x20:
     break;
   case 0x21: // LXI H,D16
-    p->l = p->read_byte(p->pc);
-    p->h = p->read_byte(++p->pc);
+    p->l = read_byte(p, p->pc++);
+    p->h = read_byte(p, p->pc++);
     break;
   case 0x22: // SHLD  addr
   {
     uint16_t addr = read_word(p, p->pc);
     p->pc += 2;
-    p->write_byte(addr, p->l);
-    p->write_byte(addr + 1, p->h);
+    write_byte(p, addr, p->l);
+    write_byte(p, addr + 1, p->h);
     break;
   }
   case 0x23: // INX H
     tmp_16 = join_for_16_bit(p->h, p->l);
     tmp_16++;
-    p->h = (uint8_t)tmp_16 >> 8;
-    p->l = (uint8_t)tmp_16 & 0xff;
+    p->h = (uint8_t)(tmp_16 >> 8);
+    p->l = (uint8_t)(tmp_16 & 0xff);
     break;
   case 0x24: // INR H
     update_acf(p, p->h, 1, "add");
@@ -186,49 +211,43 @@ void process_instruction(i8080 *p)
     update_z_s_p(p, p->h);
     break;
   case 0x26: // MVI H, D8
-    p->h = p->read_byte(p->pc++);
+    p->h = read_byte(p, p->pc++);
     break;
-  case 0x27: // DAA (especial). Not sure what to implement here yet
-    if (((p->a & 0x0F) > 9) || (p->acf))
-    {
-      p->a += 0x06;
-      p->acf = 1;
-    }
-    else
-    {
-      p->acf = 0;
-    }
+  case 0x27: // DAA
+  {
+    // Adds 6 to each digit out of BCD range. The carry is only ever set
+    uint8_t correction = 0;
+    bool carry = p->cf;
 
-    if ((p->a > 0x9F) || (p->cf))
+    if ((p->a & 0x0f) > 9 || p->acf)
     {
-      p->a += 0x60;
-      p->cf = 1;
+      correction |= 0x06;
     }
-    else
+    if (p->a > 0x99 || p->cf)
     {
-      p->cf = 0;
+      correction |= 0x60;
+      carry = true;
     }
-
-    update_zf_sf(p);
+    add_byte(p, correction, 0);
+    p->cf = carry;
     break;
+  }
   case 0x28: // Undocumented
     break;
   case 0x29: // DAD H
   {
-    tmp_16 = join_for_16_bit(p->h, p->l) + join_for_16_bit(p->h, p->l);
-    p->h = (uint8_t)tmp_16 >> 8;
-    p->l = (uint8_t)tmp_16 & 0xff;
-    // update carry flag
-    uint32_t sum = tmp_16 + p->cf;
-    p->cf = (sum >> 16);
+    uint32_t sum = join_for_16_bit(p->h, p->l) + join_for_16_bit(p->h, p->l);
+    p->h = (uint8_t)(sum >> 8);
+    p->l = (uint8_t)(sum & 0xff);
+    p->cf = sum >> 16;
     break;
   }
   case 0x2a: // LHLD D
   {
-    int16_t addr = read_word(p, p->pc);
+    uint16_t addr = read_word(p, p->pc);
     p->pc += 2;
-    p->l = p->read_byte(addr);
-    p->h = p->read_byte(addr + 1);
+    p->l = read_byte(p, addr);
+    p->h = read_byte(p, addr + 1);
     break;
   }
   case 0x2b: // DCX H
@@ -248,17 +267,17 @@ void process_instruction(i8080 *p)
     update_z_s_p(p, p->l);
     break;
   case 0x2e: // MVI L, D8
-    p->l = p->read_byte(p->pc++);
+    p->l = read_byte(p, p->pc++);
     break;
   case 0x2f: // CMA
-    p->a = !p->a;
+    p->a = ~p->a;
     break;
   case 0x30: // Undocumented
     break;
   case 0x31: // LXI SP,D16
   {
-    uint8_t low = p->read_byte(p->pc);
-    uint8_t high = p->read_byte(++p->pc);
+    uint8_t low = read_byte(p, p->pc++);
+    uint8_t high = read_byte(p, p->pc++);
     p->sp = (high << 8) | low;
     break;
   }
@@ -266,7 +285,7 @@ void process_instruction(i8080 *p)
   {
     uint16_t addr = read_word(p, p->pc);
     p->pc += 2;
-    p->write_byte(addr, p->a);
+    write_byte(p, addr, p->a);
     break;
   }
   case 0x33: // INX SP
@@ -276,20 +295,24 @@ void process_instruction(i8080 *p)
   {
     tmp_16 = join_hl(p);
     uint8_t val = read_byte(p, tmp_16);
+    update_acf(p, val, 1, "add");
     val++;
     write_byte(p, tmp_16, val);
     update_z_s_p(p, val);
     break;
   }
   case 0x35: // DCR M
+  {
     tmp_16 = join_hl(p);
     uint8_t val = read_byte(p, tmp_16);
+    update_acf(p, val, 1, "sub");
     val--;
     write_byte(p, tmp_16, val);
     update_z_s_p(p, val);
     break;
+  }
   case 0x36: // MVI M, D8
-    write_byte(p, join_hl(p), p->read_byte(p->pc++));
+    write_byte(p, join_hl(p), read_byte(p, p->pc++));
     break;
   case 0x37: // STC
     p->cf = 1;
@@ -298,19 +321,17 @@ void process_instruction(i8080 *p)
     break;
   case 0x39: // DAD SP
   {
-    tmp_16 = join_for_16_bit(p->h, p->l) + p->sp;
-    p->h = (uint8_t)(tmp_16 >> 8);
-    p->l = (uint8_t)(tmp_16 & 0xff);
-    // update carry flag
-    uint32_t sum = tmp_16 + p->cf;
+    uint32_t sum = join_for_16_bit(p->h, p->l) + p->sp;
+    p->h = (uint8_t)(sum >> 8);
+    p->l = (uint8_t)(sum & 0xff);
     p->cf = sum >> 16;
     break;
   }
   case 0x3a: // LDA addr
   {
-    int16_t addr = read_word(p, p->pc);
+    uint16_t addr = read_word(p, p->pc);
     p->pc += 2;
-    p->a = p->read_byte(addr);
+    p->a = read_byte(p, addr);
     break;
   }
   case 0x3b: // DCX SP
@@ -327,7 +348,7 @@ void process_instruction(i8080 *p)
     update_z_s_p(p, p->a);
     break;
   case 0x3e: // MVI A, D8
-    p->a = p->read_byte(p->pc++);
+    p->a = read_byte(p, p->pc++);
     break;
   case 0x3f: // CMC
     p->cf = !p->cf;
@@ -495,7 +516,8 @@ void process_instruction(i8080 *p)
     write_byte(p, join_hl(p), p->l);
     break;
   case 0x76: // HLT
-             // IMPLEMENTATION PENDING
+    p->halted = true;
+    i8080_stop(p, I8080_EXIT_HALT);
     break;
   case 0x77: // MOV M,A
     write_byte(p, join_hl(p), p->a);
@@ -719,6 +741,7 @@ void process_instruction(i8080 *p)
   case 0xc0: // RNZ
     if (!p->zf)
     {
+      p->cycles += CONDITIONAL_EXTRA_CYCLES;
       ret(p);
     }
     break;
@@ -747,6 +770,7 @@ void process_instruction(i8080 *p)
     {
       uint16_t addr = read_word(p, p->pc);
       p->pc += 2;
+      p->cycles += CONDITIONAL_EXTRA_CYCLES;
       call(p, addr);
     }
     else
@@ -767,6 +791,7 @@ void process_instruction(i8080 *p)
   case 0xc8: // RZ
     if (p->zf)
     {
+      p->cycles += CONDITIONAL_EXTRA_CYCLES;
       ret(p);
     }
     break;
@@ -778,15 +803,20 @@ void process_instruction(i8080 *p)
     {
       p->pc = read_word(p, p->pc);
     }
-    p->pc += 2;
+    else
+    {
+      p->pc += 2;
+    }
     break;
-  case 0xcb: // Undocumented
+  case 0xcb: // Undocumented JMP adr
+    p->pc = read_word(p, p->pc);
     break;
   case 0xcc: // CZ adr
     if (p->zf)
     {
       uint16_t addr = read_word(p, p->pc);
       p->pc += 2;
+      p->cycles += CONDITIONAL_EXTRA_CYCLES;
       call(p, addr);
     }
     else
@@ -811,6 +841,7 @@ void process_instruction(i8080 *p)
   case 0xd0: // RNC
     if (!p->cf)
     {
+      p->cycles += CONDITIONAL_EXTRA_CYCLES;
       ret(p);
     }
     break;
@@ -833,14 +864,15 @@ void process_instruction(i8080 *p)
       p->pc += 2;
     }
     break;
-  case 0xd3: // OUT D8 (Especial)
-    non_implem_error(opcode);
+  case 0xd3: // OUT D8
+    port_out(p, read_byte(p, p->pc++), p->a);
     break;
   case 0xd4: // CNC addr
     if (!p->cf)
     {
       uint16_t addr = read_word(p, p->pc);
       p->pc += 2;
+      p->cycles += CONDITIONAL_EXTRA_CYCLES;
       call(p, addr);
     }
     else
@@ -861,10 +893,12 @@ void process_instruction(i8080 *p)
   case 0xd8: // RC
     if (p->cf)
     {
+      p->cycles += CONDITIONAL_EXTRA_CYCLES;
       ret(p);
     }
     break;
-  case 0xd9: // Undocumented
+  case 0xd9: // Undocumented RET
+    ret(p);
     break;
   case 0xda: // JC addr
     if (p->cf)
@@ -877,14 +911,15 @@ void process_instruction(i8080 *p)
       p->pc += 2;
     }
     break;
-  case 0xdb: // IN D8 (Especial)
-    non_implem_error(opcode);
+  case 0xdb: // IN D8
+    p->a = port_in(p, read_byte(p, p->pc++));
     break;
   case 0xdc: // CC addr
     if (p->cf)
     {
       uint16_t addr = read_word(p, p->pc);
       p->pc += 2;
+      p->cycles += CONDITIONAL_EXTRA_CYCLES;
       call(p, addr);
     }
     else
@@ -892,8 +927,13 @@ void process_instruction(i8080 *p)
       p->pc += 2;
     }
     break;
-  case 0xdd: // Undocumented
+  case 0xdd: // Undocumented CALL addr
+  {
+    uint16_t addr = read_word(p, p->pc);
+    p->pc += 2;
+    call(p, addr);
     break;
+  }
   case 0xde: // SBI D8
     p->a = sub_byte(p, read_byte(p, p->pc), p->cf);
     p->pc++;
@@ -904,6 +944,7 @@ void process_instruction(i8080 *p)
   case 0xe0: // RPO
     if (!p->pf)
     {
+      p->cycles += CONDITIONAL_EXTRA_CYCLES;
       ret(p);
     }
     break;
@@ -938,6 +979,7 @@ void process_instruction(i8080 *p)
     {
       uint16_t addr = read_word(p, p->pc);
       p->pc += 2;
+      p->cycles += CONDITIONAL_EXTRA_CYCLES;
       call(p, addr);
     }
     else
@@ -950,8 +992,6 @@ void process_instruction(i8080 *p)
     break;
   case 0xe6: // ANI D8
     and_byte(p, read_byte(p, p->pc));
-    p->cf = 0;
-    update_z_s_p(p, p->a);
     p->pc++;
     break;
   case 0xe7: // RST 4
@@ -960,6 +1000,7 @@ void process_instruction(i8080 *p)
   case 0xe8: // RPE
     if (p->pf)
     {
+      p->cycles += CONDITIONAL_EXTRA_CYCLES;
       ret(p);
     }
     break;
@@ -991,6 +1032,7 @@ void process_instruction(i8080 *p)
     {
       uint16_t addr = read_word(p, p->pc);
       p->pc += 2;
+      p->cycles += CONDITIONAL_EXTRA_CYCLES;
       call(p, addr);
     }
     else
@@ -998,20 +1040,24 @@ void process_instruction(i8080 *p)
       p->pc += 2;
     }
     break;
-  case 0xed: // Undocumented
+  case 0xed: // Undocumented CALL addr
+  {
+    uint16_t addr = read_word(p, p->pc);
+    p->pc += 2;
+    call(p, addr);
     break;
+  }
   case 0xee: // XRI D8
     xor_byte(p, read_byte(p, p->pc));
-    p->cf = 0;
-    update_z_s_p(p, p->a);
     p->pc++;
     break;
   case 0xef: // RST 5
     call(p, 0x28);
     break;
   case 0xf0: // RP
-    if (p->sf)
+    if (!p->sf)
     {
+      p->cycles += CONDITIONAL_EXTRA_CYCLES;
       ret(p);
     }
     break;
@@ -1031,15 +1077,27 @@ void process_instruction(i8080 *p)
   case 0xf2: // JP addr
     if (!p->sf)
     {
-      p->pc = read_byte(p, p->pc);
+      p->pc = read_word(p, p->pc);
+    }
+    else
+    {
+      p->pc += 2;
     }
     break;
-  case 0xf3: // Especial
+  case 0xf3: // DI
+    p->interrupts_enabled = false;
     break;
   case 0xf4: // CP addr
-    if (p->sf)
+    if (!p->sf)
     {
-      p->pc = read_byte(p, p->pc);
+      uint16_t addr = read_word(p, p->pc);
+      p->pc += 2;
+      p->cycles += CONDITIONAL_EXTRA_CYCLES;
+      call(p, addr);
+    }
+    else
+    {
+      p->pc += 2;
     }
     break;
   case 0xf5: // PUSH PSW
@@ -1056,16 +1114,15 @@ void process_instruction(i8080 *p)
   }
   case 0xf6: // ORI D8
     or_byte(p, read_byte(p, p->pc));
-    p->cf = 0;
-    update_z_s_p(p, p->a);
     p->pc++;
     break;
   case 0xf7: // RST 6
     call(p, 0x30);
     break;
-  case 0xf8: // RP
+  case 0xf8: // RM
     if (p->sf)
     {
+      p->cycles += CONDITIONAL_EXTRA_CYCLES;
       ret(p);
     }
     break;
@@ -1075,16 +1132,23 @@ void process_instruction(i8080 *p)
   case 0xfa: // JM addr
     if (p->sf)
     {
-      p->pc = read_byte(p, p->pc);
+      p->pc = read_word(p, p->pc);
+    }
+    else
+    {
+      p->pc += 2;
     }
     break;
-  case 0xfb: // Especial
+  case 0xfb: // EI
+    p->interrupts_enabled = true;
+    p->interrupt_delay = true;
     break;
-  case 0xfc:
+  case 0xfc: // CM addr
     if (p->sf)
     {
       uint16_t addr = read_word(p, p->pc);
       p->pc += 2;
+      p->cycles += CONDITIONAL_EXTRA_CYCLES;
       call(p, addr);
     }
     else
@@ -1092,8 +1156,13 @@ void process_instruction(i8080 *p)
       p->pc += 2;
     }
     break;
-  case 0xfd: // Undocumented
+  case 0xfd: // Undocumented CALL addr
+  {
+    uint16_t addr = read_word(p, p->pc);
+    p->pc += 2;
+    call(p, addr);
     break;
+  }
   case 0xfe: // CPI D8
     sub_byte(p, read_byte(p, p->pc), 0);
     p->pc++;
@@ -1102,8 +1171,9 @@ void process_instruction(i8080 *p)
     call(p, 0x38);
     break;
   default:
-    fprintf(stderr, "Unrecognized opcode: %x\n", opcode);
-    exit(-1);
+    i8080_stop(p, I8080_EXIT_INVALID_OPCODE);
     break;
   }
+
+  return opcode;
 }
\ No newline at end of file
@@ -0,0 +1,185 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 199309L
+#endif
+#include "latency.h"
+#include "disassembler.h"
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_TSC 1
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define HAS_TSC 1
+#endif
+
+#ifdef I8080_LATENCY
+static const char *HELPERS_NAMES[LATENCY_HELPERS] = {
+    "read_byte", "read_word", "write_byte", "write_word", "parity", "update_acf",
+    "update_z_s_p", "update_cf", "add_byte", "sub_byte", "and_byte", "xor_byte",
+    "or_byte", "cmp_byte", "stack_push", "stack_pop", "call", "ret",
+};
+
+latency_histogram latency_opcodes[256];
+latency_histogram latency_helpers[LATENCY_HELPERS];
+#endif
+
+#if !defined(HAS_TSC) || defined(I8080_LATENCY)
+static uint64_t monotonic_ns(void)
+{
+  struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+  timespec_get(&ts, TIME_UTC);
+#endif
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+uint64_t latency_now(void)
+{
+#ifdef HAS_TSC
+  return __rdtsc();
+#else
+  return monotonic_ns();
+#endif
+}
+
+// Index of the most significant bit set
+static int msb(uint64_t value)
+{
+#if defined(__GNUC__)
+  return 63 - __builtin_clzll(value);
+#else
+  int bit = 0;
+  while (value >>= 1)
+  {
+    bit++;
+  }
+  return bit;
+#endif
+}
+
+static uint32_t bucket_index(uint64_t value)
+{
+  if (value < LATENCY_SUB_BUCKETS)
+  {
+    return value;
+  }
+
+  int shift = msb(value) - LATENCY_SUB_BUCKET_BITS;
+  return (shift + 1) * LATENCY_SUB_BUCKETS + ((value >> shift) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+static uint64_t bucket_lower_bound(uint32_t index)
+{
+  if (index < LATENCY_SUB_BUCKETS)
+  {
+    return index;
+  }
+
+  int shift = index / LATENCY_SUB_BUCKETS - 1;
+  return (uint64_t)(LATENCY_SUB_BUCKETS + index % LATENCY_SUB_BUCKETS) << shift;
+}
+
+void latency_record(latency_histogram *h, uint64_t ticks)
+{
+  if (h->count == 0 || ticks < h->min)
+  {
+    h->min = ticks;
+  }
+  if (ticks > h->max)
+  {
+    h->max = ticks;
+  }
+  h->count++;
+  h->total += ticks;
+  h->buckets[bucket_index(ticks)]++;
+}
+
+void latency_reset(void)
+{
+#ifdef I8080_LATENCY
+  memset(latency_opcodes, 0, sizeof(latency_opcodes));
+  memset(latency_helpers, 0, sizeof(latency_helpers));
+#endif
+}
+
+uint64_t latency_percentile(latency_histogram *h, double fraction)
+{
+  uint64_t rank = (uint64_t)(fraction * h->count);
+  uint64_t seen = 0;
+
+  for (uint32_t i = 0; i < LATENCY_BUCKETS; i++)
+  {
+    seen += h->buckets[i];
+    if (seen > rank)
+    {
+      uint64_t value = bucket_lower_bound(i);
+      return value > h->max ? h->max : value;
+    }
+  }
+  return h->max;
+}
+
+#ifdef I8080_LATENCY
+// Measures the tick rate against the monotonic clock
+static double ticks_per_ns(void)
+{
+#ifdef HAS_TSC
+  uint64_t start_ns = monotonic_ns();
+  uint64_t start_ticks = latency_now();
+
+  while (monotonic_ns() - start_ns < 10000000)
+  {
+  }
+
+  return (double)(latency_now() - start_ticks) / (monotonic_ns() - start_ns);
+#else
+  return 1.0;
+#endif
+}
+
+static void write_histogram(FILE *out, const char *name, latency_histogram *h, double scale)
+{
+  fprintf(out, "%s,%llu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", name,
+          (unsigned long long)h->count,
+          h->total / scale / h->count,
+          latency_percentile(h, 0.5) / scale,
+          latency_percentile(h, 0.9) / scale,
+          latency_percentile(h, 0.99) / scale,
+          latency_percentile(h, 0.999) / scale,
+          h->max / scale);
+}
+#endif // I8080_LATENCY
+
+void latency_write_report(FILE *out)
+{
+#ifdef I8080_LATENCY
+  double scale = ticks_per_ns();
+  char name[32];
+
+  fprintf(out, "handler,count,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+
+  for (int opcode = 0; opcode < 256; opcode++)
+  {
+    if (latency_opcodes[opcode].count > 0)
+    {
+      snprintf(name, sizeof(name), "%02x %s", opcode, opcode_name(opcode));
+      write_histogram(out, name, &latency_opcodes[opcode], scale);
+    }
+  }
+
+  for (int helper = 0; helper < LATENCY_HELPERS; helper++)
+  {
+    if (latency_helpers[helper].count > 0)
+    {
+      write_histogram(out, HELPERS_NAMES[helper], &latency_helpers[helper], scale);
+    }
+  }
+#else
+  (void)out;
+#endif
+}
@@ -0,0 +1,314 @@
+#include "lockstep.h"
+#include "reference.h"
+#include <string.h>
+
+// The lockstep attached on this thread
+static _Thread_local lockstep *current;
+
+static void trace(lockstep_access *list, int *count, uint16_t addr, uint8_t value, uint8_t old)
+{
+  if (*count < LOCKSTEP_MAX_ACCESSES)
+  {
+    list[*count] = (lockstep_access){addr, value, old};
+  }
+  (*count)++;
+}
+
+static uint8_t traced_read(uint16_t addr)
+{
+  uint8_t value = current->read_byte(addr);
+
+  if (current->tracing)
+  {
+    trace(current->core.reads, &current->core.reads_count, addr, value, value);
+  }
+  return value;
+}
+
+static void traced_write(uint16_t addr, uint8_t value)
+{
+  if (current->tracing)
+  {
+    trace(current->core.writes, &current->core.writes_count, addr, value, current->read_byte(addr));
+  }
+  current->write_byte(addr, value);
+}
+
+static uint8_t traced_in(uint8_t port)
+{
+  uint8_t value = current->port_in(port);
+
+  if (current->tracing)
+  {
+    trace(current->core.ins, &current->core.ins_count, port, value, 0);
+  }
+  return value;
+}
+
+static uint8_t traced_out(uint8_t port, uint8_t value)
+{
+  if (current->tracing)
+  {
+    trace(current->core.outs, &current->core.outs_count, port, value, 0);
+  }
+  return current->port_out(port, value);
+}
+
+// The last entry for an address in a list, or NULL
+static const lockstep_access *find(const lockstep_access *list, int count, uint16_t addr)
+{
+  const lockstep_access *found = NULL;
+
+  for (int i = 0; i < count && i < LOCKSTEP_MAX_ACCESSES; i++)
+  {
+    if (list[i].addr == addr)
+    {
+      found = &list[i];
+    }
+  }
+  return found;
+}
+
+// Memory as it was when the core's step began
+static uint8_t reference_read(void *context, uint16_t addr)
+{
+  lockstep *l = context;
+  const lockstep_access *access = NULL;
+
+  for (int i = 0; i < l->core.reads_count && i < LOCKSTEP_MAX_ACCESSES && access == NULL; i++)
+  {
+    if (l->core.reads[i].addr == addr)
+    {
+      access = &l->core.reads[i];
+    }
+  }
+  for (int i = 0; i < l->core.writes_count && i < LOCKSTEP_MAX_ACCESSES && access == NULL; i++)
+  {
+    if (l->core.writes[i].addr == addr)
+    {
+      access = &l->core.writes[i];
+    }
+  }
+
+  uint8_t value = access != NULL ? access->old : l->read_byte(addr);
+
+  trace(l->reference.reads, &l->reference.reads_count, addr, value, value);
+  return value;
+}
+
+static void reference_write(void *context, uint16_t addr, uint8_t value)
+{
+  lockstep *l = context;
+
+  trace(l->reference.writes, &l->reference.writes_count, addr, value, 0);
+}
+
+// The input the core got. Asking for more than it did is a divergence
+static uint8_t reference_in(void *context, uint8_t port)
+{
+  lockstep *l = context;
+  uint8_t value = 0;
+
+  if (l->ins_used < l->core.ins_count && l->ins_used < LOCKSTEP_MAX_ACCESSES)
+  {
+    value = l->core.ins[l->ins_used].value;
+  }
+  l->ins_used++;
+  trace(l->reference.ins, &l->reference.ins_count, port, value, 0);
+  return value;
+}
+
+static void reference_out(void *context, uint8_t port, uint8_t value)
+{
+  lockstep *l = context;
+
+  trace(l->reference.outs, &l->reference.outs_count, port, value, 0);
+}
+
+void lockstep_attach(lockstep *l, i8080 *p)
+{
+  memset(l, 0, sizeof(lockstep));
+  l->read_byte = p->read_byte;
+  l->write_byte = p->write_byte;
+  l->port_in = p->port_in;
+  l->port_out = p->port_out;
+  current = l;
+
+  // Ports without a callback still trap
+  p->read_byte = &traced_read;
+  p->write_byte = &traced_write;
+  p->port_in = p->port_in != NULL ? &traced_in : NULL;
+  p->port_out = p->port_out != NULL ? &traced_out : NULL;
+  p->lockstep = l;
+}
+
+void lockstep_detach(lockstep *l, i8080 *p)
+{
+  p->read_byte = l->read_byte;
+  p->write_byte = l->write_byte;
+  p->port_in = l->port_in;
+  p->port_out = l->port_out;
+  if (p->lockstep == l)
+  {
+    p->lockstep = NULL;
+  }
+  if (current == l)
+  {
+    current = NULL;
+  }
+}
+
+void lockstep_begin(lockstep *l, i8080 *p)
+{
+  i8080_save_state(p, &l->before);
+  memset(&l->core, 0, sizeof(lockstep_trace));
+  l->tracing = true;
+}
+
+static bool same_state(const i8080_state *a, const i8080_state *b)
+{
+  return a->a == b->a && a->b == b->b && a->c == b->c && a->d == b->d && a->e == b->e && a->h == b->h &&
+         a->l == b->l && a->bp == b->bp && a->sp == b->sp && a->pc == b->pc && a->zf == b->zf && a->sf == b->sf &&
+         a->pf == b->pf && a->cf == b->cf && a->acf == b->acf && a->halted == b->halted &&
+         a->cycles == b->cycles && a->interrupt_pending == b->interrupt_pending &&
+         a->interrupts_enabled == b->interrupts_enabled && a->interrupt_delay == b->interrupt_delay &&
+         a->interrupt_opcode == b->interrupt_opcode;
+}
+
+// Whether every address written by one ends up with the same value in the other
+static bool same_writes(const lockstep_trace *a, const lockstep_trace *b)
+{
+  for (int i = 0; i < a->writes_count && i < LOCKSTEP_MAX_ACCESSES; i++)
+  {
+    const lockstep_access *last = find(a->writes, a->writes_count, a->writes[i].addr);
+    const lockstep_access *other = find(b->writes, b->writes_count, a->writes[i].addr);
+
+    if (other == NULL || other->value != last->value)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool same_outs(const lockstep_trace *a, const lockstep_trace *b)
+{
+  if (a->outs_count != b->outs_count)
+  {
+    return false;
+  }
+  for (int i = 0; i < a->outs_count && i < LOCKSTEP_MAX_ACCESSES; i++)
+  {
+    if (a->outs[i].addr != b->outs[i].addr || a->outs[i].value != b->outs[i].value)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void lockstep_check(lockstep *l, i8080 *p, uint8_t opcode)
+{
+  l->tracing = false;
+
+  // A trapped instruction is undone, there is nothing to compare
+  if (p->exit_reason >= I8080_EXIT_INVALID_OPCODE || l->diverged)
+  {
+    return;
+  }
+
+  reference_bus bus = {&reference_read, &reference_write, &reference_in, &reference_out, l};
+  i8080_state expected = l->before;
+  i8080_state actual;
+
+  memset(&l->reference, 0, sizeof(lockstep_trace));
+  l->ins_used = 0;
+  reference_step(&expected, &bus);
+  i8080_save_state(p, &actual);
+  l->steps++;
+
+  if (same_state(&expected, &actual) && same_writes(&l->core, &l->reference) &&
+      same_writes(&l->reference, &l->core) && same_outs(&l->core, &l->reference) &&
+      l->reference.ins_count == l->core.ins_count)
+  {
+    return;
+  }
+
+  l->diverged = true;
+  l->opcode = opcode;
+  l->expected = expected;
+  l->actual = actual;
+  l->expected_trace = l->reference;
+  l->actual_trace = l->core;
+  i8080_stop(p, I8080_EXIT_DIVERGENCE);
+}
+
+static void report_accesses(const char *name, const lockstep_access *list, int count, FILE *out)
+{
+  fprintf(out, "  %-9s", name);
+  for (int i = 0; i < count && i < LOCKSTEP_MAX_ACCESSES; i++)
+  {
+    fprintf(out, " %04x=%02x", list[i].addr, list[i].value);
+  }
+  if (count > LOCKSTEP_MAX_ACCESSES)
+  {
+    fprintf(out, " and %d more", count - LOCKSTEP_MAX_ACCESSES);
+  }
+  fprintf(out, "\n");
+}
+
+#define REPORT_FIELD(name, field, format)                                                                    \
+  if (l->expected.field != l->actual.field)                                                                  \
+  {                                                                                                          \
+    fprintf(out, "  %-9s expected " format ", got " format "\n", name, l->expected.field, l->actual.field);  \
+  }
+
+void lockstep_report(const lockstep *l, FILE *out)
+{
+  if (!l->diverged)
+  {
+    fprintf(out, "no divergence in %llu steps\n", (unsigned long long)l->steps);
+    return;
+  }
+
+  fprintf(out, "divergence at step %llu, pc %04x, opcode %02x\n", (unsigned long long)l->steps, l->before.pc,
+          l->opcode);
+  REPORT_FIELD("a", a, "%02x");
+  REPORT_FIELD("b", b, "%02x");
+  REPORT_FIELD("c", c, "%02x");
+  REPORT_FIELD("d", d, "%02x");
+  REPORT_FIELD("e", e, "%02x");
+  REPORT_FIELD("h", h, "%02x");
+  REPORT_FIELD("l", l, "%02x");
+  REPORT_FIELD("sp", sp, "%04x");
+  REPORT_FIELD("pc", pc, "%04x");
+  REPORT_FIELD("zf", zf, "%d");
+  REPORT_FIELD("sf", sf, "%d");
+  REPORT_FIELD("pf", pf, "%d");
+  REPORT_FIELD("cf", cf, "%d");
+  REPORT_FIELD("acf", acf, "%d");
+  REPORT_FIELD("halted", halted, "%d");
+  if (l->expected.cycles != l->actual.cycles)
+  {
+    fprintf(out, "  %-9s expected %llu, got %llu\n", "cycles", (unsigned long long)l->expected.cycles,
+            (unsigned long long)l->actual.cycles);
+  }
+  REPORT_FIELD("interrupts", interrupts_enabled, "%d");
+  REPORT_FIELD("ei delay", interrupt_delay, "%d");
+
+  if (!same_writes(&l->actual_trace, &l->expected_trace) || !same_writes(&l->expected_trace, &l->actual_trace))
+  {
+    fprintf(out, "  memory writes differ\n");
+    report_accesses("expected", l->expected_trace.writes, l->expected_trace.writes_count, out);
+    report_accesses("got", l->actual_trace.writes, l->actual_trace.writes_count, out);
+  }
+  if (!same_outs(&l->actual_trace, &l->expected_trace) ||
+      l->expected_trace.ins_count != l->actual_trace.ins_count)
+  {
+    fprintf(out, "  port accesses differ\n");
+    report_accesses("in", l->expected_trace.ins, l->expected_trace.ins_count, out);
+    report_accesses("got in", l->actual_trace.ins, l->actual_trace.ins_count, out);
+    report_accesses("out", l->expected_trace.outs, l->expected_trace.outs_count, out);
+    report_accesses("got out", l->actual_trace.outs, l->actual_trace.outs_count, out);
+  }
+}
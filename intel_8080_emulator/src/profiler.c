@@ -0,0 +1,92 @@
+#include "profiler.h"
+#include "disassembler.h"
+#include <stdlib.h>
+#include <string.h>
+
+void profiler_init(profiler *prof)
+{
+  memset(prof, 0, sizeof(profiler));
+}
+
+void profiler_write_folded(profiler *prof, i8080 *p, FILE *out)
+{
+  char text[32];
+
+  for (uint32_t pc = 0; pc < 0x10000; pc++)
+  {
+    if (prof->pc_count[pc] == 0)
+    {
+      continue;
+    }
+
+    disassemble(p, pc, text, sizeof(text));
+    fprintf(out, "page %02xxxh;%04xh %s %llu\n", pc >> 8, pc, text,
+            (unsigned long long)prof->pc_cycles[pc]);
+  }
+}
+
+void profiler_write_callgrind(profiler *prof, i8080 *p, FILE *out)
+{
+  char text[32];
+
+  fprintf(out, "# callgrind format\n");
+  fprintf(out, "version: 1\n");
+  fprintf(out, "creator: intel_8080_emulator\n");
+  fprintf(out, "positions: instr\n");
+  fprintf(out, "events: Ir Cycles\n");
+  fprintf(out, "ob=i8080\n");
+
+  for (uint32_t pc = 0; pc < 0x10000; pc++)
+  {
+    if (prof->pc_count[pc] == 0)
+    {
+      continue;
+    }
+
+    disassemble(p, pc, text, sizeof(text));
+    fprintf(out, "fn=%04xh %s\n", pc, text);
+    fprintf(out, "0x%04x %llu %llu\n", pc, (unsigned long long)prof->pc_count[pc],
+            (unsigned long long)prof->pc_cycles[pc]);
+  }
+}
+
+typedef struct opcode_cost
+{
+  uint8_t opcode;
+  uint64_t cycles;
+} opcode_cost;
+
+static int compare_opcode_cost(const void *a, const void *b)
+{
+  uint64_t cycles_a = ((const opcode_cost *)a)->cycles;
+  uint64_t cycles_b = ((const opcode_cost *)b)->cycles;
+  return (cycles_a < cycles_b) - (cycles_a > cycles_b);
+}
+
+void profiler_write_opcodes(profiler *prof, FILE *out)
+{
+  opcode_cost costs[256];
+
+  for (int i = 0; i < 256; i++)
+  {
+    costs[i].opcode = i;
+    costs[i].cycles = prof->opcode_cycles[i];
+  }
+
+  qsort(costs, 256, sizeof(opcode_cost), compare_opcode_cost);
+
+  fprintf(out, "opcode,name,count,cycles\n");
+  for (int i = 0; i < 256; i++)
+  {
+    uint8_t opcode = costs[i].opcode;
+
+    if (prof->opcode_count[opcode] == 0)
+    {
+      continue;
+    }
+
+    fprintf(out, "%02x,%s,%llu,%llu\n", opcode, opcode_name(opcode),
+            (unsigned long long)prof->opcode_count[opcode],
+            (unsigned long long)prof->opcode_cycles[opcode]);
+  }
+}
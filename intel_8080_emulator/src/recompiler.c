@@ -0,0 +1,823 @@
+#include "recompiler.h"
+#include "disassembler.h"
+#include "instructions.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const REGISTERS[8] = {"p->b", "p->c", "p->d", "p->e", "p->h", "p->l", NULL, "p->a"};
+static const char *const MEMORY_OPERAND = "read_byte(p, join_hl(p))";
+
+// Register pairs B, D and H by their number in the opcode
+static const char *const PAIRS_HIGH[3] = {"p->b", "p->d", "p->h"};
+static const char *const PAIRS_LOW[3] = {"p->c", "p->e", "p->l"};
+
+// NZ Z NC C PO PE P M
+static const char *const CONDITIONS[8] = {"!p->zf", "p->zf", "!p->cf", "p->cf", "!p->pf", "p->pf", "!p->sf", "p->sf"};
+
+// ADD ADC SUB SBB ANA XRA ORA CMP, split around the operand
+static const char *const ALU_BEGIN[8] = {
+    "add_byte(p, ", "add_byte(p, ", "p->a = sub_byte(p, ", "p->a = sub_byte(p, ",
+    "and_byte(p, ", "xor_byte(p, ", "or_byte(p, ",         "cmp_byte(p, ",
+};
+static const char *const ALU_END[8] = {", 0)", ", p->cf)", ", 0)", ", p->cf)", ")", ")", ")", ")"};
+
+// The image, for the disassembler's read_byte callback
+static _Thread_local const recompiler *disassembled;
+
+static uint8_t read_image(uint16_t addr)
+{
+  return disassembled->rom[(uint16_t)(addr - disassembled->origin)];
+}
+
+static bool contains(const recompiler *r, uint32_t addr, uint32_t length)
+{
+  return addr >= r->origin && addr + length <= (uint32_t)r->origin + r->size;
+}
+
+static uint8_t image_byte(const recompiler *r, uint16_t addr)
+{
+  return r->rom[addr - r->origin];
+}
+
+static uint16_t image_word(const recompiler *r, uint16_t addr)
+{
+  return image_byte(r, addr) | image_byte(r, addr + 1) << 8;
+}
+
+static bool is_jump(uint8_t opcode)
+{
+  return opcode == 0xc3 || opcode == 0xcb || (opcode & 0xc7) == 0xc2;
+}
+
+static bool is_call(uint8_t opcode)
+{
+  return opcode == 0xcd || opcode == 0xdd || opcode == 0xed || opcode == 0xfd || (opcode & 0xc7) == 0xc4;
+}
+
+static bool is_return(uint8_t opcode)
+{
+  return opcode == 0xc9 || opcode == 0xd9 || (opcode & 0xc7) == 0xc0;
+}
+
+static bool is_rst(uint8_t opcode)
+{
+  return (opcode & 0xc7) == 0xc7;
+}
+
+static bool is_io(uint8_t opcode)
+{
+  return opcode == 0xd3 || opcode == 0xdb;
+}
+
+// Whether the instruction leaves the block. EI does, as the instruction after it, which a pending interrupt
+// follows, is left to the interpreter
+static bool ends_block(uint8_t opcode)
+{
+  return is_jump(opcode) || is_call(opcode) || is_return(opcode) || is_rst(opcode) || opcode == 0xe9 ||
+         opcode == 0x76 || opcode == 0xfb;
+}
+
+int recompiler_init(recompiler *r, const uint8_t *rom, uint32_t size, uint16_t origin)
+{
+  if (size == 0 || origin + size > 0x10000)
+  {
+    return -1;
+  }
+
+  memset(r, 0, sizeof(recompiler));
+  r->rom = rom;
+  r->size = size;
+  r->origin = origin;
+  return 0;
+}
+
+// Makes addr start a block, queueing it to be followed unless it already was
+static void add_leader(recompiler *r, uint16_t *worklist, int *count, uint32_t addr)
+{
+  if (!contains(r, addr, 1) || (r->marks[addr] & MARK_LEADER))
+  {
+    return;
+  }
+
+  r->marks[addr] |= MARK_LEADER;
+  r->leaders++;
+  if (!(r->marks[addr] & MARK_INSTRUCTION))
+  {
+    worklist[(*count)++] = addr;
+  }
+}
+
+static void mark_written(recompiler *r, uint32_t addr)
+{
+  if (contains(r, addr, 1))
+  {
+    r->marks[addr] |= MARK_WRITTEN;
+  }
+}
+
+// Follows the code from a leader to the end of its block, queueing the blocks it leads to
+static void follow(recompiler *r, uint16_t *worklist, int *count, uint16_t leader)
+{
+  uint32_t addr = leader;
+
+  for (;;)
+  {
+    if (addr != leader && (r->marks[addr & 0xffff] & (MARK_LEADER | MARK_INSTRUCTION)))
+    {
+      // Falling into code already followed, which then starts a block of its own
+      add_leader(r, worklist, count, addr);
+      return;
+    }
+    if (!contains(r, addr, 1))
+    {
+      return;
+    }
+
+    uint8_t opcode = image_byte(r, addr);
+    uint8_t length = instruction_length(opcode);
+    uint32_t next = addr + length;
+
+    if (!contains(r, addr, length))
+    {
+      return;
+    }
+    if (is_io(opcode) && addr != leader)
+    {
+      // IN and OUT are left to the interpreter, so they start blocks that aren't compiled
+      add_leader(r, worklist, count, addr);
+      return;
+    }
+
+    r->marks[addr] |= MARK_INSTRUCTION;
+    r->instructions++;
+
+    if (opcode == 0x32)
+    {
+      mark_written(r, image_word(r, addr + 1));
+    }
+    else if (opcode == 0x22)
+    {
+      mark_written(r, image_word(r, addr + 1));
+      mark_written(r, (uint16_t)(image_word(r, addr + 1) + 1));
+    }
+
+    if (is_jump(opcode) || is_call(opcode))
+    {
+      add_leader(r, worklist, count, image_word(r, addr + 1));
+    }
+    else if (is_rst(opcode))
+    {
+      add_leader(r, worklist, count, opcode & 0x38);
+    }
+
+    // Nothing after unconditional jumps and returns and PCHL is known to be code
+    if (opcode == 0xc3 || opcode == 0xcb || opcode == 0xc9 || opcode == 0xd9 || opcode == 0xe9)
+    {
+      return;
+    }
+    if (ends_block(opcode) || is_io(opcode))
+    {
+      add_leader(r, worklist, count, next);
+      return;
+    }
+    addr = next;
+  }
+}
+
+int recompiler_discover(recompiler *r, uint16_t entry, uint8_t vectors)
+{
+  // Every address is queued at most once, when it becomes a leader
+  uint16_t *worklist = malloc(0x10000 * sizeof(uint16_t));
+  int count = 0;
+
+  if (worklist == NULL)
+  {
+    return -1;
+  }
+
+  add_leader(r, worklist, &count, entry);
+  for (int rst = 0; rst < 8; rst++)
+  {
+    if (vectors & (1 << rst))
+    {
+      add_leader(r, worklist, &count, rst * 8);
+    }
+  }
+
+  while (count > 0)
+  {
+    follow(r, worklist, &count, worklist[--count]);
+  }
+
+  free(worklist);
+  return r->instructions;
+}
+
+// The address after the last instruction of the block starting at start, 0x10000 past the end of the 64K
+static uint32_t block_end(const recompiler *r, uint16_t start)
+{
+  uint32_t addr = start;
+
+  for (;;)
+  {
+    uint8_t opcode = image_byte(r, addr);
+    uint32_t next = addr + instruction_length(opcode);
+
+    if (ends_block(opcode) || !contains(r, next, 1) || (r->marks[next] & MARK_LEADER) ||
+        !(r->marks[next] & MARK_INSTRUCTION))
+    {
+      return next;
+    }
+    addr = next;
+  }
+}
+
+// Blocks starting with IN or OUT, or holding bytes the image writes to, are left to the interpreter
+static bool compilable(const recompiler *r, uint16_t start, uint32_t end)
+{
+  if ((r->marks[start] & (MARK_LEADER | MARK_INSTRUCTION)) != (MARK_LEADER | MARK_INSTRUCTION) ||
+      is_io(image_byte(r, start)))
+  {
+    return false;
+  }
+  for (uint32_t addr = start; addr < end; addr++)
+  {
+    if (r->marks[addr] & MARK_WRITTEN)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void emit_leave(FILE *out, uint16_t next)
+{
+  fprintf(out, "  if (recompiled_leave(p))\n  {\n    p->pc = 0x%04x;\n    return;\n  }\n", next);
+}
+
+static void emit_condition(FILE *out, uint8_t opcode, const char *statement)
+{
+  fprintf(out, "  if (%s)\n  {\n    p->cycles += %d;\n    %s\n  }\n", CONDITIONS[(opcode >> 3) & 7],
+          CONDITIONAL_EXTRA_CYCLES, statement);
+}
+
+// The statements of branches, calls, returns, HLT and EI, which set pc and end their blocks
+static void emit_exit(FILE *out, uint8_t opcode, uint16_t word, uint16_t next)
+{
+  char statement[32];
+
+  if (opcode == 0xe9) // PCHL
+  {
+    fprintf(out, "  p->pc = join_hl(p);\n");
+    return;
+  }
+  if (is_jump(opcode))
+  {
+    if ((opcode & 0xc7) == 0xc2)
+    {
+      fprintf(out, "  p->pc = %s ? 0x%04x : 0x%04x;\n", CONDITIONS[(opcode >> 3) & 7], word, next);
+    }
+    else
+    {
+      fprintf(out, "  p->pc = 0x%04x;\n", word);
+    }
+    return;
+  }
+
+  // Calls push, and the callgraph sees, the address after the instruction
+  fprintf(out, "  p->pc = 0x%04x;\n", next);
+  if (is_call(opcode) || is_rst(opcode))
+  {
+    snprintf(statement, sizeof(statement), "call(p, 0x%04x);", is_rst(opcode) ? opcode & 0x38 : word);
+  }
+  else
+  {
+    snprintf(statement, sizeof(statement), "ret(p);");
+  }
+
+  if ((opcode & 0xc7) == 0xc4 || (opcode & 0xc7) == 0xc0)
+  {
+    emit_condition(out, opcode, statement);
+  }
+  else if (is_call(opcode) || is_return(opcode) || is_rst(opcode))
+  {
+    fprintf(out, "  %s\n", statement);
+  }
+  else if (opcode == 0x76)
+  {
+    fprintf(out, "  p->halted = true;\n  i8080_stop(p, I8080_EXIT_HALT);\n");
+  }
+  else if (opcode == 0xfb)
+  {
+    fprintf(out, "  p->interrupts_enabled = true;\n  p->interrupt_delay = true;\n");
+  }
+}
+
+static void emit_inr_dcr(FILE *out, uint8_t opcode)
+{
+  bool increment = (opcode & 7) == 4;
+  const char *reg = REGISTERS[(opcode >> 3) & 7];
+
+  if (reg == NULL)
+  {
+    fprintf(out, "  {\n    uint16_t addr = join_hl(p);\n    uint8_t val = read_byte(p, addr);\n");
+    fprintf(out, "    p->acf = (val & 0x0f) %s;\n", increment ? "== 0x0f" : "!= 0");
+    fprintf(out, "    val%s;\n    write_byte(p, addr, val);\n    update_z_s_p(p, val);\n  }\n", increment ? "++" : "--");
+    return;
+  }
+  fprintf(out, "  p->acf = (%s & 0x0f) %s;\n", reg, increment ? "== 0x0f" : "!= 0");
+  fprintf(out, "  %s%s;\n  update_z_s_p(p, %s);\n", reg, increment ? "++" : "--", reg);
+}
+
+// INX, DCX, DAD, LXI, PUSH and POP of the pair numbered in the opcode
+static bool emit_pair(FILE *out, uint8_t opcode, uint16_t word)
+{
+  int pair = (opcode >> 4) & 3;
+  const char *high = pair < 3 ? PAIRS_HIGH[pair] : NULL;
+  const char *low = pair < 3 ? PAIRS_LOW[pair] : NULL;
+
+  switch (opcode & 0xcf)
+  {
+  case 0x01: // LXI
+    if (high == NULL)
+    {
+      fprintf(out, "  p->sp = 0x%04x;\n", word);
+    }
+    else
+    {
+      fprintf(out, "  %s = 0x%02x;\n  %s = 0x%02x;\n", high, word >> 8, low, word & 0xff);
+    }
+    return false;
+  case 0x03: // INX
+    if (high == NULL)
+    {
+      fprintf(out, "  p->sp++;\n");
+    }
+    else
+    {
+      fprintf(out, "  if (++%s == 0)\n  {\n    %s++;\n  }\n", low, high);
+    }
+    return false;
+  case 0x0b: // DCX
+    if (high == NULL)
+    {
+      fprintf(out, "  p->sp--;\n");
+    }
+    else
+    {
+      fprintf(out, "  if (%s-- == 0)\n  {\n    %s--;\n  }\n", low, high);
+    }
+    return false;
+  case 0x09: // DAD
+    fprintf(out, "  {\n    uint32_t sum = join_hl(p) + ");
+    if (high == NULL)
+    {
+      fprintf(out, "p->sp;\n");
+    }
+    else
+    {
+      fprintf(out, "join_for_16_bit(%s, %s);\n", high, low);
+    }
+    fprintf(out, "    p->h = (uint8_t)(sum >> 8);\n    p->l = (uint8_t)sum;\n    p->cf = sum >> 16;\n  }\n");
+    return false;
+  case 0xc1: // POP
+    if (high == NULL)
+    {
+      fprintf(out, "  {\n    uint16_t psw = stack_pop(p);\n    p->a = psw >> 8;\n");
+      fprintf(out, "    p->sf = (psw >> 7) & 1;\n    p->zf = (psw >> 6) & 1;\n    p->acf = (psw >> 4) & 1;\n");
+      fprintf(out, "    p->pf = (psw >> 2) & 1;\n    p->cf = psw & 1;\n  }\n");
+    }
+    else
+    {
+      fprintf(out, "  {\n    uint16_t val = stack_pop(p);\n    %s = val >> 8;\n    %s = val & 0xff;\n  }\n", high, low);
+    }
+    return true;
+  default: // PUSH
+    if (high == NULL)
+    {
+      fprintf(out, "  stack_push(p, (p->a << 8) | (p->sf << 7) | (p->zf << 6) | (p->acf << 4) | (p->pf << 2) | 0x02 | "
+                   "p->cf);\n");
+    }
+    else
+    {
+      fprintf(out, "  stack_push(p, (%s << 8) | %s);\n", high, low);
+    }
+    return true;
+  }
+}
+
+// The rest, with no operands but the immediate or address. Returns whether it accessed memory
+static bool emit_other(FILE *out, uint8_t opcode, uint8_t byte, uint16_t word)
+{
+  switch (opcode)
+  {
+  case 0x02: // STAX B
+  case 0x12: // STAX D
+    fprintf(out, "  write_byte(p, join_for_16_bit(%s, %s), p->a);\n", PAIRS_HIGH[opcode >> 4], PAIRS_LOW[opcode >> 4]);
+    return true;
+  case 0x0a: // LDAX B
+  case 0x1a: // LDAX D
+    fprintf(out, "  p->a = read_byte(p, join_for_16_bit(%s, %s));\n", PAIRS_HIGH[opcode >> 4], PAIRS_LOW[opcode >> 4]);
+    return true;
+  case 0x07: // RLC
+    fprintf(out, "  p->cf = p->a >> 7;\n  p->a = (p->a << 1) | p->cf;\n");
+    return false;
+  case 0x0f: // RRC
+    fprintf(out, "  p->cf = p->a & 1;\n  p->a = (p->a >> 1) | (p->a << 7);\n");
+    return false;
+  case 0x17: // RAL
+    fprintf(out, "  {\n    bool carry = p->a >> 7;\n    p->a = (p->a << 1) | p->cf;\n    p->cf = carry;\n  }\n");
+    return false;
+  case 0x1f: // RAR
+    fprintf(out, "  {\n    bool carry = p->a & 1;\n    p->a = (p->a >> 1) | (p->cf << 7);\n    p->cf = carry;\n  }\n");
+    return false;
+  case 0x22: // SHLD
+    fprintf(out, "  write_byte(p, 0x%04x, p->l);\n  write_byte(p, 0x%04x, p->h);\n", word, (uint16_t)(word + 1));
+    return true;
+  case 0x2a: // LHLD
+    fprintf(out, "  p->l = read_byte(p, 0x%04x);\n  p->h = read_byte(p, 0x%04x);\n", word, (uint16_t)(word + 1));
+    return true;
+  case 0x27: // DAA
+    fprintf(out, "  {\n    uint8_t correction = 0;\n    bool carry = p->cf;\n");
+    fprintf(out, "    if ((p->a & 0x0f) > 9 || p->acf)\n    {\n      correction |= 0x06;\n    }\n");
+    fprintf(out, "    if (p->a > 0x99 || p->cf)\n    {\n      correction |= 0x60;\n      carry = true;\n    }\n");
+    fprintf(out, "    add_byte(p, correction, 0);\n    p->cf = carry;\n  }\n");
+    return false;
+  case 0x2f: // CMA
+    fprintf(out, "  p->a = ~p->a;\n");
+    return false;
+  case 0x32: // STA
+    fprintf(out, "  write_byte(p, 0x%04x, p->a);\n", word);
+    return true;
+  case 0x3a: // LDA
+    fprintf(out, "  p->a = read_byte(p, 0x%04x);\n", word);
+    return true;
+  case 0x36: // MVI M
+    fprintf(out, "  write_byte(p, join_hl(p), 0x%02x);\n", byte);
+    return true;
+  case 0x37: // STC
+    fprintf(out, "  p->cf = 1;\n");
+    return false;
+  case 0x3f: // CMC
+    fprintf(out, "  p->cf = !p->cf;\n");
+    return false;
+  case 0xe3: // XTHL
+    fprintf(out, "  {\n    uint16_t val = read_word(p, p->sp);\n    write_word(p, p->sp, join_hl(p));\n");
+    fprintf(out, "    p->h = val >> 8;\n    p->l = val & 0xff;\n  }\n");
+    return true;
+  case 0xeb: // XCHG
+    fprintf(out, "  {\n    uint8_t h = p->h, l = p->l;\n    p->h = p->d;\n    p->l = p->e;\n    p->d = h;\n    p->e = l;\n  }\n");
+    return false;
+  case 0xf3: // DI
+    fprintf(out, "  p->interrupts_enabled = false;\n");
+    return false;
+  case 0xf9: // SPHL
+    fprintf(out, "  p->sp = join_hl(p);\n");
+    return false;
+  default: // NOP and the undocumented NOPs
+    return false;
+  }
+}
+
+// Writes the statements of an instruction that doesn't end its block. Returns whether it accessed memory
+static bool emit_instruction(FILE *out, uint8_t opcode, uint8_t byte, uint16_t word)
+{
+  int dst = (opcode >> 3) & 7, src = opcode & 7;
+
+  if (opcode >= 0x40 && opcode < 0x80) // MOV
+  {
+    if (dst == 6)
+    {
+      fprintf(out, "  write_byte(p, join_hl(p), %s);\n", REGISTERS[src]);
+    }
+    else if (src == 6)
+    {
+      fprintf(out, "  %s = %s;\n", REGISTERS[dst], MEMORY_OPERAND);
+    }
+    else if (dst != src)
+    {
+      fprintf(out, "  %s = %s;\n", REGISTERS[dst], REGISTERS[src]);
+    }
+    return dst == 6 || src == 6;
+  }
+  if (opcode >= 0x80 && opcode < 0xc0)
+  {
+    fprintf(out, "  %s%s%s;\n", ALU_BEGIN[dst], src == 6 ? MEMORY_OPERAND : REGISTERS[src], ALU_END[dst]);
+    return src == 6;
+  }
+  if ((opcode & 0xc7) == 0xc6) // ADI ACI SUI SBI ANI XRI ORI CPI
+  {
+    fprintf(out, "  %s0x%02x%s;\n", ALU_BEGIN[dst], byte, ALU_END[dst]);
+    return false;
+  }
+  if ((opcode & 0xc7) == 0x06 && dst != 6) // MVI
+  {
+    fprintf(out, "  %s = 0x%02x;\n", REGISTERS[dst], byte);
+    return false;
+  }
+  if ((opcode & 0xc6) == 0x04) // INR DCR
+  {
+    emit_inr_dcr(out, opcode);
+    return dst == 6;
+  }
+  if ((opcode & 0xcf) == 0x01 || (opcode & 0xcf) == 0x03 || (opcode & 0xcf) == 0x0b || (opcode & 0xcf) == 0x09 ||
+      (opcode & 0xcf) == 0xc1 || (opcode & 0xcf) == 0xc5)
+  {
+    return emit_pair(out, opcode, word);
+  }
+  return emit_other(out, opcode, byte, word);
+}
+
+// Writes the function of the block from start to end. Returns the most cycles it can take
+static uint32_t emit_block(const recompiler *r, FILE *out, const char *name, uint16_t start, uint32_t end)
+{
+  i8080 image_reader;
+  uint32_t cycles = 0;
+
+  image_reader.read_byte = &read_image;
+  disassembled = r;
+
+  fprintf(out, "static void %s_%04x(i8080 *p)\n{\n", name, start);
+  for (uint32_t addr = start; addr < end;)
+  {
+    uint8_t opcode = image_byte(r, addr);
+    uint8_t length = instruction_length(opcode);
+    uint8_t byte = length > 1 ? image_byte(r, addr + 1) : 0;
+    uint16_t word = length > 2 ? image_word(r, addr + 1) : 0;
+    uint16_t next = addr + length;
+    char text[32];
+
+    disassemble(&image_reader, addr, text, sizeof(text));
+    fprintf(out, "  // %04xh %s\n  p->cycles += %d;\n", (unsigned)addr, text, instruction_cycles(opcode));
+    cycles += instruction_cycles(opcode);
+
+    if (ends_block(opcode))
+    {
+      emit_exit(out, opcode, word, next);
+      if ((opcode & 0xc7) == 0xc4 || (opcode & 0xc7) == 0xc0)
+      {
+        cycles += CONDITIONAL_EXTRA_CYCLES;
+      }
+    }
+    else if (emit_instruction(out, opcode, byte, word))
+    {
+      if (addr + length < end)
+      {
+        emit_leave(out, next);
+      }
+    }
+    if (addr + length == end && !ends_block(opcode))
+    {
+      fprintf(out, "  p->pc = 0x%04x;\n", next);
+    }
+    addr += length;
+  }
+  fprintf(out, "}\n\n");
+  return cycles;
+}
+
+int recompiler_emit(const recompiler *r, FILE *out, const char *name)
+{
+  recompiled_block *blocks = malloc(sizeof(recompiled_block) * (r->leaders + 1));
+  uint32_t count = 0;
+
+  if (blocks == NULL)
+  {
+    return -1;
+  }
+
+  fprintf(out, "// Recompiled from %u bytes at %04xh. Generated code, do not edit\n\n", (unsigned)r->size, r->origin);
+  fprintf(out, "#include \"recompiler.h\"\n#include \"utils.h\"\n\n");
+
+  for (uint32_t addr = r->origin; addr < (uint32_t)r->origin + r->size; addr++)
+  {
+    if (!(r->marks[addr] & MARK_LEADER) || !(r->marks[addr] & MARK_INSTRUCTION))
+    {
+      continue;
+    }
+
+    uint32_t end = block_end(r, addr);
+
+    if (compilable(r, addr, end))
+    {
+      blocks[count].addr = addr;
+      blocks[count].length = end - addr;
+      blocks[count].cycles = emit_block(r, out, name, addr, end);
+      count++;
+    }
+  }
+
+  fprintf(out, "static const uint8_t %s_bytes[] = {", name);
+  for (uint32_t i = 0; i < r->size; i++)
+  {
+    fprintf(out, "%s0x%02x,", i % 16 == 0 ? "\n    " : " ", r->rom[i]);
+  }
+  fprintf(out, "\n};\n\n");
+
+  fprintf(out, "static const recompiled_block %s_blocks[] = {\n", name);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    fprintf(out, "    {0x%04x, %u, %u, &%s_%04x},\n", blocks[i].addr, blocks[i].length, (unsigned)blocks[i].cycles, name,
+            blocks[i].addr);
+  }
+  if (count == 0)
+  {
+    fprintf(out, "    {0, 0, 0, NULL},\n");
+  }
+  fprintf(out, "};\n\n");
+
+  // Only the block starts, the compiler fills in the rest
+  fprintf(out, "static const uint32_t %s_block_at[%u] = {", name, (unsigned)r->size);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    fprintf(out, "%s[0x%04x] = %u,", i % 8 == 0 ? "\n    " : " ", (unsigned)(blocks[i].addr - r->origin),
+            (unsigned)i + 1);
+  }
+  fprintf(out, "%s\n};\n\n", count == 0 ? "0" : "");
+
+  fprintf(out, "const recompiled_image %s = {%s_bytes, 0x%04x, %u, %s_blocks, %u, %s_block_at};\n", name, name,
+          r->origin, (unsigned)r->size, name, (unsigned)count, name);
+
+  free(blocks);
+  return ferror(out) ? -1 : (int)count;
+}
+
+// Whether the block's bytes in memory are those it was compiled from
+static bool matches(const recompiled_image *image, const recompiled_block *b, i8080 *p)
+{
+  for (uint32_t i = 0; i < b->length; i++)
+  {
+    if (p->read_byte(b->addr + i) != image->bytes[b->addr - image->origin + i])
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void mark_pages(const recompiled_block *b, i8080 *p)
+{
+  for (int page = b->addr >> 8; page <= (b->addr + b->length - 1) >> 8; page++)
+  {
+    p->page_flags[page] |= PAGE_CODE;
+  }
+}
+
+int recompiled_attach(recompiled *r, const recompiled_image *image, i8080 *p)
+{
+  int matching = 0;
+
+  memset(r, 0, sizeof(recompiled));
+  r->image = image;
+  r->mismatched = calloc(image->count > 0 ? image->count : 1, sizeof(bool));
+  if (r->mismatched == NULL)
+  {
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < image->count; i++)
+  {
+    const recompiled_block *b = &image->blocks[i];
+
+    if (b->run == NULL)
+    {
+      continue;
+    }
+    if (b->length > r->longest)
+    {
+      r->longest = b->length;
+    }
+    mark_pages(b, p);
+    if (matches(image, b, p))
+    {
+      matching++;
+    }
+    else
+    {
+      r->mismatched[i] = true;
+      r->mismatches++;
+    }
+  }
+
+  p->recompiled = r;
+  return matching;
+}
+
+void recompiled_detach(recompiled *r, i8080 *p)
+{
+  // Fusion still needs to hear of writes to its pages
+  for (int page = 0; page < 256 && p->fusion == NULL; page++)
+  {
+    p->page_flags[page] &= ~PAGE_CODE;
+  }
+  if (p->recompiled == r)
+  {
+    p->recompiled = NULL;
+  }
+  free(r->mismatched);
+  r->mismatched = NULL;
+}
+
+void recompiled_invalidate_page(recompiled *r, i8080 *p, uint8_t page)
+{
+  // Checked, and the page flagged again, when one of its blocks is next entered
+  r->stale[page] = true;
+  r->code_written = true;
+  p->page_flags[page] &= ~PAGE_CODE;
+}
+
+// Checks the blocks on a written page against memory
+static void check_page(recompiled *r, i8080 *p, uint8_t page)
+{
+  const recompiled_image *image = r->image;
+  uint32_t low = 0, high = image->count;
+  uint32_t from = page << 8 > r->longest ? (page << 8) - r->longest : 0;
+
+  // The first block that may reach into the page
+  while (low < high)
+  {
+    uint32_t middle = (low + high) / 2;
+
+    if (image->blocks[middle].addr < from)
+    {
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+
+  for (uint32_t i = low; i < image->count && image->blocks[i].addr <= (page << 8 | 0xff); i++)
+  {
+    const recompiled_block *b = &image->blocks[i];
+
+    if (b->run == NULL || (b->addr + b->length - 1) >> 8 < page)
+    {
+      continue;
+    }
+    bool mismatched = !matches(image, b, p);
+
+    mark_pages(b, p);
+    if (mismatched && !r->mismatched[i])
+    {
+      r->mismatches++;
+    }
+    r->mismatched[i] = mismatched;
+  }
+  r->stale[page] = false;
+}
+
+bool recompiled_step(recompiled *r, i8080 *p, uint64_t cycles_left)
+{
+  uint32_t index = recompiled_block_at(r->image, p->pc);
+
+  if (index == 0 || observed_per_step(p) || p->halted || p->interrupt_delay ||
+      (p->interrupt_pending && p->interrupts_enabled))
+  {
+    return false;
+  }
+
+  const recompiled_block *b = &r->image->blocks[index - 1];
+  int first = b->addr >> 8, last = (b->addr + b->length - 1) >> 8;
+
+  for (int page = first; page <= last; page++)
+  {
+    if (r->stale[page])
+    {
+      check_page(r, p, page);
+    }
+  }
+  for (int page = first; page <= last; page++)
+  {
+    if (p->page_flags[page] & (PAGE_BREAKPOINT | PAGE_UNTIL_PC | PAGE_WATCH_READ))
+    {
+      return false;
+    }
+  }
+  if (r->mismatched[index - 1] || b->cycles > cycles_left)
+  {
+    return false;
+  }
+
+  r->code_written = false;
+  b->run(p);
+  r->executed++;
+  return true;
+}
+
+void recompiled_report(const recompiled *r, FILE *out)
+{
+  uint32_t in_use = 0;
+
+  for (uint32_t i = 0; i < r->image->count; i++)
+  {
+    if (r->image->blocks[i].run != NULL && !r->mismatched[i])
+    {
+      in_use++;
+    }
+  }
+  fprintf(out, "recompiled: %u of %u blocks in use, %llu run, %llu found changed\n", (unsigned)in_use,
+          (unsigned)r->image->count, (unsigned long long)r->executed, (unsigned long long)r->mismatches);
+}
@@ -0,0 +1,571 @@
+#include "reference.h"
+
+enum
+{
+  ALU_ADD,
+  ALU_ADC,
+  ALU_SUB,
+  ALU_SBB,
+  ALU_ANA,
+  ALU_XRA,
+  ALU_ORA,
+  ALU_CMP
+};
+
+static uint8_t fetch(i8080_state *s, const reference_bus *bus)
+{
+  return bus->read(bus->context, s->pc++);
+}
+
+static uint16_t fetch_word(i8080_state *s, const reference_bus *bus)
+{
+  uint8_t low = fetch(s, bus);
+  uint8_t high = fetch(s, bus);
+
+  return high << 8 | low;
+}
+
+static uint16_t hl(const i8080_state *s)
+{
+  return s->h << 8 | s->l;
+}
+
+// Registers by their 3-bit code: B C D E H L M A
+static uint8_t get_register(i8080_state *s, const reference_bus *bus, int code)
+{
+  switch (code)
+  {
+  case 0:
+    return s->b;
+  case 1:
+    return s->c;
+  case 2:
+    return s->d;
+  case 3:
+    return s->e;
+  case 4:
+    return s->h;
+  case 5:
+    return s->l;
+  case 6:
+    return bus->read(bus->context, hl(s));
+  default:
+    return s->a;
+  }
+}
+
+static void set_register(i8080_state *s, const reference_bus *bus, int code, uint8_t value)
+{
+  switch (code)
+  {
+  case 0:
+    s->b = value;
+    break;
+  case 1:
+    s->c = value;
+    break;
+  case 2:
+    s->d = value;
+    break;
+  case 3:
+    s->e = value;
+    break;
+  case 4:
+    s->h = value;
+    break;
+  case 5:
+    s->l = value;
+    break;
+  case 6:
+    bus->write(bus->context, hl(s), value);
+    break;
+  default:
+    s->a = value;
+    break;
+  }
+}
+
+// Register pairs by their 2-bit code: BC DE HL SP
+static uint16_t get_pair(const i8080_state *s, int code)
+{
+  switch (code)
+  {
+  case 0:
+    return s->b << 8 | s->c;
+  case 1:
+    return s->d << 8 | s->e;
+  case 2:
+    return hl(s);
+  default:
+    return s->sp;
+  }
+}
+
+static void set_pair(i8080_state *s, int code, uint16_t value)
+{
+  switch (code)
+  {
+  case 0:
+    s->b = value >> 8;
+    s->c = value;
+    break;
+  case 1:
+    s->d = value >> 8;
+    s->e = value;
+    break;
+  case 2:
+    s->h = value >> 8;
+    s->l = value;
+    break;
+  default:
+    s->sp = value;
+    break;
+  }
+}
+
+static void push(i8080_state *s, const reference_bus *bus, uint16_t value)
+{
+  bus->write(bus->context, --s->sp, value >> 8);
+  bus->write(bus->context, --s->sp, value & 0xff);
+}
+
+static uint16_t pop(i8080_state *s, const reference_bus *bus)
+{
+  uint8_t low = bus->read(bus->context, s->sp++);
+  uint8_t high = bus->read(bus->context, s->sp++);
+
+  return high << 8 | low;
+}
+
+static void set_z_s_p(i8080_state *s, uint8_t value)
+{
+  int ones = 0;
+
+  for (int bit = 0; bit < 8; bit++)
+  {
+    ones += (value >> bit) & 1;
+  }
+  s->zf = value == 0;
+  s->sf = value >= 0x80;
+  s->pf = ones % 2 == 0;
+}
+
+static void alu(i8080_state *s, int operation, uint8_t value)
+{
+  int carry = 0;
+  int result;
+
+  switch (operation)
+  {
+  case ALU_ADC:
+    carry = s->cf;
+    // fall through
+  case ALU_ADD:
+    result = s->a + value + carry;
+    s->acf = (s->a & 0xf) + (value & 0xf) + carry > 0xf;
+    s->cf = result > 0xff;
+    s->a = result;
+    break;
+  case ALU_SBB:
+    carry = s->cf;
+    // fall through
+  case ALU_SUB:
+  case ALU_CMP:
+    // The 8080 subtracts by adding the complement, and AC is the carry out of bit 3 of that
+    result = s->a - value - carry;
+    s->acf = (s->a & 0xf) + (~value & 0xf) + !carry > 0xf;
+    s->cf = result < 0;
+    if (operation == ALU_CMP)
+    {
+      set_z_s_p(s, result);
+      return;
+    }
+    s->a = result;
+    break;
+  case ALU_ANA:
+    s->acf = ((s->a | value) & 0x08) != 0;
+    s->cf = false;
+    s->a &= value;
+    break;
+  case ALU_XRA:
+    s->acf = false;
+    s->cf = false;
+    s->a ^= value;
+    break;
+  default:
+    s->acf = false;
+    s->cf = false;
+    s->a |= value;
+    break;
+  }
+  set_z_s_p(s, s->a);
+}
+
+// Conditions by their 3-bit code: NZ Z NC C PO PE P M
+static bool condition(const i8080_state *s, int code)
+{
+  bool flag;
+
+  switch (code >> 1)
+  {
+  case 0:
+    flag = s->zf;
+    break;
+  case 1:
+    flag = s->cf;
+    break;
+  case 2:
+    flag = s->pf;
+    break;
+  default:
+    flag = s->sf;
+    break;
+  }
+  return code & 1 ? flag : !flag;
+}
+
+static void daa(i8080_state *s)
+{
+  uint8_t correction = 0;
+  bool carry = s->cf;
+  uint8_t low = s->a & 0xf;
+  uint8_t high = s->a >> 4;
+
+  if (s->acf || low > 9)
+  {
+    correction |= 0x06;
+  }
+  if (s->cf || high > 9 || (high == 9 && low > 9))
+  {
+    correction |= 0x60;
+    carry = true;
+  }
+  alu(s, ALU_ADD, correction);
+  s->cf = carry;
+}
+
+void reference_step(i8080_state *s, const reference_bus *bus)
+{
+  bool delayed = s->interrupt_delay;
+
+  // The instruction after EI runs before an interrupt is taken
+  s->interrupt_delay = false;
+  if (s->interrupt_pending && s->interrupts_enabled && !delayed)
+  {
+    s->interrupt_pending = false;
+    s->interrupts_enabled = false;
+    s->halted = false;
+    s->cycles += 11;
+    push(s, bus, s->pc);
+    s->pc = s->interrupt_opcode & 0x38;
+  }
+
+  uint8_t opcode = fetch(s, bus);
+  int destination = (opcode >> 3) & 7;
+  int source = opcode & 7;
+  int pair = (opcode >> 4) & 3;
+
+  if (opcode == 0x76)
+  {
+    s->halted = true;
+    s->cycles += 7;
+    return;
+  }
+  if ((opcode & 0xc0) == 0x40)
+  {
+    set_register(s, bus, destination, get_register(s, bus, source));
+    s->cycles += destination == 6 || source == 6 ? 7 : 5;
+    return;
+  }
+  if ((opcode & 0xc0) == 0x80)
+  {
+    alu(s, destination, get_register(s, bus, source));
+    s->cycles += source == 6 ? 7 : 4;
+    return;
+  }
+
+  if ((opcode & 0xc0) == 0)
+  {
+    switch (opcode & 7)
+    {
+    case 0: // NOP and its aliases
+      s->cycles += 4;
+      return;
+    case 1:
+      if (opcode & 0x08) // DAD
+      {
+        uint32_t sum = hl(s) + get_pair(s, pair);
+
+        s->cf = sum > 0xffff;
+        set_pair(s, 2, sum);
+        s->cycles += 10;
+      }
+      else // LXI
+      {
+        set_pair(s, pair, fetch_word(s, bus));
+        s->cycles += 10;
+      }
+      return;
+    case 2:
+      switch (opcode)
+      {
+      case 0x02: // STAX B
+      case 0x12: // STAX D
+        bus->write(bus->context, get_pair(s, pair), s->a);
+        s->cycles += 7;
+        break;
+      case 0x0a: // LDAX B
+      case 0x1a: // LDAX D
+        s->a = bus->read(bus->context, get_pair(s, pair));
+        s->cycles += 7;
+        break;
+      case 0x22: // SHLD
+      {
+        uint16_t addr = fetch_word(s, bus);
+
+        bus->write(bus->context, addr, s->l);
+        bus->write(bus->context, addr + 1, s->h);
+        s->cycles += 16;
+        break;
+      }
+      case 0x2a: // LHLD
+      {
+        uint16_t addr = fetch_word(s, bus);
+
+        s->l = bus->read(bus->context, addr);
+        s->h = bus->read(bus->context, addr + 1);
+        s->cycles += 16;
+        break;
+      }
+      case 0x32: // STA
+        bus->write(bus->context, fetch_word(s, bus), s->a);
+        s->cycles += 13;
+        break;
+      default: // LDA
+        s->a = bus->read(bus->context, fetch_word(s, bus));
+        s->cycles += 13;
+        break;
+      }
+      return;
+    case 3: // INX, DCX
+      set_pair(s, pair, get_pair(s, pair) + (opcode & 0x08 ? -1 : 1));
+      s->cycles += 5;
+      return;
+    case 4: // INR
+    {
+      uint8_t value = get_register(s, bus, destination) + 1;
+
+      s->acf = (value & 0xf) == 0;
+      set_z_s_p(s, value);
+      set_register(s, bus, destination, value);
+      s->cycles += destination == 6 ? 10 : 5;
+      return;
+    }
+    case 5: // DCR
+    {
+      uint8_t value = get_register(s, bus, destination) - 1;
+
+      s->acf = (value & 0xf) != 0xf;
+      set_z_s_p(s, value);
+      set_register(s, bus, destination, value);
+      s->cycles += destination == 6 ? 10 : 5;
+      return;
+    }
+    case 6: // MVI
+      set_register(s, bus, destination, fetch(s, bus));
+      s->cycles += destination == 6 ? 10 : 7;
+      return;
+    default:
+    {
+      uint8_t a = s->a;
+
+      s->cycles += 4;
+      switch (opcode)
+      {
+      case 0x07: // RLC
+        s->a = a << 1 | a >> 7;
+        s->cf = a >> 7;
+        break;
+      case 0x0f: // RRC
+        s->a = a >> 1 | a << 7;
+        s->cf = a & 1;
+        break;
+      case 0x17: // RAL
+        s->a = a << 1 | s->cf;
+        s->cf = a >> 7;
+        break;
+      case 0x1f: // RAR
+        s->a = a >> 1 | s->cf << 7;
+        s->cf = a & 1;
+        break;
+      case 0x27:
+        daa(s);
+        break;
+      case 0x2f: // CMA
+        s->a = ~a;
+        break;
+      case 0x37: // STC
+        s->cf = true;
+        break;
+      default: // CMC
+        s->cf = !s->cf;
+        break;
+      }
+      return;
+    }
+    }
+  }
+
+  // The 0xc0 quarter
+  switch (opcode & 7)
+  {
+  case 0: // Rcc
+    s->cycles += 5;
+    if (condition(s, destination))
+    {
+      s->pc = pop(s, bus);
+      s->cycles += 6;
+    }
+    return;
+  case 1:
+    if (opcode & 0x08)
+    {
+      if (opcode == 0xe9) // PCHL
+      {
+        s->pc = hl(s);
+        s->cycles += 5;
+      }
+      else if (opcode == 0xf9) // SPHL
+      {
+        s->sp = hl(s);
+        s->cycles += 5;
+      }
+      else // RET and its alias
+      {
+        s->pc = pop(s, bus);
+        s->cycles += 10;
+      }
+    }
+    else if (pair == 3) // POP PSW
+    {
+      uint16_t psw = pop(s, bus);
+
+      s->a = psw >> 8;
+      s->sf = psw & 0x80;
+      s->zf = psw & 0x40;
+      s->acf = psw & 0x10;
+      s->pf = psw & 0x04;
+      s->cf = psw & 0x01;
+      s->cycles += 10;
+    }
+    else // POP
+    {
+      set_pair(s, pair, pop(s, bus));
+      s->cycles += 10;
+    }
+    return;
+  case 2: // Jcc
+  {
+    uint16_t addr = fetch_word(s, bus);
+
+    if (condition(s, destination))
+    {
+      s->pc = addr;
+    }
+    s->cycles += 10;
+    return;
+  }
+  case 3:
+    switch (opcode)
+    {
+    case 0xc3: // JMP
+    case 0xcb:
+      s->pc = fetch_word(s, bus);
+      s->cycles += 10;
+      break;
+    case 0xd3: // OUT
+      bus->out(bus->context, fetch(s, bus), s->a);
+      s->cycles += 10;
+      break;
+    case 0xdb: // IN
+      s->a = bus->in(bus->context, fetch(s, bus));
+      s->cycles += 10;
+      break;
+    case 0xe3: // XTHL
+    {
+      uint8_t low = bus->read(bus->context, s->sp);
+      uint8_t high = bus->read(bus->context, s->sp + 1);
+
+      bus->write(bus->context, s->sp, s->l);
+      bus->write(bus->context, s->sp + 1, s->h);
+      s->l = low;
+      s->h = high;
+      s->cycles += 18;
+      break;
+    }
+    case 0xeb: // XCHG
+    {
+      uint16_t de = get_pair(s, 1);
+
+      set_pair(s, 1, hl(s));
+      set_pair(s, 2, de);
+      s->cycles += 4;
+      break;
+    }
+    case 0xf3: // DI
+      s->interrupts_enabled = false;
+      s->cycles += 4;
+      break;
+    default: // EI
+      s->interrupts_enabled = true;
+      s->interrupt_delay = true;
+      s->cycles += 4;
+      break;
+    }
+    return;
+  case 4: // Ccc
+  {
+    uint16_t addr = fetch_word(s, bus);
+
+    s->cycles += 11;
+    if (condition(s, destination))
+    {
+      push(s, bus, s->pc);
+      s->pc = addr;
+      s->cycles += 6;
+    }
+    return;
+  }
+  case 5:
+    if (opcode & 0x08) // CALL and its aliases
+    {
+      uint16_t addr = fetch_word(s, bus);
+
+      push(s, bus, s->pc);
+      s->pc = addr;
+      s->cycles += 17;
+    }
+    else if (pair == 3) // PUSH PSW
+    {
+      uint8_t psw = s->sf << 7 | s->zf << 6 | s->acf << 4 | s->pf << 2 | 0x02 | s->cf;
+
+      push(s, bus, s->a << 8 | psw);
+      s->cycles += 11;
+    }
+    else // PUSH
+    {
+      push(s, bus, get_pair(s, pair));
+      s->cycles += 11;
+    }
+    return;
+  case 6: // ALU with an immediate
+    alu(s, destination, fetch(s, bus));
+    s->cycles += 7;
+    return;
+  default: // RST
+    push(s, bus, s->pc);
+    s->pc = destination << 3;
+    s->cycles += 11;
+    return;
+  }
+}
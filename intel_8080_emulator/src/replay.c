@@ -0,0 +1,283 @@
+#include "replay.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void put_byte(replay *r, uint8_t byte)
+{
+  if (r->size == r->capacity)
+  {
+    size_t capacity = r->capacity ? r->capacity * 2 : 4096;
+    uint8_t *data = realloc(r->data, capacity);
+
+    if (data == NULL)
+    {
+      r->failed = true;
+      return;
+    }
+    r->data = data;
+    r->capacity = capacity;
+  }
+  r->data[r->size++] = byte;
+}
+
+static void put_varint(replay *r, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    put_byte(r, (value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  put_byte(r, value);
+}
+
+// Decodes the event at pos into next. At the end of the data there is no next event
+static void decode_next(replay *r)
+{
+  uint64_t value = 0;
+  int shift = 0;
+
+  r->has_next = false;
+  r->next_pos = r->pos;
+  while (r->pos < r->size && shift < 64)
+  {
+    uint8_t byte = r->data[r->pos++];
+
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    shift += 7;
+    if (!(byte & 0x80))
+    {
+      break;
+    }
+  }
+
+  r->next_interrupt = value & 1;
+  r->next_cycles = r->last_cycles + (value >> 1);
+
+  if (r->next_interrupt)
+  {
+    if (r->pos + 1 > r->size)
+    {
+      return;
+    }
+    r->next_value = r->data[r->pos++];
+  }
+  else
+  {
+    if (r->pos + 2 > r->size)
+    {
+      return;
+    }
+    r->next_port = r->data[r->pos++];
+    r->next_value = r->data[r->pos++];
+  }
+  r->has_next = true;
+}
+
+static void put_event(replay *r, i8080 *p, bool interrupt)
+{
+  put_varint(r, (p->cycles - r->last_cycles) << 1 | interrupt);
+  r->last_cycles = p->cycles;
+  r->events++;
+}
+
+int replay_record(replay *r, i8080 *p)
+{
+  memset(r, 0, sizeof(replay));
+  r->mode = REPLAY_RECORD;
+  r->start_cycles = p->cycles;
+  r->last_cycles = p->cycles;
+
+  r->data = malloc(4096);
+  if (r->data == NULL)
+  {
+    return -1;
+  }
+  r->capacity = 4096;
+
+  p->replay = r;
+  return 0;
+}
+
+void replay_play(replay *r, i8080 *p)
+{
+  r->mode = REPLAY_PLAY;
+  r->last_cycles = r->start_cycles;
+  r->events = 0;
+  r->pos = 0;
+  decode_next(r);
+
+  p->replay = r;
+}
+
+void replay_seek(replay *r, i8080 *p, size_t pos, uint64_t last_cycles)
+{
+  r->mode = REPLAY_PLAY;
+  r->pos = pos;
+  r->last_cycles = last_cycles;
+  decode_next(r);
+
+  p->replay = r;
+}
+
+void replay_truncate(replay *r, i8080 *p)
+{
+  // Everything from the next event not played yet on is dropped
+  if (r->mode == REPLAY_PLAY)
+  {
+    r->size = r->next_pos;
+  }
+  r->mode = REPLAY_RECORD;
+  r->has_next = false;
+
+  p->replay = r;
+}
+
+void replay_discard(replay *r, size_t pos)
+{
+  memmove(r->data, r->data + pos, r->size - pos);
+  r->size -= pos;
+  r->pos = r->pos > pos ? r->pos - pos : 0;
+  r->next_pos = r->next_pos > pos ? r->next_pos - pos : 0;
+}
+
+void replay_detach(replay *r, i8080 *p)
+{
+  if (p->replay == r)
+  {
+    p->replay = NULL;
+  }
+}
+
+void replay_free(replay *r)
+{
+  free(r->data);
+  r->data = NULL;
+  r->size = 0;
+  r->capacity = 0;
+}
+
+static void put_u64(uint8_t *out, uint64_t value)
+{
+  for (int i = 0; i < 8; i++)
+  {
+    out[i] = value >> (i * 8);
+  }
+}
+
+static uint64_t get_u64(const uint8_t *in)
+{
+  uint64_t value = 0;
+
+  for (int i = 0; i < 8; i++)
+  {
+    value |= (uint64_t)in[i] << (i * 8);
+  }
+  return value;
+}
+
+int replay_save(const replay *r, FILE *out)
+{
+  uint8_t header[21];
+
+  if (r->failed)
+  {
+    return -1;
+  }
+
+  memcpy(header, REPLAY_MAGIC, 4);
+  header[4] = REPLAY_VERSION;
+  put_u64(header + 5, r->start_cycles);
+  put_u64(header + 13, r->size);
+
+  if (fwrite(header, sizeof(header), 1, out) != 1)
+  {
+    return -1;
+  }
+  if (r->size > 0 && fwrite(r->data, r->size, 1, out) != 1)
+  {
+    return -1;
+  }
+  return 0;
+}
+
+int replay_load(replay *r, FILE *in)
+{
+  uint8_t header[21];
+
+  memset(r, 0, sizeof(replay));
+  if (fread(header, sizeof(header), 1, in) != 1)
+  {
+    return -1;
+  }
+  if (memcmp(header, REPLAY_MAGIC, 4) != 0 || header[4] != REPLAY_VERSION)
+  {
+    return -1;
+  }
+
+  // The data can't be longer than what is left of the file
+  uint64_t size = get_u64(header + 13);
+  long here = ftell(in);
+  if (here < 0 || fseek(in, 0, SEEK_END) != 0)
+  {
+    return -1;
+  }
+  long end = ftell(in);
+  if (end < here || fseek(in, here, SEEK_SET) != 0 || size > (uint64_t)(end - here))
+  {
+    return -1;
+  }
+
+  r->start_cycles = get_u64(header + 5);
+  r->size = size;
+  r->capacity = r->size;
+  r->data = malloc(r->size ? r->size : 1);
+  if (r->data == NULL)
+  {
+    return -1;
+  }
+  if (r->size > 0 && fread(r->data, r->size, 1, in) != 1)
+  {
+    replay_free(r);
+    return -1;
+  }
+  return 0;
+}
+
+void replay_record_in(replay *r, i8080 *p, uint8_t port, uint8_t value)
+{
+  put_event(r, p, false);
+  put_byte(r, port);
+  put_byte(r, value);
+}
+
+void replay_record_interrupt(replay *r, i8080 *p, uint8_t opcode)
+{
+  put_event(r, p, true);
+  put_byte(r, opcode);
+}
+
+uint8_t replay_play_in(replay *r, i8080 *p, uint8_t port)
+{
+  if (!r->has_next || r->next_interrupt || r->next_cycles != p->cycles || r->next_port != port)
+  {
+    i8080_stop(p, I8080_EXIT_REPLAY);
+    return p->a;
+  }
+
+  uint8_t value = r->next_value;
+
+  r->last_cycles = r->next_cycles;
+  r->events++;
+  decode_next(r);
+  return value;
+}
+
+uint8_t replay_take_interrupt(replay *r)
+{
+  uint8_t opcode = r->next_value;
+
+  r->last_cycles = r->next_cycles;
+  r->events++;
+  decode_next(r);
+  return opcode;
+}
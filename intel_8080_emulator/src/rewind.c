@@ -0,0 +1,245 @@
+#include "rewind.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void arm_pages(i8080 *p)
+{
+  for (int page = 0; page < 256; page++)
+  {
+    p->page_flags[page] |= PAGE_REWIND;
+  }
+}
+
+static void disarm_pages(i8080 *p)
+{
+  for (int page = 0; page < 256; page++)
+  {
+    p->page_flags[page] &= ~PAGE_REWIND;
+  }
+}
+
+static void free_pages(rewind_buffer *rw, rewind_keyframe *kf)
+{
+  rw->used -= kf->pages_count * sizeof(rewind_page);
+  free(kf->pages);
+  kf->pages = NULL;
+  kf->pages_count = 0;
+  kf->pages_capacity = 0;
+}
+
+// Drops the whole history. The next instruction takes a new keyframe
+static void forget(rewind_buffer *rw)
+{
+  for (int i = 0; i < rw->count; i++)
+  {
+    free_pages(rw, &rw->keyframes[i]);
+  }
+  rw->count = 0;
+  rw->used = 0;
+  rw->next_keyframe = 0;
+}
+
+// Drops the oldest keyframes while over budget, and the input recorded before the oldest one left
+static void trim(rewind_buffer *rw)
+{
+  int dropped = 0;
+
+  while (rw->count - dropped > 1 && rw->used > rw->budget)
+  {
+    free_pages(rw, &rw->keyframes[dropped]);
+    rw->used -= sizeof(rewind_keyframe);
+    dropped++;
+  }
+  if (dropped == 0)
+  {
+    return;
+  }
+
+  rw->count -= dropped;
+  memmove(rw->keyframes, rw->keyframes + dropped, rw->count * sizeof(rewind_keyframe));
+
+  size_t pos = rw->keyframes[0].replay_pos;
+  if (pos > rw->input.size / 2)
+  {
+    replay_discard(&rw->input, pos);
+    for (int i = 0; i < rw->count; i++)
+    {
+      rw->keyframes[i].replay_pos -= pos;
+    }
+  }
+}
+
+int rewind_init(rewind_buffer *rw, i8080 *p, uint64_t interval, size_t budget)
+{
+  if (p->replay != NULL)
+  {
+    return -1;
+  }
+
+  memset(rw, 0, sizeof(rewind_buffer));
+  rw->interval = interval;
+  rw->budget = budget;
+
+  if (replay_record(&rw->input, p) != 0)
+  {
+    return -1;
+  }
+
+  p->rewind = rw;
+  rewind_take_keyframe(rw, p);
+  return 0;
+}
+
+void rewind_free(rewind_buffer *rw, i8080 *p)
+{
+  forget(rw);
+  free(rw->keyframes);
+  rw->keyframes = NULL;
+  rw->capacity = 0;
+
+  replay_detach(&rw->input, p);
+  replay_free(&rw->input);
+
+  if (p->rewind == rw)
+  {
+    p->rewind = NULL;
+    disarm_pages(p);
+  }
+}
+
+uint64_t rewind_available(const rewind_buffer *rw)
+{
+  if (rw->count == 0)
+  {
+    return 0;
+  }
+  return rw->instructions - rw->keyframes[0].instructions;
+}
+
+void rewind_take_keyframe(rewind_buffer *rw, i8080 *p)
+{
+  rw->next_keyframe = p->cycles + rw->interval;
+
+  if (rw->count == rw->capacity)
+  {
+    int capacity = rw->capacity ? rw->capacity * 2 : 64;
+    rewind_keyframe *keyframes = realloc(rw->keyframes, capacity * sizeof(rewind_keyframe));
+
+    if (keyframes == NULL)
+    {
+      return;
+    }
+    rw->keyframes = keyframes;
+    rw->capacity = capacity;
+  }
+
+  rewind_keyframe *kf = &rw->keyframes[rw->count++];
+
+  memset(kf, 0, sizeof(rewind_keyframe));
+  i8080_save_state(p, &kf->state);
+  kf->instructions = rw->instructions;
+
+  // While going forward after a step back the input is played, and only what was played counts
+  kf->replay_pos = rw->input.mode == REPLAY_PLAY ? rw->input.next_pos : rw->input.size;
+  kf->replay_cycles = rw->input.last_cycles;
+
+  rw->used += sizeof(rewind_keyframe);
+  arm_pages(p);
+  trim(rw);
+}
+
+void rewind_save_page(rewind_buffer *rw, i8080 *p, uint8_t page)
+{
+  rewind_keyframe *kf = &rw->keyframes[rw->count - 1];
+
+  p->page_flags[page] &= ~PAGE_REWIND;
+
+  if (kf->pages_count == kf->pages_capacity)
+  {
+    int capacity = kf->pages_capacity ? kf->pages_capacity * 2 : 8;
+    rewind_page *pages = realloc(kf->pages, capacity * sizeof(rewind_page));
+
+    if (pages == NULL)
+    {
+      // Without the page the history is wrong
+      forget(rw);
+      disarm_pages(p);
+      return;
+    }
+    kf->pages = pages;
+    kf->pages_capacity = capacity;
+  }
+
+  rewind_page *saved = &kf->pages[kf->pages_count++];
+
+  saved->page = page;
+  for (int i = 0; i < 256; i++)
+  {
+    saved->data[i] = p->read_byte((page << 8) | i);
+  }
+
+  rw->used += sizeof(rewind_page);
+  trim(rw);
+}
+
+int rewind_step_back(rewind_buffer *rw, i8080 *p, uint64_t instructions)
+{
+  if (rw->count == 0 || instructions > rewind_available(rw))
+  {
+    return -1;
+  }
+
+  uint64_t target = rw->instructions - instructions;
+  int k = rw->count - 1;
+
+  while (rw->keyframes[k].instructions > target)
+  {
+    k--;
+  }
+
+  // Newest first, so each page ends up as it was at keyframe k
+  for (int j = rw->count - 1; j >= k; j--)
+  {
+    rewind_keyframe *kf = &rw->keyframes[j];
+
+    for (int i = kf->pages_count - 1; i >= 0; i--)
+    {
+      for (int offset = 0; offset < 256; offset++)
+      {
+        restore_byte(p, (kf->pages[i].page << 8) | offset, kf->pages[i].data[offset]);
+      }
+    }
+    free_pages(rw, kf);
+    if (j > k)
+    {
+      rw->used -= sizeof(rewind_keyframe);
+    }
+  }
+  rw->count = k + 1;
+
+  rewind_keyframe *kf = &rw->keyframes[k];
+
+  i8080_load_state(p, &kf->state);
+  rw->instructions = kf->instructions;
+  rw->next_keyframe = kf->state.cycles + rw->interval;
+  arm_pages(p);
+
+  // The devices already got the output of the instructions run again
+  uint8_t (*devices_out)(uint8_t port, uint8_t value) = p->port_out;
+
+  p->port_out = NULL;
+  replay_seek(&rw->input, p, kf->replay_pos, kf->replay_cycles);
+  while (rw->instructions < target)
+  {
+    i8080_step(p);
+    if (p->exit_reason >= I8080_EXIT_INVALID_OPCODE)
+    {
+      break;
+    }
+  }
+  replay_truncate(&rw->input, p);
+  p->port_out = devices_out;
+
+  return rw->instructions == target ? 0 : -1;
+}
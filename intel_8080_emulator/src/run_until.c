@@ -0,0 +1,216 @@
+#include "run_until.h"
+#include <string.h>
+
+static bool get_bit(const uint8_t *bitmap, uint16_t index)
+{
+  return (bitmap[index >> 3] >> (index & 7)) & 1;
+}
+
+static void set_bit(uint8_t *bitmap, uint16_t index)
+{
+  bitmap[index >> 3] |= 1 << (index & 7);
+}
+
+int run_until_compile(run_until *u, const until_condition *conditions, int count)
+{
+  if (count > RUN_UNTIL_MAX_CONDITIONS)
+  {
+    return -1;
+  }
+
+  memset(u, 0, sizeof(run_until));
+  memcpy(u->conditions, conditions, count * sizeof(until_condition));
+  u->count = count;
+  u->max_instructions = UINT64_MAX;
+  u->instructions_condition = -1;
+  u->max_cycles = UINT64_MAX;
+  u->cycles_condition = -1;
+  u->met = -1;
+
+  for (int i = 0; i < count; i++)
+  {
+    const until_condition *condition = &conditions[i];
+
+    switch (condition->kind)
+    {
+    case UNTIL_PC:
+      set_bit(u->pcs, condition->addr);
+      break;
+    case UNTIL_MEMORY:
+      u->memory[u->memory_count++] = i;
+      break;
+    case UNTIL_REGISTER:
+      u->registers[u->registers_count++] = i;
+      break;
+    case UNTIL_INSTRUCTIONS:
+      if (condition->count < u->max_instructions)
+      {
+        u->max_instructions = condition->count;
+        u->instructions_condition = i;
+      }
+      break;
+    case UNTIL_CYCLES:
+      if (condition->count < u->max_cycles)
+      {
+        u->max_cycles = condition->count;
+        u->cycles_condition = i;
+      }
+      break;
+    case UNTIL_PORT_IN:
+      set_bit(u->ports_in, condition->port);
+      u->has_ports = true;
+      break;
+    case UNTIL_PORT_OUT:
+      set_bit(u->ports_out, condition->port);
+      u->has_ports = true;
+      break;
+    }
+  }
+
+  u->per_step = u->registers_count > 0 || u->instructions_condition >= 0;
+
+  return 0;
+}
+
+static void meet(run_until *u, i8080 *p, int condition)
+{
+  if (u->met < 0)
+  {
+    u->met = condition;
+  }
+  i8080_stop(p, I8080_EXIT_UNTIL);
+}
+
+bool run_until_check_pc(run_until *u, i8080 *p)
+{
+  if (!get_bit(u->pcs, p->pc))
+  {
+    return false;
+  }
+
+  for (int i = 0; i < u->count; i++)
+  {
+    if (u->conditions[i].kind == UNTIL_PC && u->conditions[i].addr == p->pc)
+    {
+      meet(u, p, i);
+      break;
+    }
+  }
+  return true;
+}
+
+static uint16_t register_value(i8080 *p, enum until_register reg)
+{
+  switch (reg)
+  {
+  case REG_A:
+    return p->a;
+  case REG_B:
+    return p->b;
+  case REG_C:
+    return p->c;
+  case REG_D:
+    return p->d;
+  case REG_E:
+    return p->e;
+  case REG_H:
+    return p->h;
+  case REG_L:
+    return p->l;
+  case REG_BC:
+    return (p->b << 8) | p->c;
+  case REG_DE:
+    return (p->d << 8) | p->e;
+  case REG_HL:
+    return (p->h << 8) | p->l;
+  default:
+    return p->sp;
+  }
+}
+
+bool run_until_check_step(run_until *u, i8080 *p)
+{
+  if (++u->instructions >= u->max_instructions)
+  {
+    meet(u, p, u->instructions_condition);
+    return true;
+  }
+
+  for (int i = 0; i < u->registers_count; i++)
+  {
+    const until_condition *condition = &u->conditions[u->registers[i]];
+
+    if (register_value(p, condition->reg) == condition->value)
+    {
+      meet(u, p, u->registers[i]);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void run_until_check_write(run_until *u, i8080 *p, uint16_t addr, uint8_t value)
+{
+  for (int i = 0; i < u->memory_count; i++)
+  {
+    const until_condition *condition = &u->conditions[u->memory[i]];
+
+    if (condition->addr == addr && condition->value == value)
+    {
+      meet(u, p, u->memory[i]);
+      return;
+    }
+  }
+}
+
+void run_until_check_port(run_until *u, i8080 *p, uint8_t port, bool out)
+{
+  if (get_bit(out ? u->ports_out : u->ports_in, port))
+  {
+    enum until_kind kind = out ? UNTIL_PORT_OUT : UNTIL_PORT_IN;
+
+    for (int i = 0; i < u->count; i++)
+    {
+      if (u->conditions[i].kind == kind && u->conditions[i].port == port)
+      {
+        meet(u, p, i);
+        return;
+      }
+    }
+  }
+}
+
+int i8080_run_until(i8080 *p, run_until *u)
+{
+  u->instructions = 0;
+  u->met = -1;
+
+  for (int i = 0; i < u->count; i++)
+  {
+    if (u->conditions[i].kind == UNTIL_PC)
+    {
+      p->page_flags[u->conditions[i].addr >> 8] |= PAGE_UNTIL_PC;
+    }
+    else if (u->conditions[i].kind == UNTIL_MEMORY)
+    {
+      p->page_flags[u->conditions[i].addr >> 8] |= PAGE_UNTIL_WRITE;
+    }
+  }
+
+  p->until = u;
+  enum i8080_exit reason = i8080_run(p, u->max_cycles);
+  p->until = NULL;
+
+  for (int page = 0; page < 256; page++)
+  {
+    p->page_flags[page] &= ~(PAGE_UNTIL_PC | PAGE_UNTIL_WRITE);
+  }
+
+  if (u->met < 0 && reason == I8080_EXIT_BUDGET && u->cycles_condition >= 0)
+  {
+    u->met = u->cycles_condition;
+  }
+
+  return u->met;
+}
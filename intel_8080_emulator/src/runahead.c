@@ -0,0 +1,127 @@
+#include "runahead.h"
+#include "replay.h"
+#include <string.h>
+
+// What is put aside while the frames ahead run
+typedef struct observers
+{
+  struct profiler *profiler;
+  struct callgraph *callgraph;
+  struct coverage *coverage;
+  struct heatmap *heatmap;
+  struct rewind_buffer *rewind;
+  uint16_t rewind_pages[256];
+  replay replay;
+} observers;
+
+void runahead_init(runahead *ra, uint64_t frame_cycles, int frames)
+{
+  memset(ra, 0, sizeof(runahead));
+  ra->frame_cycles = frame_cycles;
+  ra->frames = frames;
+}
+
+static enum i8080_exit run_frame(runahead *ra, i8080 *p)
+{
+  if (ra->frame_begin != NULL)
+  {
+    ra->frame_begin(p, ra->context);
+  }
+  return i8080_run_frame(p, ra->frame_cycles);
+}
+
+// Detaches what counts or records the run, and marks where the replay is
+static void put_aside(observers *o, i8080 *p)
+{
+  o->profiler = p->profiler;
+  o->callgraph = p->callgraph;
+  o->coverage = p->coverage;
+  o->heatmap = p->heatmap;
+  o->rewind = p->rewind;
+  p->profiler = NULL;
+  p->callgraph = NULL;
+  p->coverage = NULL;
+  p->heatmap = NULL;
+  p->rewind = NULL;
+
+  // The pages rewind still has to save at their first write
+  for (int page = 0; page < 256; page++)
+  {
+    o->rewind_pages[page] = p->page_flags[page] & PAGE_REWIND;
+    p->page_flags[page] &= ~PAGE_REWIND;
+  }
+
+  // The replay stays attached so the frames ahead get the input being played
+  if (p->replay != NULL)
+  {
+    o->replay = *p->replay;
+  }
+}
+
+static void bring_back(observers *o, i8080 *p)
+{
+  p->profiler = o->profiler;
+  p->callgraph = o->callgraph;
+  p->coverage = o->coverage;
+  p->heatmap = o->heatmap;
+  p->rewind = o->rewind;
+
+  for (int page = 0; page < 256; page++)
+  {
+    p->page_flags[page] |= o->rewind_pages[page];
+  }
+
+  // Back to where the replay was, dropping what was recorded ahead. Recording may have moved the data
+  if (p->replay != NULL)
+  {
+    o->replay.data = p->replay->data;
+    o->replay.capacity = p->replay->capacity;
+    *p->replay = o->replay;
+  }
+}
+
+// Shows the state the machine has now
+static void present(runahead *ra, i8080 *p)
+{
+  if (ra->present != NULL)
+  {
+    ra->present(p, ra->context);
+  }
+}
+
+enum i8080_exit runahead_frame(runahead *ra, i8080 *p)
+{
+  enum i8080_exit reason = run_frame(ra, p);
+  observers aside;
+
+  if (reason != I8080_EXIT_BUDGET)
+  {
+    return reason;
+  }
+  if (ra->frames == 0)
+  {
+    present(ra, p);
+    return reason;
+  }
+
+  snapshot_take(&ra->snap, p);
+  put_aside(&aside, p);
+  ra->speculative = true;
+
+  for (int i = 0; i < ra->frames; i++)
+  {
+    if (run_frame(ra, p) != I8080_EXIT_BUDGET)
+    {
+      break;
+    }
+  }
+  present(ra, p);
+
+  ra->speculative = false;
+  snapshot_restore(&ra->snap, p);
+  snapshot_release(&ra->snap, p);
+  bring_back(&aside, p);
+  p->exit_reason = reason;
+
+  return reason;
+}
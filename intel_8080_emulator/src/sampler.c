@@ -0,0 +1,106 @@
+#include "sampler.h"
+#include "disassembler.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int sampling_loop(void *arg)
+{
+  sampler *s = arg;
+  struct timespec interval = {
+      .tv_sec = s->interval_us / 1000000,
+      .tv_nsec = (s->interval_us % 1000000) * 1000,
+  };
+  uint64_t previous = atomic_load_explicit(&s->snapshot, memory_order_relaxed);
+
+  while (atomic_load_explicit(&s->running, memory_order_relaxed))
+  {
+    thrd_sleep(&interval, NULL);
+
+    uint64_t snapshot = atomic_load_explicit(&s->snapshot, memory_order_relaxed);
+
+    if (snapshot == previous)
+    {
+      s->idle_samples++;
+      continue;
+    }
+
+    s->histogram[snapshot & 0xffff]++;
+    s->samples++;
+    previous = snapshot;
+  }
+
+  return 0;
+}
+
+int sampler_start(sampler *s, uint32_t interval_us)
+{
+  memset(s->histogram, 0, sizeof(s->histogram));
+  s->samples = 0;
+  s->idle_samples = 0;
+  s->interval_us = interval_us;
+  atomic_store(&s->snapshot, 0);
+  atomic_store(&s->running, true);
+
+  if (thrd_create(&s->thread, sampling_loop, s) != thrd_success)
+  {
+    atomic_store(&s->running, false);
+    return -1;
+  }
+
+  return 0;
+}
+
+void sampler_stop(sampler *s)
+{
+  atomic_store(&s->running, false);
+  thrd_join(s->thread, NULL);
+}
+
+typedef struct pc_samples
+{
+  uint16_t pc;
+  uint64_t samples;
+} pc_samples;
+
+static int compare_pc_samples(const void *a, const void *b)
+{
+  uint64_t samples_a = ((const pc_samples *)a)->samples;
+  uint64_t samples_b = ((const pc_samples *)b)->samples;
+  return (samples_a < samples_b) - (samples_a > samples_b);
+}
+
+void sampler_write_report(sampler *s, i8080 *p, FILE *out)
+{
+  pc_samples *sampled = malloc(0x10000 * sizeof(pc_samples));
+  uint32_t count = 0;
+  char text[32];
+
+  if (sampled == NULL)
+  {
+    return;
+  }
+
+  for (uint32_t pc = 0; pc < 0x10000; pc++)
+  {
+    if (s->histogram[pc] > 0)
+    {
+      sampled[count].pc = pc;
+      sampled[count].samples = s->histogram[pc];
+      count++;
+    }
+  }
+
+  qsort(sampled, count, sizeof(pc_samples), compare_pc_samples);
+
+  fprintf(out, "address,instruction,samples,percent\n");
+  for (uint32_t i = 0; i < count; i++)
+  {
+    disassemble(p, sampled[i].pc, text, sizeof(text));
+    fprintf(out, "%04x,%s,%llu,%.2f\n", sampled[i].pc, text,
+            (unsigned long long)sampled[i].samples,
+            100.0 * sampled[i].samples / s->samples);
+  }
+
+  free(sampled);
+}
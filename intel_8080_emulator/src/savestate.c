@@ -0,0 +1,298 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "savestate.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SAVESTATE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// magic, version, 7 registers, bp sp pc, flags, interrupt opcode, cycles, device size, more flags
+#define HEADER_SIZE (4 + 1 + 7 + 6 + 1 + 1 + 8 + 4 + 1)
+
+#define FLAG_Z 0x01
+#define FLAG_S 0x02
+#define FLAG_P 0x04
+#define FLAG_C 0x08
+#define FLAG_AC 0x10
+#define FLAG_HALTED 0x20
+#define FLAG_INTERRUPT_PENDING 0x40
+#define FLAG_INTERRUPTS_ENABLED 0x80
+
+// In the second byte of flags
+#define FLAG_INTERRUPT_DELAY 0x01
+
+static void put_le(uint8_t *out, uint64_t value, int bytes)
+{
+  for (int i = 0; i < bytes; i++)
+  {
+    out[i] = value >> (i * 8);
+  }
+}
+
+static uint64_t get_le(const uint8_t *in, int bytes)
+{
+  uint64_t value = 0;
+
+  for (int i = 0; i < bytes; i++)
+  {
+    value |= (uint64_t)in[i] << (i * 8);
+  }
+  return value;
+}
+
+static void read_page(void *context, uint8_t page, uint8_t *data)
+{
+  i8080 *p = context;
+
+  for (int offset = 0; offset < 256; offset++)
+  {
+    data[offset] = p->read_byte((page << 8) | offset);
+  }
+}
+
+int savestate_save(i8080 *p, const void *device, size_t device_size, FILE *out)
+{
+  i8080_state s;
+
+  i8080_save_state(p, &s);
+  return savestate_write(&s, &read_page, p, device, device_size, out);
+}
+
+int savestate_write(const i8080_state *s, savestate_page_reader read_page, void *context,
+                    const void *device, size_t device_size, FILE *out)
+{
+  uint8_t header[HEADER_SIZE];
+  uint8_t table[512];
+  uint8_t *memory = malloc(0x10000);
+
+  if (memory == NULL || device_size > UINT32_MAX)
+  {
+    free(memory);
+    return -1;
+  }
+
+  memcpy(header, SAVESTATE_MAGIC, 4);
+  header[4] = SAVESTATE_VERSION;
+  header[5] = s->a;
+  header[6] = s->b;
+  header[7] = s->c;
+  header[8] = s->d;
+  header[9] = s->e;
+  header[10] = s->h;
+  header[11] = s->l;
+  put_le(header + 12, s->bp, 2);
+  put_le(header + 14, s->sp, 2);
+  put_le(header + 16, s->pc, 2);
+  header[18] = (s->zf ? FLAG_Z : 0) | (s->sf ? FLAG_S : 0) | (s->pf ? FLAG_P : 0) | (s->cf ? FLAG_C : 0) |
+               (s->acf ? FLAG_AC : 0) | (s->halted ? FLAG_HALTED : 0) |
+               (s->interrupt_pending ? FLAG_INTERRUPT_PENDING : 0) |
+               (s->interrupts_enabled ? FLAG_INTERRUPTS_ENABLED : 0);
+  header[19] = s->interrupt_opcode;
+  put_le(header + 20, s->cycles, 8);
+  put_le(header + 28, device_size, 4);
+  header[32] = s->interrupt_delay ? FLAG_INTERRUPT_DELAY : 0;
+
+  for (int page = 0; page < 256; page++)
+  {
+    uint8_t *data = memory + (page << 8);
+    int offset = 1;
+
+    read_page(context, page, data);
+    while (offset < 256 && data[offset] == data[0])
+    {
+      offset++;
+    }
+    table[page * 2] = offset == 256 ? SAVESTATE_PAGE_FILL : SAVESTATE_PAGE_RAW;
+    table[page * 2 + 1] = data[0];
+  }
+
+  int failed = fwrite(header, sizeof(header), 1, out) != 1;
+
+  if (!failed && device_size > 0)
+  {
+    failed = fwrite(device, device_size, 1, out) != 1;
+  }
+  if (!failed)
+  {
+    failed = fwrite(table, sizeof(table), 1, out) != 1;
+  }
+  for (int page = 0; page < 256 && !failed; page++)
+  {
+    if (table[page * 2] == SAVESTATE_PAGE_RAW)
+    {
+      failed = fwrite(memory + (page << 8), 256, 1, out) != 1;
+    }
+  }
+
+  free(memory);
+  return failed ? -1 : 0;
+}
+
+int savestate_restore(i8080 *p, const uint8_t *data, size_t size, void *device, size_t device_size, bool fresh)
+{
+  if (size < HEADER_SIZE || memcmp(data, SAVESTATE_MAGIC, 4) != 0 || data[4] != SAVESTATE_VERSION)
+  {
+    return -1;
+  }
+  if (get_le(data + 28, 4) != device_size)
+  {
+    return -1;
+  }
+
+  const uint8_t *table = data + HEADER_SIZE + device_size;
+  const uint8_t *pages = table + 512;
+  size_t raw = 0;
+
+  if (size < HEADER_SIZE + device_size + 512)
+  {
+    return -1;
+  }
+  for (int page = 0; page < 256; page++)
+  {
+    if (table[page * 2] == SAVESTATE_PAGE_RAW)
+    {
+      raw++;
+    }
+    else if (table[page * 2] != SAVESTATE_PAGE_FILL)
+    {
+      return -1;
+    }
+  }
+  if (size < HEADER_SIZE + device_size + 512 + raw * 256)
+  {
+    return -1;
+  }
+
+  // The state is whole, from here on nothing fails
+  i8080_state s;
+
+  s.a = data[5];
+  s.b = data[6];
+  s.c = data[7];
+  s.d = data[8];
+  s.e = data[9];
+  s.h = data[10];
+  s.l = data[11];
+  s.bp = get_le(data + 12, 2);
+  s.sp = get_le(data + 14, 2);
+  s.pc = get_le(data + 16, 2);
+  s.zf = data[18] & FLAG_Z;
+  s.sf = data[18] & FLAG_S;
+  s.pf = data[18] & FLAG_P;
+  s.cf = data[18] & FLAG_C;
+  s.acf = data[18] & FLAG_AC;
+  s.halted = data[18] & FLAG_HALTED;
+  s.interrupt_pending = data[18] & FLAG_INTERRUPT_PENDING;
+  s.interrupts_enabled = data[18] & FLAG_INTERRUPTS_ENABLED;
+  s.interrupt_delay = data[32] & FLAG_INTERRUPT_DELAY;
+  s.interrupt_opcode = data[19];
+  s.cycles = get_le(data + 20, 8);
+  i8080_load_state(p, &s);
+
+  if (device_size > 0)
+  {
+    memcpy(device, data + HEADER_SIZE, device_size);
+  }
+
+  for (int page = 0; page < 256; page++)
+  {
+    uint8_t kind = table[page * 2];
+    uint8_t fill = table[page * 2 + 1];
+
+    if (kind == SAVESTATE_PAGE_RAW)
+    {
+      for (int offset = 0; offset < 256; offset++)
+      {
+        restore_byte(p, (page << 8) | offset, pages[offset]);
+      }
+      pages += 256;
+    }
+    else if (!fresh || fill != 0)
+    {
+      for (int offset = 0; offset < 256; offset++)
+      {
+        restore_byte(p, (page << 8) | offset, fill);
+      }
+    }
+  }
+
+  return 0;
+}
+
+int savestate_load(i8080 *p, const char *path, void *device, size_t device_size, bool fresh)
+{
+#ifdef SAVESTATE_MMAP
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+
+  if (fd < 0)
+  {
+    return -1;
+  }
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+  {
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (data != MAP_FAILED)
+    {
+      int result = savestate_restore(p, data, st.st_size, device, device_size, fresh);
+
+      munmap(data, st.st_size);
+      close(fd);
+      return result;
+    }
+  }
+  close(fd);
+#endif
+
+  // Read the whole file where it can't be mapped
+  FILE *in = fopen(path, "rb");
+
+  if (in == NULL)
+  {
+    return -1;
+  }
+
+  size_t size = 0, capacity = 0x4000;
+  uint8_t *data = malloc(capacity);
+
+  while (data != NULL)
+  {
+    size += fread(data + size, 1, capacity - size, in);
+    if (size < capacity)
+    {
+      break;
+    }
+
+    uint8_t *grown = realloc(data, capacity * 2);
+
+    if (grown == NULL)
+    {
+      free(data);
+      data = NULL;
+      break;
+    }
+    data = grown;
+    capacity *= 2;
+  }
+  fclose(in);
+
+  if (data == NULL)
+  {
+    return -1;
+  }
+
+  int result = savestate_restore(p, data, size, device, device_size, fresh);
+
+  free(data);
+  return result;
+}
@@ -0,0 +1,53 @@
+#include "snapshot.h"
+#include "utils.h"
+
+void snapshot_take(snapshot *s, i8080 *p)
+{
+  i8080_save_state(p, &s->state);
+  s->saved_count = 0;
+
+  for (int page = 0; page < 256; page++)
+  {
+    p->page_flags[page] |= PAGE_SNAPSHOT;
+  }
+  p->snapshot = s;
+}
+
+void snapshot_restore(snapshot *s, i8080 *p)
+{
+  for (int i = 0; i < s->saved_count; i++)
+  {
+    uint8_t page = s->saved[i];
+
+    for (int offset = 0; offset < 256; offset++)
+    {
+      restore_byte(p, (page << 8) | offset, s->pages[page][offset]);
+    }
+    p->page_flags[page] |= PAGE_SNAPSHOT;
+  }
+  s->saved_count = 0;
+
+  i8080_load_state(p, &s->state);
+}
+
+void snapshot_release(snapshot *s, i8080 *p)
+{
+  for (int page = 0; page < 256; page++)
+  {
+    p->page_flags[page] &= ~PAGE_SNAPSHOT;
+  }
+  if (p->snapshot == s)
+  {
+    p->snapshot = NULL;
+  }
+}
+
+void snapshot_save_page(snapshot *s, i8080 *p, uint8_t page)
+{
+  for (int offset = 0; offset < 256; offset++)
+  {
+    s->pages[page][offset] = p->read_byte((page << 8) | offset);
+  }
+  s->saved[s->saved_count++] = page;
+  p->page_flags[page] &= ~PAGE_SNAPSHOT;
+}
@@ -0,0 +1,112 @@
+#include "state_hash.h"
+#include <stdlib.h>
+#include <string.h>
+
+int state_hash_attach(state_hash *h, i8080 *p)
+{
+  memset(h, 0, sizeof(state_hash));
+
+  for (uint32_t addr = 0; addr < 0x10000; addr++)
+  {
+    h->memory ^= state_hash_mix(addr << 8 | p->read_byte(addr));
+  }
+
+  h->visited_capacity = 1024;
+  h->visited = calloc(h->visited_capacity, sizeof(uint64_t));
+  if (h->visited == NULL)
+  {
+    return -1;
+  }
+
+  p->state_hash = h;
+  return 0;
+}
+
+void state_hash_detach(state_hash *h, i8080 *p)
+{
+  free(h->visited);
+  h->visited = NULL;
+  h->visited_count = 0;
+  h->visited_capacity = 0;
+
+  if (p->state_hash == h)
+  {
+    p->state_hash = NULL;
+  }
+}
+
+uint64_t state_hash_value(const state_hash *h, const i8080 *p)
+{
+  uint64_t registers = (uint64_t)p->a << 56 | (uint64_t)p->b << 48 | (uint64_t)p->c << 40 | (uint64_t)p->d << 32 |
+                       (uint64_t)p->e << 24 | (uint64_t)p->h << 16 | (uint64_t)p->l << 8 | p->interrupt_opcode;
+  uint64_t pointers = (uint64_t)p->bp << 32 | (uint64_t)p->sp << 16 | p->pc;
+  uint64_t flags = p->zf | p->sf << 1 | p->pf << 2 | p->cf << 3 | p->acf << 4 | p->halted << 5 |
+                   p->interrupt_pending << 6 | p->interrupts_enabled << 7 | p->interrupt_delay << 8;
+
+  return h->memory ^ state_hash_mix(registers) ^ state_hash_mix(pointers ^ flags << 48 ^ 0x8080ULL << 56);
+}
+
+// Inserts without growing. Zero marks an empty slot, so the zero hash is kept apart
+static bool insert(state_hash *h, uint64_t hash)
+{
+  size_t mask = h->visited_capacity - 1;
+  size_t slot = hash & mask;
+
+  while (h->visited[slot] != 0)
+  {
+    if (h->visited[slot] == hash)
+    {
+      return true;
+    }
+    slot = (slot + 1) & mask;
+  }
+  h->visited[slot] = hash;
+  h->visited_count++;
+  return false;
+}
+
+int state_hash_visit(state_hash *h, i8080 *p)
+{
+  uint64_t hash = state_hash_value(h, p);
+
+  if (hash == 0)
+  {
+    bool seen = h->visited_zero;
+
+    h->visited_zero = true;
+    return seen;
+  }
+
+  // Keep the load under 1/2
+  if ((h->visited_count + 1) * 2 > h->visited_capacity)
+  {
+    uint64_t *old = h->visited;
+    size_t old_capacity = h->visited_capacity;
+
+    h->visited = calloc(old_capacity * 2, sizeof(uint64_t));
+    if (h->visited == NULL)
+    {
+      h->visited = old;
+      return -1;
+    }
+    h->visited_capacity = old_capacity * 2;
+    h->visited_count = 0;
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+      if (old[i] != 0)
+      {
+        insert(h, old[i]);
+      }
+    }
+    free(old);
+  }
+
+  return insert(h, hash);
+}
+
+void state_hash_clear_visited(state_hash *h)
+{
+  memset(h->visited, 0, h->visited_capacity * sizeof(uint64_t));
+  h->visited_count = 0;
+  h->visited_zero = false;
+}
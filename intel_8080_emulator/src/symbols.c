@@ -0,0 +1,123 @@
+#include "symbols.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int compare_symbols(const void *a, const void *b)
+{
+  return ((const symbol *)a)->addr - ((const symbol *)b)->addr;
+}
+
+int symbols_load(symbol_map *map, const char *path)
+{
+  FILE *file = fopen(path, "r");
+  char line[128];
+  uint32_t capacity = 256;
+
+  if (file == NULL)
+  {
+    return -1;
+  }
+
+  free(map->symbols);
+  map->symbols = malloc(capacity * sizeof(symbol));
+  map->count = 0;
+
+  while (map->symbols != NULL && fgets(line, sizeof(line), file) != NULL)
+  {
+    unsigned int addr;
+    char name[32];
+
+    if (line[0] == ';' || line[0] == '#' || sscanf(line, "%x %31s", &addr, name) != 2)
+    {
+      continue;
+    }
+
+    if (map->count == capacity)
+    {
+      capacity *= 2;
+      symbol *symbols = realloc(map->symbols, capacity * sizeof(symbol));
+
+      if (symbols == NULL)
+      {
+        free(map->symbols);
+        map->symbols = NULL;
+        break;
+      }
+      map->symbols = symbols;
+    }
+
+    map->symbols[map->count].addr = addr;
+    strcpy(map->symbols[map->count].name, name);
+    map->count++;
+  }
+
+  fclose(file);
+
+  if (map->symbols == NULL)
+  {
+    map->count = 0;
+    return -1;
+  }
+
+  qsort(map->symbols, map->count, sizeof(symbol), compare_symbols);
+  return 0;
+}
+
+void symbols_free(symbol_map *map)
+{
+  free(map->symbols);
+  map->symbols = NULL;
+  map->count = 0;
+}
+
+// Index of the last symbol at or before addr, or -1
+static int32_t find_preceding(symbol_map *map, uint16_t addr)
+{
+  int32_t low = 0, high = (int32_t)map->count - 1, found = -1;
+
+  while (low <= high)
+  {
+    int32_t mid = (low + high) / 2;
+
+    if (map->symbols[mid].addr <= addr)
+    {
+      found = mid;
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid - 1;
+    }
+  }
+
+  return found;
+}
+
+const char *symbols_find(symbol_map *map, uint16_t addr)
+{
+  int32_t found = find_preceding(map, addr);
+
+  if (found < 0 || map->symbols[found].addr != addr)
+  {
+    return NULL;
+  }
+  return map->symbols[found].name;
+}
+
+void symbols_name(symbol_map *map, uint16_t addr, char *out, size_t out_size)
+{
+  int32_t found = find_preceding(map, addr);
+
+  if (found < 0)
+  {
+    snprintf(out, out_size, "sub_%04x", addr);
+  }
+  else if (map->symbols[found].addr == addr)
+  {
+    snprintf(out, out_size, "%s", map->symbols[found].name);
+  }
+  else
+  {
+    snprintf(out, out_size, "%s+0x%x", map->symbols[found].name, addr - map->symbols[found].addr);
+  }
+}
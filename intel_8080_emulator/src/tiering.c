@@ -0,0 +1,155 @@
+#include "tiering.h"
+#include <string.h>
+
+static const char *const TIER_NAMES[TIERS] = {
+    [TIER_INTERPRETED] = "interpreted",
+    [TIER_PREDECODED] = "predecoded",
+    [TIER_COMPILED] = "compiled",
+};
+
+void tiering_attach(tiering *t, i8080 *p, const recompiled_image *image)
+{
+  memset(t, 0, sizeof(tiering));
+  t->predecode_after = TIERING_PREDECODE_AFTER;
+  t->compile_after = TIERING_COMPILE_AFTER;
+
+  fusion_attach(&t->f, p);
+  if (image != NULL)
+  {
+    recompiled_attach(&t->r, image, p);
+    t->compiled = true;
+  }
+  p->tiering = t;
+}
+
+void tiering_detach(tiering *t, i8080 *p)
+{
+  // The recompiled code first, so fusion_detach clears PAGE_CODE
+  if (t->compiled)
+  {
+    recompiled_detach(&t->r, p);
+  }
+  fusion_detach(&t->f, p);
+  if (p->tiering == t)
+  {
+    p->tiering = NULL;
+  }
+}
+
+static void promote(tiering *t, uint16_t addr, enum tier tier)
+{
+  t->tiers[addr] = tier;
+  t->promotions[tier]++;
+}
+
+bool tiering_step(tiering *t, i8080 *p, uint64_t cycles_left)
+{
+  uint16_t pc = p->pc;
+  uint32_t hotness = t->hotness[pc];
+
+  if (hotness != UINT32_MAX)
+  {
+    t->hotness[pc] = ++hotness;
+  }
+
+  switch (t->tiers[pc])
+  {
+  case TIER_INTERPRETED:
+    if (hotness >= t->predecode_after)
+    {
+      promote(t, pc, TIER_PREDECODED);
+    }
+    t->dispatched[TIER_INTERPRETED]++;
+    return false;
+
+  case TIER_PREDECODED:
+    if (hotness < t->compile_after || !t->compiled || recompiled_block_at(t->r.image, pc) == 0)
+    {
+      break;
+    }
+    promote(t, pc, TIER_COMPILED);
+    // fall through
+
+  case TIER_COMPILED:
+    if (recompiled_step(&t->r, p, cycles_left))
+    {
+      t->dispatched[TIER_COMPILED]++;
+      return true;
+    }
+    break;
+  }
+
+  // So that a write into its code brings it back down. Fusion and the recompiled code clear the flag when they forget the page
+  p->page_flags[pc >> 8] |= PAGE_CODE;
+  p->page_flags[(uint16_t)(pc + FUSION_MAX_GROUP_BYTES - 1) >> 8] |= PAGE_CODE;
+
+  // Blocks that can't be run now still have their groups fused
+  if (fusion_step(&t->f, p, cycles_left))
+  {
+    t->dispatched[TIER_PREDECODED]++;
+    return true;
+  }
+  t->dispatched[TIER_INTERPRETED]++;
+  return false;
+}
+
+// The bytes of the group or block run from an address in its tier. Not classified yet, it may be the longest group
+static uint32_t code_bytes(const tiering *t, uint16_t addr)
+{
+  enum fusion_kind kind = fusion_kind_at(&t->f, addr);
+  uint32_t bytes = kind == FUSION_UNCLASSIFIED ? FUSION_MAX_GROUP_BYTES : fusion_bytes(kind);
+
+  uint32_t index = t->tiers[addr] == TIER_COMPILED ? recompiled_block_at(t->r.image, addr) : 0;
+
+  if (index != 0)
+  {
+    uint32_t length = t->r.image->blocks[index - 1].length;
+
+    bytes = length > bytes ? length : bytes;
+  }
+  return bytes;
+}
+
+void tiering_code_written(tiering *t, uint16_t addr)
+{
+  uint32_t reach = t->compiled && t->r.longest > FUSION_MAX_GROUP_BYTES ? t->r.longest : FUSION_MAX_GROUP_BYTES;
+
+  // Data stored next to the code, on the same page, leaves it where it is
+  for (uint32_t back = 0; back < reach; back++)
+  {
+    uint16_t start = addr - back;
+
+    if (t->tiers[start] != TIER_INTERPRETED && code_bytes(t, start) > back)
+    {
+      t->tiers[start] = TIER_INTERPRETED;
+      t->hotness[start] = 0;
+      t->demotions++;
+    }
+  }
+}
+
+const char *tiering_tier_name(enum tier tier)
+{
+  return tier < TIERS ? TIER_NAMES[tier] : "?";
+}
+
+void tiering_report(const tiering *t, FILE *out)
+{
+  uint32_t addresses[TIERS] = {0};
+
+  for (uint32_t addr = 0; addr < 0x10000; addr++)
+  {
+    if (t->hotness[addr] != 0)
+    {
+      addresses[t->tiers[addr]]++;
+    }
+  }
+
+  fprintf(out, "tier          addresses  dispatched  promoted\n");
+  for (int tier = 0; tier < TIERS; tier++)
+  {
+    fprintf(out, "%-12s  %9u  %10llu  %8llu\n", TIER_NAMES[tier], (unsigned)addresses[tier],
+            (unsigned long long)t->dispatched[tier], (unsigned long long)t->promotions[tier]);
+  }
+  fprintf(out, "%llu addresses demoted by writes to code\n", (unsigned long long)t->demotions);
+}
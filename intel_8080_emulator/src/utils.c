@@ -1,13 +1,44 @@
 #include "i8080.h"
 #include "instructions.h"
+#include "callgraph.h"
+#include "latency.h"
+#include "heatmap.h"
+#include "debugger.h"
+#include "run_until.h"
+#include "replay.h"
+#include "rewind.h"
+#include "snapshot.h"
+#include "checkpoint.h"
+#include "state_hash.h"
+#include "fusion.h"
+#include "recompiler.h"
+#include "tiering.h"
 #include <stdlib.h>
 #include <string.h>
 
-void non_implem_error(uint8_t opcode)
-{
-  fprintf(stderr, "Not implemented: %x\n", opcode);
-  exit(-1);
-}
+// Sign, zero and parity of every byte, in their PSW bit positions
+#define ZSP_S 0x80
+#define ZSP_Z 0x40
+#define ZSP_P 0x04
+
+static const uint8_t ZSP_FLAGS[256] = {
+    0x44, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04,
+    0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00,
+    0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00,
+    0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04,
+    0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00,
+    0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04,
+    0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04,
+    0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00,
+    0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80,
+    0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84,
+    0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84,
+    0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80,
+    0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84,
+    0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80,
+    0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80,
+    0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84,
+};
 
 // Joins registers h and l to form a 16 bit address
 uint16_t join_hl(i8080 *p)
@@ -21,42 +52,191 @@ uint16_t join_for_16_bit(uint8_t high, uint8_t low)
   return (high << 8) | low;
 }
 
+// Tells the tiering manager, fusion and the recompiled code that a page they run code from was written
+static void code_written(i8080 *p, uint16_t addr)
+{
+  uint8_t page = addr >> 8;
+
+  // While fusion still knows the groups written into
+  if (p->tiering != NULL)
+  {
+    tiering_code_written(p->tiering, addr);
+  }
+  if (p->fusion != NULL)
+  {
+    fusion_invalidate_page(p->fusion, p, page);
+  }
+  if (p->recompiled != NULL)
+  {
+    recompiled_invalidate_page(p->recompiled, p, page);
+  }
+}
+
 void write_byte(i8080 *p, uint16_t addr, uint8_t data)
 {
+  LATENCY_BEGIN();
+  if (p->heatmap != NULL)
+  {
+    heatmap_write(p->heatmap, addr);
+  }
+  uint16_t flags = p->page_flags[addr >> 8];
+  if (flags & PAGE_WATCH_WRITE)
+  {
+    debugger_check_write(p->debugger, p, addr, data);
+  }
+  if (flags & PAGE_UNTIL_WRITE)
+  {
+    run_until_check_write(p->until, p, addr, data);
+  }
+  if (flags & PAGE_REWIND)
+  {
+    rewind_save_page(p->rewind, p, addr >> 8);
+  }
+  if (flags & PAGE_SNAPSHOT)
+  {
+    snapshot_save_page(p->snapshot, p, addr >> 8);
+  }
+  if (flags & PAGE_CHECKPOINT)
+  {
+    checkpoint_save_page(p->checkpoint, p, addr >> 8);
+  }
+  if (flags & PAGE_CODE)
+  {
+    code_written(p, addr);
+  }
+  if (p->state_hash != NULL)
+  {
+    state_hash_write(p->state_hash, p, addr, data);
+  }
+  p->write_byte(addr, data);
+  LATENCY_HELPER_END(LATENCY_WRITE_BYTE);
+}
+
+void restore_byte(i8080 *p, uint16_t addr, uint8_t data)
+{
+  uint16_t flags = p->page_flags[addr >> 8];
+  if (flags & PAGE_CHECKPOINT)
+  {
+    checkpoint_save_page(p->checkpoint, p, addr >> 8);
+  }
+  if (flags & PAGE_CODE)
+  {
+    code_written(p, addr);
+  }
+  if (p->state_hash != NULL)
+  {
+    state_hash_write(p->state_hash, p, addr, data);
+  }
   p->write_byte(addr, data);
 }
 
+bool observed_per_step(const i8080 *p)
+{
+  return p->profiler != NULL || p->coverage != NULL || p->fuzz != NULL || p->heatmap != NULL ||
+         p->rewind != NULL || p->lockstep != NULL || p->replay != NULL || (p->until != NULL && p->until->per_step);
+}
+
 void write_word(i8080 *p, uint16_t addr, uint16_t data)
 {
-  p->write_byte(addr + 1, data >> 8);
-  p->write_byte(addr, data & 0xff);
+  LATENCY_BEGIN();
+  write_byte(p, addr + 1, data >> 8);
+  write_byte(p, addr, data & 0xff);
+  LATENCY_HELPER_END(LATENCY_WRITE_WORD);
 }
 
 uint8_t read_byte(i8080 *p, uint16_t addr)
 {
+  LATENCY_BEGIN();
+  if (p->heatmap != NULL)
+  {
+    heatmap_read(p->heatmap, addr);
+  }
+  uint8_t value = p->read_byte(addr);
+  if (p->page_flags[addr >> 8] & PAGE_WATCH_READ)
+  {
+    debugger_check_read(p->debugger, p, addr, value);
+  }
+  LATENCY_HELPER_END(LATENCY_READ_BYTE);
+  return value;
+}
+
+uint8_t read_opcode(i8080 *p, uint16_t addr)
+{
+  if (p->heatmap != NULL)
+  {
+    heatmap_fetch(p->heatmap, addr);
+  }
   return p->read_byte(addr);
 }
 
-uint16_t read_word(i8080 *p, uint16_t addr)
+uint8_t port_in(i8080 *p, uint8_t port)
 {
-  uint16_t hi = p->read_byte(addr + 1) << 8;
-  return hi | p->read_byte(addr);
+  bool playing = p->replay != NULL && p->replay->mode == REPLAY_PLAY;
+
+  if (p->port_in == NULL && !playing)
+  {
+    i8080_stop(p, I8080_EXIT_IO_TRAP);
+    return p->a;
+  }
+  if (p->until != NULL && p->until->has_ports)
+  {
+    run_until_check_port(p->until, p, port, false);
+  }
+  if (p->replay == NULL)
+  {
+    return p->port_in(port);
+  }
+  if (playing)
+  {
+    return replay_play_in(p->replay, p, port);
+  }
+
+  uint8_t value = p->port_in(port);
+  replay_record_in(p->replay, p, port, value);
+  return value;
 }
 
-bool parity(uint8_t value)
+void port_out(i8080 *p, uint8_t port, uint8_t value)
 {
-  uint8_t ones = 0;
+  bool playing = p->replay != NULL && p->replay->mode == REPLAY_PLAY;
 
-  for (int i = 0; i < 8; i++)
+  if (p->port_out == NULL && !playing)
   {
-    ones += ((value >> i) & 1);
+    i8080_stop(p, I8080_EXIT_IO_TRAP);
+    return;
   }
-  return ones % 2 == 0;
+  if (p->until != NULL && p->until->has_ports)
+  {
+    run_until_check_port(p->until, p, port, true);
+  }
+  // Output is dropped while playing a replay without the devices
+  if (p->port_out != NULL)
+  {
+    p->port_out(port, value);
+  }
+}
+
+uint16_t read_word(i8080 *p, uint16_t addr)
+{
+  LATENCY_BEGIN();
+  uint16_t hi = read_byte(p, addr + 1) << 8;
+  uint16_t value = hi | read_byte(p, addr);
+  LATENCY_HELPER_END(LATENCY_READ_WORD);
+  return value;
+}
+
+bool parity(uint8_t value)
+{
+  LATENCY_BEGIN();
+  bool even = ZSP_FLAGS[value] & ZSP_P;
+  LATENCY_HELPER_END(LATENCY_PARITY);
+  return even;
 }
 
 // Updates the auxiliary carry flag
 void update_acf(i8080 *p, uint8_t a, uint8_t b, char *mode)
 {
+  LATENCY_BEGIN();
   if (strcmp(mode, "add") == 0)
   {
     uint8_t sumLSB = (a & 0xf) + (b & 0xf);
@@ -76,96 +256,140 @@ void update_acf(i8080 *p, uint8_t a, uint8_t b, char *mode)
   }
   else if (strcmp(mode, "and") == 0)
   {
-    p->acf = (a | b) >> 3;
+    p->acf = ((a | b) >> 3) & 1;
   }
   else
   {
-    fprintf(stderr, "Unsupported mode: %s\n", mode);
-    exit(-1);
+    i8080_stop(p, I8080_EXIT_UNIMPLEMENTED);
   }
+  LATENCY_HELPER_END(LATENCY_UPDATE_ACF);
 }
 
 void update_z_s_p(i8080 *p, uint8_t value)
 {
-  p->zf = p->a == 0;
-  p->sf = p->a >> 7;
-  p->pf = parity(value);
+  LATENCY_BEGIN();
+  uint8_t flags = ZSP_FLAGS[value];
+  p->zf = flags & ZSP_Z;
+  p->sf = flags & ZSP_S;
+  p->pf = flags & ZSP_P;
+  LATENCY_HELPER_END(LATENCY_UPDATE_Z_S_P);
 }
 
 void update_cf(i8080 *p, uint8_t val_1, uint8_t val_2)
 {
+  LATENCY_BEGIN();
   uint16_t sum = val_1 + val_2 + p->cf;
   p->cf = (sum >> 8) > 0;
+  LATENCY_HELPER_END(LATENCY_UPDATE_CF);
 }
 
 void update_zf_sf(i8080 *p)
 {
-  p->zf = p->a == 0;
-  p->sf = p->a & 0x80;
+  p->zf = ZSP_FLAGS[p->a] & ZSP_Z;
+  p->sf = ZSP_FLAGS[p->a] & ZSP_S;
 }
 
 void add_byte(i8080 *p, uint8_t to_add, uint8_t carry)
 {
+  LATENCY_BEGIN();
   uint16_t value = (p->a + to_add + carry);
   p->acf = (p->a ^ to_add ^ value) & 0x10;
   p->a = (uint8_t)value;
   p->cf = value > 255;
-  update_zf_sf(p);
+  update_z_s_p(p, p->a);
+  LATENCY_HELPER_END(LATENCY_ADD_BYTE);
 }
 
 uint8_t sub_byte(i8080 *p, uint8_t subt, uint8_t borrow)
 {
+  LATENCY_BEGIN();
   uint8_t subt_ones_comp = (~subt);
   // One's complement way
   uint16_t res = p->a + subt_ones_comp + (borrow ? 0 : 1);
   p->cf = !(res & 0x100);
   p->acf = ((p->a & 0xF) + (subt_ones_comp & 0xF) + (borrow ? 0 : 1)) & 0x10;
+  update_z_s_p(p, res & 0xff);
+  LATENCY_HELPER_END(LATENCY_SUB_BYTE);
   return res & 0xff;
 }
 
 void and_byte(i8080 *p, uint8_t to_and)
 {
+  LATENCY_BEGIN();
+  p->acf = ((p->a | to_and) >> 3) & 1;
   p->a = p->a & to_and;
+  p->cf = 0;
+  update_z_s_p(p, p->a);
+  LATENCY_HELPER_END(LATENCY_AND_BYTE);
 }
 
 void xor_byte(i8080 *p, uint8_t to_xor)
 {
+  LATENCY_BEGIN();
   p->a = p->a ^ to_xor;
+  p->acf = 0;
+  p->cf = 0;
+  update_z_s_p(p, p->a);
+  LATENCY_HELPER_END(LATENCY_XOR_BYTE);
 }
 
 void or_byte(i8080 *p, uint8_t to_or)
 {
+  LATENCY_BEGIN();
   p->a = p->a | to_or;
+  p->acf = 0;
+  p->cf = 0;
+  update_z_s_p(p, p->a);
+  LATENCY_HELPER_END(LATENCY_OR_BYTE);
 }
 
 void cmp_byte(i8080 *p, uint8_t to_cmp)
 {
-  uint8_t res = p->a - to_cmp;
-  update_acf(p, p->a, to_cmp, "sub");
-  update_z_s_p(p, res);
+  LATENCY_BEGIN();
+  // A subtraction that only keeps the flags
+  sub_byte(p, to_cmp, 0);
+  LATENCY_HELPER_END(LATENCY_CMP_BYTE);
 }
 
 void stack_push(i8080 *p, uint16_t to_push)
 {
+  LATENCY_BEGIN();
   p->sp -= 2;
   write_word(p, p->sp, to_push);
+  LATENCY_HELPER_END(LATENCY_STACK_PUSH);
 }
 
 uint16_t stack_pop(i8080 *p)
 {
+  LATENCY_BEGIN();
   uint16_t val = read_word(p, p->sp);
   p->sp += 2;
+  LATENCY_HELPER_END(LATENCY_STACK_POP);
   return val;
 }
 
 void ret(i8080 *p)
 {
+  LATENCY_BEGIN();
+  if (p->callgraph != NULL)
+  {
+    callgraph_ret(p->callgraph, p);
+  }
+
   p->pc = stack_pop(p);
-  p->sp += 2;
+  LATENCY_HELPER_END(LATENCY_RET);
 }
 
 void call(i8080 *p, uint16_t addr)
 {
+  LATENCY_BEGIN();
   stack_push(p, p->pc);
+
+  if (p->callgraph != NULL)
+  {
+    callgraph_call(p->callgraph, p, addr);
+  }
+
   p->pc = addr;
+  LATENCY_HELPER_END(LATENCY_CALL);
 }
\ No newline at end of file
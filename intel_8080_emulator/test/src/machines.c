@@ -0,0 +1,99 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+#include "machines.h"
+
+uint8_t memory[MEM_SIZE];
+uint8_t plain_memory[MEM_SIZE];
+
+// The processors interrupted by the device, if there is one
+static i8080 *current, *plain_current;
+static bool has_device;
+
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  memory[addr] = val;
+  if (has_device && addr == DEVICE_ADDR)
+  {
+    i8080_interrupt(current, 0xcf);
+  }
+}
+
+static uint8_t plain_read_byte(uint16_t addr)
+{
+  return plain_memory[addr];
+}
+
+static void plain_write_byte(uint16_t addr, uint8_t val)
+{
+  plain_memory[addr] = val;
+  if (has_device && addr == DEVICE_ADDR)
+  {
+    i8080_interrupt(plain_current, 0xcf);
+  }
+}
+
+void machines_init(i8080 *cpu, i8080 *plain, bool device)
+{
+  memset(memory, 0, MEM_SIZE);
+  memset(plain_memory, 0, MEM_SIZE);
+  i8080_init(cpu);
+  cpu->read_byte = &read_byte_implementation;
+  cpu->write_byte = &write_byte_implementation;
+  i8080_init(plain);
+  plain->read_byte = &plain_read_byte;
+  plain->write_byte = &plain_write_byte;
+  current = cpu;
+  plain_current = plain;
+  has_device = device;
+}
+
+void load_fused_rom(uint8_t *mem)
+{
+  memset(mem, 0, MEM_SIZE);
+  memcpy(mem, fused_rom, sizeof(fused_rom));
+  for (int i = 0; i < 16; i++)
+  {
+    mem[0x4000 + i] = i * 37;
+  }
+}
+
+void assert_same_state(const i8080 *p, const i8080 *q)
+{
+  i8080_state s, t;
+
+  i8080_save_state(p, &s);
+  i8080_save_state(q, &t);
+  assert_int_equal(s.a, t.a);
+  assert_int_equal(s.b, t.b);
+  assert_int_equal(s.c, t.c);
+  assert_int_equal(s.d, t.d);
+  assert_int_equal(s.e, t.e);
+  assert_int_equal(s.h, t.h);
+  assert_int_equal(s.l, t.l);
+  assert_int_equal(s.sp, t.sp);
+  assert_int_equal(s.pc, t.pc);
+  assert_int_equal(s.zf, t.zf);
+  assert_int_equal(s.sf, t.sf);
+  assert_int_equal(s.pf, t.pf);
+  assert_int_equal(s.cf, t.cf);
+  assert_int_equal(s.acf, t.acf);
+  assert_int_equal(s.halted, t.halted);
+  assert_int_equal(s.cycles, t.cycles);
+  assert_int_equal(s.interrupt_pending, t.interrupt_pending);
+  assert_int_equal(s.interrupts_enabled, t.interrupts_enabled);
+  assert_int_equal(s.interrupt_delay, t.interrupt_delay);
+}
+
+void assert_same_memory(void)
+{
+  assert_memory_equal(memory, plain_memory, MEM_SIZE);
+}
@@ -0,0 +1,65 @@
+#ifndef MACHINES_H
+#define MACHINES_H
+#include "i8080.h"
+
+#define MEM_SIZE 0x10000
+
+// Writes to this address raise RST 1 on the machine that made them, when the machines have the device
+#define DEVICE_ADDR 0x4000
+
+/*
+Twin machines for the tests of fusion, the recompiled code, tiering and
+the code cache: the one under test, with its memory, and a plain one
+running the same code an instruction at a time, with its own
+*/
+extern uint8_t memory[MEM_SIZE];
+extern uint8_t plain_memory[MEM_SIZE];
+
+// Fused groups on page 0, with the data at 4000h and the stack in RAM, ending with HLT at 0027h
+static const uint8_t fused_rom[] = {
+    0x31, 0x00, 0x80, // LXI SP,8000h
+    0x21, 0x00, 0x40, // LXI H,4000h
+    0x06, 0x10,       // MVI B,10h
+    0x16, 0x00,       // MVI D,0
+    0x7e,             // loop: MOV A,M
+    0x23,             // INX H
+    0x82,             // ADD D
+    0x57,             // MOV D,A
+    0x05,             // DCR B
+    0xc2, 0x0a, 0x00, // JNZ loop
+    0x11, 0x03, 0x00, // LXI D,0003h
+    0xcd, 0x40, 0x00, // CALL 0040h
+    0xfe, 0x07,       // CPI 07h
+    0xca, 0x20, 0x00, // JZ 0020h
+    0x76,             // HLT
+    0x00, 0x00,       //
+    0xfe, 0x00,       // CPI 00h
+    0xc2, 0x26, 0x00, // JNZ 0026h
+    0x76,             // HLT
+    0x76,             // HLT
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x1b,             // 0040h: DCX D
+    0x7a,             // MOV A,D
+    0xb3,             // ORA E
+    0xc2, 0x40, 0x00, // JNZ 0040h
+    0x3e, 0x07,       // MVI A,07h
+    0xc9,             // RET
+};
+
+/*
+Clears both memories and sets both processors up to use them. Without
+the device, all of the memory is plain RAM, as fusion_map_ram needs
+*/
+void machines_init(i8080 *cpu, i8080 *plain, bool device);
+
+// Clears the memory and loads fused_rom, with its 16 bytes of data
+void load_fused_rom(uint8_t *mem);
+
+// Compares the registers, flags, cycles and interrupt state
+void assert_same_state(const i8080 *p, const i8080 *q);
+
+// Compares the memories of the two machines
+void assert_same_memory(void);
+
+#endif // MACHINES_H
@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "recompiler_roms.h"
+
+static recompiler r;
+
+// Discovers the ROM at 0000h from there and the vectors given, and writes its image
+static int emit(FILE *out, const uint8_t *rom, uint32_t size, uint8_t vectors, const char *name)
+{
+  if (recompiler_init(&r, rom, size, 0) != 0 || recompiler_discover(&r, 0, vectors) < 0)
+  {
+    return -1;
+  }
+  return recompiler_emit(&r, out, name) < 0 ? -1 : 0;
+}
+
+// Writes the recompiled test ROMs to the file named on the command line
+int main(int argc, char **argv)
+{
+  static uint8_t random[RANDOM_ROM_SIZE];
+  FILE *out;
+
+  if (argc != 2 || (out = fopen(argv[1], "w")) == NULL)
+  {
+    fprintf(stderr, "usage: recompile_test_roms output.c\n");
+    return 1;
+  }
+
+  random_rom(random);
+  if (emit(out, program_rom, sizeof(program_rom), 0x03, "program_image") != 0 ||
+      emit(out, rewriting_rom, sizeof(rewriting_rom), 0x01, "rewriting_image") != 0 ||
+      emit(out, patching_rom, sizeof(patching_rom), 0x01, "patching_image") != 0 ||
+      emit(out, io_rom, sizeof(io_rom), 0x01, "io_image") != 0 ||
+      emit(out, random, sizeof(random), 0xff, "random_image") != 0 || fclose(out) != 0)
+  {
+    fprintf(stderr, "%s: write failed\n", argv[1]);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,105 @@
+#ifndef RECOMPILER_ROMS_H
+#define RECOMPILER_ROMS_H
+#include "recompiler.h"
+#include "machines.h"
+
+/*
+ROMs recompiled at build time by recompile_test_roms.c, which writes
+their images to recompiled_roms.c for test_recompiler.c and test_tiering.c.
+They raise RST 1 by writing to DEVICE_ADDR of machines.h
+*/
+
+// Loops, calls, the RST 1 handler and a PCHL to code discovery can't see, ending with HLT at 005bh
+static const uint8_t program_rom[] = {
+    0x31, 0x00, 0x01, // LXI SP,0100h
+    0xc3, 0x10, 0x00, // JMP 0010h
+    0x00, 0x00,       //
+    0x1c,             // 0008h: INR E
+    0xc9,             // RET
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x21, 0x00, 0x02, // 0010h: LXI H,0200h
+    0x06, 0x10,       // MVI B,10h
+    0x16, 0x00,       // MVI D,0
+    0x7e,             // 0017h: MOV A,M
+    0x23,             // INX H
+    0x82,             // ADD D
+    0x57,             // MOV D,A
+    0x05,             // DCR B
+    0xc2, 0x17, 0x00, // JNZ 0017h
+    0x11, 0x03, 0x00, // LXI D,0003h
+    0xcd, 0x40, 0x00, // CALL 0040h
+    0xfb,             // EI
+    0x32, 0x00, 0x40, // STA 4000h
+    0x27,             // DAA
+    0xf5,             // PUSH PSW
+    0xc1,             // POP B
+    0x21, 0x50, 0x00, // LXI H,0050h
+    0xe9,             // PCHL
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x1b,             // 0040h: DCX D
+    0x7a,             // MOV A,D
+    0xb3,             // ORA E
+    0xc2, 0x40, 0x00, // JNZ 0040h
+    0x3e, 0x07,       // MVI A,07h
+    0xc9,             // RET
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xeb,             // 0050h: XCHG
+    0x19,             // DAD D
+    0x22, 0x00, 0x03, // SHLD 0300h
+    0xe3,             // XTHL
+    0x17,             // RAL
+    0x0f,             // RRC
+    0x2f,             // CMA
+    0xde, 0x12,       // SBI 12h
+    0x76,             // HLT
+};
+
+// Turns its own JZ into JNZ with a STA the first time it is taken, ending with HLT at 0007h
+static const uint8_t rewriting_rom[] = {
+    0x3e, 0x05,       // MVI A,05h
+    0xfe, 0x05,       // CPI 05h
+    0xca, 0x10, 0x00, // JZ 0010h
+    0x76,             // HLT
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x3e, 0xc2,       // 0010h: MVI A,0c2h
+    0x32, 0x04, 0x00, // STA 0004h
+    0x3e, 0x05,       // MVI A,05h
+    0xc3, 0x02, 0x00, // JMP 0002h
+};
+
+// Puts INR A over the NOP ahead of it in the same block, through HL
+static const uint8_t patching_rom[] = {
+    0x21, 0x07, 0x00, // LXI H,0007h
+    0x36, 0x3c,       // MVI M,3ch
+    0x3e, 0x01,       // MVI A,01h
+    0x00,             // NOP
+    0x76,             // HLT
+};
+
+// IN and OUT around INR A
+static const uint8_t io_rom[] = {
+    0xdb, 0x01, // IN 01h
+    0x3c,       // INR A
+    0xd3, 0x02, // OUT 02h
+    0x76,       // HLT
+};
+
+// Random bytes, so random code, at 0000h
+#define RANDOM_ROM_SIZE 0x800
+
+static void random_rom(uint8_t *rom)
+{
+  uint32_t x = 0x8080;
+
+  for (int i = 0; i < RANDOM_ROM_SIZE; i++)
+  {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rom[i] = x >> 24;
+  }
+}
+
+extern const recompiled_image program_image, rewriting_image, patching_image, io_image, random_image;
+
+#endif // RECOMPILER_ROMS_H
@@ -0,0 +1,327 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#include "i8080.h"
+#include "reference.h"
+
+#define MEM_SIZE 0x10000
+#define THREADS 8
+
+// The operand of M instructions
+#define OPERAND_ADDR 0x8000
+
+/*
+Every 8-bit ALU instruction is run on every accumulator, operand, carry
+and auxiliary carry, by the core and by the reference interpreter, and
+the states they end in must match. The sweeps are shared out by opcode
+to a pool of threads with their own memory
+*/
+typedef struct opcode_result
+{
+  long cases, failed;
+  char first_failure[128];
+} opcode_result;
+
+typedef struct alu_sweep
+{
+  const uint8_t *opcodes;
+  int opcodes_count;
+  atomic_int next;
+  opcode_result results[256];
+} alu_sweep;
+
+static _Thread_local uint8_t *worker_memory;
+static _Thread_local uint8_t reference_written;
+
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return worker_memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  worker_memory[addr] = val;
+}
+
+static uint8_t reference_read(void *context, uint16_t addr)
+{
+  (void)context;
+  return worker_memory[addr];
+}
+
+// The reference runs first, so its write is kept aside for the core to read the old value
+static void reference_write(void *context, uint16_t addr, uint8_t value)
+{
+  (void)context;
+  (void)addr;
+  reference_written = value;
+}
+
+// The operand goes to the register the opcode names, or to memory, or after the opcode
+static void set_operand(i8080_state *s, uint8_t opcode, uint8_t operand)
+{
+  int reg = opcode >= 0x80 ? opcode & 7 : (opcode >> 3) & 7;
+
+  worker_memory[1] = operand;
+  worker_memory[OPERAND_ADDR] = operand;
+  s->h = OPERAND_ADDR >> 8;
+  s->l = OPERAND_ADDR & 0xff;
+  if ((opcode & 0xc7) == 0xc6 || ((opcode & 0xc6) != 0x04 && opcode < 0x80))
+  {
+    return;
+  }
+
+  switch (reg)
+  {
+  case 0:
+    s->b = operand;
+    break;
+  case 1:
+    s->c = operand;
+    break;
+  case 2:
+    s->d = operand;
+    break;
+  case 3:
+    s->e = operand;
+    break;
+  case 4:
+    s->h = operand;
+    break;
+  case 5:
+    s->l = operand;
+    break;
+  case 6:
+    break;
+  case 7:
+    s->a = operand;
+    break;
+  }
+}
+
+#define CHECK(field)                                                                                              \
+  if (passed && expected.field != actual.field)                                                                    \
+  {                                                                                                                \
+    snprintf(why, why_size, "a %02x, operand %02x, cf %d, acf %d: %s expected %x, got %x", before->a, operand,     \
+             before->cf, before->acf, #field, (unsigned)expected.field, (unsigned)actual.field);                   \
+    passed = false;                                                                                                \
+  }
+
+static bool run_case(i8080 *cpu, const i8080_state *before, uint8_t operand, char *why, size_t why_size)
+{
+  reference_bus bus = {&reference_read, &reference_write, NULL, NULL, NULL};
+  i8080_state expected = *before, actual;
+  bool passed = true;
+
+  reference_written = worker_memory[OPERAND_ADDR];
+  reference_step(&expected, &bus);
+
+  i8080_load_state(cpu, before);
+  i8080_step(cpu);
+  i8080_save_state(cpu, &actual);
+
+  CHECK(a);
+  CHECK(b);
+  CHECK(c);
+  CHECK(d);
+  CHECK(e);
+  CHECK(h);
+  CHECK(l);
+  CHECK(sp);
+  CHECK(pc);
+  CHECK(zf);
+  CHECK(sf);
+  CHECK(pf);
+  CHECK(cf);
+  CHECK(acf);
+  CHECK(cycles);
+  if (passed && reference_written != worker_memory[OPERAND_ADDR])
+  {
+    snprintf(why, why_size, "a %02x, operand %02x: memory expected %02x, got %02x", before->a, operand,
+             reference_written, worker_memory[OPERAND_ADDR]);
+    passed = false;
+  }
+  return passed;
+}
+
+static void sweep_opcode(i8080 *cpu, uint8_t opcode, opcode_result *result)
+{
+  char why[128];
+
+  for (int a = 0; a < 256; a++)
+  {
+    for (int operand = 0; operand < 256; operand++)
+    {
+      for (int carries = 0; carries < 4; carries++)
+      {
+        i8080_state s = {0};
+
+        s.a = a;
+        s.b = s.c = s.d = s.e = 0x5a;
+        s.sp = 0xf000;
+        s.cf = carries & 1;
+        s.acf = carries >> 1;
+        // The other flags are only ever overwritten, any starting value will do
+        s.zf = operand & 1;
+        s.sf = operand & 2;
+        s.pf = operand & 4;
+        worker_memory[0] = opcode;
+        set_operand(&s, opcode, operand);
+
+        result->cases++;
+        if (!run_case(cpu, &s, operand, why, sizeof(why)) && result->failed++ == 0)
+        {
+          strcpy(result->first_failure, why);
+        }
+      }
+    }
+  }
+}
+
+static int sweep_worker(void *arg)
+{
+  alu_sweep *sweep = arg;
+  i8080 cpu;
+  int i;
+
+  worker_memory = calloc(MEM_SIZE, 1);
+  if (worker_memory == NULL)
+  {
+    return -1;
+  }
+  i8080_init(&cpu);
+  cpu.read_byte = &read_byte_implementation;
+  cpu.write_byte = &write_byte_implementation;
+
+  while ((i = atomic_fetch_add(&sweep->next, 1)) < sweep->opcodes_count)
+  {
+    uint8_t opcode = sweep->opcodes[i];
+
+    sweep_opcode(&cpu, opcode, &sweep->results[opcode]);
+  }
+  free(worker_memory);
+  return 0;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Sweeps the opcodes on all the threads. Returns the number of failed cases
+static long run_sweep(const char *name, const uint8_t *opcodes, int count)
+{
+  alu_sweep *sweep = calloc(1, sizeof(alu_sweep));
+  thrd_t workers[THREADS];
+  int started = 0;
+  long cases = 0, failed = 0;
+  double start = now();
+
+  if (sweep == NULL)
+  {
+    return -1;
+  }
+  sweep->opcodes = opcodes;
+  sweep->opcodes_count = count;
+
+  for (int i = 0; i < THREADS; i++)
+  {
+    if (thrd_create(&workers[started], sweep_worker, sweep) == thrd_success)
+    {
+      started++;
+    }
+  }
+  if (started == 0)
+  {
+    sweep_worker(sweep);
+  }
+  for (int i = 0; i < started; i++)
+  {
+    thrd_join(workers[i], NULL);
+  }
+
+  for (int i = 0; i < count; i++)
+  {
+    opcode_result *result = &sweep->results[opcodes[i]];
+
+    cases += result->cases;
+    failed += result->failed;
+    if (result->failed > 0)
+    {
+      fprintf(stderr, "%02x: %ld of %ld failed, first: %s\n", opcodes[i], result->failed, result->cases,
+              result->first_failure);
+    }
+  }
+
+  double seconds = now() - start;
+  printf("%s: %ld cases on %d threads, %.0f per second\n", name, cases, started ? started : 1,
+         seconds > 0 ? cases / seconds : 0.0);
+  free(sweep);
+  return cases > 0 ? failed : -1;
+}
+
+// ADD ADC SUB SBB ANA XRA ORA CMP with every register and M, and their immediate forms
+static void sweeps_arithmetic_and_logic(void **state)
+{
+  (void)state;
+  uint8_t opcodes[72];
+  int count = 0;
+
+  for (int opcode = 0x80; opcode < 0xc0; opcode++)
+  {
+    opcodes[count++] = opcode;
+  }
+  for (int opcode = 0xc6; opcode <= 0xfe; opcode += 8)
+  {
+    opcodes[count++] = opcode;
+  }
+
+  assert_int_equal(run_sweep("arithmetic and logic", opcodes, count), 0);
+}
+
+// INR and DCR on every register and M
+static void sweeps_increments(void **state)
+{
+  (void)state;
+  uint8_t opcodes[16];
+  int count = 0;
+
+  for (int reg = 0; reg < 8; reg++)
+  {
+    opcodes[count++] = 0x04 | reg << 3;
+    opcodes[count++] = 0x05 | reg << 3;
+  }
+
+  assert_int_equal(run_sweep("increments", opcodes, count), 0);
+}
+
+// DAA, the rotates and the carry and accumulator complements
+static void sweeps_accumulator(void **state)
+{
+  (void)state;
+  static const uint8_t opcodes[] = {0x27, 0x07, 0x0f, 0x17, 0x1f, 0x2f, 0x37, 0x3f};
+
+  assert_int_equal(run_sweep("accumulator", opcodes, sizeof(opcodes)), 0);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(sweeps_arithmetic_and_logic),
+      cmocka_unit_test(sweeps_increments),
+      cmocka_unit_test(sweeps_accumulator),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,130 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "checkpoint.h"
+#include "savestate.h"
+#include "snapshot.h"
+
+#define MEM_SIZE 0x10000
+#define CHECKPOINT_PATH "test_checkpoint.bin"
+
+static uint8_t memory[MEM_SIZE] = {0};
+
+// Fills memory from 1000h on: loop: INR A; MOV M,A; INR L; JNZ loop; INR H; JMP loop
+static const uint8_t program[] = {0x3c, 0x77, 0x2c, 0xc2, 0x00, 0x00, 0x24, 0xc3, 0x00, 0x00};
+
+// The actual implementations of the i8080 structure function pointers
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  memory[addr] = val;
+}
+
+static int setup(void **state)
+{
+  i8080 *cpu = malloc(sizeof(i8080));
+
+  if (cpu == NULL)
+  {
+    return -1;
+  }
+
+  memset(memory, 0, MEM_SIZE);
+  memcpy(memory, program, sizeof(program));
+  i8080_init(cpu);
+  cpu->read_byte = &read_byte_implementation;
+  cpu->write_byte = &write_byte_implementation;
+  cpu->h = 0x10;
+  *state = cpu;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  free(*state);
+  remove(CHECKPOINT_PATH);
+  return 0;
+}
+
+static void writes_state_at_start_while_running(void **state)
+{
+  i8080 *p = *state;
+  static checkpoint c;
+  static uint8_t expected[MEM_SIZE];
+  uint32_t device = 0xdeadbeef, loaded = 0;
+
+  checkpoint_init(&c);
+  i8080_run(p, 20000);
+
+  memcpy(expected, memory, MEM_SIZE);
+  i8080 before = *p;
+
+  assert_true(checkpoint_start(&c, p, CHECKPOINT_PATH, &device, sizeof(device)) == 0);
+
+  // Keeps writing pages while the thread saves them
+  while (!checkpoint_done(&c))
+  {
+    i8080_run(p, 1000);
+  }
+  i8080_run(p, 200000);
+  assert_true(checkpoint_finish(&c, p) == 0);
+  assert_null(p->checkpoint);
+  assert_false(p->page_flags[0x30] & PAGE_CHECKPOINT);
+
+  // The file holds the machine as it was at checkpoint_start
+  memset(memory, 0x55, MEM_SIZE);
+  assert_true(savestate_load(p, CHECKPOINT_PATH, &loaded, sizeof(loaded), false) == 0);
+  assert_memory_equal(memory, expected, MEM_SIZE);
+  assert_true(p->pc == before.pc);
+  assert_true(p->h == before.h && p->l == before.l);
+  assert_true(p->cycles == before.cycles);
+  assert_true(loaded == device);
+}
+
+// Pages restored before the thread reaches them are saved as they were at checkpoint_start
+static void writes_state_at_start_across_restore(void **state)
+{
+  i8080 *p = *state;
+  static checkpoint c;
+  static snapshot s;
+  static uint8_t expected[MEM_SIZE];
+
+  checkpoint_init(&c);
+  snapshot_take(&s, p);
+  i8080_run(p, 200000);
+
+  memcpy(expected, memory, MEM_SIZE);
+  i8080 before = *p;
+
+  assert_true(checkpoint_start(&c, p, CHECKPOINT_PATH, NULL, 0) == 0);
+  snapshot_restore(&s, p);
+  assert_true(checkpoint_finish(&c, p) == 0);
+  snapshot_release(&s, p);
+  assert_true(p->cycles == 0);
+
+  memset(memory, 0x55, MEM_SIZE);
+  assert_true(savestate_load(p, CHECKPOINT_PATH, NULL, 0, false) == 0);
+  assert_memory_equal(memory, expected, MEM_SIZE);
+  assert_true(p->cycles == before.cycles);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(writes_state_at_start_while_running, setup, teardown),
+      cmocka_unit_test_setup_teardown(writes_state_at_start_across_restore, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,228 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include "i8080.h"
+#include "code_cache.h"
+#include "utils.h"
+#include "machines.h"
+
+#define THREADS 8
+
+// A second machine sharing the ROM with the one under test. Each worker thread has its own memory
+static uint8_t other_memory[MEM_SIZE] = {0};
+static _Thread_local uint8_t worker_memory[MEM_SIZE] = {0};
+
+typedef struct machines
+{
+  i8080 cpu, other, plain;
+  fusion f, other_f;
+  code_cache c;
+} machines;
+
+static uint8_t other_read_byte(uint16_t addr)
+{
+  return other_memory[addr];
+}
+
+static void other_write_byte(uint16_t addr, uint8_t val)
+{
+  other_memory[addr] = val;
+}
+
+static uint8_t worker_read_byte(uint16_t addr)
+{
+  return worker_memory[addr];
+}
+
+static void worker_write_byte(uint16_t addr, uint8_t val)
+{
+  worker_memory[addr] = val;
+}
+
+static int setup(void **state)
+{
+  machines *m = malloc(sizeof(machines));
+
+  if (m == NULL || code_cache_init(&m->c, 16) != 0)
+  {
+    free(m);
+    return -1;
+  }
+
+  machines_init(&m->cpu, &m->plain, false);
+  load_fused_rom(memory);
+  load_fused_rom(other_memory);
+  load_fused_rom(plain_memory);
+  i8080_init(&m->other);
+  m->other.read_byte = &other_read_byte;
+  m->other.write_byte = &other_write_byte;
+  fusion_attach(&m->f, &m->cpu);
+  fusion_attach(&m->other_f, &m->other);
+  *state = m;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  machines *m = *state;
+
+  fusion_detach(&m->f, &m->cpu);
+  fusion_detach(&m->other_f, &m->other);
+  code_cache_free(&m->c);
+  free(m);
+  return 0;
+}
+
+// The second machine finds the page the first classified, and both run as the interpreter does
+static void shares_classified_pages(void **state)
+{
+  machines *m = *state;
+
+  assert_int_equal(code_cache_share(&m->c, &m->f, &m->cpu, 0, 1), 1);
+  assert_int_equal(code_cache_share(&m->c, &m->other_f, &m->other, 0, 1), 1);
+  assert_int_equal(m->c.pages, 1);
+  assert_int_equal(m->c.misses, 1);
+  assert_int_equal(m->c.hits, 1);
+  assert_ptr_equal(m->f.shared[0], m->other_f.shared[0]);
+  assert_int_equal(m->f.shared[0][0x0a], FUSION_LOAD_INX);
+  assert_int_equal(m->f.shared[0][0x40], FUSION_NONE);
+  // Groups may reach past the end of the page from here on
+  assert_int_equal(m->f.shared[0][0xf7], FUSION_UNCLASSIFIED);
+
+  assert_int_equal(i8080_run(&m->cpu, 100000), I8080_EXIT_HALT);
+  assert_int_equal(i8080_run(&m->other, 100000), I8080_EXIT_HALT);
+  assert_int_equal(i8080_run(&m->plain, 100000), I8080_EXIT_HALT);
+  assert_same_state(&m->cpu, &m->plain);
+  assert_same_state(&m->other, &m->plain);
+  assert_int_equal(m->cpu.pc, 0x27);
+  assert_int_equal(m->other_f.executed[FUSION_LOAD_INX], 16);
+  assert_int_equal(m->other_f.executed[FUSION_LXI_CALL], 1);
+
+  // Nothing was classified in the machines' own tables, none was allocated
+  assert_null(m->f.kinds[0]);
+  assert_null(m->other_f.kinds[0]);
+}
+
+// The same bytes at another page, or other bytes at the same page, are other pages
+static void keys_pages_by_contents_and_address(void **state)
+{
+  machines *m = *state;
+
+  assert_int_equal(code_cache_share(&m->c, &m->f, &m->cpu, 0, 1), 1);
+  memcpy(other_memory + 0x0100, fused_rom, sizeof(fused_rom));
+  assert_int_equal(code_cache_share(&m->c, &m->other_f, &m->other, 1, 1), 1);
+  assert_int_equal(m->c.pages, 2);
+
+  other_memory[0x0005] = 0x50;
+  assert_int_equal(code_cache_share(&m->c, &m->other_f, &m->other, 0, 1), 1);
+  assert_int_equal(m->c.pages, 3);
+  assert_int_equal(m->c.hits, 0);
+  assert_true(m->f.shared[0] != m->other_f.shared[0]);
+}
+
+// A write to a shared page makes only the machine that wrote it classify it itself
+static void stops_sharing_written_pages(void **state)
+{
+  machines *m = *state;
+
+  code_cache_share(&m->c, &m->f, &m->cpu, 0, 1);
+  code_cache_share(&m->c, &m->other_f, &m->other, 0, 1);
+
+  // MVI B,08h
+  write_byte(&m->cpu, 0x0007, 0x08);
+  plain_memory[0x0007] = 0x08;
+  assert_null(m->f.shared[0]);
+  assert_non_null(m->other_f.shared[0]);
+
+  assert_int_equal(i8080_run(&m->cpu, 100000), I8080_EXIT_HALT);
+  assert_int_equal(i8080_run(&m->plain, 100000), I8080_EXIT_HALT);
+  assert_same_state(&m->cpu, &m->plain);
+  assert_int_equal(m->f.kinds[0][0x0a], FUSION_LOAD_INX);
+  assert_int_equal(m->f.executed[FUSION_LOAD_INX], 8);
+}
+
+// Pages that don't fit are left to fusion
+static void fills_up(void **state)
+{
+  machines *m = *state;
+  code_cache c;
+
+  assert_int_equal(code_cache_init(&c, 1), 0);
+  assert_int_equal(code_cache_share(&c, &m->f, &m->cpu, 0, 256), c.capacity / 2);
+  assert_null(m->f.shared[255]);
+  assert_null(code_cache_lookup(&c, &m->cpu, 255));
+  assert_non_null(code_cache_lookup(&c, &m->cpu, 0));
+  code_cache_free(&c);
+}
+
+typedef struct worker
+{
+  code_cache *c;
+  thrd_t thread;
+  i8080 cpu;
+  fusion f;
+  int shared;
+} worker;
+
+static int run_worker(void *arg)
+{
+  worker *w = arg;
+
+  load_fused_rom(worker_memory);
+  i8080_init(&w->cpu);
+  w->cpu.read_byte = &worker_read_byte;
+  w->cpu.write_byte = &worker_write_byte;
+  fusion_attach(&w->f, &w->cpu);
+  w->shared = code_cache_share(w->c, &w->f, &w->cpu, 0, 1);
+  i8080_run(&w->cpu, 100000);
+  fusion_detach(&w->f, &w->cpu);
+  return 0;
+}
+
+// Threads looking the page up at once end up with one copy of it
+static void shares_pages_across_threads(void **state)
+{
+  machines *m = *state;
+  worker *workers = calloc(THREADS, sizeof(worker));
+
+  assert_non_null(workers);
+  for (int i = 0; i < THREADS; i++)
+  {
+    workers[i].c = &m->c;
+    assert_int_equal(thrd_create(&workers[i].thread, run_worker, &workers[i]), thrd_success);
+  }
+  assert_int_equal(i8080_run(&m->plain, 100000), I8080_EXIT_HALT);
+
+  for (int i = 0; i < THREADS; i++)
+  {
+    thrd_join(workers[i].thread, NULL);
+    assert_int_equal(workers[i].shared, 1);
+    assert_ptr_equal(workers[i].f.shared[0], workers[0].f.shared[0]);
+    assert_same_state(&workers[i].cpu, &m->plain);
+    assert_int_equal(workers[i].f.executed[FUSION_LOAD_INX], 16);
+  }
+  assert_int_equal(m->c.pages, 1);
+  assert_int_equal(m->c.misses, 1);
+  assert_int_equal(m->c.hits, THREADS - 1);
+  free(workers);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(shares_classified_pages, setup, teardown),
+      cmocka_unit_test_setup_teardown(keys_pages_by_contents_and_address, setup, teardown),
+      cmocka_unit_test_setup_teardown(stops_sharing_written_pages, setup, teardown),
+      cmocka_unit_test_setup_teardown(fills_up, setup, teardown),
+      cmocka_unit_test_setup_teardown(shares_pages_across_threads, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,138 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "coverage.h"
+
+#define MEM_SIZE 0x10000
+
+static uint8_t memory[MEM_SIZE] = {0};
+
+// JNZ 0006h; NOP; NOP; NOP; NOP
+static const uint8_t program[] = {0xc2, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+// The actual implementations of the i8080 structure function pointers
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  memory[addr] = val;
+}
+
+static int setup(void **state)
+{
+  i8080 *cpu = malloc(sizeof(i8080));
+  coverage *cov = malloc(sizeof(coverage));
+
+  if (cpu == NULL || cov == NULL)
+  {
+    free(cpu);
+    free(cov);
+    return -1;
+  }
+
+  memset(memory, 0, MEM_SIZE);
+  memcpy(memory, program, sizeof(program));
+  i8080_init(cpu);
+  cpu->read_byte = &read_byte_implementation;
+  cpu->write_byte = &write_byte_implementation;
+  coverage_init(cov);
+  cpu->coverage = cov;
+
+  *state = cpu;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  i8080 *cpu = *state;
+  free(cpu->coverage);
+  free(cpu);
+  return 0;
+}
+
+static void records_executed_and_taken(void **state)
+{
+  i8080 *p = *state;
+
+  p->zf = 0;
+  i8080_step(p);
+  i8080_step(p);
+
+  assert_true(p->pc == 7);
+  assert_true(coverage_bit(p->coverage->executed, 0));
+  assert_false(coverage_bit(p->coverage->executed, 3));
+  assert_true(coverage_bit(p->coverage->executed, 6));
+  assert_true(coverage_bit(p->coverage->taken, 0));
+  assert_false(coverage_bit(p->coverage->not_taken, 0));
+  assert_true(coverage_count(p->coverage) == 2);
+}
+
+static void merges_runs(void **state)
+{
+  i8080 *p = *state;
+  coverage *first = malloc(sizeof(coverage));
+  char path[] = "test_coverage.bin";
+
+  p->zf = 0;
+  i8080_step(p);
+  memcpy(first, p->coverage, sizeof(coverage));
+
+  coverage_init(p->coverage);
+  p->pc = 0;
+  p->zf = 1;
+  i8080_step(p);
+  i8080_step(p);
+  assert_true(coverage_bit(p->coverage->not_taken, 0));
+  assert_false(coverage_bit(p->coverage->taken, 0));
+
+  assert_true(coverage_save(first, path) == 0);
+  assert_true(coverage_load(p->coverage, path) == 0);
+  remove(path);
+  free(first);
+
+  assert_true(coverage_bit(p->coverage->taken, 0));
+  assert_true(coverage_bit(p->coverage->not_taken, 0));
+  assert_true(coverage_bit(p->coverage->executed, 3));
+  assert_true(coverage_bit(p->coverage->executed, 6) == false);
+}
+
+static void writes_lcov(void **state)
+{
+  i8080 *p = *state;
+  char buffer[512] = {0};
+  FILE *out = tmpfile();
+
+  p->zf = 0;
+  i8080_step(p);
+  coverage_write_lcov(p->coverage, p, 0, 7, NULL, "rom.lst", out);
+  rewind(out);
+  fread(buffer, 1, sizeof(buffer) - 1, out);
+  fclose(out);
+
+  assert_string_equal(buffer,
+                      "TN:\nSF:rom.lst\n"
+                      "BRDA:1,0,0,1\nBRDA:1,0,1,0\nDA:1,1\n"
+                      "DA:2,0\nDA:3,0\nDA:4,0\nDA:5,0\n"
+                      "BRF:2\nBRH:1\nLF:5\nLH:1\nend_of_record\n");
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(records_executed_and_taken, setup, teardown),
+      cmocka_unit_test_setup_teardown(merges_runs, setup, teardown),
+      cmocka_unit_test_setup_teardown(writes_lcov, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
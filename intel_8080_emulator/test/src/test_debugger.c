@@ -0,0 +1,230 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "debugger.h"
+#include "run_until.h"
+
+#define MEM_SIZE 0x10000
+
+static uint8_t memory[MEM_SIZE] = {0};
+
+// The actual implementations of the i8080 structure function pointers
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  memory[addr] = val;
+}
+
+static uint8_t port_in_implementation(uint8_t port)
+{
+  return port + 1;
+}
+
+static int setup(void **state)
+{
+  i8080 *cpu = malloc(sizeof(i8080));
+  debugger *d = malloc(sizeof(debugger));
+
+  if (cpu == NULL || d == NULL)
+  {
+    free(cpu);
+    free(d);
+    return -1;
+  }
+
+  memset(memory, 0, MEM_SIZE);
+  i8080_init(cpu);
+  cpu->read_byte = &read_byte_implementation;
+  cpu->write_byte = &write_byte_implementation;
+  cpu->port_in = &port_in_implementation;
+  debugger_attach(d, cpu);
+
+  *state = cpu;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  i8080 *cpu = *state;
+  free(cpu->debugger);
+  free(cpu);
+  return 0;
+}
+
+static void runs_without_breakpoints(void **state)
+{
+  i8080 *p = *state;
+
+  // All NOPs
+  assert_true(i8080_run(p, 400) == I8080_EXIT_BUDGET);
+  assert_true(p->cycles == 400);
+  assert_true(p->pc == 100);
+  assert_true(p->page_flags[0] == 0);
+}
+
+static void stops_at_breakpoint_and_resumes(void **state)
+{
+  i8080 *p = *state;
+
+  debugger_set_breakpoint(p->debugger, p, 3);
+  assert_true(p->page_flags[0] & PAGE_BREAKPOINT);
+
+  assert_true(i8080_run(p, 400) == I8080_EXIT_BREAKPOINT);
+  assert_true(p->cycles == 12);
+  assert_true(p->pc == 3);
+  assert_true(p->debugger->hit == DEBUGGER_BREAKPOINT);
+
+  // Resuming from the breakpoint does not hit it again
+  assert_true(i8080_run(p, 8) == I8080_EXIT_BUDGET);
+  assert_true(p->cycles == 20);
+  assert_true(p->pc == 5);
+
+  debugger_clear_breakpoint(p->debugger, p, 3);
+  assert_false(p->page_flags[0] & PAGE_BREAKPOINT);
+}
+
+static void stops_after_watched_write(void **state)
+{
+  i8080 *p = *state;
+  uint8_t program[] = {0x26, 0x20, 0x2e, 0x01, 0x3e, 0x55, 0x77, 0x00}; // MVI H,20h; MVI L,01h; MVI A,55h; MOV M,A; NOP
+
+  memcpy(memory, program, sizeof(program));
+  debugger_set_watchpoint(p->debugger, p, 0x2000, 4, false, true);
+
+  assert_true(i8080_run(p, 400) == I8080_EXIT_WATCHPOINT);
+
+  assert_true(p->pc == 7);
+  assert_true(memory[0x2001] == 0x55);
+  assert_true(p->debugger->hit == DEBUGGER_WATCH_WRITE);
+  assert_true(p->debugger->hit_addr == 0x2001);
+  assert_true(p->debugger->hit_value == 0x55);
+
+  debugger_clear_watchpoint(p->debugger, p, 0x2000, 4);
+  assert_true(p->page_flags[0x20] == 0);
+}
+
+static void stops_after_watched_read(void **state)
+{
+  i8080 *p = *state;
+  uint8_t program[] = {0x26, 0x20, 0x2e, 0x00, 0x7e, 0x00}; // MVI H,20h; MVI L,00h; MOV A,M; NOP
+
+  memcpy(memory, program, sizeof(program));
+  memory[0x2000] = 0x42;
+  debugger_set_watchpoint(p->debugger, p, 0x2000, 1, true, false);
+
+  assert_true(i8080_run(p, 400) == I8080_EXIT_WATCHPOINT);
+
+  assert_true(p->pc == 5);
+  assert_true(p->a == 0x42);
+  assert_true(p->debugger->hit == DEBUGGER_WATCH_READ);
+}
+
+static void traps_and_halts(void **state)
+{
+  i8080 *p = *state;
+  uint8_t program[] = {0x3e, 0x07, 0xd3, 0x10, 0x76, 0x00}; // MVI A,07h; OUT 10h; HLT; NOP
+
+  memcpy(memory, program, sizeof(program));
+
+  // No port_out callback: the OUT is undone and the run can be resumed
+  assert_true(i8080_run(p, 400) == I8080_EXIT_IO_TRAP);
+  assert_true(p->pc == 2);
+  assert_true(p->cycles == 7);
+  assert_true(p->exit_pc == 2);
+  assert_true(p->exit_opcode == 0xd3);
+
+  // Skip the OUT by hand
+  p->pc = 4;
+  assert_true(i8080_run(p, 400) == I8080_EXIT_HALT);
+  assert_true(p->pc == 5);
+  assert_true(p->halted);
+
+  // A halted processor stays halted
+  assert_true(i8080_run(p, 400) == I8080_EXIT_HALT);
+  assert_true(p->pc == 5);
+  assert_string_equal(i8080_exit_name(I8080_EXIT_IO_TRAP), "I/O trap");
+}
+
+static void runs_until_first_condition(void **state)
+{
+  i8080 *p = *state;
+  run_until u;
+  // MVI B,07h; MVI H,20h; MVI L,00h; MOV M,B; IN 10h; NOP
+  uint8_t program[] = {0x06, 0x07, 0x26, 0x20, 0x2e, 0x00, 0x70, 0xdb, 0x10, 0x00};
+  until_condition conditions[] = {
+      {.kind = UNTIL_PC, .addr = 9},
+      {.kind = UNTIL_PORT_IN, .port = 0x10},
+      {.kind = UNTIL_MEMORY, .addr = 0x2000, .value = 7},
+      {.kind = UNTIL_REGISTER, .reg = REG_HL, .value = 0x2000},
+      {.kind = UNTIL_INSTRUCTIONS, .count = 2},
+  };
+
+  memcpy(memory, program, sizeof(program));
+
+  assert_true(run_until_compile(&u, conditions, 5) == 0);
+  assert_true(i8080_run_until(p, &u) == 4);
+  assert_true(p->pc == 4);
+
+  assert_true(i8080_run_until(p, &u) == 3);
+  assert_true(p->pc == 6);
+
+  assert_true(i8080_run_until(p, &u) == 2);
+  assert_true(p->pc == 7);
+  assert_true(memory[0x2000] == 7);
+
+  assert_true(i8080_run_until(p, &u) == 1);
+  assert_true(p->pc == 9);
+  assert_true(p->a == 0x11);
+
+  // A pc condition at the starting pc waits until pc comes back
+  p->pc = 0;
+  assert_true(run_until_compile(&u, conditions, 1) == 0);
+  assert_true(i8080_run_until(p, &u) == 0);
+  assert_true(p->pc == 9);
+  assert_true(i8080_run_until(p, &u) == 0);
+  assert_true(p->pc == 9);
+
+  for (int page = 0; page < 256; page++)
+  {
+    assert_true(p->page_flags[page] == 0);
+  }
+}
+
+static void runs_until_cycles(void **state)
+{
+  i8080 *p = *state;
+  run_until u;
+  until_condition conditions[] = {
+      {.kind = UNTIL_CYCLES, .count = 40},
+  };
+
+  assert_true(run_until_compile(&u, conditions, 1) == 0);
+  assert_true(i8080_run_until(p, &u) == 0);
+  assert_true(p->cycles == 40);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(runs_without_breakpoints, setup, teardown),
+      cmocka_unit_test_setup_teardown(stops_at_breakpoint_and_resumes, setup, teardown),
+      cmocka_unit_test_setup_teardown(stops_after_watched_write, setup, teardown),
+      cmocka_unit_test_setup_teardown(stops_after_watched_read, setup, teardown),
+      cmocka_unit_test_setup_teardown(traps_and_halts, setup, teardown),
+      cmocka_unit_test_setup_teardown(runs_until_first_condition, setup, teardown),
+      cmocka_unit_test_setup_teardown(runs_until_cycles, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,156 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "explorer.h"
+
+#define MEM_SIZE 0x10000
+
+static uint8_t memory[MEM_SIZE] = {0};
+
+static const uint8_t inputs[] = {0, 1, 2, 3};
+
+// IN 0; MOV B,A; IN 1; MOV C,A; IN 2; HLT
+static const uint8_t three_inputs[] = {0xdb, 0x00, 0x47, 0xdb, 0x01, 0x4f, 0xdb, 0x02, 0x76};
+
+// loop: IN 0; MVI A,0; JMP loop
+static const uint8_t forgets_input[] = {0xdb, 0x00, 0x3e, 0x00, 0xc3, 0x00, 0x00};
+
+// The actual implementations of the i8080 structure function pointers
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  memory[addr] = val;
+}
+
+static int setup(void **state)
+{
+  i8080 *cpu = malloc(sizeof(i8080));
+
+  if (cpu == NULL)
+  {
+    return -1;
+  }
+
+  memset(memory, 0, MEM_SIZE);
+  i8080_init(cpu);
+  cpu->read_byte = &read_byte_implementation;
+  cpu->write_byte = &write_byte_implementation;
+  *state = cpu;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  free(*state);
+  return 0;
+}
+
+static bool halted_with_2_3_1(const i8080 *p, void *context)
+{
+  (void)context;
+  return p->halted && p->b == 2 && p->c == 3 && p->a == 1;
+}
+
+static void finds_input_sequence(void **state)
+{
+  i8080 *cpu = *state;
+  explorer e;
+  uint8_t path[8];
+
+  memcpy(memory, three_inputs, sizeof(three_inputs));
+
+  for (int threads = 1; threads <= 4; threads++)
+  {
+    assert_int_equal(explorer_init(&e, inputs, sizeof(inputs), 1000, threads), 0);
+    e.goal = &halted_with_2_3_1;
+
+    assert_int_equal(explorer_run(&e, cpu, 1000, 8), 1);
+    assert_int_equal(explorer_path(explorer_found(&e), path, 8), 3);
+    assert_int_equal(path[0], 2);
+    assert_int_equal(path[1], 3);
+    assert_int_equal(path[2], 1);
+    assert_int_equal(explorer_found(&e)->port, 2);
+
+    // The host's processor and memory are left as they were
+    assert_int_equal(cpu->pc, 0);
+    assert_int_equal(cpu->cycles, 0);
+    assert_memory_equal(memory, three_inputs, sizeof(three_inputs));
+
+    explorer_free(&e);
+  }
+}
+
+static void stops_at_max_depth(void **state)
+{
+  i8080 *cpu = *state;
+  explorer e;
+
+  memcpy(memory, three_inputs, sizeof(three_inputs));
+
+  assert_int_equal(explorer_init(&e, inputs, sizeof(inputs), 1000, 2), 0);
+  e.goal = &halted_with_2_3_1;
+
+  // Two inputs deep the HLT can't be reached: the start, 4 and 16 states
+  assert_int_equal(explorer_run(&e, cpu, 1000, 2), 0);
+  assert_null(explorer_found(&e));
+  assert_int_equal(atomic_load(&e.states), 1 + 4 + 16);
+
+  explorer_free(&e);
+}
+
+static void merges_repeated_states(void **state)
+{
+  i8080 *cpu = *state;
+  explorer e;
+
+  memcpy(memory, forgets_input, sizeof(forgets_input));
+
+  // Every input leads back to the state at the first IN, so the search ends by itself
+  assert_int_equal(explorer_init(&e, inputs, sizeof(inputs), 1000, 3), 0);
+  assert_int_equal(explorer_run(&e, cpu, 1000, 1000), 0);
+  assert_int_equal(atomic_load(&e.states), 1);
+  assert_false(atomic_load(&e.full));
+
+  explorer_free(&e);
+}
+
+// A set too small for the search leaves it incomplete rather than failed
+static void reports_full_visited_set(void **state)
+{
+  i8080 *cpu = *state;
+  explorer e;
+
+  memcpy(memory, three_inputs, sizeof(three_inputs));
+
+  assert_int_equal(explorer_init(&e, inputs, sizeof(inputs), 4, 2), 0);
+  e.goal = &halted_with_2_3_1;
+
+  assert_int_equal(explorer_run(&e, cpu, 1000, 8), 2);
+  assert_null(explorer_found(&e));
+  assert_true(atomic_load(&e.full));
+
+  explorer_free(&e);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(finds_input_sequence, setup, teardown),
+      cmocka_unit_test_setup_teardown(stops_at_max_depth, setup, teardown),
+      cmocka_unit_test_setup_teardown(merges_repeated_states, setup, teardown),
+      cmocka_unit_test_setup_teardown(reports_full_visited_set, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,382 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "fusion.h"
+#include "debugger.h"
+#include "sampler.h"
+#include "machines.h"
+
+// Turns its own JZ into JNZ the first time it is taken, ending with HLT at 0007h
+static const uint8_t rewriting[] = {
+    0x3e, 0x05,       // MVI A,05h
+    0xfe, 0x05,       // CPI 05h
+    0xca, 0x10, 0x00, // JZ 0010h
+    0x76,             // HLT
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x3e, 0xc2,       // MVI A,0c2h
+    0x32, 0x04, 0x00, // STA 0004h
+    0x3e, 0x05,       // MVI A,05h
+    0xc3, 0x02, 0x00, // JMP 0002h
+};
+
+typedef struct machines
+{
+  i8080 cpu, plain;
+  fusion f;
+} machines;
+
+static int setup(void **state)
+{
+  machines *m = malloc(sizeof(machines));
+
+  if (m == NULL)
+  {
+    return -1;
+  }
+
+  machines_init(&m->cpu, &m->plain, false);
+  fusion_attach(&m->f, &m->cpu);
+  *state = m;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  machines *m = *state;
+
+  fusion_detach(&m->f, &m->cpu);
+  free(m);
+  return 0;
+}
+
+static void runs_program_like_unfused(void **state)
+{
+  machines *m = *state;
+  char report[512] = {0};
+  FILE *out = tmpfile();
+
+  load_fused_rom(memory);
+  load_fused_rom(plain_memory);
+
+  assert_int_equal(i8080_run(&m->cpu, 100000), I8080_EXIT_HALT);
+  assert_int_equal(i8080_run(&m->plain, 100000), I8080_EXIT_HALT);
+  assert_int_equal(m->cpu.pc, 0x27);
+  assert_same_state(&m->cpu, &m->plain);
+  assert_same_memory();
+
+  assert_int_equal(m->f.executed[FUSION_LOAD_INX], 16);
+  assert_int_equal(m->f.executed[FUSION_DCR_JNZ], 16);
+  assert_int_equal(m->f.executed[FUSION_LXI_CALL], 1);
+  assert_int_equal(m->f.executed[FUSION_TEST_JNZ], 3);
+  assert_int_equal(m->f.executed[FUSION_CPI_JZ], 1);
+  assert_int_equal(m->f.executed[FUSION_CPI_JNZ], 1);
+  assert_true(m->cpu.page_flags[0] & PAGE_CODE);
+  assert_false(m->cpu.page_flags[0x40] & PAGE_CODE);
+
+  fusion_report(&m->f, out);
+  rewind(out);
+  assert_true(fread(report, 1, sizeof(report) - 1, out) > 0);
+  fclose(out);
+  assert_non_null(strstr(report, "MOV A,r; ORA r; JNZ"));
+  assert_non_null(strstr(report, "41 dispatches saved"));
+}
+
+static void relearns_rewritten_code(void **state)
+{
+  machines *m = *state;
+
+  memcpy(memory, rewriting, sizeof(rewriting));
+
+  assert_int_equal(i8080_run(&m->cpu, 1000), I8080_EXIT_HALT);
+  assert_int_equal(m->cpu.pc, 0x08);
+  assert_int_equal(m->f.executed[FUSION_CPI_JZ], 1);
+  assert_int_equal(m->f.executed[FUSION_CPI_JNZ], 1);
+  assert_int_equal(m->f.invalidations, 1);
+}
+
+// Random operands and registers for every kind of group, run fused and one instruction at a time
+static void matches_unfused_groups(void **state)
+{
+  machines *m = *state;
+  static const uint8_t first[] = {0x05, 0x7e, 0x01, 0xfe, 0xfe, 0x78};
+  static const uint8_t second[] = {0xc2, 0x23, 0xcd, 0xca, 0xc2, 0xb0};
+  static const int instructions[] = {2, 2, 2, 2, 2, 3};
+
+  srand(8080);
+  for (int i = 0; i < MEM_SIZE; i++)
+  {
+    memory[i] = rand();
+  }
+
+  for (int kind = 0; kind < 6; kind++)
+  {
+    for (int round = 0; round < 2000; round++)
+    {
+      i8080_state s = {0};
+      uint16_t pc = rand();
+
+      s.a = rand() % 4;
+      s.b = rand() % 3;
+      s.c = rand() % 3;
+      s.d = rand();
+      s.e = rand() % 3;
+      s.h = rand();
+      s.l = rand();
+      s.sp = rand();
+      s.pc = pc;
+      s.zf = rand() & 1;
+      s.cf = rand() & 1;
+      s.acf = rand() & 1;
+
+      // Random registers, pairs and immediates within each kind of group
+      memory[pc] = first[kind];
+      memory[(uint16_t)(pc + 1)] = rand() % 4;
+      memory[(uint16_t)(pc + 2)] = rand();
+      memory[(uint16_t)(pc + 3)] = rand();
+      switch (kind)
+      {
+      case 0:
+      {
+        int r = rand() % 7;
+
+        memory[pc] |= (r == 6 ? 7 : r) << 3;
+        memory[(uint16_t)(pc + 1)] = second[kind];
+        break;
+      }
+      case 1:
+        memory[(uint16_t)(pc + 1)] = second[kind];
+        break;
+      case 2:
+        memory[pc] |= (rand() % 4) << 4;
+        memory[(uint16_t)(pc + 3)] = second[kind];
+        break;
+      case 3:
+      case 4:
+        memory[(uint16_t)(pc + 2)] = second[kind];
+        break;
+      case 5:
+        memory[pc] |= rand() % 6;
+        memory[(uint16_t)(pc + 1)] = second[kind] | rand() % 6;
+        memory[(uint16_t)(pc + 2)] = 0xc2;
+        break;
+      }
+      memcpy(plain_memory, memory, MEM_SIZE);
+      fusion_flush(&m->f, &m->cpu);
+
+      i8080_load_state(&m->cpu, &s);
+      i8080_load_state(&m->plain, &s);
+      assert_true(fusion_step(&m->f, &m->cpu, UINT64_MAX));
+      for (int step = 0; step < instructions[kind]; step++)
+      {
+        i8080_step(&m->plain);
+      }
+
+      assert_same_state(&m->cpu, &m->plain);
+      assert_int_equal(memory[(uint16_t)(s.sp - 1)], plain_memory[(uint16_t)(s.sp - 1)]);
+      assert_int_equal(memory[(uint16_t)(s.sp - 2)], plain_memory[(uint16_t)(s.sp - 2)]);
+    }
+    assert_int_equal(m->f.executed[FUSION_DCR_JNZ + kind], 2000);
+  }
+}
+
+static void splits_groups_for_the_debugger(void **state)
+{
+  machines *m = *state;
+  debugger d;
+
+  load_fused_rom(memory);
+  debugger_attach(&d, &m->cpu);
+
+  // The read of MOV A,M stops the run before INX H
+  debugger_set_watchpoint(&d, &m->cpu, 0x4000, 1, true, false);
+  assert_int_equal(i8080_run(&m->cpu, 100000), I8080_EXIT_WATCHPOINT);
+  assert_int_equal(m->cpu.pc, 0x0b);
+  assert_int_equal(m->cpu.l, 0x00);
+  debugger_clear_watchpoint(&d, &m->cpu, 0x4000, 1);
+
+  // As does a breakpoint on the JNZ of DCR B
+  debugger_set_breakpoint(&d, &m->cpu, 0x0f);
+  assert_int_equal(i8080_run(&m->cpu, 100000), I8080_EXIT_BREAKPOINT);
+  assert_int_equal(m->cpu.pc, 0x0f);
+  assert_int_equal(m->cpu.b, 0x0f);
+  assert_int_equal(m->f.executed[FUSION_LOAD_INX], 0);
+  debugger_detach(&d, &m->cpu);
+}
+
+// The block idioms at 0100h, each followed by HLT
+static const uint8_t copy_bc_loop[] = {0x7e, 0x12, 0x23, 0x13, 0x0b, 0x78, 0xb1, 0xc2, 0x00, 0x01, 0x76};
+static const uint8_t copy_c_loop[] = {0x7e, 0x12, 0x23, 0x13, 0x0d, 0xc2, 0x00, 0x01, 0x76};
+static const uint8_t fill_bc_loop[] = {0x36, 0xe5, 0x23, 0x0b, 0x78, 0xb1, 0xc2, 0x00, 0x01, 0x76};
+static const uint8_t fill_e_loop[] = {0x73, 0x23, 0x0b, 0x78, 0xb1, 0xc2, 0x00, 0x01, 0x76};
+static const uint8_t fill_b_loop[] = {0x77, 0x23, 0x05, 0xc2, 0x00, 0x01, 0x76};
+
+static void load_loop(machines *m, const uint8_t *loop, size_t size, const i8080_state *s)
+{
+  memcpy(memory + 0x100, loop, size);
+  memcpy(plain_memory, memory, MEM_SIZE);
+  fusion_flush(&m->f, &m->cpu);
+  i8080_load_state(&m->cpu, s);
+  i8080_load_state(&m->plain, s);
+}
+
+// Random counts and addresses, overlapping ones too, run as blocks and one instruction at a time
+static void matches_unfused_blocks(void **state)
+{
+  machines *m = *state;
+  static const uint8_t *loops[] = {copy_bc_loop, copy_c_loop, fill_bc_loop, fill_e_loop, fill_b_loop};
+  static const size_t sizes[] = {sizeof(copy_bc_loop), sizeof(copy_c_loop), sizeof(fill_bc_loop),
+                                 sizeof(fill_e_loop), sizeof(fill_b_loop)};
+  static const enum fusion_kind kinds[] = {FUSION_COPY_BC, FUSION_COPY_R, FUSION_FILL_BC, FUSION_FILL_BC,
+                                           FUSION_FILL_R};
+
+  srand(8085);
+  for (int i = 0; i < MEM_SIZE; i++)
+  {
+    memory[i] = rand();
+  }
+  fusion_map_ram(&m->f, memory, 0x10, 0xf0);
+
+  for (int loop = 0; loop < 5; loop++)
+  {
+    for (int round = 0; round < 50; round++)
+    {
+      i8080_state s = {0};
+      uint16_t src = 0x1000 + rand() % 0x6000;
+      uint16_t dst = round % 4 == 0 ? src + rand() % 8 : round % 4 == 1 ? src - rand() % 8 : 0x1000 + rand() % 0x6000;
+      uint16_t count = 1 + rand() % 0x800;
+
+      s.a = rand();
+      s.b = count >> 8;
+      s.c = count & 0xff;
+      s.d = dst >> 8;
+      s.e = dst & 0xff;
+      s.h = src >> 8;
+      s.l = src & 0xff;
+      s.pc = 0x100;
+      s.cf = rand() & 1;
+      s.acf = rand() & 1;
+      load_loop(m, loops[loop], sizes[loop], &s);
+
+      assert_int_equal(i8080_run(&m->cpu, 10000000), I8080_EXIT_HALT);
+      assert_int_equal(i8080_run(&m->plain, 10000000), I8080_EXIT_HALT);
+      assert_same_state(&m->cpu, &m->plain);
+      assert_same_memory();
+    }
+    assert_true(m->f.executed[kinds[loop]] > 0);
+  }
+}
+
+static void stops_blocks_at_unmapped_pages(void **state)
+{
+  machines *m = *state;
+  i8080_state s = {.b = 0x01, .c = 0x00, .h = 0x1f, .l = 0x80, .pc = 0x100};
+
+  fusion_map_ram(&m->f, memory, 0x10, 0x10);
+  load_loop(m, fill_bc_loop, sizeof(fill_bc_loop), &s);
+
+  assert_int_equal(i8080_run(&m->cpu, 100000), I8080_EXIT_HALT);
+  assert_int_equal(i8080_run(&m->plain, 100000), I8080_EXIT_HALT);
+  assert_same_state(&m->cpu, &m->plain);
+  assert_same_memory();
+  assert_int_equal(m->f.executed[FUSION_FILL_BC], 0x80);
+  assert_int_equal(memory[0x2000], 0xe5);
+  assert_int_equal(memory[0x2080], 0x00);
+}
+
+static void stops_blocks_at_budget(void **state)
+{
+  machines *m = *state;
+  i8080_state s = {.b = 0x10, .c = 0x00, .e = 0x42, .h = 0x30, .pc = 0x100};
+
+  fusion_map_ram(&m->f, memory, 0x00, 0x100);
+  load_loop(m, fill_e_loop, sizeof(fill_e_loop), &s);
+
+  // 10 iterations of 36 cycles, then as many as the next run allows
+  assert_int_equal(i8080_run(&m->cpu, 360), I8080_EXIT_BUDGET);
+  assert_int_equal(m->cpu.cycles, 360);
+  assert_int_equal(m->cpu.pc, 0x100);
+  assert_int_equal(m->cpu.l, 10);
+  assert_int_equal(m->cpu.c, 0xf6);
+  assert_int_equal(memory[0x3009], 0x42);
+  assert_int_equal(memory[0x300a], 0x00);
+
+  assert_int_equal(i8080_run(&m->cpu, 1000000), I8080_EXIT_HALT);
+  assert_int_equal(m->cpu.cycles, 36 * 0x1000 + 7);
+  assert_int_equal(m->f.executed[FUSION_FILL_BC], 0x1000);
+}
+
+// A budget ending inside a group stops the run where an instruction at a time would
+static void stops_inside_groups_at_budget(void **state)
+{
+  machines *m = *state;
+  static const uint8_t loop[] = {
+      0x06, 0x05,       // MVI B,05h
+      0x05,             // DCR B
+      0xc2, 0x02, 0x00, // JNZ 0002h
+      0x76,             // HLT
+  };
+
+  memcpy(memory, loop, sizeof(loop));
+  memcpy(plain_memory, loop, sizeof(loop));
+
+  while (!m->plain.halted)
+  {
+    assert_int_equal(i8080_run(&m->cpu, 1), i8080_run(&m->plain, 1));
+    assert_same_state(&m->cpu, &m->plain);
+  }
+  assert_int_equal(m->cpu.pc, 0x07);
+  assert_int_equal(m->f.executed[FUSION_DCR_JNZ], 0);
+
+  // With the budget to run them whole, the same groups are fused
+  m->cpu.pc = m->plain.pc = 0;
+  m->cpu.halted = m->plain.halted = false;
+  assert_int_equal(i8080_run(&m->cpu, 7), i8080_run(&m->plain, 7));
+  assert_int_equal(i8080_run(&m->cpu, 6), i8080_run(&m->plain, 6));
+  assert_same_state(&m->cpu, &m->plain);
+  assert_int_equal(m->cpu.pc, 0x02);
+  assert_int_equal(m->f.executed[FUSION_DCR_JNZ], 1);
+}
+
+// The sampler sees where each fused group ends, the sampling thread isn't needed for that
+static void publishes_groups_to_sampler(void **state)
+{
+  machines *m = *state;
+  static sampler s;
+  static const uint8_t loop[] = {
+      0x05,             // DCR B
+      0xc2, 0x00, 0x00, // JNZ 0000h
+  };
+
+  memcpy(memory, loop, sizeof(loop));
+  atomic_store(&s.snapshot, 0);
+  m->cpu.sampler = &s;
+
+  // 100 iterations of 15 cycles, the last one ending back at 0000h at cycle 1500
+  assert_int_equal(i8080_run(&m->cpu, 1500), I8080_EXIT_BUDGET);
+  assert_true(m->f.executed[FUSION_DCR_JNZ] > 90);
+  assert_int_equal(atomic_load(&s.snapshot), (uint64_t)1500 << 16);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(runs_program_like_unfused, setup, teardown),
+      cmocka_unit_test_setup_teardown(relearns_rewritten_code, setup, teardown),
+      cmocka_unit_test_setup_teardown(matches_unfused_groups, setup, teardown),
+      cmocka_unit_test_setup_teardown(splits_groups_for_the_debugger, setup, teardown),
+      cmocka_unit_test_setup_teardown(matches_unfused_blocks, setup, teardown),
+      cmocka_unit_test_setup_teardown(stops_blocks_at_unmapped_pages, setup, teardown),
+      cmocka_unit_test_setup_teardown(stops_blocks_at_budget, setup, teardown),
+      cmocka_unit_test_setup_teardown(stops_inside_groups_at_budget, setup, teardown),
+      cmocka_unit_test_setup_teardown(publishes_groups_to_sampler, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
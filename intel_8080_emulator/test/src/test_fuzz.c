@@ -0,0 +1,134 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "fuzz.h"
+
+// At 100h: IN 0; ADI 80h; JC high; HLT; high: MVI A,1; STA 2000h; HLT
+static const uint8_t reads_port[] = {0xdb, 0x00, 0xc6, 0x80, 0xda, 0x0a, 0x01, 0x76, 0x00, 0x00,
+                                     0x3e, 0x01, 0x32, 0x00, 0x20, 0x76};
+
+// LDA 3000h; ADI 80h; JC high; HLT; high: MVI A,1; STA 2000h; HLT
+static const uint8_t reads_memory[] = {0x3a, 0x00, 0x30, 0xc6, 0x80, 0xda, 0x0b, 0x00, 0x76, 0x00, 0x00,
+                                       0x3e, 0x01, 0x32, 0x00, 0x20, 0x76};
+
+static const uint8_t low[] = {0x10};
+static const uint8_t high[] = {0x90};
+
+static int setup(void **state)
+{
+  fuzz *f = malloc(sizeof(fuzz));
+
+  if (f == NULL || fuzz_init(f, reads_port, sizeof(reads_port), 0x100, 10000) != 0)
+  {
+    free(f);
+    return -1;
+  }
+  *state = f;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  fuzz_free(*state);
+  free(*state);
+  return 0;
+}
+
+static int edges_count(const fuzz *f)
+{
+  int count = 0;
+
+  for (int i = 0; i < FUZZ_MAP_SIZE; i++)
+  {
+    count += f->edges[i] != 0;
+  }
+  return count;
+}
+
+static void resets_between_runs(void **state)
+{
+  fuzz *f = *state;
+
+  assert_int_equal(fuzz_run_one(f, low, sizeof(low)), I8080_EXIT_HALT);
+  assert_int_equal(f->cpu.pc, 0x108);
+  assert_int_equal(f->memory[0x2000], 0);
+
+  uint64_t cycles = f->cpu.cycles;
+
+  assert_int_equal(fuzz_run_one(f, high, sizeof(high)), I8080_EXIT_HALT);
+  assert_int_equal(f->cpu.pc, 0x110);
+  assert_int_equal(f->memory[0x2000], 1);
+
+  // The page written by the last run is put back
+  assert_int_equal(fuzz_run_one(f, low, sizeof(low)), I8080_EXIT_HALT);
+  assert_int_equal(f->cpu.pc, 0x108);
+  assert_int_equal(f->cpu.cycles, cycles);
+  assert_int_equal(f->memory[0x2000], 0);
+}
+
+static void stops_without_input(void **state)
+{
+  fuzz *f = *state;
+
+  assert_int_equal(fuzz_run_one(f, NULL, 0), I8080_EXIT_STOPPED);
+  assert_int_equal(f->cpu.pc, 0x102);
+}
+
+static void counts_edges(void **state)
+{
+  fuzz *f = *state;
+
+  fuzz_run_one(f, low, sizeof(low));
+  int after_low = edges_count(f);
+
+  assert_true(after_low > 0);
+
+  fuzz_run_one(f, low, sizeof(low));
+  assert_int_equal(edges_count(f), after_low);
+
+  // Taking the jump is a new edge
+  fuzz_run_one(f, high, sizeof(high));
+  assert_true(edges_count(f) > after_low);
+}
+
+static void copies_input_to_memory(void **state)
+{
+  fuzz *f = *state;
+
+  fuzz_free(f);
+  assert_int_equal(fuzz_init(f, reads_memory, sizeof(reads_memory), 0, 10000), 0);
+  f->mode = FUZZ_INPUT_MEMORY;
+  f->input_addr = 0x3000;
+  f->input_max = 1;
+
+  const uint8_t longer[] = {0x90, 0x55};
+
+  assert_int_equal(fuzz_run_one(f, longer, sizeof(longer)), I8080_EXIT_HALT);
+  assert_int_equal(f->cpu.pc, 0x11);
+  assert_int_equal(f->memory[0x3000], 0x90);
+  assert_int_equal(f->memory[0x3001], 0);
+
+  assert_int_equal(fuzz_run_one(f, NULL, 0), I8080_EXIT_HALT);
+  assert_int_equal(f->cpu.pc, 0x09);
+  assert_int_equal(f->memory[0x3000], 0);
+  assert_int_equal(f->memory[0x2000], 0);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(resets_between_runs, setup, teardown),
+      cmocka_unit_test_setup_teardown(stops_without_input, setup, teardown),
+      cmocka_unit_test_setup_teardown(counts_edges, setup, teardown),
+      cmocka_unit_test_setup_teardown(copies_input_to_memory, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
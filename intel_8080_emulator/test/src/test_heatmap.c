@@ -0,0 +1,141 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "heatmap.h"
+
+#define MEM_SIZE 0x10000
+
+static uint8_t memory[MEM_SIZE] = {0};
+
+// One read, one write and the fetches and operands of four instructions, on pages 00h, 20h and 30h
+static const uint8_t program[] = {
+    0x21, 0x00, 0x20, // LXI H,2000h
+    0x7e,             // MOV A,M
+    0x32, 0x05, 0x30, // STA 3005h
+    0x76,             // HLT
+};
+
+// The actual implementations of the i8080 structure function pointers
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  memory[addr] = val;
+}
+
+static int setup(void **state)
+{
+  i8080 *cpu = malloc(sizeof(i8080));
+  heatmap *h = malloc(sizeof(heatmap));
+
+  if (cpu == NULL || h == NULL || heatmap_init(h, true) != 0)
+  {
+    free(cpu);
+    free(h);
+    return -1;
+  }
+
+  memset(memory, 0, MEM_SIZE);
+  memcpy(memory, program, sizeof(program));
+  i8080_init(cpu);
+  cpu->read_byte = &read_byte_implementation;
+  cpu->write_byte = &write_byte_implementation;
+  cpu->heatmap = h;
+
+  *state = cpu;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  i8080 *cpu = *state;
+  heatmap_free(cpu->heatmap);
+  free(cpu->heatmap);
+  free(cpu);
+  return 0;
+}
+
+static void counts_accesses_per_page(void **state)
+{
+  i8080 *p = *state;
+  heatmap *h = p->heatmap;
+
+  assert_int_equal(i8080_run(p, 1000), I8080_EXIT_HALT);
+
+  assert_int_equal(h->fetches[0x00], 4);
+  assert_int_equal(h->reads[0x00], 4);
+  assert_int_equal(h->writes[0x00], 0);
+  assert_int_equal(h->reads[0x20], 1);
+  assert_int_equal(h->fetches[0x20], 0);
+  assert_int_equal(h->writes[0x30], 1);
+  assert_int_equal(h->reads[0x30], 0);
+
+  for (int page = 1; page < 256; page++)
+  {
+    assert_int_equal(h->fetches[page], 0);
+  }
+}
+
+// Opcodes count as fetches, their operand bytes as reads
+static void splits_fetches_from_operands(void **state)
+{
+  i8080 *p = *state;
+  heatmap *h = p->heatmap;
+  static const uint16_t opcodes[] = {0x0000, 0x0003, 0x0004, 0x0007};
+  static const uint16_t operands[] = {0x0001, 0x0002, 0x0005, 0x0006};
+
+  assert_int_equal(i8080_run(p, 1000), I8080_EXIT_HALT);
+
+  for (int i = 0; i < 4; i++)
+  {
+    assert_int_equal(h->byte_fetches[opcodes[i]], 1);
+    assert_int_equal(h->byte_reads[opcodes[i]], 0);
+    assert_int_equal(h->byte_fetches[operands[i]], 0);
+    assert_int_equal(h->byte_reads[operands[i]], 1);
+  }
+  assert_int_equal(h->byte_reads[0x2000], 1);
+  assert_int_equal(h->byte_writes[0x3005], 1);
+
+  heatmap_reset(h);
+  assert_int_equal(h->fetches[0x00], 0);
+  assert_int_equal(h->byte_reads[0x2000], 0);
+}
+
+// The CSV has a row per page accessed
+static void writes_pages_accessed(void **state)
+{
+  i8080 *p = *state;
+  char csv[256] = {0};
+  FILE *out = tmpfile();
+
+  assert_int_equal(i8080_run(p, 1000), I8080_EXIT_HALT);
+  assert_non_null(out);
+  heatmap_write_csv(p->heatmap, p->cycles, out);
+  rewind(out);
+  assert_true(fread(csv, 1, sizeof(csv) - 1, out) > 0);
+  fclose(out);
+
+  // 10 + 7 + 13 + 7 cycles
+  assert_string_equal(csv, "37,00,4,0,4\n37,20,1,0,0\n37,30,0,1,0\n");
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(counts_accesses_per_page, setup, teardown),
+      cmocka_unit_test_setup_teardown(splits_fetches_from_operands, setup, teardown),
+      cmocka_unit_test_setup_teardown(writes_pages_accessed, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
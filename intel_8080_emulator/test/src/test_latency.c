@@ -0,0 +1,115 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "latency.h"
+
+#define MEM_SIZE 0x10000
+
+static uint8_t memory[MEM_SIZE] = {0};
+
+// loop: INR A; JMP loop
+static const uint8_t program[] = {0x3c, 0xc3, 0x00, 0x00};
+
+// The actual implementations of the i8080 structure function pointers
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  memory[addr] = val;
+}
+
+// Values under LATENCY_SUB_BUCKETS have a bucket each
+static void keeps_small_values_exact(void **state)
+{
+  (void)state;
+  static latency_histogram h;
+
+  memset(&h, 0, sizeof(h));
+  for (uint64_t ticks = 0; ticks < LATENCY_SUB_BUCKETS; ticks++)
+  {
+    latency_record(&h, ticks);
+  }
+  assert_int_equal(h.count, LATENCY_SUB_BUCKETS);
+  assert_int_equal(h.min, 0);
+  assert_int_equal(h.max, LATENCY_SUB_BUCKETS - 1);
+  assert_int_equal(h.total, LATENCY_SUB_BUCKETS * (LATENCY_SUB_BUCKETS - 1) / 2);
+  assert_int_equal(latency_percentile(&h, 0.0), 0);
+  assert_int_equal(latency_percentile(&h, 0.5), LATENCY_SUB_BUCKETS / 2);
+  assert_int_equal(latency_percentile(&h, 1.0), LATENCY_SUB_BUCKETS - 1);
+}
+
+// Larger values are reported as the lower bound of their bucket, within 1/16 of them
+static void reports_percentiles_within_a_bucket(void **state)
+{
+  (void)state;
+  static latency_histogram h;
+
+  memset(&h, 0, sizeof(h));
+  for (uint64_t ticks = 1; ticks <= 1000; ticks++)
+  {
+    latency_record(&h, ticks);
+  }
+  assert_int_equal(h.min, 1);
+  assert_int_equal(h.max, 1000);
+  assert_in_range(latency_percentile(&h, 0.5), 501 - 501 / LATENCY_SUB_BUCKETS, 501);
+  assert_in_range(latency_percentile(&h, 0.9), 901 - 901 / LATENCY_SUB_BUCKETS, 901);
+  assert_in_range(latency_percentile(&h, 0.99), 991 - 991 / LATENCY_SUB_BUCKETS, 991);
+  assert_int_equal(latency_percentile(&h, 1.0), 1000);
+
+  // One slow outlier only shows at the top
+  latency_record(&h, 1000000);
+  assert_in_range(latency_percentile(&h, 0.99), 991 - 991 / LATENCY_SUB_BUCKETS, 991);
+  assert_int_equal(latency_percentile(&h, 1.0), 1000000);
+}
+
+static void writes_report_of_handlers_run(void **state)
+{
+  (void)state;
+  i8080 cpu;
+  char report[4096] = {0};
+  FILE *out = tmpfile();
+
+  memcpy(memory, program, sizeof(program));
+  i8080_init(&cpu);
+  cpu.read_byte = &read_byte_implementation;
+  cpu.write_byte = &write_byte_implementation;
+  latency_reset();
+  i8080_run(&cpu, 1500);
+
+  assert_non_null(out);
+  latency_write_report(out);
+  long size = ftell(out);
+  rewind(out);
+  assert_true(fread(report, 1, sizeof(report) - 1, out) == (size_t)size);
+  fclose(out);
+
+#ifdef I8080_LATENCY
+  // 100 iterations of 15 cycles
+  assert_true(strncmp(report, "handler,count,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n", 58) == 0);
+  assert_non_null(strstr(report, "\n3c INR A,100,"));
+  assert_non_null(strstr(report, "\nc3 JMP,100,"));
+  assert_null(strstr(report, "\n00 NOP,"));
+#else
+  assert_int_equal(size, 0);
+#endif
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(keeps_small_values_exact),
+      cmocka_unit_test(reports_percentiles_within_a_bucket),
+      cmocka_unit_test(writes_report_of_handlers_run),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,229 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "lockstep.h"
+
+#define MEM_SIZE 0x10000
+
+static uint8_t memory[MEM_SIZE] = {0};
+
+// Moves, 16-bit arithmetic, the stack, rotates and jumps, ending with HLT at 0047h
+static const uint8_t program[] = {
+    0x31, 0x00, 0x01, // LXI SP,0100h
+    0x21, 0x34, 0x12, // LXI H,1234h
+    0x01, 0x01, 0x00, // LXI B,0001h
+    0x09,             // DAD B
+    0x23,             // INX H
+    0x2b,             // DCX H
+    0x22, 0x00, 0x02, // SHLD 0200h
+    0x2a, 0x00, 0x02, // LHLD 0200h
+    0xe5,             // PUSH H
+    0xf5,             // PUSH PSW
+    0xf1,             // POP PSW
+    0xd1,             // POP D
+    0xeb,             // XCHG
+    0xe3,             // XTHL
+    0x3e, 0x81,       // MVI A,81h
+    0x07,             // RLC
+    0x1f,             // RAR
+    0x17,             // RAL
+    0x0f,             // RRC
+    0x2f,             // CMA
+    0x37,             // STC
+    0x3f,             // CMC
+    0x32, 0x01, 0x02, // STA 0201h
+    0x0a,             // LDAX B
+    0xcd, 0x30, 0x00, // CALL 0030h
+    0xda, 0x40, 0x00, // JC 0040h
+    0xd2, 0x40, 0x00, // JNC 0040h
+};
+
+// EI; loop: IN 1; OUT 2; JMP loop, with an RST 7 handler doing HLT
+static const uint8_t echo[] = {0xfb, 0xdb, 0x01, 0xd3, 0x02, 0xc3, 0x01, 0x00};
+
+// EI; loop: JMP loop, with an RST 7 handler doing INR B; EI; RET
+static const uint8_t busy[] = {0xfb, 0xc3, 0x01, 0x00};
+static const uint8_t busy_handler[] = {0x04, 0xfb, 0xc9};
+
+static uint8_t last_out;
+
+// The actual implementations of the i8080 structure function pointers
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  memory[addr] = val;
+}
+
+static uint8_t port_in_implementation(uint8_t port)
+{
+  return port + 0x40;
+}
+
+static uint8_t port_out_implementation(uint8_t port, uint8_t value)
+{
+  (void)port;
+  last_out = value;
+  return 0;
+}
+
+static int setup(void **state)
+{
+  i8080 *cpu = malloc(sizeof(i8080));
+
+  if (cpu == NULL)
+  {
+    return -1;
+  }
+
+  memset(memory, 0, MEM_SIZE);
+  memcpy(memory, program, sizeof(program));
+  memory[0x30] = 0xc9;                   // RET
+  memcpy(memory + 0x40, "\xcb\x45\x00", 3); // undocumented JMP 0045h
+  memcpy(memory + 0x45, "\xfb\xf3\x76", 3); // EI; DI; HLT
+
+  i8080_init(cpu);
+  cpu->read_byte = &read_byte_implementation;
+  cpu->write_byte = &write_byte_implementation;
+  cpu->port_in = &port_in_implementation;
+  cpu->port_out = &port_out_implementation;
+  *state = cpu;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  free(*state);
+  return 0;
+}
+
+static void matches_reference(void **state)
+{
+  i8080 *cpu = *state;
+  lockstep l;
+
+  lockstep_attach(&l, cpu);
+  assert_int_equal(i8080_run(cpu, 10000), I8080_EXIT_HALT);
+  assert_false(l.diverged);
+  assert_int_equal(l.steps, 32);
+  assert_int_equal(cpu->pc, 0x48);
+
+  // What the program computed
+  assert_int_equal(memory[0x200], 0x35);
+  assert_int_equal(memory[0x201], 0x7e);
+  assert_int_equal(memory[0x100], 0x35);
+  assert_int_equal(memory[0x101], 0x12);
+  assert_int_equal(cpu->d, 0x12);
+  assert_int_equal(cpu->e, 0x35);
+  assert_int_equal(cpu->h, 0);
+  assert_int_equal(cpu->l, 0);
+  assert_int_equal(cpu->a, memory[1]);
+
+  lockstep_detach(&l, cpu);
+  assert_ptr_equal(cpu->read_byte, &read_byte_implementation);
+  assert_null(cpu->lockstep);
+}
+
+static void matches_with_io_and_interrupts(void **state)
+{
+  i8080 *cpu = *state;
+  lockstep l;
+
+  memcpy(memory, echo, sizeof(echo));
+  memory[0x38] = 0x76;
+  cpu->sp = 0x100;
+
+  lockstep_attach(&l, cpu);
+  assert_int_equal(i8080_run(cpu, 100), I8080_EXIT_BUDGET);
+  assert_int_equal(last_out, 0x41);
+
+  i8080_interrupt(cpu, 0xff);
+  assert_int_equal(i8080_run(cpu, 1000), I8080_EXIT_HALT);
+  assert_false(l.diverged);
+  assert_int_equal(cpu->pc, 0x39);
+  lockstep_detach(&l, cpu);
+}
+
+// With an interrupt always pending, each one waits for the RET after EI, so the stack doesn't grow
+static void enables_interrupts_after_the_next_instruction(void **state)
+{
+  i8080 *cpu = *state;
+  lockstep l;
+
+  memcpy(memory, busy, sizeof(busy));
+  memcpy(memory + 0x38, busy_handler, sizeof(busy_handler));
+  cpu->sp = 0x100;
+
+  lockstep_attach(&l, cpu);
+  for (int i = 0; i < 300; i++)
+  {
+    i8080_interrupt(cpu, 0xff);
+    i8080_step(cpu);
+    assert_true(cpu->sp >= 0xfe);
+  }
+  assert_false(l.diverged);
+  // After EI and the JMP it delays, three steps per interrupt: the RST taken with INR B, EI and RET
+  assert_int_equal(cpu->b, 100);
+  lockstep_detach(&l, cpu);
+}
+
+static void reports_first_divergence(void **state)
+{
+  i8080 *cpu = *state;
+  lockstep l;
+  char report[512] = {0};
+  FILE *out = tmpfile();
+
+  assert_non_null(out);
+  memory[0] = 0x3e; // MVI A,05h
+  memory[1] = 0x05;
+
+  // A core that gets MVI wrong, and writes where it shouldn't
+  lockstep_attach(&l, cpu);
+  lockstep_begin(&l, cpu);
+  cpu->pc = 2;
+  cpu->cycles = 7;
+  cpu->a = 6;
+  cpu->write_byte(0x1234, 0x56);
+  lockstep_check(&l, cpu, 0x3e);
+
+  assert_true(l.diverged);
+  assert_int_equal(cpu->exit_reason, I8080_EXIT_DIVERGENCE);
+  assert_int_equal(l.opcode, 0x3e);
+  assert_int_equal(l.expected.a, 5);
+  assert_int_equal(l.actual.a, 6);
+
+  lockstep_report(&l, out);
+  rewind(out);
+  assert_true(fread(report, 1, sizeof(report) - 1, out) > 0);
+  fclose(out);
+
+  assert_non_null(strstr(report, "divergence at step 1, pc 0000, opcode 3e"));
+  assert_non_null(strstr(report, "a         expected 05, got 06"));
+  assert_non_null(strstr(report, "memory writes differ"));
+  assert_non_null(strstr(report, "1234=56"));
+  assert_null(strstr(report, "cycles"));
+  lockstep_detach(&l, cpu);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(matches_reference, setup, teardown),
+      cmocka_unit_test_setup_teardown(enables_interrupts_after_the_next_instruction, setup, teardown),
+      cmocka_unit_test_setup_teardown(matches_with_io_and_interrupts, setup, teardown),
+      cmocka_unit_test_setup_teardown(reports_first_divergence, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,190 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "profiler.h"
+#include "callgraph.h"
+
+#define MEM_SIZE 0x10000
+
+static uint8_t memory[MEM_SIZE] = {0};
+
+// The actual implementations of the i8080 structure function pointers
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  memory[addr] = val;
+}
+
+static int setup(void **state)
+{
+  i8080 *cpu = malloc(sizeof(i8080));
+  profiler *prof = malloc(sizeof(profiler));
+
+  if (cpu == NULL || prof == NULL)
+  {
+    free(cpu);
+    free(prof);
+    return -1;
+  }
+
+  memset(memory, 0, MEM_SIZE);
+  i8080_init(cpu);
+  cpu->read_byte = &read_byte_implementation;
+  cpu->write_byte = &write_byte_implementation;
+  profiler_init(prof);
+  cpu->profiler = prof;
+
+  *state = cpu;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  i8080 *cpu = *state;
+  free(cpu->profiler);
+  free(cpu);
+  return 0;
+}
+
+static void counts_per_pc_and_opcode(void **state)
+{
+  i8080 *p = *state;
+  uint8_t program[] = {0x06, 0x01, 0x04, 0x04, 0x00}; // MVI B,1; INR B; INR B; NOP
+
+  memcpy(memory, program, sizeof(program));
+
+  for (int i = 0; i < 4; i++)
+  {
+    i8080_step(p);
+  }
+
+  assert_true(p->profiler->pc_count[0] == 1);
+  assert_true(p->profiler->pc_count[1] == 0); // Operand, never executed
+  assert_true(p->profiler->pc_count[2] == 1);
+  assert_true(p->profiler->pc_cycles[0] == 7);
+  assert_true(p->profiler->opcode_count[0x04] == 2);
+  assert_true(p->profiler->opcode_cycles[0x04] == 10);
+  assert_true(p->cycles == 7 + 5 + 5 + 4);
+}
+
+static void conditional_call_cycles(void **state)
+{
+  i8080 *p = *state;
+  uint8_t program[] = {0xc4, 0x10, 0x00}; // CNZ 0010h
+
+  memcpy(memory, program, sizeof(program));
+  p->sp = 0x100;
+
+  p->zf = 1;
+  i8080_step(p);
+  assert_true(p->cycles == 11);
+  assert_true(p->pc == 3);
+
+  p->pc = 0;
+  p->zf = 0;
+  i8080_step(p);
+  assert_true(p->cycles == 11 + 17);
+  assert_true(p->pc == 0x10);
+  assert_true(p->profiler->pc_cycles[0] == 11 + 17);
+}
+
+static void folded_output(void **state)
+{
+  i8080 *p = *state;
+  char buffer[256] = {0};
+  FILE *out = tmpfile();
+
+  memory[0] = 0x3e; // MVI A,2ah
+  memory[1] = 0x2a;
+  i8080_step(p);
+
+  profiler_write_folded(p->profiler, p, out);
+  rewind(out);
+  fread(buffer, 1, sizeof(buffer) - 1, out);
+  fclose(out);
+
+  assert_string_equal(buffer, "page 00xxh;0000h MVI A,2ah 7\n");
+}
+
+static void callgraph_inclusive_exclusive(void **state)
+{
+  i8080 *p = *state;
+  callgraph *cg = malloc(sizeof(callgraph));
+  uint8_t program[] = {0xcd, 0x10, 0x00, 0x00}; // CALL 0010h; NOP
+  uint8_t outer[] = {0xcd, 0x20, 0x00, 0xc9};   // CALL 0020h; RET
+  uint8_t inner[] = {0x00, 0xc9};               // NOP; RET
+
+  memcpy(memory, program, sizeof(program));
+  memcpy(memory + 0x10, outer, sizeof(outer));
+  memcpy(memory + 0x20, inner, sizeof(inner));
+  p->sp = 0x1000;
+  assert_true(callgraph_init(cg, p) == 0);
+  p->callgraph = cg;
+
+  while (p->pc != 3)
+  {
+    i8080_step(p);
+  }
+
+  assert_true(cg->depth == 1);
+  assert_true(p->sp == 0x1000);
+  assert_true(cg->calls[0x10] == 1);
+  assert_true(cg->calls[0x20] == 1);
+  assert_true(cg->exclusive_cycles[0x20] == 4 + 10);
+  assert_true(cg->exclusive_cycles[0x10] == 17 + 10);
+  assert_true(cg->inclusive_cycles[0x10] == 17 + 10 + 4 + 10);
+
+  callgraph_free(cg);
+  free(cg);
+}
+
+static void callgraph_ret_used_as_jump(void **state)
+{
+  i8080 *p = *state;
+  callgraph *cg = malloc(sizeof(callgraph));
+  uint8_t program[] = {0xcd, 0x10, 0x00};                   // CALL 0010h
+  uint8_t routine[] = {0x26, 0x00, 0x2e, 0x30, 0xe5, 0xc9}; // MVI H,0; MVI L,30h; PUSH H; RET
+
+  memcpy(memory, program, sizeof(program));
+  memcpy(memory + 0x10, routine, sizeof(routine));
+  memory[0x30] = 0xc9; // RET
+  p->sp = 0x1000;
+  assert_true(callgraph_init(cg, p) == 0);
+  p->callgraph = cg;
+
+  while (p->pc != 3)
+  {
+    i8080_step(p);
+  }
+
+  // The pushed address is jumped to without leaving the subroutine
+  assert_true(cg->depth == 1);
+  assert_true(cg->exclusive_cycles[0x10] == 7 + 7 + 11 + 10 + 10);
+
+  callgraph_free(cg);
+  free(cg);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(counts_per_pc_and_opcode, setup, teardown),
+      cmocka_unit_test_setup_teardown(conditional_call_cycles, setup, teardown),
+      cmocka_unit_test_setup_teardown(folded_output, setup, teardown),
+      cmocka_unit_test_setup_teardown(callgraph_inclusive_exclusive, setup, teardown),
+      cmocka_unit_test_setup_teardown(callgraph_ret_used_as_jump, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
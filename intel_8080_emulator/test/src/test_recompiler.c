@@ -0,0 +1,263 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "debugger.h"
+#include "recompiler.h"
+#include "machines.h"
+#include "recompiler_roms.h"
+
+typedef struct machines
+{
+  i8080 cpu, plain;
+  recompiled r;
+  recompiler compiler;
+} machines;
+
+static int setup(void **state)
+{
+  machines *m = calloc(1, sizeof(machines));
+
+  if (m == NULL)
+  {
+    return -1;
+  }
+
+  machines_init(&m->cpu, &m->plain, true);
+  *state = m;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  machines *m = *state;
+
+  recompiled_detach(&m->r, &m->cpu);
+  free(m);
+  return 0;
+}
+
+// Loads the ROM into both memories and attaches its image, instead of any attached before
+static void load(machines *m, const uint8_t *rom, size_t size, const recompiled_image *image)
+{
+  recompiled_detach(&m->r, &m->cpu);
+  memcpy(memory, rom, size);
+  memcpy(plain_memory, memory, MEM_SIZE);
+  assert_int_equal(recompiled_attach(&m->r, image, &m->cpu), image->count);
+}
+
+// Discovery follows branches, calls and the vectors asked for, but not PCHL
+static void discovers_blocks(void **state)
+{
+  machines *m = *state;
+  recompiler *c = &m->compiler;
+
+  assert_int_equal(recompiler_init(c, program_rom, sizeof(program_rom), 0), 0);
+  assert_true(recompiler_discover(c, 0, 0x01) > 0);
+
+  // The loop, the instruction after its JNZ, the call and the instruction after it
+  assert_int_equal(c->marks[0x0017], MARK_INSTRUCTION | MARK_LEADER);
+  assert_int_equal(c->marks[0x001f], MARK_INSTRUCTION | MARK_LEADER);
+  assert_int_equal(c->marks[0x0040], MARK_INSTRUCTION | MARK_LEADER);
+  assert_int_equal(c->marks[0x0025], MARK_INSTRUCTION | MARK_LEADER);
+  assert_int_equal(c->marks[0x0018], MARK_INSTRUCTION);
+  assert_int_equal(c->marks[0x0050], 0);
+  assert_int_equal(c->marks[0x0008], 0);
+
+  assert_true(recompiler_discover(c, 0, 0x02) > 0);
+  assert_int_equal(c->marks[0x0008], MARK_INSTRUCTION | MARK_LEADER);
+  assert_int_equal(c->marks[0x0009], MARK_INSTRUCTION);
+
+  assert_int_equal(recompiler_init(c, program_rom, 0xffff, 2), -1);
+}
+
+// Writes the image into text
+static void emit(recompiler *c, const char *name, char *text, size_t text_size)
+{
+  FILE *out = tmpfile();
+  size_t size;
+
+  assert_non_null(out);
+  assert_true(recompiler_emit(c, out, name) >= 0);
+  rewind(out);
+  size = fread(text, 1, text_size - 1, out);
+  text[size] = '\0';
+  fclose(out);
+}
+
+// Blocks written to by STA, and blocks starting with IN or OUT, are not compiled
+static void leaves_written_code_and_io_to_the_interpreter(void **state)
+{
+  machines *m = *state;
+  recompiler *c = &m->compiler;
+  static char text[0x10000];
+
+  assert_int_equal(recompiler_init(c, rewriting_rom, sizeof(rewriting_rom), 0), 0);
+  recompiler_discover(c, 0, 0);
+  assert_true(c->marks[0x0004] & MARK_WRITTEN);
+  emit(c, "rewriting", text, sizeof(text));
+  assert_non_null(strstr(text, "static void rewriting_0000(i8080 *p)"));
+  assert_null(strstr(text, "rewriting_0002(i8080 *p)"));
+  assert_non_null(strstr(text, "static void rewriting_0010(i8080 *p)"));
+
+  assert_int_equal(recompiler_init(c, io_rom, sizeof(io_rom), 0), 0);
+  recompiler_discover(c, 0, 0);
+  emit(c, "io", text, sizeof(text));
+  assert_null(strstr(text, "io_0000(i8080 *p)"));
+  assert_non_null(strstr(text, "static void io_0002(i8080 *p)"));
+  assert_null(strstr(text, "io_0003(i8080 *p)"));
+  assert_non_null(strstr(text, "static void io_0005(i8080 *p)"));
+
+  // They run as the interpreter would
+  load(m, rewriting_rom, sizeof(rewriting_rom), &rewriting_image);
+  assert_int_equal(i8080_run(&m->cpu, 100000), I8080_EXIT_HALT);
+  assert_int_equal(i8080_run(&m->plain, 100000), I8080_EXIT_HALT);
+  assert_same_state(&m->cpu, &m->plain);
+  assert_same_memory();
+  assert_int_equal(m->cpu.pc, 0x08);
+  assert_true(m->r.executed > 0);
+}
+
+// Loops, calls, an interrupt raised by a write and code only the interpreter finds
+static void runs_program_like_interpreter(void **state)
+{
+  machines *m = *state;
+
+  for (int i = 0; i < 16; i++)
+  {
+    memory[0x200 + i] = i * 37;
+  }
+  load(m, program_rom, sizeof(program_rom), &program_image);
+
+  assert_int_equal(i8080_run(&m->cpu, 100000), I8080_EXIT_HALT);
+  assert_int_equal(i8080_run(&m->plain, 100000), I8080_EXIT_HALT);
+  assert_same_state(&m->cpu, &m->plain);
+  assert_same_memory();
+  assert_int_equal(m->cpu.pc, 0x5c);
+  assert_int_equal(m->cpu.interrupts_enabled, false);
+  // The 16 and 3 loop iterations and 5 other blocks. The block after EI starts in the interpreter, and the handler is
+  // entered by the interpreter taking the interrupt
+  assert_int_equal(m->r.executed, 16 + 3 + 5);
+}
+
+// A MVI M ahead of itself in the same block leaves it, and the block is not run again
+static void runs_code_patched_at_run_time(void **state)
+{
+  machines *m = *state;
+
+  load(m, patching_rom, sizeof(patching_rom), &patching_image);
+  assert_int_equal(i8080_run(&m->cpu, 100000), I8080_EXIT_HALT);
+  assert_int_equal(m->cpu.a, 0x02);
+  assert_int_equal(m->r.executed, 1);
+
+  m->cpu.pc = 0;
+  m->cpu.halted = false;
+  assert_int_equal(i8080_run(&m->cpu, 100000), I8080_EXIT_HALT);
+  assert_int_equal(m->cpu.a, 0x02);
+  assert_int_equal(m->r.executed, 1);
+  assert_int_equal(m->r.mismatches, 1);
+
+  // Until the code is put back
+  memory[0x0007] = 0x00;
+  recompiled_invalidate_page(&m->r, &m->cpu, 0);
+  m->cpu.pc = 0;
+  m->cpu.halted = false;
+  i8080_run(&m->cpu, 100000);
+  assert_int_equal(m->r.executed, 2);
+}
+
+// Breakpoints, watchpoints and budgets stop runs where they stop the interpreter
+static void splits_blocks_for_the_debugger_and_budget(void **state)
+{
+  machines *m = *state;
+  debugger d;
+
+  load(m, program_rom, sizeof(program_rom), &program_image);
+  debugger_attach(&d, &m->cpu);
+
+  // The read of MOV A,M stops the run before INX H
+  debugger_set_watchpoint(&d, &m->cpu, 0x200, 1, true, false);
+  assert_int_equal(i8080_run(&m->cpu, 100000), I8080_EXIT_WATCHPOINT);
+  assert_int_equal(m->cpu.pc, 0x18);
+  debugger_clear_watchpoint(&d, &m->cpu, 0x200, 1);
+
+  // As does a breakpoint on DCR B in the middle of a block
+  debugger_set_breakpoint(&d, &m->cpu, 0x1b);
+  assert_int_equal(i8080_run(&m->cpu, 100000), I8080_EXIT_BREAKPOINT);
+  assert_int_equal(m->cpu.pc, 0x1b);
+  debugger_clear_breakpoint(&d, &m->cpu, 0x1b);
+  debugger_detach(&d, &m->cpu);
+
+  // Runs with every budget end where the interpreter's do
+  for (uint64_t budget = 1; budget < 400; budget++)
+  {
+    machines_init(&m->cpu, &m->plain, true);
+    load(m, program_rom, sizeof(program_rom), &program_image);
+
+    assert_int_equal(i8080_run(&m->cpu, budget), i8080_run(&m->plain, budget));
+    assert_same_state(&m->cpu, &m->plain);
+    assert_same_memory();
+  }
+}
+
+// Random code from random states, with random budgets and interrupts
+static void runs_random_code_like_interpreter(void **state)
+{
+  machines *m = *state;
+  static uint8_t rom[RANDOM_ROM_SIZE];
+  uint64_t executed = 0;
+
+  random_rom(rom);
+  srand(8080);
+  for (int trial = 0; trial < 3000; trial++)
+  {
+    i8080_state s = {0};
+    uint64_t budget = 1 + rand() % 4000;
+
+    memset(memory, 0, MEM_SIZE);
+    load(m, rom, sizeof(rom), &random_image);
+    s.a = rand();
+    s.b = rand();
+    s.c = rand();
+    s.d = rand();
+    s.e = rand();
+    s.h = rand();
+    s.l = rand();
+    s.sp = rand();
+    s.pc = rand() % RANDOM_ROM_SIZE;
+    s.zf = rand() & 1;
+    s.sf = rand() & 1;
+    s.pf = rand() & 1;
+    s.cf = rand() & 1;
+    s.acf = rand() & 1;
+    s.interrupts_enabled = rand() & 1;
+    i8080_load_state(&m->cpu, &s);
+    i8080_load_state(&m->plain, &s);
+
+    assert_int_equal(i8080_run(&m->cpu, budget), i8080_run(&m->plain, budget));
+    assert_same_state(&m->cpu, &m->plain);
+    assert_same_memory();
+    executed += m->r.executed;
+  }
+  assert_true(executed > 3000);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(discovers_blocks, setup, teardown),
+      cmocka_unit_test_setup_teardown(leaves_written_code_and_io_to_the_interpreter, setup, teardown),
+      cmocka_unit_test_setup_teardown(runs_program_like_interpreter, setup, teardown),
+      cmocka_unit_test_setup_teardown(runs_code_patched_at_run_time, setup, teardown),
+      cmocka_unit_test_setup_teardown(splits_blocks_for_the_debugger_and_budget, setup, teardown),
+      cmocka_unit_test_setup_teardown(runs_random_code_like_interpreter, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,186 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "replay.h"
+
+#define MEM_SIZE 0x10000
+
+static uint8_t memory[MEM_SIZE] = {0};
+static uint8_t next_input = 0;
+
+// EI; MVI H,20h; loop: IN 01h; MOV M,A; INR L; JMP loop
+static const uint8_t program[] = {0xfb, 0x26, 0x20, 0xdb, 0x01, 0x77, 0x2c, 0xc3, 0x03, 0x00};
+
+// RST 7 handler: EI; RET
+static const uint8_t handler[] = {0xfb, 0xc9};
+
+// The actual implementations of the i8080 structure function pointers
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  memory[addr] = val;
+}
+
+static uint8_t port_in_implementation(uint8_t port)
+{
+  return next_input += port * 3;
+}
+
+static void load(i8080 *p)
+{
+  memset(memory, 0, MEM_SIZE);
+  memcpy(memory, program, sizeof(program));
+  memcpy(memory + 0x38, handler, sizeof(handler));
+
+  i8080_init(p);
+  p->read_byte = &read_byte_implementation;
+  p->write_byte = &write_byte_implementation;
+}
+
+static int setup(void **state)
+{
+  i8080 *cpu = malloc(sizeof(i8080));
+
+  if (cpu == NULL)
+  {
+    return -1;
+  }
+
+  load(cpu);
+  *state = cpu;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  free(*state);
+  return 0;
+}
+
+static void replays_inputs_and_interrupts(void **state)
+{
+  i8080 *p = *state;
+  replay r;
+  static uint8_t recorded[MEM_SIZE];
+
+  p->port_in = &port_in_implementation;
+  assert_true(replay_record(&r, p) == 0);
+
+  for (int frame = 0; frame < 20; frame++)
+  {
+    assert_true(i8080_run(p, 500) == I8080_EXIT_BUDGET);
+    i8080_interrupt(p, 0xff);
+  }
+  replay_detach(&r, p);
+
+  i8080 expected = *p;
+  memcpy(recorded, memory, MEM_SIZE);
+  assert_true(r.events > 20);
+
+  // Round trip through a file
+  FILE *file = tmpfile();
+  assert_non_null(file);
+  assert_true(replay_save(&r, file) == 0);
+  replay_free(&r);
+  rewind(file);
+  assert_true(replay_load(&r, file) == 0);
+  fclose(file);
+
+  // Played back with no devices and a different run length
+  load(p);
+  replay_play(&r, p);
+  assert_true(i8080_run(p, expected.cycles) == I8080_EXIT_BUDGET);
+
+  assert_true(p->cycles == expected.cycles);
+  assert_true(p->pc == expected.pc);
+  assert_true(p->sp == expected.sp);
+  assert_true(p->a == expected.a);
+  assert_true(p->l == expected.l);
+  assert_memory_equal(memory, recorded, MEM_SIZE);
+
+  // Past the end of the recording the next IN traps
+  assert_true(i8080_run(p, 1000) == I8080_EXIT_REPLAY);
+  assert_true(p->read_byte(p->pc) == 0xdb);
+
+  replay_detach(&r, p);
+  replay_free(&r);
+}
+
+// Only RST instructions are taken, anything else is refused without stopping the run
+static void rejects_interrupts_other_than_rst(void **state)
+{
+  i8080 *p = *state;
+
+  p->port_in = &port_in_implementation;
+  assert_true(i8080_interrupt(p, 0x00) == -1);
+  assert_false(p->interrupt_pending);
+  assert_true(i8080_run(p, 1000) == I8080_EXIT_BUDGET);
+  assert_true(p->exit_reason == I8080_EXIT_BUDGET);
+
+  assert_true(i8080_interrupt(p, 0xff) == 0);
+  assert_true(p->interrupt_pending);
+  assert_true(p->interrupt_opcode == 0xff);
+}
+
+// A size in the header larger than the file is refused before anything is allocated
+static void rejects_truncated_recordings(void **state)
+{
+  i8080 *p = *state;
+  replay r;
+  static uint8_t saved[4096];
+  FILE *file = tmpfile();
+
+  p->port_in = &port_in_implementation;
+  assert_true(replay_record(&r, p) == 0);
+  assert_true(i8080_run(p, 2000) == I8080_EXIT_BUDGET);
+  replay_detach(&r, p);
+
+  assert_non_null(file);
+  assert_true(replay_save(&r, file) == 0);
+  replay_free(&r);
+  size_t size = ftell(file);
+  rewind(file);
+  assert_true(fread(saved, 1, sizeof(saved), file) == size);
+  fclose(file);
+
+  // Cut short by a byte
+  file = tmpfile();
+  assert_non_null(file);
+  assert_true(fwrite(saved, size - 1, 1, file) == 1);
+  rewind(file);
+  assert_true(replay_load(&r, file) == -1);
+  assert_null(r.data);
+  fclose(file);
+
+  // Asking for all of the address space
+  file = tmpfile();
+  assert_non_null(file);
+  memset(saved + 13, 0xff, 8);
+  assert_true(fwrite(saved, size, 1, file) == 1);
+  rewind(file);
+  assert_true(replay_load(&r, file) == -1);
+  assert_null(r.data);
+  fclose(file);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(replays_inputs_and_interrupts, setup, teardown),
+      cmocka_unit_test_setup_teardown(rejects_interrupts_other_than_rst, setup, teardown),
+      cmocka_unit_test_setup_teardown(rejects_truncated_recordings, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
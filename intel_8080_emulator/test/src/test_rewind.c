@@ -0,0 +1,219 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "rewind.h"
+
+#define MEM_SIZE 0x10000
+#define STEPS 3000
+
+static uint8_t memory[MEM_SIZE] = {0};
+static uint8_t next_input = 0;
+static int outputs = 0;
+
+// EI; MVI H,20h; loop: IN 01h; MOV M,A; INR L; JMP loop
+static const uint8_t program[] = {0xfb, 0x26, 0x20, 0xdb, 0x01, 0x77, 0x2c, 0xc3, 0x03, 0x00};
+
+// RST 7 handler: EI; RET
+static const uint8_t handler[] = {0xfb, 0xc9};
+
+// loop: IN 01h; OUT 02h; JMP loop
+static const uint8_t echo[] = {0xdb, 0x01, 0xd3, 0x02, 0xc3, 0x00, 0x00};
+
+typedef struct trace
+{
+  uint64_t cycles;
+  uint16_t pc, sp;
+  uint8_t a;
+  uint32_t checksum;
+} trace;
+
+static trace traces[STEPS + 1];
+
+// The actual implementations of the i8080 structure function pointers
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  memory[addr] = val;
+}
+
+static uint8_t port_in_implementation(uint8_t port)
+{
+  return next_input += port * 5;
+}
+
+static uint8_t port_out_implementation(uint8_t port, uint8_t value)
+{
+  (void)port;
+  (void)value;
+  outputs++;
+  return 0;
+}
+
+static int setup(void **state)
+{
+  i8080 *cpu = malloc(sizeof(i8080));
+
+  if (cpu == NULL)
+  {
+    return -1;
+  }
+
+  memset(memory, 0, MEM_SIZE);
+  memcpy(memory, program, sizeof(program));
+  memcpy(memory + 0x38, handler, sizeof(handler));
+
+  i8080_init(cpu);
+  cpu->read_byte = &read_byte_implementation;
+  cpu->write_byte = &write_byte_implementation;
+  cpu->port_in = &port_in_implementation;
+  *state = cpu;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  free(*state);
+  return 0;
+}
+
+static trace take_trace(i8080 *p)
+{
+  trace t = {.cycles = p->cycles, .pc = p->pc, .sp = p->sp, .a = p->a};
+
+  // The data page and the top of the stack
+  for (int i = 0; i < 256; i++)
+  {
+    t.checksum = t.checksum * 31 + memory[0x2000 + i];
+    t.checksum = t.checksum * 31 + memory[0xff00 + i];
+  }
+  return t;
+}
+
+static void assert_trace(i8080 *p, uint64_t step)
+{
+  trace t = take_trace(p);
+
+  assert_true(t.cycles == traces[step].cycles);
+  assert_true(t.pc == traces[step].pc);
+  assert_true(t.sp == traces[step].sp);
+  assert_true(t.a == traces[step].a);
+  assert_true(t.checksum == traces[step].checksum);
+}
+
+static void run_traced(i8080 *p, uint64_t from)
+{
+  for (uint64_t step = from; step < STEPS; step++)
+  {
+    traces[step] = take_trace(p);
+    if (step % 97 == 0)
+    {
+      i8080_interrupt(p, 0xff);
+    }
+    i8080_step(p);
+  }
+  traces[STEPS] = take_trace(p);
+}
+
+static void steps_back_to_any_instruction(void **state)
+{
+  i8080 *p = *state;
+  rewind_buffer rw;
+
+  assert_true(rewind_init(&rw, p, 200, 1 << 20) == 0);
+  run_traced(p, 0);
+  assert_true(rewind_available(&rw) == STEPS);
+
+  assert_true(rewind_step_back(&rw, p, 1) == 0);
+  assert_trace(p, STEPS - 1);
+
+  assert_true(rewind_step_back(&rw, p, 1000) == 0);
+  assert_trace(p, STEPS - 1001);
+
+  assert_true(rewind_step_back(&rw, p, STEPS - 1001) == 0);
+  assert_trace(p, 0);
+  assert_true(rewind_step_back(&rw, p, 1) == -1);
+
+  // Going forward again with new input makes a new history
+  run_traced(p, 0);
+  assert_true(rewind_step_back(&rw, p, 10) == 0);
+  assert_trace(p, STEPS - 10);
+
+  rewind_free(&rw, p);
+  for (int page = 0; page < 256; page++)
+  {
+    assert_false(p->page_flags[page] & PAGE_REWIND);
+  }
+}
+
+static void keeps_history_within_budget(void **state)
+{
+  i8080 *p = *state;
+  rewind_buffer rw;
+  size_t budget = 4 * (sizeof(rewind_keyframe) + 2 * sizeof(rewind_page));
+
+  assert_true(rewind_init(&rw, p, 200, budget) == 0);
+  run_traced(p, 0);
+
+  assert_true(rw.used <= budget);
+  assert_true(rewind_available(&rw) < STEPS);
+  assert_true(rewind_step_back(&rw, p, STEPS) == -1);
+
+  assert_true(rewind_step_back(&rw, p, rewind_available(&rw)) == 0);
+  assert_trace(p, rw.instructions);
+
+  rewind_free(&rw, p);
+}
+
+// Stepping back runs the instructions again without the devices seeing their output twice
+static void keeps_output_from_the_devices(void **state)
+{
+  i8080 *p = *state;
+  rewind_buffer rw;
+
+  memcpy(memory, echo, sizeof(echo));
+  p->port_out = &port_out_implementation;
+  outputs = 0;
+
+  assert_true(rewind_init(&rw, p, 200, 1 << 20) == 0);
+  for (int step = 0; step < 600; step++)
+  {
+    i8080_step(p);
+  }
+  assert_int_equal(outputs, 200);
+
+  // Keyframes are 20 instructions apart, so 15 are run again from the one before
+  assert_true(rewind_step_back(&rw, p, 95) == 0);
+  assert_int_equal(outputs, 200);
+  assert_ptr_equal(p->port_out, &port_out_implementation);
+
+  // Going forward again sends them
+  for (int step = 0; step < 95; step++)
+  {
+    i8080_step(p);
+  }
+  assert_int_equal(outputs, 232);
+
+  rewind_free(&rw, p);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(steps_back_to_any_instruction, setup, teardown),
+      cmocka_unit_test_setup_teardown(keeps_history_within_budget, setup, teardown),
+      cmocka_unit_test_setup_teardown(keeps_output_from_the_devices, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
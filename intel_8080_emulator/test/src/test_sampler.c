@@ -0,0 +1,133 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "i8080.h"
+#include "sampler.h"
+
+#define MEM_SIZE 0x10000
+
+static uint8_t memory[MEM_SIZE] = {0};
+
+// loop: INR A; JMP loop
+static const uint8_t program[] = {0x3c, 0xc3, 0x00, 0x00};
+
+// The actual implementations of the i8080 structure function pointers
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  memory[addr] = val;
+}
+
+static int setup(void **state)
+{
+  i8080 *cpu = malloc(sizeof(i8080));
+  sampler *s = malloc(sizeof(sampler));
+
+  if (cpu == NULL || s == NULL)
+  {
+    free(cpu);
+    free(s);
+    return -1;
+  }
+
+  memset(memory, 0, MEM_SIZE);
+  memcpy(memory, program, sizeof(program));
+  i8080_init(cpu);
+  cpu->read_byte = &read_byte_implementation;
+  cpu->write_byte = &write_byte_implementation;
+  cpu->sampler = s;
+
+  *state = cpu;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  i8080 *cpu = *state;
+  free(cpu->sampler);
+  free(cpu);
+  return 0;
+}
+
+static double seconds(void)
+{
+  struct timespec now;
+
+  timespec_get(&now, TIME_UTC);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Runs the loop for about the time given
+static void run_for(i8080 *p, double duration)
+{
+  double end = seconds() + duration;
+
+  while (seconds() < end)
+  {
+    i8080_run(p, 10000);
+  }
+}
+
+static void samples_running_loop(void **state)
+{
+  i8080 *p = *state;
+  sampler *s = p->sampler;
+  char report[256] = {0};
+  FILE *out = tmpfile();
+
+  assert_int_equal(sampler_start(s, 200), 0);
+  run_for(p, 0.05);
+  sampler_stop(s);
+
+  // Every sample the cycles moved for was taken in the loop
+  assert_true(s->samples > 10);
+  assert_int_equal(s->histogram[0x0000] + s->histogram[0x0001], s->samples);
+
+  assert_non_null(out);
+  sampler_write_report(s, p, out);
+  rewind(out);
+  assert_true(fread(report, 1, sizeof(report) - 1, out) > 0);
+  fclose(out);
+  assert_true(strncmp(report, "address,instruction,samples,percent\n", 36) == 0);
+  assert_non_null(strstr(report, "0000,INR A,"));
+  assert_non_null(strstr(report, "0001,JMP 0000h,"));
+}
+
+static void counts_paused_run_as_idle(void **state)
+{
+  i8080 *p = *state;
+  sampler *s = p->sampler;
+  struct timespec pause = {.tv_nsec = 50000000};
+
+  assert_int_equal(sampler_start(s, 1000), 0);
+  run_for(p, 0.01);
+
+  // Nothing is run, the last snapshot published stays
+  thrd_sleep(&pause, NULL);
+  sampler_stop(s);
+
+  assert_true(s->samples > 0);
+  assert_true(s->idle_samples >= 10);
+  assert_int_equal(s->histogram[0x0000] + s->histogram[0x0001], s->samples);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(samples_running_loop, setup, teardown),
+      cmocka_unit_test_setup_teardown(counts_paused_run_as_idle, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
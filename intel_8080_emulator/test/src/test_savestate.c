@@ -0,0 +1,136 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "savestate.h"
+
+#define MEM_SIZE 0x10000
+#define STATE_PATH "test_savestate.bin"
+
+static uint8_t memory[MEM_SIZE] = {0};
+
+// MVI H,20h; loop: INR A; MOV M,A; INR L; JMP loop
+static const uint8_t program[] = {0x26, 0x20, 0x3c, 0x77, 0x2c, 0xc3, 0x02, 0x00};
+
+typedef struct device
+{
+  uint32_t timer;
+  uint8_t latch;
+} device;
+
+// The actual implementations of the i8080 structure function pointers
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  memory[addr] = val;
+}
+
+static int setup(void **state)
+{
+  i8080 *cpu = malloc(sizeof(i8080));
+
+  if (cpu == NULL)
+  {
+    return -1;
+  }
+
+  memset(memory, 0, MEM_SIZE);
+  memcpy(memory, program, sizeof(program));
+  i8080_init(cpu);
+  cpu->read_byte = &read_byte_implementation;
+  cpu->write_byte = &write_byte_implementation;
+  *state = cpu;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  free(*state);
+  remove(STATE_PATH);
+  return 0;
+}
+
+static void saves_and_loads(void **state)
+{
+  i8080 *p = *state;
+  static uint8_t expected[MEM_SIZE];
+  device saved = {.timer = 123456, .latch = 7}, loaded = {0};
+
+  memset(memory + 0x8000, 0xff, 0x1000);
+  i8080_run(p, 3000);
+  p->interrupts_enabled = true;
+  p->interrupt_delay = true;
+  p->cf = true;
+
+  FILE *out = fopen(STATE_PATH, "wb");
+  assert_non_null(out);
+  assert_true(savestate_save(p, &saved, sizeof(saved), out) == 0);
+
+  // Two raw pages, the program and the data, and the rest as fills
+  long size = ftell(out);
+  fclose(out);
+  assert_true(size < 33 + (long)sizeof(saved) + 512 + 2 * 256 + 1);
+
+  i8080 before = *p;
+  memcpy(expected, memory, MEM_SIZE);
+
+  memset(memory, 0, MEM_SIZE);
+  i8080_init(p);
+  p->read_byte = &read_byte_implementation;
+  p->write_byte = &write_byte_implementation;
+
+  assert_true(savestate_load(p, STATE_PATH, &loaded, sizeof(loaded), true) == 0);
+  assert_memory_equal(memory, expected, MEM_SIZE);
+  assert_true(p->pc == before.pc);
+  assert_true(p->a == before.a);
+  assert_true(p->l == before.l);
+  assert_true(p->cycles == before.cycles);
+  assert_true(p->cf && p->interrupts_enabled && p->interrupt_delay);
+  assert_false(p->zf);
+  assert_true(loaded.timer == saved.timer && loaded.latch == saved.latch);
+
+  // A different device state size is refused before anything changes
+  p->pc = 0x1234;
+  assert_true(savestate_load(p, STATE_PATH, &loaded, 1, false) == -1);
+  assert_true(p->pc == 0x1234);
+}
+
+static void rejects_truncated_state(void **state)
+{
+  i8080 *p = *state;
+  static uint8_t data[4096];
+
+  FILE *out = fopen(STATE_PATH, "w+b");
+  assert_non_null(out);
+  assert_true(savestate_save(p, NULL, 0, out) == 0);
+  long size = ftell(out);
+  rewind(out);
+  assert_true(fread(data, 1, sizeof(data), out) == (size_t)size);
+  fclose(out);
+
+  assert_true(savestate_restore(p, data, size, NULL, 0, false) == 0);
+  assert_true(savestate_restore(p, data, size - 1, NULL, 0, false) == -1);
+
+  data[4] = SAVESTATE_VERSION + 1;
+  assert_true(savestate_restore(p, data, size, NULL, 0, false) == -1);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(saves_and_loads, setup, teardown),
+      cmocka_unit_test_setup_teardown(rejects_truncated_state, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
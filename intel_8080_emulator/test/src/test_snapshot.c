@@ -0,0 +1,208 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "snapshot.h"
+#include "runahead.h"
+#include "replay.h"
+#include "heatmap.h"
+
+#define MEM_SIZE 0x10000
+#define FRAME_CYCLES 1000
+
+static uint8_t memory[MEM_SIZE] = {0};
+
+// MVI H,20h; loop: INR A; MOV M,A; JMP loop
+static const uint8_t program[] = {0x26, 0x20, 0x3c, 0x77, 0xc3, 0x02, 0x00};
+
+// The actual implementations of the i8080 structure function pointers
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  memory[addr] = val;
+}
+
+static uint8_t port_in_implementation(uint8_t port)
+{
+  return port * 3;
+}
+
+static void load(i8080 *p)
+{
+  memset(memory, 0, MEM_SIZE);
+  memcpy(memory, program, sizeof(program));
+
+  i8080_init(p);
+  p->read_byte = &read_byte_implementation;
+  p->write_byte = &write_byte_implementation;
+}
+
+static int setup(void **state)
+{
+  i8080 *cpu = malloc(sizeof(i8080));
+
+  if (cpu == NULL)
+  {
+    return -1;
+  }
+
+  load(cpu);
+  *state = cpu;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  free(*state);
+  return 0;
+}
+
+static void restores_registers_and_memory(void **state)
+{
+  i8080 *p = *state;
+  static snapshot s;
+  static uint8_t expected[MEM_SIZE];
+
+  i8080_run(p, 500);
+  memcpy(expected, memory, MEM_SIZE);
+  uint16_t pc = p->pc;
+  uint8_t a = p->a;
+  uint64_t cycles = p->cycles;
+
+  snapshot_take(&s, p);
+  i8080_run(p, 700);
+  assert_true(s.saved_count == 1);
+  assert_true(memory[0x2000] != expected[0x2000]);
+
+  // Restoring twice gives the same state
+  for (int i = 0; i < 2; i++)
+  {
+    snapshot_restore(&s, p);
+    assert_true(p->pc == pc);
+    assert_true(p->a == a);
+    assert_true(p->cycles == cycles);
+    assert_memory_equal(memory, expected, MEM_SIZE);
+    i8080_run(p, 300);
+  }
+
+  snapshot_release(&s, p);
+  assert_null(p->snapshot);
+  assert_true(p->page_flags[0x20] == 0);
+}
+
+typedef struct presented
+{
+  uint8_t counter;
+  uint64_t cycles;
+} presented;
+
+static void present(i8080 *p, void *context)
+{
+  presented *shown = context;
+
+  shown->counter = memory[0x2000];
+  shown->cycles = p->cycles;
+}
+
+static void presents_frames_ahead(void **state)
+{
+  i8080 *p = *state;
+  static runahead ra;
+  uint8_t counters[8];
+  presented shown;
+
+  // Without run-ahead, the counter at the end of each frame
+  for (int frame = 0; frame < 8; frame++)
+  {
+    assert_true(i8080_run_frame(p, FRAME_CYCLES) == I8080_EXIT_BUDGET);
+    counters[frame] = memory[0x2000];
+  }
+  assert_true(p->cycles / FRAME_CYCLES == 8);
+
+  load(p);
+  runahead_init(&ra, FRAME_CYCLES, 2);
+  ra.present = &present;
+  ra.context = &shown;
+
+  for (int frame = 0; frame < 5; frame++)
+  {
+    assert_true(runahead_frame(&ra, p) == I8080_EXIT_BUDGET);
+
+    // The real machine is one frame further on, and what is shown two more
+    assert_true(p->cycles / FRAME_CYCLES == (uint64_t)frame + 1);
+    assert_true(memory[0x2000] == counters[frame]);
+    assert_true(shown.counter == counters[frame + 2]);
+    assert_true(shown.cycles / FRAME_CYCLES == (uint64_t)frame + 3);
+  }
+  assert_null(p->snapshot);
+}
+
+// What the real frames do is recorded and counted once, as without run-ahead
+static void hides_frames_ahead_from_observers(void **state)
+{
+  i8080 *p = *state;
+  static runahead ra;
+  static replay expected, r;
+  static heatmap expected_map, h;
+
+  // MVI H,20h; loop: IN 01h; MOV M,A; INR L; JMP loop
+  static const uint8_t reading[] = {0x26, 0x20, 0xdb, 0x01, 0x77, 0x2c, 0xc3, 0x02, 0x00};
+
+  memcpy(memory, reading, sizeof(reading));
+  p->port_in = &port_in_implementation;
+  assert_true(replay_record(&expected, p) == 0);
+  assert_true(heatmap_init(&expected_map, false) == 0);
+  p->heatmap = &expected_map;
+  for (int frame = 0; frame < 5; frame++)
+  {
+    assert_true(i8080_run_frame(p, FRAME_CYCLES) == I8080_EXIT_BUDGET);
+  }
+  replay_detach(&expected, p);
+
+  load(p);
+  memcpy(memory, reading, sizeof(reading));
+  p->port_in = &port_in_implementation;
+  assert_true(replay_record(&r, p) == 0);
+  assert_true(heatmap_init(&h, false) == 0);
+  p->heatmap = &h;
+  runahead_init(&ra, FRAME_CYCLES, 2);
+  for (int frame = 0; frame < 5; frame++)
+  {
+    assert_true(runahead_frame(&ra, p) == I8080_EXIT_BUDGET);
+  }
+  replay_detach(&r, p);
+
+  assert_true(r.events == expected.events);
+  assert_true(r.last_cycles == expected.last_cycles);
+  assert_true(r.size == expected.size);
+  assert_memory_equal(r.data, expected.data, expected.size);
+  assert_memory_equal(h.reads, expected_map.reads, sizeof(h.reads));
+  assert_memory_equal(h.writes, expected_map.writes, sizeof(h.writes));
+  assert_memory_equal(h.fetches, expected_map.fetches, sizeof(h.fetches));
+
+  replay_free(&expected);
+  replay_free(&r);
+  heatmap_free(&expected_map);
+  heatmap_free(&h);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(restores_registers_and_memory, setup, teardown),
+      cmocka_unit_test_setup_teardown(presents_frames_ahead, setup, teardown),
+      cmocka_unit_test_setup_teardown(hides_frames_ahead_from_observers, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
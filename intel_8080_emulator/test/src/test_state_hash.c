@@ -0,0 +1,135 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "state_hash.h"
+#include "snapshot.h"
+
+#define MEM_SIZE 0x10000
+
+static uint8_t memory[MEM_SIZE] = {0};
+
+// MVI H,20h; loop: INR A; MOV M,A; JMP loop
+static const uint8_t program[] = {0x26, 0x20, 0x3c, 0x77, 0xc3, 0x02, 0x00};
+
+// The actual implementations of the i8080 structure function pointers
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  memory[addr] = val;
+}
+
+static int setup(void **state)
+{
+  i8080 *cpu = malloc(sizeof(i8080));
+
+  if (cpu == NULL)
+  {
+    return -1;
+  }
+
+  memset(memory, 0, MEM_SIZE);
+  memcpy(memory, program, sizeof(program));
+  i8080_init(cpu);
+  cpu->read_byte = &read_byte_implementation;
+  cpu->write_byte = &write_byte_implementation;
+  *state = cpu;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  free(*state);
+  return 0;
+}
+
+// Hash of the current state computed from scratch
+static uint64_t fresh_hash(i8080 *p)
+{
+  state_hash h;
+  state_hash *attached = p->state_hash;
+
+  if (state_hash_attach(&h, p) != 0)
+  {
+    return 0;
+  }
+  uint64_t hash = state_hash_value(&h, p);
+  state_hash_detach(&h, p);
+  p->state_hash = attached;
+  return hash;
+}
+
+static void follows_writes_and_restores(void **state)
+{
+  i8080 *p = *state;
+  state_hash h;
+  static snapshot s;
+
+  assert_true(state_hash_attach(&h, p) == 0);
+  uint64_t start = state_hash_value(&h, p);
+
+  i8080_run(p, 1000);
+  assert_true(state_hash_value(&h, p) != start);
+  assert_true(state_hash_value(&h, p) == fresh_hash(p));
+
+  snapshot_take(&s, p);
+  uint64_t taken = state_hash_value(&h, p);
+  i8080_run(p, 777);
+  snapshot_restore(&s, p);
+  snapshot_release(&s, p);
+  assert_true(state_hash_value(&h, p) == taken);
+  assert_true(fresh_hash(p) == taken);
+
+  // Only the cycle count differs
+  p->cycles += 5;
+  assert_true(state_hash_value(&h, p) == taken);
+
+  state_hash_detach(&h, p);
+  assert_null(p->state_hash);
+}
+
+static void detects_revisited_state(void **state)
+{
+  i8080 *p = *state;
+  state_hash h;
+  int steps = 0;
+
+  assert_true(state_hash_attach(&h, p) == 0);
+
+  // A and the byte at 2000h count up together and wrap after 256 loops. The
+  // state at 0002h comes back with the zero flag set, so the first to repeat
+  // is the one after the first INR A
+  while (state_hash_visit(&h, p) == 0)
+  {
+    i8080_step(p);
+    steps++;
+  }
+
+  assert_true(p->pc == 3);
+  assert_true(steps == 2 + 3 * 256);
+  assert_true(h.visited_count == (size_t)steps);
+
+  state_hash_clear_visited(&h);
+  assert_true(state_hash_visit(&h, p) == 0);
+  state_hash_detach(&h, p);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(follows_writes_and_restores, setup, teardown),
+      cmocka_unit_test_setup_teardown(detects_revisited_state, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,199 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i8080.h"
+#include "tiering.h"
+#include "machines.h"
+#include "recompiler_roms.h"
+
+typedef struct machines
+{
+  i8080 cpu, plain;
+  tiering t;
+} machines;
+
+static int setup(void **state)
+{
+  machines *m = calloc(1, sizeof(machines));
+
+  if (m == NULL)
+  {
+    return -1;
+  }
+
+  machines_init(&m->cpu, &m->plain, true);
+  *state = m;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  machines *m = *state;
+
+  tiering_detach(&m->t, &m->cpu);
+  free(m);
+  return 0;
+}
+
+// Loads the ROM into both memories and attaches the manager with the thresholds
+static void load(machines *m, const uint8_t *rom, size_t size, const recompiled_image *image, uint32_t predecode_after,
+                 uint32_t compile_after)
+{
+  memcpy(memory, rom, size);
+  memcpy(plain_memory, memory, MEM_SIZE);
+  tiering_attach(&m->t, &m->cpu, image);
+  m->t.predecode_after = predecode_after;
+  m->t.compile_after = compile_after;
+}
+
+// The loop moves up a tier at each threshold, code run once stays interpreted
+static void promotes_hot_code(void **state)
+{
+  machines *m = *state;
+
+  for (int i = 0; i < 16; i++)
+  {
+    memory[0x200 + i] = i * 37;
+  }
+  load(m, program_rom, sizeof(program_rom), &program_image, 4, 8);
+
+  assert_int_equal(i8080_run(&m->cpu, 100000), I8080_EXIT_HALT);
+  assert_int_equal(i8080_run(&m->plain, 100000), I8080_EXIT_HALT);
+  assert_same_state(&m->cpu, &m->plain);
+  assert_same_memory();
+
+  // The 9 iterations from the 8th on, the rest of the program is never hot
+  assert_int_equal(m->t.promotions[TIER_COMPILED], 1);
+  assert_int_equal(m->t.dispatched[TIER_COMPILED], 9);
+  assert_int_equal(m->t.r.executed, 9);
+  assert_true(m->t.dispatched[TIER_PREDECODED] > 0);
+  // The stack shares page 0 with the code, but the return address pushed by the CALL lands outside it
+  assert_int_equal(m->t.demotions, 0);
+  assert_int_equal(m->t.tiers[0x0017], TIER_COMPILED);
+}
+
+// Without an image, hot code goes no further than fusion
+static void stops_at_predecoded_without_image(void **state)
+{
+  machines *m = *state;
+
+  load(m, program_rom, sizeof(program_rom), NULL, 2, 4);
+  assert_int_equal(i8080_run(&m->cpu, 100000), I8080_EXIT_HALT);
+  assert_int_equal(i8080_run(&m->plain, 100000), I8080_EXIT_HALT);
+  assert_same_state(&m->cpu, &m->plain);
+  assert_same_memory();
+
+  assert_true(m->t.promotions[TIER_PREDECODED] > 0);
+  assert_int_equal(m->t.promotions[TIER_COMPILED], 0);
+  assert_int_equal(m->t.dispatched[TIER_COMPILED], 0);
+  assert_true(m->t.f.executed[FUSION_LOAD_INX] > 0);
+
+  tiering_detach(&m->t, &m->cpu);
+  assert_null(m->cpu.tiering);
+  assert_null(m->cpu.fusion);
+  assert_int_equal(m->cpu.page_flags[0] & PAGE_CODE, 0);
+}
+
+// The STA over the JZ sends the code that may reach into it back to the interpreter
+static void demotes_rewritten_code(void **state)
+{
+  machines *m = *state;
+
+  load(m, rewriting_rom, sizeof(rewriting_rom), &rewriting_image, 1, 1);
+  assert_int_equal(i8080_run(&m->cpu, 100000), I8080_EXIT_HALT);
+  assert_int_equal(i8080_run(&m->plain, 100000), I8080_EXIT_HALT);
+  assert_same_state(&m->cpu, &m->plain);
+  assert_same_memory();
+  assert_int_equal(m->cpu.pc, 0x08);
+
+  // The three instructions before the HLT, promoted on their first dispatch and not classified yet
+  assert_int_equal(m->t.demotions, 3);
+  assert_int_equal(m->t.tiers[0x0000], TIER_INTERPRETED);
+  assert_int_equal(m->t.hotness[0x0000], 0);
+  // Run again after the write, so promoted again, but no further than its first dispatch takes it
+  assert_int_equal(m->t.tiers[0x0002], TIER_PREDECODED);
+  assert_int_equal(m->t.hotness[0x0002], 1);
+  assert_int_equal(m->t.dispatched[TIER_COMPILED], 0);
+}
+
+// LXI B,1000h; loop: INR D; STA 00F0h; DCX B; MOV A,B; ORA C; JNZ loop; HLT
+static const uint8_t variable_loop[] = {0x01, 0x00, 0x10, 0x14, 0x32, 0xf0, 0x00, 0x0b,
+                                        0x78, 0xb1, 0xc2, 0x03, 0x00, 0x76};
+
+// A variable stored on the code's page leaves the loop where it is
+static void keeps_code_next_to_written_data(void **state)
+{
+  machines *m = *state;
+
+  load(m, variable_loop, sizeof(variable_loop), NULL, TIERING_PREDECODE_AFTER, TIERING_COMPILE_AFTER);
+  assert_int_equal(i8080_run(&m->cpu, 1000000), I8080_EXIT_HALT);
+  assert_int_equal(i8080_run(&m->plain, 1000000), I8080_EXIT_HALT);
+  assert_same_state(&m->cpu, &m->plain);
+  assert_same_memory();
+
+  assert_int_equal(m->t.demotions, 0);
+  assert_int_equal(m->t.tiers[0x0003], TIER_PREDECODED);
+  assert_true(m->t.dispatched[TIER_PREDECODED] > 4000);
+}
+
+// Random code from random states, with random budgets, interrupts and thresholds
+static void runs_random_code_like_interpreter(void **state)
+{
+  machines *m = *state;
+  static uint8_t rom[RANDOM_ROM_SIZE];
+  uint64_t compiled = 0;
+
+  random_rom(rom);
+  srand(8085);
+  for (int trial = 0; trial < 1000; trial++)
+  {
+    i8080_state s = {0};
+    uint64_t budget = 1 + rand() % 4000;
+    uint32_t predecode_after = 1 + rand() % 4;
+
+    memset(memory, 0, MEM_SIZE);
+    load(m, rom, sizeof(rom), &random_image, predecode_after, predecode_after + rand() % 4);
+    s.a = rand();
+    s.b = rand();
+    s.c = rand();
+    s.d = rand();
+    s.e = rand();
+    s.h = rand();
+    s.l = rand();
+    s.sp = rand();
+    s.pc = rand() % RANDOM_ROM_SIZE;
+    s.zf = rand() & 1;
+    s.sf = rand() & 1;
+    s.pf = rand() & 1;
+    s.cf = rand() & 1;
+    s.acf = rand() & 1;
+    s.interrupts_enabled = rand() & 1;
+    i8080_load_state(&m->cpu, &s);
+    i8080_load_state(&m->plain, &s);
+
+    assert_int_equal(i8080_run(&m->cpu, budget), i8080_run(&m->plain, budget));
+    assert_same_state(&m->cpu, &m->plain);
+    assert_same_memory();
+    compiled += m->t.dispatched[TIER_COMPILED];
+    tiering_detach(&m->t, &m->cpu);
+  }
+  assert_true(compiled > 3000);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test_setup_teardown(promotes_hot_code, setup, teardown),
+      cmocka_unit_test_setup_teardown(stops_at_predecoded_without_image, setup, teardown),
+      cmocka_unit_test_setup_teardown(demotes_rewritten_code, setup, teardown),
+      cmocka_unit_test_setup_teardown(keeps_code_next_to_written_data, setup, teardown),
+      cmocka_unit_test_setup_teardown(runs_random_code_like_interpreter, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
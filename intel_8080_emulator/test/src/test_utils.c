@@ -38,6 +38,7 @@ static int setup(void **state)
     return -1;
   }
 
+  i8080_init(cpu);
   cpu->read_byte = &read_byte_implementation;
   cpu->write_byte = &write_byte_implementation;
 
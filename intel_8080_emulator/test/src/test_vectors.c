@@ -0,0 +1,683 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#include "i8080.h"
+#include "instructions.h"
+#include "vector_parser.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define VECTORS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+Runs SingleStepTests-style vector files, 00.json to ff.json or their
+binary conversions 00.bin to ff.bin, through process_instruction:
+  test_vectors [-j threads] directory
+  test_vectors --convert file.json file.bin
+Files are mapped and parsed one vector at a time, and opcode files run
+on a pool of threads. Without arguments the built-in vectors are run
+*/
+
+// One entry per bus cycle. Only their number is checked
+#define CYCLE "[0, 0, \"r--\"]"
+#define CYCLES_10 "[" CYCLE "," CYCLE "," CYCLE "," CYCLE "," CYCLE "," CYCLE "," CYCLE "," CYCLE "," CYCLE "," CYCLE "]"
+#define CYCLES_11 "[" CYCLE "," CYCLE "," CYCLE "," CYCLE "," CYCLE "," CYCLE "," CYCLE "," CYCLE "," CYCLE "," CYCLE "," CYCLE "]"
+
+// LXI B,1234h; PUSH B; IN 10h; OUT 20h, in the layout of the SingleStepTests files
+#define LXI_VECTOR(c_final) \
+  "{\"name\": \"01 0000\"," \
+  " \"initial\": {\"pc\": 256, \"sp\": 32768, \"a\": 0, \"b\": 0, \"c\": 0, \"d\": 1, \"e\": 2, \"f\": 2," \
+  "  \"h\": 3, \"l\": 4, \"ei\": 0, \"ram\": [[256, 1], [257, 52], [258, 18]]}," \
+  " \"final\": {\"pc\": 259, \"sp\": 32768, \"a\": 0, \"b\": 18, \"c\": " #c_final ", \"d\": 1, \"e\": 2, \"f\": 2," \
+  "  \"h\": 3, \"l\": 4, \"ei\": 0, \"ram\": [[256, 1], [257, 52], [258, 18]]}," \
+  " \"cycles\": " CYCLES_10 "}"
+
+static const char vectors_json[] =
+    "["
+    LXI_VECTOR(52) ","
+    "{\"name\": \"c5 0000\","
+    " \"initial\": {\"pc\": 512, \"sp\": 32768, \"a\": 0, \"b\": 18, \"c\": 52, \"d\": 0, \"e\": 0, \"f\": 215,"
+    "  \"h\": 0, \"l\": 0, \"ram\": [[512, 197]]},"
+    " \"final\": {\"pc\": 513, \"sp\": 32766, \"a\": 0, \"b\": 18, \"c\": 52, \"d\": 0, \"e\": 0, \"f\": 215,"
+    "  \"h\": 0, \"l\": 0, \"ram\": [[512, 197], [32766, 52], [32767, 18]]},"
+    " \"cycles\": " CYCLES_11 "}"
+    ","
+    "{\"name\": \"db 0000\","
+    " \"initial\": {\"pc\": 768, \"sp\": 0, \"a\": 0, \"b\": 0, \"c\": 0, \"d\": 0, \"e\": 0, \"f\": 2,"
+    "  \"h\": 0, \"l\": 0, \"ram\": [[768, 219], [769, 16]]},"
+    " \"final\": {\"pc\": 770, \"sp\": 0, \"a\": 90, \"b\": 0, \"c\": 0, \"d\": 0, \"e\": 0, \"f\": 2,"
+    "  \"h\": 0, \"l\": 0, \"ram\": [[768, 219], [769, 16]]},"
+    " \"cycles\": " CYCLES_10 ", \"ports\": [[16, 90, \"r\"]]}"
+    ","
+    "{\"name\": \"d3 0000\","
+    " \"initial\": {\"pc\": 1024, \"sp\": 0, \"a\": 119, \"b\": 0, \"c\": 0, \"d\": 0, \"e\": 0, \"f\": 2,"
+    "  \"h\": 0, \"l\": 0, \"ram\": [[1024, 211], [1025, 32]]},"
+    " \"final\": {\"pc\": 1026, \"sp\": 0, \"a\": 119, \"b\": 0, \"c\": 0, \"d\": 0, \"e\": 0, \"f\": 2,"
+    "  \"h\": 0, \"l\": 0, \"ram\": [[1024, 211], [1025, 32]]},"
+    " \"cycles\": " CYCLES_10 ", \"ports\": [[32, 119, \"w\"]]}"
+    "]";
+
+// The LXI vector expecting the wrong C
+static const char wrong_json[] = "[" LXI_VECTOR(53) "]";
+
+// A processor with its own memory, one per thread
+typedef struct vector_machine
+{
+  i8080 cpu;
+  uint8_t memory[0x10000];
+  const test_vector *vector;
+  int port;
+  bool port_wrong;
+  uint16_t written[8];
+  int written_count;
+} vector_machine;
+
+static _Thread_local vector_machine *machine;
+
+static uint8_t read_byte_implementation(uint16_t addr)
+{
+  return machine->memory[addr];
+}
+
+static void write_byte_implementation(uint16_t addr, uint8_t val)
+{
+  if (machine->written_count < 8)
+  {
+    machine->written[machine->written_count++] = addr;
+  }
+  machine->memory[addr] = val;
+}
+
+// Ports answer with the vector's accesses, in order
+static uint8_t port_in_implementation(uint8_t port)
+{
+  const test_vector *v = machine->vector;
+
+  if (machine->port < v->ports_count && !v->ports[machine->port].write && v->ports[machine->port].port == port)
+  {
+    return v->ports[machine->port++].value;
+  }
+  machine->port_wrong = true;
+  return 0;
+}
+
+static uint8_t port_out_implementation(uint8_t port, uint8_t value)
+{
+  const test_vector *v = machine->vector;
+
+  if (machine->port < v->ports_count && v->ports[machine->port].write && v->ports[machine->port].port == port &&
+      v->ports[machine->port].value == value)
+  {
+    machine->port++;
+  }
+  else
+  {
+    machine->port_wrong = true;
+  }
+  return 0;
+}
+
+static void machine_init(vector_machine *m)
+{
+  memset(m->memory, 0, sizeof(m->memory));
+  i8080_init(&m->cpu);
+  m->cpu.read_byte = &read_byte_implementation;
+  m->cpu.write_byte = &write_byte_implementation;
+  m->cpu.port_in = &port_in_implementation;
+  m->cpu.port_out = &port_out_implementation;
+}
+
+// The flags as PUSH PSW lays them out: S Z 0 AC 0 P 1 C
+static uint8_t flags_byte(const i8080 *p)
+{
+  return p->sf << 7 | p->zf << 6 | p->acf << 4 | p->pf << 2 | 0x02 | p->cf;
+}
+
+// Keeps the first difference
+#define CHECK(field, expected, actual)                                                                       \
+  if (passed && (expected) != (actual))                                                                      \
+  {                                                                                                          \
+    snprintf(why, why_size, "%s: %s expected %x, got %x", v->name, field, (unsigned)(expected),              \
+             (unsigned)(actual));                                                                            \
+    passed = false;                                                                                          \
+  }
+
+// Runs one vector. On failure why tells the first difference
+static bool run_vector(vector_machine *m, const test_vector *v, char *why, size_t why_size)
+{
+  i8080 *p = &m->cpu;
+  const vector_state *s = &v->initial;
+  bool passed = true;
+
+  machine = m;
+  m->vector = v;
+  m->port = 0;
+  m->port_wrong = false;
+  m->written_count = 0;
+
+  for (int i = 0; i < s->ram_count; i++)
+  {
+    m->memory[s->ram_addr[i]] = s->ram_value[i];
+  }
+  p->a = s->a;
+  p->b = s->b;
+  p->c = s->c;
+  p->d = s->d;
+  p->e = s->e;
+  p->h = s->h;
+  p->l = s->l;
+  p->sp = s->sp;
+  p->pc = s->pc;
+  p->sf = s->f & 0x80;
+  p->zf = s->f & 0x40;
+  p->acf = s->f & 0x10;
+  p->pf = s->f & 0x04;
+  p->cf = s->f & 0x01;
+  p->halted = false;
+  p->cycles = 0;
+  p->exit_reason = I8080_EXIT_NONE;
+
+  process_instruction(p);
+
+  s = &v->final;
+  CHECK("pc", s->pc, p->pc)
+  CHECK("sp", s->sp, p->sp)
+  CHECK("a", s->a, p->a)
+  CHECK("b", s->b, p->b)
+  CHECK("c", s->c, p->c)
+  CHECK("d", s->d, p->d)
+  CHECK("e", s->e, p->e)
+  CHECK("h", s->h, p->h)
+  CHECK("l", s->l, p->l)
+  CHECK("f", (s->f & 0xd5) | 0x02, flags_byte(p))
+  CHECK("cycles", v->cycles > 0 ? (uint64_t)v->cycles : p->cycles, p->cycles)
+  CHECK("ports", true, !m->port_wrong && m->port == v->ports_count)
+  for (int i = 0; i < s->ram_count; i++)
+  {
+    CHECK("memory", s->ram_value[i], m->memory[s->ram_addr[i]])
+  }
+
+  // Clear what the vector used, not the whole 64K
+  for (int i = 0; i < v->initial.ram_count; i++)
+  {
+    m->memory[v->initial.ram_addr[i]] = 0;
+  }
+  for (int i = 0; i < s->ram_count; i++)
+  {
+    m->memory[s->ram_addr[i]] = 0;
+  }
+  for (int i = 0; i < m->written_count; i++)
+  {
+    m->memory[m->written[i]] = 0;
+  }
+  return passed;
+}
+
+typedef struct vector_file
+{
+  const uint8_t *data;
+  size_t size;
+  void *mapping;
+} vector_file;
+
+static int open_vectors(const char *path, vector_file *file)
+{
+  memset(file, 0, sizeof(vector_file));
+
+#ifdef VECTORS_MMAP
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+
+  if (fd < 0)
+  {
+    return -1;
+  }
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+  {
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (data != MAP_FAILED)
+    {
+      close(fd);
+      file->data = data;
+      file->size = st.st_size;
+      file->mapping = data;
+      return 0;
+    }
+  }
+  close(fd);
+#endif
+
+  // Read the whole file where it can't be mapped
+  FILE *in = fopen(path, "rb");
+  uint8_t *data;
+  long size;
+
+  if (in == NULL)
+  {
+    return -1;
+  }
+  fseek(in, 0, SEEK_END);
+  size = ftell(in);
+  fseek(in, 0, SEEK_SET);
+  data = malloc(size > 0 ? size : 1);
+  if (data == NULL || fread(data, 1, size, in) != (size_t)size)
+  {
+    free(data);
+    fclose(in);
+    return -1;
+  }
+  fclose(in);
+  file->data = data;
+  file->size = size;
+  return 0;
+}
+
+static void close_vectors(vector_file *file)
+{
+#ifdef VECTORS_MMAP
+  if (file->mapping != NULL)
+  {
+    munmap(file->mapping, file->size);
+    return;
+  }
+#endif
+  free((void *)file->data);
+}
+
+typedef struct file_result
+{
+  bool present;
+  bool malformed;
+  long passed, failed;
+  char first_failure[128];
+} file_result;
+
+typedef struct vector_run
+{
+  const char *prefix;
+  atomic_int next;
+  file_result results[256];
+} vector_run;
+
+static void run_file(vector_machine *m, const char *path, file_result *result)
+{
+  vector_file file;
+  vector_reader reader;
+  test_vector v;
+  char why[128];
+  int read;
+
+  if (open_vectors(path, &file) != 0)
+  {
+    return;
+  }
+  result->present = true;
+
+  vector_reader_init(&reader, file.data, file.size);
+  while ((read = vector_reader_next(&reader, &v)) == 1)
+  {
+    if (run_vector(m, &v, why, sizeof(why)))
+    {
+      result->passed++;
+    }
+    else if (result->failed++ == 0)
+    {
+      strcpy(result->first_failure, why);
+    }
+  }
+  if (read < 0)
+  {
+    result->malformed = true;
+    snprintf(result->first_failure, sizeof(result->first_failure), "malformed at byte %zu", reader.error_pos);
+  }
+  close_vectors(&file);
+}
+
+static int run_worker(void *arg)
+{
+  vector_run *run = arg;
+  vector_machine *m = malloc(sizeof(vector_machine));
+  int opcode;
+
+  if (m == NULL)
+  {
+    return -1;
+  }
+  machine_init(m);
+
+  while ((opcode = atomic_fetch_add(&run->next, 1)) < 256)
+  {
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s%02x.bin", run->prefix, opcode);
+    run_file(m, path, &run->results[opcode]);
+    if (!run->results[opcode].present)
+    {
+      snprintf(path, sizeof(path), "%s%02x.json", run->prefix, opcode);
+      run_file(m, path, &run->results[opcode]);
+    }
+  }
+  free(m);
+  return 0;
+}
+
+// Runs every opcode file named prefix followed by the opcode in hex. Returns the number of failed vectors
+static long run_vectors(const char *prefix, int threads, vector_run *run, FILE *out)
+{
+  thrd_t workers[64];
+  int started = 0;
+  long passed = 0, failed = 0;
+  clock_t start = clock();
+
+  memset(run, 0, sizeof(vector_run));
+  run->prefix = prefix;
+
+  if (threads > 64)
+  {
+    threads = 64;
+  }
+  for (int i = 0; i < threads; i++)
+  {
+    if (thrd_create(&workers[started], run_worker, run) == thrd_success)
+    {
+      started++;
+    }
+  }
+  if (started == 0)
+  {
+    run_worker(run);
+  }
+  for (int i = 0; i < started; i++)
+  {
+    thrd_join(workers[i], NULL);
+  }
+
+  for (int opcode = 0; opcode < 256; opcode++)
+  {
+    file_result *result = &run->results[opcode];
+
+    if (!result->present)
+    {
+      continue;
+    }
+    passed += result->passed;
+    failed += result->failed + result->malformed;
+    if (out != NULL && (result->failed > 0 || result->malformed))
+    {
+      fprintf(out, "%02x: %ld passed, %ld failed, first: %s\n", opcode, result->passed, result->failed,
+              result->first_failure);
+    }
+  }
+
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  if (out != NULL)
+  {
+    fprintf(out, "%ld vectors passed, %ld failed, %.0f per second of processor time\n", passed, failed,
+            seconds > 0 ? (passed + failed) / seconds : 0.0);
+  }
+  return failed;
+}
+
+static int convert(const char *from, const char *to)
+{
+  vector_file file;
+  vector_reader reader;
+  test_vector v;
+  FILE *out;
+  int read;
+
+  if (open_vectors(from, &file) != 0)
+  {
+    fprintf(stderr, "can't read %s\n", from);
+    return 1;
+  }
+  out = fopen(to, "wb");
+  if (out == NULL || vector_write_binary_header(out) != 0)
+  {
+    fprintf(stderr, "can't write %s\n", to);
+    close_vectors(&file);
+    return 1;
+  }
+
+  vector_reader_init(&reader, file.data, file.size);
+  while ((read = vector_reader_next(&reader, &v)) == 1 && vector_write_binary(&v, out) == 0)
+  {
+  }
+  if (read < 0)
+  {
+    fprintf(stderr, "%s: malformed at byte %zu\n", from, reader.error_pos);
+  }
+  close_vectors(&file);
+  return fclose(out) != 0 || read != 0;
+}
+
+static int setup(void **state)
+{
+  vector_machine *m = malloc(sizeof(vector_machine));
+
+  if (m == NULL)
+  {
+    return -1;
+  }
+
+  machine_init(m);
+  *state = m;
+
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  free(*state);
+  return 0;
+}
+
+static void parses_json(void **state)
+{
+  (void)state;
+  vector_reader reader;
+  test_vector v;
+
+  vector_reader_init(&reader, (const uint8_t *)vectors_json, strlen(vectors_json));
+  assert_int_equal(vector_reader_next(&reader, &v), 1);
+  assert_string_equal(v.name, "01 0000");
+  assert_int_equal(v.initial.pc, 256);
+  assert_int_equal(v.initial.d, 1);
+  assert_int_equal(v.initial.ram_count, 3);
+  assert_int_equal(v.initial.ram_addr[2], 258);
+  assert_int_equal(v.initial.ram_value[2], 18);
+  assert_int_equal(v.final.c, 52);
+  assert_int_equal(v.cycles, 10);
+  assert_int_equal(v.ports_count, 0);
+
+  assert_int_equal(vector_reader_next(&reader, &v), 1);
+  assert_int_equal(v.final.ram_count, 3);
+  assert_int_equal(v.final.f, 215);
+  assert_int_equal(v.cycles, 11);
+
+  assert_int_equal(vector_reader_next(&reader, &v), 1);
+  assert_int_equal(v.ports_count, 1);
+  assert_int_equal(v.ports[0].port, 16);
+  assert_int_equal(v.ports[0].value, 90);
+  assert_false(v.ports[0].write);
+
+  assert_int_equal(vector_reader_next(&reader, &v), 1);
+  assert_true(v.ports[0].write);
+  assert_int_equal(vector_reader_next(&reader, &v), 0);
+}
+
+static void rejects_malformed_json(void **state)
+{
+  (void)state;
+  vector_reader reader;
+  test_vector v;
+  const char *cut = "[{\"name\": \"01 0000\", \"initial\": {\"pc\": 256,";
+
+  vector_reader_init(&reader, (const uint8_t *)cut, strlen(cut));
+  assert_int_equal(vector_reader_next(&reader, &v), -1);
+  assert_int_equal(reader.error_pos, strlen(cut));
+}
+
+static void converts_to_binary(void **state)
+{
+  (void)state;
+  vector_reader json, binary;
+  test_vector from, to;
+  char *data;
+  size_t size;
+  FILE *out = tmpfile();
+
+  assert_non_null(out);
+  assert_int_equal(vector_write_binary_header(out), 0);
+  vector_reader_init(&json, (const uint8_t *)vectors_json, strlen(vectors_json));
+  while (vector_reader_next(&json, &from) == 1)
+  {
+    assert_int_equal(vector_write_binary(&from, out), 0);
+  }
+
+  size = ftell(out);
+  data = malloc(size);
+  assert_non_null(data);
+  rewind(out);
+  assert_int_equal(fread(data, 1, size, out), size);
+  fclose(out);
+
+  vector_reader_init(&json, (const uint8_t *)vectors_json, strlen(vectors_json));
+  vector_reader_init(&binary, (const uint8_t *)data, size);
+  assert_true(binary.binary);
+  while (vector_reader_next(&json, &from) == 1)
+  {
+    assert_int_equal(vector_reader_next(&binary, &to), 1);
+    assert_memory_equal(&from, &to, sizeof(test_vector));
+  }
+  assert_int_equal(vector_reader_next(&binary, &to), 0);
+  free(data);
+}
+
+static void runs_vectors(void **state)
+{
+  vector_machine *m = *state;
+  vector_reader reader;
+  test_vector v;
+  char why[128];
+  int count = 0;
+
+  vector_reader_init(&reader, (const uint8_t *)vectors_json, strlen(vectors_json));
+  while (vector_reader_next(&reader, &v) == 1)
+  {
+    bool passed = run_vector(m, &v, why, sizeof(why));
+
+    if (!passed)
+    {
+      fprintf(stderr, "%s\n", why);
+    }
+    assert_true(passed);
+    count++;
+  }
+  assert_int_equal(count, 4);
+
+  // Memory is left clean for the next vector
+  for (int addr = 0; addr < 0x10000; addr++)
+  {
+    assert_int_equal(m->memory[addr], 0);
+  }
+
+  vector_reader_init(&reader, (const uint8_t *)wrong_json, strlen(wrong_json));
+  assert_int_equal(vector_reader_next(&reader, &v), 1);
+  assert_false(run_vector(m, &v, why, sizeof(why)));
+  assert_string_equal(why, "01 0000: c expected 35, got 34");
+}
+
+static void runs_files_in_parallel(void **state)
+{
+  (void)state;
+  const char *paths[] = {"test_vectors_01.json", "test_vectors_c5.bin"};
+  vector_reader reader;
+  test_vector v;
+  vector_run *run = malloc(sizeof(vector_run));
+  FILE *out;
+
+  assert_non_null(run);
+
+  // The LXI vector as JSON, the PUSH one converted
+  out = fopen(paths[0], "wb");
+  assert_non_null(out);
+  fprintf(out, "[%s, %s]", LXI_VECTOR(52), LXI_VECTOR(53));
+  fclose(out);
+
+  out = fopen(paths[1], "wb");
+  assert_non_null(out);
+  vector_write_binary_header(out);
+  vector_reader_init(&reader, (const uint8_t *)vectors_json, strlen(vectors_json));
+  vector_reader_next(&reader, &v);
+  vector_reader_next(&reader, &v);
+  vector_write_binary(&v, out);
+  fclose(out);
+
+  assert_int_equal(run_vectors("test_vectors_", 4, run, NULL), 1);
+  assert_true(run->results[0x01].present);
+  assert_int_equal(run->results[0x01].passed, 1);
+  assert_int_equal(run->results[0x01].failed, 1);
+  assert_true(run->results[0xc5].present);
+  assert_int_equal(run->results[0xc5].passed, 1);
+  assert_false(run->results[0x00].present);
+
+  remove(paths[0]);
+  remove(paths[1]);
+  free(run);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc == 4 && strcmp(argv[1], "--convert") == 0)
+  {
+    return convert(argv[2], argv[3]);
+  }
+  if (argc > 1)
+  {
+    int threads = 8;
+    char prefix[480];
+    vector_run *run = malloc(sizeof(vector_run));
+
+    if (argc == 4 && strcmp(argv[1], "-j") == 0)
+    {
+      threads = atoi(argv[2]);
+    }
+    if (run == NULL || threads < 1)
+    {
+      return 1;
+    }
+    snprintf(prefix, sizeof(prefix), "%s/", argv[argc - 1]);
+
+    long failed = run_vectors(prefix, threads, run, stdout);
+    free(run);
+    return failed > 0;
+  }
+
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(parses_json),
+      cmocka_unit_test(rejects_malformed_json),
+      cmocka_unit_test(converts_to_binary),
+      cmocka_unit_test_setup_teardown(runs_vectors, setup, teardown),
+      cmocka_unit_test(runs_files_in_parallel),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
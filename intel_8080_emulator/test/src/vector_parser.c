@@ -0,0 +1,529 @@
+#include "vector_parser.h"
+#include <string.h>
+
+static void skip_space(vector_reader *r)
+{
+  while (r->pos < r->size &&
+         (r->data[r->pos] == ' ' || r->data[r->pos] == '\n' || r->data[r->pos] == '\r' || r->data[r->pos] == '\t'))
+  {
+    r->pos++;
+  }
+}
+
+// The next character after white space, or 0 at the end
+static char peek(vector_reader *r)
+{
+  skip_space(r);
+  return r->pos < r->size ? r->data[r->pos] : 0;
+}
+
+static bool expect(vector_reader *r, char c)
+{
+  if (peek(r) != c)
+  {
+    r->error_pos = r->pos;
+    return false;
+  }
+  r->pos++;
+  return true;
+}
+
+// Steps over the comma before another entry of an array or object
+static bool more(vector_reader *r)
+{
+  if (peek(r) != ',')
+  {
+    return false;
+  }
+  r->pos++;
+  return true;
+}
+
+static bool parse_number(vector_reader *r, long *value)
+{
+  bool negative = peek(r) == '-';
+  size_t start;
+
+  if (negative)
+  {
+    r->pos++;
+  }
+  start = r->pos;
+  *value = 0;
+  while (r->pos < r->size && r->data[r->pos] >= '0' && r->data[r->pos] <= '9')
+  {
+    *value = *value * 10 + (r->data[r->pos++] - '0');
+  }
+  if (r->pos == start || *value > 0xffffff)
+  {
+    r->error_pos = r->pos;
+    return false;
+  }
+  if (negative)
+  {
+    *value = -*value;
+  }
+  return true;
+}
+
+// Copies the string, cut to size, without decoding escapes
+static bool parse_string(vector_reader *r, char *out, size_t size)
+{
+  size_t length = 0;
+
+  if (!expect(r, '"'))
+  {
+    return false;
+  }
+  while (r->pos < r->size && r->data[r->pos] != '"')
+  {
+    if (r->data[r->pos] == '\\')
+    {
+      r->pos++;
+    }
+    if (r->pos < r->size && length + 1 < size)
+    {
+      out[length++] = r->data[r->pos];
+    }
+    r->pos++;
+  }
+  if (size > 0)
+  {
+    out[length] = 0;
+  }
+  return expect(r, '"');
+}
+
+static bool skip_value(vector_reader *r)
+{
+  char c = peek(r);
+
+  if (c == '"')
+  {
+    return parse_string(r, NULL, 0);
+  }
+  if (c == '[' || c == '{')
+  {
+    char close = c == '[' ? ']' : '}';
+
+    r->pos++;
+    if (peek(r) == close)
+    {
+      r->pos++;
+      return true;
+    }
+    do
+    {
+      if (c == '{' && (!parse_string(r, NULL, 0) || !expect(r, ':')))
+      {
+        return false;
+      }
+      if (!skip_value(r))
+      {
+        return false;
+      }
+    } while (more(r));
+    return expect(r, close);
+  }
+  if (c == '-' || (c >= '0' && c <= '9'))
+  {
+    long value;
+
+    // Fractions and exponents don't occur in vector files
+    return parse_number(r, &value);
+  }
+
+  // true, false and null
+  size_t start = r->pos;
+  while (r->pos < r->size && r->data[r->pos] >= 'a' && r->data[r->pos] <= 'z')
+  {
+    r->pos++;
+  }
+  if (r->pos == start)
+  {
+    r->error_pos = r->pos;
+    return false;
+  }
+  return true;
+}
+
+static bool parse_byte(vector_reader *r, uint8_t *out)
+{
+  long value;
+
+  if (!parse_number(r, &value) || value < 0 || value > 0xff)
+  {
+    r->error_pos = r->pos;
+    return false;
+  }
+  *out = value;
+  return true;
+}
+
+static bool parse_word(vector_reader *r, uint16_t *out)
+{
+  long value;
+
+  if (!parse_number(r, &value) || value < 0 || value > 0xffff)
+  {
+    r->error_pos = r->pos;
+    return false;
+  }
+  *out = value;
+  return true;
+}
+
+// [[addr, value], ...]
+static bool parse_ram(vector_reader *r, vector_state *s)
+{
+  s->ram_count = 0;
+  if (!expect(r, '['))
+  {
+    return false;
+  }
+  if (peek(r) == ']')
+  {
+    r->pos++;
+    return true;
+  }
+  do
+  {
+    if (s->ram_count == VECTOR_MAX_RAM || !expect(r, '[') || !parse_word(r, &s->ram_addr[s->ram_count]) ||
+        !expect(r, ',') || !parse_byte(r, &s->ram_value[s->ram_count]) || !expect(r, ']'))
+    {
+      r->error_pos = r->pos;
+      return false;
+    }
+    s->ram_count++;
+  } while (more(r));
+  return expect(r, ']');
+}
+
+static bool parse_state(vector_reader *r, vector_state *s)
+{
+  memset(s, 0, sizeof(vector_state));
+  if (!expect(r, '{'))
+  {
+    return false;
+  }
+  if (peek(r) == '}')
+  {
+    r->pos++;
+    return true;
+  }
+  do
+  {
+    char key[8];
+    bool parsed;
+
+    if (!parse_string(r, key, sizeof(key)) || !expect(r, ':'))
+    {
+      return false;
+    }
+    if (strcmp(key, "pc") == 0)
+    {
+      parsed = parse_word(r, &s->pc);
+    }
+    else if (strcmp(key, "sp") == 0)
+    {
+      parsed = parse_word(r, &s->sp);
+    }
+    else if (strcmp(key, "ram") == 0)
+    {
+      parsed = parse_ram(r, s);
+    }
+    else if (strlen(key) == 1 && strchr("abcdefhl", key[0]) != NULL)
+    {
+      uint8_t *registers[] = {&s->a, &s->b, &s->c, &s->d, &s->e, &s->f, NULL, &s->h, NULL, NULL, NULL, &s->l};
+      parsed = parse_byte(r, registers[key[0] - 'a']);
+    }
+    else
+    {
+      parsed = skip_value(r);
+    }
+    if (!parsed)
+    {
+      return false;
+    }
+  } while (more(r));
+  return expect(r, '}');
+}
+
+// [[port, value, "r" or "w"], ...]
+static bool parse_ports(vector_reader *r, test_vector *v)
+{
+  v->ports_count = 0;
+  if (!expect(r, '['))
+  {
+    return false;
+  }
+  if (peek(r) == ']')
+  {
+    r->pos++;
+    return true;
+  }
+  do
+  {
+    vector_port *port = &v->ports[v->ports_count];
+    char direction[4];
+
+    if (v->ports_count == VECTOR_MAX_PORTS || !expect(r, '[') || !parse_byte(r, &port->port) ||
+        !expect(r, ',') || !parse_byte(r, &port->value) || !expect(r, ',') ||
+        !parse_string(r, direction, sizeof(direction)) || !expect(r, ']'))
+    {
+      r->error_pos = r->pos;
+      return false;
+    }
+    port->write = direction[0] == 'w';
+    v->ports_count++;
+  } while (more(r));
+  return expect(r, ']');
+}
+
+// Counts the entries of an array without looking into them
+static bool count_array(vector_reader *r, int *count)
+{
+  *count = 0;
+  if (!expect(r, '['))
+  {
+    return false;
+  }
+  if (peek(r) == ']')
+  {
+    r->pos++;
+    return true;
+  }
+  do
+  {
+    if (!skip_value(r))
+    {
+      return false;
+    }
+    (*count)++;
+  } while (more(r));
+  return expect(r, ']');
+}
+
+static int next_json(vector_reader *r, test_vector *v)
+{
+  if (!r->started)
+  {
+    if (!expect(r, '['))
+    {
+      return -1;
+    }
+    r->started = true;
+    if (peek(r) == ']')
+    {
+      r->pos++;
+      return 0;
+    }
+  }
+  else
+  {
+    char c = peek(r);
+
+    if (c == ']')
+    {
+      r->pos++;
+      return 0;
+    }
+    if (!expect(r, ','))
+    {
+      return -1;
+    }
+  }
+
+  if (!expect(r, '{'))
+  {
+    return -1;
+  }
+  if (peek(r) == '}')
+  {
+    r->pos++;
+    return 1;
+  }
+  do
+  {
+    char key[16];
+    bool parsed;
+
+    if (!parse_string(r, key, sizeof(key)) || !expect(r, ':'))
+    {
+      return -1;
+    }
+    if (strcmp(key, "name") == 0)
+    {
+      parsed = parse_string(r, v->name, sizeof(v->name));
+    }
+    else if (strcmp(key, "initial") == 0)
+    {
+      parsed = parse_state(r, &v->initial);
+    }
+    else if (strcmp(key, "final") == 0)
+    {
+      parsed = parse_state(r, &v->final);
+    }
+    else if (strcmp(key, "cycles") == 0)
+    {
+      parsed = count_array(r, &v->cycles);
+    }
+    else if (strcmp(key, "ports") == 0)
+    {
+      parsed = parse_ports(r, v);
+    }
+    else
+    {
+      parsed = skip_value(r);
+    }
+    if (!parsed)
+    {
+      return -1;
+    }
+  } while (more(r));
+  return expect(r, '}') ? 1 : -1;
+}
+
+static bool take(vector_reader *r, void *out, size_t size)
+{
+  if (r->size - r->pos < size)
+  {
+    r->error_pos = r->pos;
+    return false;
+  }
+  memcpy(out, r->data + r->pos, size);
+  r->pos += size;
+  return true;
+}
+
+static bool take_word(vector_reader *r, uint16_t *value)
+{
+  uint8_t bytes[2];
+
+  if (!take(r, bytes, 2))
+  {
+    return false;
+  }
+  *value = bytes[0] | bytes[1] << 8;
+  return true;
+}
+
+static bool take_state(vector_reader *r, vector_state *s)
+{
+  uint8_t registers[8];
+  uint8_t count;
+
+  if (!take_word(r, &s->pc) || !take_word(r, &s->sp) || !take(r, registers, 8) || !take(r, &count, 1) ||
+      count > VECTOR_MAX_RAM)
+  {
+    r->error_pos = r->pos;
+    return false;
+  }
+  s->a = registers[0];
+  s->b = registers[1];
+  s->c = registers[2];
+  s->d = registers[3];
+  s->e = registers[4];
+  s->f = registers[5];
+  s->h = registers[6];
+  s->l = registers[7];
+  s->ram_count = count;
+  for (int i = 0; i < count; i++)
+  {
+    if (!take_word(r, &s->ram_addr[i]) || !take(r, &s->ram_value[i], 1))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int next_binary(vector_reader *r, test_vector *v)
+{
+  uint8_t length, counts[2];
+  uint16_t cycles;
+
+  if (r->pos == r->size)
+  {
+    return 0;
+  }
+  if (!take(r, &length, 1) || length >= sizeof(v->name) || !take(r, v->name, length))
+  {
+    return -1;
+  }
+  v->name[length] = 0;
+  if (!take_state(r, &v->initial) || !take_state(r, &v->final) || !take_word(r, &cycles) || !take(r, counts, 1) ||
+      counts[0] > VECTOR_MAX_PORTS)
+  {
+    return -1;
+  }
+  v->cycles = cycles;
+  v->ports_count = counts[0];
+  for (int i = 0; i < v->ports_count; i++)
+  {
+    uint8_t port[3];
+
+    if (!take(r, port, 3))
+    {
+      return -1;
+    }
+    v->ports[i] = (vector_port){port[0], port[1], port[2]};
+  }
+  return 1;
+}
+
+void vector_reader_init(vector_reader *r, const uint8_t *data, size_t size)
+{
+  memset(r, 0, sizeof(vector_reader));
+  r->data = data;
+  r->size = size;
+  if (size >= 5 && memcmp(data, VECTOR_BINARY_MAGIC, 4) == 0 && data[4] == VECTOR_BINARY_VERSION)
+  {
+    r->binary = true;
+    r->pos = 5;
+  }
+}
+
+int vector_reader_next(vector_reader *r, test_vector *v)
+{
+  memset(v, 0, sizeof(test_vector));
+  return r->binary ? next_binary(r, v) : next_json(r, v);
+}
+
+int vector_write_binary_header(FILE *out)
+{
+  uint8_t header[5] = {'I', '8', 'T', 'V', VECTOR_BINARY_VERSION};
+
+  return fwrite(header, sizeof(header), 1, out) == 1 ? 0 : -1;
+}
+
+static void put_state(const vector_state *s, FILE *out)
+{
+  uint8_t fixed[13] = {s->pc & 0xff, s->pc >> 8, s->sp & 0xff, s->sp >> 8, s->a, s->b, s->c, s->d, s->e, s->f,
+                       s->h, s->l, s->ram_count};
+
+  fwrite(fixed, sizeof(fixed), 1, out);
+  for (int i = 0; i < s->ram_count; i++)
+  {
+    uint8_t entry[3] = {s->ram_addr[i] & 0xff, s->ram_addr[i] >> 8, s->ram_value[i]};
+    fwrite(entry, sizeof(entry), 1, out);
+  }
+}
+
+int vector_write_binary(const test_vector *v, FILE *out)
+{
+  uint8_t length = strlen(v->name);
+  uint8_t tail[3] = {v->cycles & 0xff, v->cycles >> 8, v->ports_count};
+
+  fwrite(&length, 1, 1, out);
+  fwrite(v->name, length, 1, out);
+  put_state(&v->initial, out);
+  put_state(&v->final, out);
+  fwrite(tail, sizeof(tail), 1, out);
+  for (int i = 0; i < v->ports_count; i++)
+  {
+    uint8_t port[3] = {v->ports[i].port, v->ports[i].value, v->ports[i].write};
+    fwrite(port, sizeof(port), 1, out);
+  }
+  return ferror(out) ? -1 : 0;
+}
@@ -0,0 +1,69 @@
+#ifndef VECTOR_PARSER_H
+#define VECTOR_PARSER_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// More than any 8080 instruction touches
+#define VECTOR_MAX_RAM 64
+#define VECTOR_MAX_PORTS 8
+
+#define VECTOR_BINARY_MAGIC "I8TV"
+#define VECTOR_BINARY_VERSION 1
+
+typedef struct vector_state
+{
+  uint16_t pc, sp;
+  uint8_t a, b, c, d, e, f, h, l;
+  int ram_count;
+  uint16_t ram_addr[VECTOR_MAX_RAM];
+  uint8_t ram_value[VECTOR_MAX_RAM];
+} vector_state;
+
+typedef struct vector_port
+{
+  uint8_t port, value;
+  bool write;
+} vector_port;
+
+/*
+One test of a SingleStepTests-style file: the state before and after a
+single instruction, with the memory it uses, the bus cycles it takes and
+the port accesses it makes
+*/
+typedef struct test_vector
+{
+  char name[32];
+  vector_state initial, final;
+  int cycles;
+  vector_port ports[VECTOR_MAX_PORTS];
+  int ports_count;
+} test_vector;
+
+/*
+Reads vectors one at a time from a whole file in memory, usually mapped.
+The file is either a JSON array of vector objects, of which only the
+current one is looked at, or the binary form written by
+vector_write_binary, told apart by its magic. Keys not known are skipped
+*/
+typedef struct vector_reader
+{
+  const uint8_t *data;
+  size_t size, pos;
+  bool binary;
+  bool started;
+  // Where the file stopped making sense, for error messages
+  size_t error_pos;
+} vector_reader;
+
+void vector_reader_init(vector_reader *r, const uint8_t *data, size_t size);
+
+// Returns 1 with the next vector in v, 0 at the end and -1 on a malformed file
+int vector_reader_next(vector_reader *r, test_vector *v);
+
+// Binary files are the header followed by the vectors. Both return -1 on I/O errors
+int vector_write_binary_header(FILE *out);
+int vector_write_binary(const test_vector *v, FILE *out);
+
+#endif // VECTOR_PARSER_H